@@ -0,0 +1,280 @@
+// IOTMP frames per second and wire bytes per frame for the SSL and WebSocket
+// transports, writing every frame on its own or packing queued frames into
+// one write (one WebSocket message) as the client does.
+//
+// Client and server TLS endpoints run in-process over an OpenSSL BIO pair,
+// so the numbers measure the CPU cost of framing, masking, encrypting and
+// parsing, without any network in between. The server side decodes frames
+// with the client input_buffer.
+//
+//   frame_coalescing_bench [payload_bytes] [frames]
+
+#include <thinger/iotmp/core/iotmp_input_buffer.hpp>
+
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace thinger::iotmp;
+using namespace std::chrono;
+
+namespace {
+
+    constexpr size_t COALESCE_BYTES = 16 * 1024;
+    constexpr size_t BIO_BUFFER = 1024 * 1024;
+    constexpr uint8_t STREAM_DATA = 0x06;
+
+    void fail(const char* what) {
+        std::fprintf(stderr, "%s failed\n", what);
+        ERR_print_errors_fp(stderr);
+        std::exit(1);
+    }
+
+    // Throwaway self-signed certificate for the in-process server
+    void set_certificate(SSL_CTX* ctx) {
+        EVP_PKEY* key = EVP_EC_gen("P-256");
+        X509* cert = X509_new();
+        if(!key || !cert) fail("key generation");
+        ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+        X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+        X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+        X509_set_pubkey(cert, key);
+        X509_NAME_add_entry_by_txt(X509_get_subject_name(cert), "CN", MBSTRING_ASC,
+            reinterpret_cast<const unsigned char*>("localhost"), -1, -1, 0);
+        X509_set_issuer_name(cert, X509_get_subject_name(cert));
+        if(!X509_sign(cert, key, EVP_sha256())) fail("certificate signing");
+        if(SSL_CTX_use_certificate(ctx, cert) != 1 || SSL_CTX_use_PrivateKey(ctx, key) != 1) fail("certificate setup");
+        X509_free(cert);
+        EVP_PKEY_free(key);
+    }
+
+    // Client and server TLS sessions connected through a BIO pair
+    struct tls_pair {
+        SSL_CTX* client_ctx = SSL_CTX_new(TLS_client_method());
+        SSL_CTX* server_ctx = SSL_CTX_new(TLS_server_method());
+        SSL* client = nullptr;
+        SSL* server = nullptr;
+        BIO* client_bio = nullptr;
+
+        tls_pair() {
+            set_certificate(server_ctx);
+            client = SSL_new(client_ctx);
+            server = SSL_new(server_ctx);
+            BIO* server_bio = nullptr;
+            if(!BIO_new_bio_pair(&client_bio, BIO_BUFFER, &server_bio, BIO_BUFFER)) fail("BIO pair");
+            SSL_set_bio(client, client_bio, client_bio);
+            SSL_set_bio(server, server_bio, server_bio);
+            SSL_set_connect_state(client);
+            SSL_set_accept_state(server);
+            for(int i = 0; i < 100; ++i) {
+                int c = SSL_do_handshake(client);
+                int s = SSL_do_handshake(server);
+                if(c == 1 && s == 1) return;
+            }
+            fail("handshake");
+        }
+
+        ~tls_pair() {
+            SSL_free(client);
+            SSL_free(server);
+            SSL_CTX_free(client_ctx);
+            SSL_CTX_free(server_ctx);
+        }
+
+        // Bytes the client put on the wire
+        uint64_t wire_bytes() const {
+            return BIO_number_written(client_bio);
+        }
+    };
+
+    // Masked client-to-server WebSocket binary frame (RFC 6455)
+    void websocket_frame(const std::string& payload, std::minstd_rand& random, std::string& out) {
+        out.clear();
+        out.push_back(static_cast<char>(0x82));
+        size_t size = payload.size();
+        if(size < 126) {
+            out.push_back(static_cast<char>(0x80 | size));
+        } else if(size <= 0xFFFF) {
+            out.push_back(static_cast<char>(0x80 | 126));
+            out.push_back(static_cast<char>(size >> 8));
+            out.push_back(static_cast<char>(size));
+        } else {
+            out.push_back(static_cast<char>(0x80 | 127));
+            for(int shift = 56; shift >= 0; shift -= 8) out.push_back(static_cast<char>(size >> shift));
+        }
+        uint32_t key = random();
+        char mask[4];
+        std::memcpy(mask, &key, 4);
+        out.append(mask, 4);
+        size_t offset = out.size();
+        out.append(payload);
+        for(size_t i = 0; i < size; ++i) out[offset + i] ^= mask[i % 4];
+    }
+
+    // Server side: decrypt, strip WebSocket framing and count IOTMP frames
+    class receiver {
+    public:
+        explicit receiver(bool websocket) : websocket_(websocket) {}
+
+        uint64_t drain(SSL* ssl) {
+            uint8_t chunk[16 * 1024];
+            for(;;) {
+                int n = SSL_read(ssl, chunk, sizeof(chunk));
+                if(n <= 0) break;
+                if(websocket_) {
+                    pending_.append(reinterpret_cast<char*>(chunk), n);
+                    unwrap();
+                } else {
+                    feed(chunk, n);
+                }
+            }
+            return frames_;
+        }
+
+    private:
+        void unwrap() {
+            auto& bytes = pending_;
+            size_t offset = 0;
+            for(;;) {
+                if(bytes.size() - offset < 2) break;
+                auto* data = reinterpret_cast<const uint8_t*>(bytes.data() + offset);
+                uint64_t size = data[1] & 0x7F;
+                size_t header = 2;
+                if(size == 126) {
+                    if(bytes.size() - offset < 4) break;
+                    size = (data[2] << 8) | data[3];
+                    header = 4;
+                } else if(size == 127) {
+                    if(bytes.size() - offset < 10) break;
+                    size = 0;
+                    for(int i = 0; i < 8; ++i) size = (size << 8) | data[2 + i];
+                    header = 10;
+                }
+                if(bytes.size() - offset < header + 4 + size) break;
+                const uint8_t* mask = data + header;
+                auto space = input_.prepare(size);
+                for(size_t i = 0; i < size; ++i) space[i] = data[header + 4 + i] ^ mask[i % 4];
+                input_.commit(size);
+                parse();
+                offset += header + 4 + size;
+            }
+            bytes.erase(0, offset);
+        }
+
+        void feed(const uint8_t* data, size_t size) {
+            auto space = input_.prepare(size);
+            std::memcpy(space.data(), data, size);
+            input_.commit(size);
+            parse();
+        }
+
+        void parse() {
+            frame_header header;
+            while(parse_frame_header(input_.data(), input_.size(), header) == frame_parse::COMPLETE &&
+                  input_.size() >= header.length + header.size) {
+                input_.consume(header.length + header.size);
+                ++frames_;
+            }
+        }
+
+        bool websocket_;
+        std::string pending_;           // WebSocket bytes not unwrapped yet
+        input_buffer input_;
+        uint64_t frames_ = 0;
+    };
+
+    std::string iotmp_frame(size_t payload) {
+        std::string frame(1, static_cast<char>(STREAM_DATA));
+        size_t value = payload;
+        do {
+            uint8_t byte = value & 0x7F;
+            value >>= 7;
+            frame.push_back(static_cast<char>(value ? byte | 0x80 : byte));
+        } while(value);
+        frame.append(payload, 'x');
+        return frame;
+    }
+
+    struct result {
+        double frames_per_second;
+        double wire_bytes_per_frame;
+    };
+
+    result run(bool websocket, bool coalesce, size_t payload, size_t frames) {
+        tls_pair tls;
+        receiver server(websocket);
+        std::minstd_rand random(42);
+        auto frame = iotmp_frame(payload);
+        std::string batch, message;
+        uint64_t initial_bytes = tls.wire_bytes();
+
+        auto write = [&](const std::string& data) {
+            const std::string* out = &data;
+            if(websocket) {
+                websocket_frame(data, random, message);
+                out = &message;
+            }
+            if(SSL_write(tls.client, out->data(), static_cast<int>(out->size())) <= 0) fail("SSL_write");
+            server.drain(tls.server);
+        };
+
+        auto started = steady_clock::now();
+        size_t sent = 0;
+        while(sent < frames) {
+            if(coalesce) {
+                // the writer found the queue full of frames
+                batch.clear();
+                while(sent < frames && batch.size() < COALESCE_BYTES) {
+                    batch.append(frame);
+                    ++sent;
+                }
+                write(batch);
+            } else {
+                write(frame);
+                ++sent;
+            }
+        }
+        uint64_t received = server.drain(tls.server);
+        double elapsed = duration<double>(steady_clock::now() - started).count();
+        if(received != frames) {
+            std::fprintf(stderr, "received %llu of %zu frames\n", static_cast<unsigned long long>(received), frames);
+            std::exit(1);
+        }
+        return {frames / elapsed, static_cast<double>(tls.wire_bytes() - initial_bytes) / frames};
+    }
+
+}
+
+int main(int argc, char* argv[]) {
+    size_t payload = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 64;
+    size_t frames = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 200000;
+
+    std::printf("%zu frames of %zu payload bytes, packed writes up to %zu bytes\n\n", frames, payload, COALESCE_BYTES);
+    std::printf("%-24s %16s %18s\n", "transport", "frames/s", "wire bytes/frame");
+
+    struct mode {
+        const char* name;
+        bool websocket;
+        bool coalesce;
+    };
+    const mode modes[] = {
+        {"ssl", false, false},
+        {"ssl, packed", false, true},
+        {"websocket", true, false},
+        {"websocket, packed", true, true},
+    };
+    for(auto& m : modes) {
+        auto r = run(m.websocket, m.coalesce, payload, frames);
+        std::printf("%-24s %16.0f %18.1f\n", m.name, r.frames_per_second, r.wire_bytes_per_frame);
+    }
+    return 0;
+}
@@ -0,0 +1,165 @@
+// Memory cost per device in gateway mode.
+//
+// Adds N devices with a few resources each to a gateway and reports the
+// resident set size growth per device twice: once added (idle, not
+// connected), and once every device is connected to the mock IOTMP server,
+// authenticated, has its server event streams ready and answered a
+// DESCRIBE of its API, as it does against the Thinger.io server. The second
+// figure includes the sockets, TLS state, read and write buffers of every
+// connection.
+//
+// The mock server runs in a child process, so its own memory per session is
+// not counted.
+//
+//   gateway_memory_bench [devices] [tcp|tls]
+
+#include "mock_server.hpp"
+
+#include <thinger/iotmp/gateway.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <thread>
+
+#include <csignal>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace thinger::iotmp;
+
+namespace {
+
+    constexpr auto CONNECT_TIMEOUT = std::chrono::seconds(120);
+    constexpr auto SETTLE_TIME = std::chrono::seconds(1);    // for the DESCRIBE of the last devices
+
+    // Resident set size in bytes, from /proc/self/statm
+    size_t resident_bytes() {
+        std::ifstream statm("/proc/self/statm");
+        size_t pages = 0, resident = 0;
+        statm >> pages >> resident;
+        return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    }
+
+    // Start the mock server in a child process, which describes every device
+    // once authenticated. Returns its pid, and its port in port.
+    pid_t spawn_server(mock::transport kind, uint16_t& port) {
+        int fds[2];
+        if(::pipe(fds) != 0) return -1;
+        pid_t pid = ::fork();
+        if(pid == 0) {
+            ::close(fds[0]);
+            mock::server server(kind);
+            server.set_session_handler([](std::shared_ptr<mock::session> session) -> mock::awaitable<void> {
+                co_await session->describe();
+            });
+            server.start();
+            uint16_t listening = server.get_port();
+            if(::write(fds[1], &listening, sizeof(listening)) != sizeof(listening)) ::_exit(1);
+            ::close(fds[1]);
+            // until SIGTERM
+            for(;;) ::pause();
+        }
+        ::close(fds[1]);
+        if(pid > 0 && ::read(fds[0], &port, sizeof(port)) != sizeof(port)) {
+            ::kill(pid, SIGTERM);
+            ::waitpid(pid, nullptr, 0);
+            pid = -1;
+        }
+        ::close(fds[0]);
+        return pid;
+    }
+
+    void print_growth(const char* name, size_t growth, size_t devices) {
+        std::printf("%-10s rss growth %8.1f MB, per device %6.1f KB, projected for 1000 %7.1f MB\n", name,
+            growth / (1024.0 * 1024.0), devices ? growth / 1024.0 / devices : 0.0,
+            devices ? growth * 1000.0 / devices / (1024.0 * 1024.0) : 0.0);
+    }
+
+}
+
+int main(int argc, char* argv[]) {
+    size_t devices = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000;
+    std::string transport_name = argc > 2 ? argv[2] : "tcp";
+
+    mock::transport kind;
+    transport_type client_transport;
+    if(transport_name == "tcp") {
+        kind = mock::transport::TCP;
+        client_transport = transport_type::TCP;
+    } else if(transport_name == "tls" || transport_name == "ssl") {
+        kind = mock::transport::TLS;
+        client_transport = transport_type::SSL;
+    } else {
+        std::fprintf(stderr, "unknown transport '%s': use tcp or tls\n", transport_name.c_str());
+        return 1;
+    }
+
+    // a socket per device on each side
+    rlimit files{};
+    if(::getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max) {
+        files.rlim_cur = files.rlim_max;
+        ::setrlimit(RLIMIT_NOFILE, &files);
+    }
+
+    // before any thread is started in this process
+    uint16_t port = 0;
+    pid_t server = spawn_server(kind, port);
+    if(server < 0) {
+        std::perror("mock server");
+        return 1;
+    }
+
+    spdlog::set_level(spdlog::level::warn);
+    std::atomic<size_t> ready{0};
+    int result = 0;
+    {
+        gateway gw(4);
+        gw.set_host("127.0.0.1");
+        gw.set_transport(client_transport);
+        gw.set_port(port);
+        gw.set_state_callback([&ready](const std::string&, client_state state, const std::string&) {
+            if(state == client_state::STREAMS_READY) ready.fetch_add(1, std::memory_order_relaxed);
+        });
+
+        size_t before = resident_bytes();
+        for(size_t i = 0; i < devices; ++i) {
+            auto* device = gw.add_device("user", "device_" + std::to_string(i), "credential");
+            (*device)["temperature"] = [](output& out) { out = 21.5; };
+            (*device)["humidity"] = [](output& out) { out = 40; };
+            (*device)["relay"] = [](input& in) { bool state = in; (void)state; };
+            (*device)["setpoint"] = [](input& in, output& out) { out = in; };
+            (*device)["reset"] = []() {};
+        }
+        size_t idle = resident_bytes();
+
+        gw.start();
+        auto deadline = std::chrono::steady_clock::now() + CONNECT_TIMEOUT;
+        while(ready.load(std::memory_order_relaxed) < devices && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        std::this_thread::sleep_for(SETTLE_TIME);
+        size_t connected = resident_bytes();
+        size_t connected_devices = ready.load(std::memory_order_relaxed);
+
+        std::printf("sizeof(client): %zu bytes\n", sizeof(client));
+        std::printf("devices:        %zu (%zu connected over %s)\n\n", devices, connected_devices,
+            mock::to_string(kind));
+        print_growth("idle", idle > before ? idle - before : 0, devices);
+        print_growth("connected", connected > before ? connected - before : 0, devices);
+
+        if(connected_devices < devices) {
+            std::fprintf(stderr, "only %zu of %zu devices connected\n", connected_devices, devices);
+            result = 1;
+        }
+        gw.stop();
+    }
+
+    ::kill(server, SIGTERM);
+    ::waitpid(server, nullptr, 0);
+    return result;
+}
@@ -0,0 +1,436 @@
+// Heap allocations of the client on its steady-state data paths.
+//
+// Replaces the global operator new to count the allocations made on the
+// client connection thread while an in-process client exchanges stream data
+// with the mock server over loopback TCP. Each scenario warms up first (so
+// the write queue, frame pool and asio handler caches reach their working
+// size) and is then measured:
+//
+//   stream    256 byte binary chunks sent with client::stream_resource
+//   upload    1 KB chunks received by a $fs/upload session, with its ACKs
+//   interval  a fixed-output resource streamed every second
+//   terminal  keystrokes to a $terminal session, each awaited until the
+//             shell echoes it (alternating a character and a backspace, so
+//             the line does not grow)
+//   proxy     1 KB payloads through a $proxy session to a TCP echo server
+//             on the mock server thread, one at a time
+//
+// Reports allocations per message, and exits with 1 if any scenario is over
+// the budget (allocations per message, 0 by default).
+//
+//   iotmp_alloc_check [scenario|all] [messages] [--budget N]
+//
+// messages is the number of measured chunks for stream and upload (10000 by
+// default); the interval scenario measures 5 rounds, and the terminal and
+// proxy ones 1000 round trips. Only the connection
+// thread is counted: the mock server and, with session sharding, the worker
+// threads are not.
+
+#include "mock_server.hpp"
+
+#include <thinger/iotmp/client.hpp>
+#include <thinger/iotmp/extensions/fs/filesystem.hpp>
+#include <thinger/iotmp/extensions/proxy/proxy.hpp>
+#include <thinger/iotmp/extensions/terminal/terminal.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <future>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+namespace {
+
+    std::atomic<bool> counting{false};
+    std::atomic<uint64_t> allocations{0};
+    thread_local bool connection_thread = false;
+
+    void* allocate(std::size_t size) {
+        if(connection_thread && counting.load(std::memory_order_relaxed)) {
+            allocations.fetch_add(1, std::memory_order_relaxed);
+        }
+        if(void* p = std::malloc(size ? size : 1)) return p;
+        throw std::bad_alloc();
+    }
+
+    void* allocate(std::size_t size, std::align_val_t alignment) {
+        if(connection_thread && counting.load(std::memory_order_relaxed)) {
+            allocations.fetch_add(1, std::memory_order_relaxed);
+        }
+        void* p = nullptr;
+        auto align = std::max(static_cast<std::size_t>(alignment), sizeof(void*));
+        if(::posix_memalign(&p, align, size ? size : 1) == 0) return p;
+        throw std::bad_alloc();
+    }
+
+}
+
+void* operator new(std::size_t size) { return allocate(size); }
+void* operator new[](std::size_t size) { return allocate(size); }
+void* operator new(std::size_t size, std::align_val_t alignment) { return allocate(size, alignment); }
+void* operator new[](std::size_t size, std::align_val_t alignment) { return allocate(size, alignment); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+
+using namespace thinger::iotmp;
+using namespace std::chrono;
+
+namespace {
+
+    constexpr uint16_t STREAM_ID = 0x7001;          // not known by the server: it just counts the frames
+    constexpr size_t STREAM_CHUNK = 256;
+    constexpr size_t UPLOAD_CHUNK = 1024;
+    constexpr size_t WARMUP = 1000;                 // stream chunks before measuring
+    constexpr size_t UPLOAD_WARMUP_ACKS = 10;
+    constexpr size_t INTERVAL_WARMUP = 2;           // interval rounds before measuring
+    constexpr size_t INTERVAL_ROUNDS = 5;
+    constexpr size_t PROXY_PAYLOAD = 1024;
+    constexpr size_t ROUND_TRIPS = 1000;            // terminal keystrokes or proxy payloads
+    constexpr size_t ROUND_TRIP_WARMUP = 100;
+    constexpr auto SHELL_STARTUP = milliseconds(1000);  // let the shell print its prompt
+    constexpr auto POLL = milliseconds(1);
+    constexpr auto STALL_TIMEOUT = seconds(10);
+    constexpr auto CONNECT_TIMEOUT = seconds(30);
+
+    using mock::awaitable;
+    namespace net = mock::net;
+
+    struct result {
+        const char* scenario = nullptr;
+        uint64_t messages = 0;
+        uint64_t allocations = 0;
+        bool completed = false;
+    };
+
+    awaitable<void> sleep_for(steady_clock::duration length) {
+        net::steady_timer timer(co_await net::this_coro::executor, length);
+        boost::system::error_code ec;
+        co_await timer.async_wait(net::redirect_error(mock::use_awaitable, ec));
+    }
+
+    // Poll until done() holds; false if nothing changed for STALL_TIMEOUT
+    template<typename Done, typename Progress>
+    awaitable<bool> wait_for(Done done, Progress progress) {
+        auto last = progress();
+        auto changed = steady_clock::now();
+        while(!done()) {
+            co_await sleep_for(POLL);
+            auto now = progress();
+            if(now != last) {
+                last = now;
+                changed = steady_clock::now();
+            } else if(steady_clock::now() - changed > STALL_TIMEOUT) {
+                co_return false;
+            }
+        }
+        co_return true;
+    }
+
+    void start_counting() {
+        allocations.store(0, std::memory_order_relaxed);
+        counting.store(true, std::memory_order_relaxed);
+    }
+
+    uint64_t stop_counting() {
+        counting.store(false, std::memory_order_relaxed);
+        return allocations.load(std::memory_order_relaxed);
+    }
+
+    // Runs on the client connection thread, sending as the write queue allows
+    mock::awaitable<void> produce(client& device, size_t chunks) {
+        std::vector<uint8_t> chunk(STREAM_CHUNK, 's');
+        for(size_t sent = 0; sent < chunks && device.is_connected();) {
+            if(!device.is_writable(STREAM_ID)) {
+                co_await sleep_for(POLL);
+                continue;
+            }
+            if(device.stream_resource(STREAM_ID, chunk.data(), chunk.size())) ++sent;
+        }
+    }
+
+    json_t binary(size_t size, uint8_t fill = 'u') {
+        return json_t::binary(std::vector<uint8_t>(size, fill));
+    }
+
+    class check {
+    public:
+        check(client& device, std::shared_ptr<mock::session> server, size_t messages) :
+            device_(device), server_(std::move(server)), messages_(messages) {}
+
+        awaitable<void> stream(result& out) {
+            uint64_t base = server_->get_messages_in();
+            auto received = [&] { return server_->get_messages_in() - base; };
+
+            net::co_spawn(device_.get_io_context(), produce(device_, WARMUP), net::detached);
+            if(!co_await wait_for([&] { return received() >= WARMUP; }, received)) co_return;
+
+            start_counting();
+            net::co_spawn(device_.get_io_context(), produce(device_, messages_), net::detached);
+            out.completed = co_await wait_for([&] { return received() >= WARMUP + messages_; }, received);
+            out.allocations = stop_counting();
+            out.messages = received() - WARMUP;
+        }
+
+        awaitable<void> upload(result& out) {
+            // the device ACKs every ACK threshold bytes: warm up and measure whole periods
+            size_t size = std::max<size_t>(messages_ * 10 / 9, 100) * UPLOAD_CHUNK;
+            size_t threshold = calculate_ack_threshold(size, DEFAULT_CHUNK_SIZE);
+            size_t warmup = std::min(UPLOAD_WARMUP_ACKS, size / threshold / 2) * threshold;
+            size_t acked = 0;
+            bool ended = false;
+            auto handler = [&](iotmp_message& message) {
+                if(message.get_message_type() == message::type::STOP_STREAM) ended = true;
+                else acked += get_value(message.payload(), "bytes", static_cast<size_t>(0));
+            };
+            auto progress = [&] { return acked; };
+
+            json_t params;
+            params["path"] = "alloc.bin";
+            params["size"] = size;
+            auto stream_id = co_await server_->start_stream("$fs/upload/alloc", params, handler);
+            if(!stream_id) co_return;
+
+            auto chunk = binary(UPLOAD_CHUNK);
+            for(size_t offset = 0; offset < warmup; offset += UPLOAD_CHUNK) server_->stream_data(stream_id, chunk);
+            if(co_await wait_for([&] { return acked >= warmup || ended; }, progress) && !ended) {
+                start_counting();
+                for(size_t offset = warmup; offset < size; offset += UPLOAD_CHUNK) server_->stream_data(stream_id, chunk);
+                out.completed = co_await wait_for([&] { return acked >= size || ended; }, progress) && acked >= size;
+                out.allocations = stop_counting();
+                out.messages = (size - warmup) / UPLOAD_CHUNK;
+            }
+            // the handler refers to this frame: make sure it is gone
+            if(!ended) co_await server_->stop_stream(stream_id);
+        }
+
+        awaitable<void> interval(result& out) {
+            size_t rounds = 0;
+            auto handler = [&](iotmp_message& message) {
+                if(message.get_message_type() == message::type::STREAM_DATA) ++rounds;
+            };
+
+            json_t params;
+            params["interval"] = 1;
+            auto stream_id = co_await server_->start_stream("sensor", params, handler);
+            if(!stream_id) co_return;
+            auto progress = [&] { return rounds; };
+
+            if(co_await wait_for([&] { return rounds >= INTERVAL_WARMUP; }, progress)) {
+                start_counting();
+                out.completed = co_await wait_for([&] { return rounds >= INTERVAL_WARMUP + INTERVAL_ROUNDS; }, progress);
+                out.allocations = stop_counting();
+                out.messages = rounds - INTERVAL_WARMUP;
+            }
+            co_await server_->stop_stream(stream_id);
+        }
+
+        awaitable<void> terminal(result& out) {
+            size_t outputs = 0;
+            bool ended = false;
+            auto handler = [&](iotmp_message& message) {
+                if(message.get_message_type() == message::type::STOP_STREAM) ended = true;
+                else ++outputs;
+            };
+
+            json_t params;
+            params["cols"] = 80;
+            params["rows"] = 24;
+            auto stream_id = co_await server_->start_stream("$terminal/alloc", params, handler);
+            if(!stream_id) co_return;
+            co_await sleep_for(SHELL_STARTUP);
+
+            // a character, then a backspace to erase it
+            const json_t keys[] = {binary(1, 'x'), binary(1, '\x7f')};
+            auto round_trip = [&](size_t i) -> awaitable<bool> {
+                auto before = outputs;
+                server_->stream_data(stream_id, keys[i % 2]);
+                co_return co_await wait_for([&] { return outputs != before || ended; }, [&] { return outputs; }) && !ended;
+            };
+            co_await round_trips(round_trip, out);
+            if(!ended) co_await server_->stop_stream(stream_id);
+        }
+
+        awaitable<void> proxy(result& out) {
+            size_t received = 0;
+            bool ended = false;
+            auto handler = [&](iotmp_message& message) {
+                if(message.get_message_type() == message::type::STOP_STREAM) ended = true;
+                else if(message.payload().is_binary()) received += message.payload().get_binary().size();
+            };
+
+            json_t params;
+            params["protocol"] = "tcp";
+            params["address"] = "127.0.0.1";
+            params["port"] = echo_port_;
+            auto stream_id = co_await server_->start_stream("$proxy/alloc", params, handler);
+            if(!stream_id) co_return;
+
+            auto payload = binary(PROXY_PAYLOAD);
+            size_t sent = 0;
+            auto round_trip = [&](size_t) -> awaitable<bool> {
+                sent += PROXY_PAYLOAD;
+                server_->stream_data(stream_id, payload);
+                co_return co_await wait_for([&] { return received >= sent || ended; }, [&] { return received; }) && !ended;
+            };
+            co_await round_trips(round_trip, out);
+            if(!ended) co_await server_->stop_stream(stream_id);
+        }
+
+        void set_echo_port(uint16_t port) {
+            echo_port_ = port;
+        }
+
+    private:
+        // Warm up, then count the allocations of ROUND_TRIPS round trips
+        template<typename RoundTrip>
+        awaitable<void> round_trips(RoundTrip& round_trip, result& out) {
+            for(size_t i = 0; i < ROUND_TRIP_WARMUP; ++i) {
+                if(!co_await round_trip(i)) co_return;
+            }
+            start_counting();
+            size_t done = 0;
+            while(done < ROUND_TRIPS && co_await round_trip(ROUND_TRIP_WARMUP + done)) ++done;
+            out.allocations = stop_counting();
+            out.messages = done;
+            out.completed = done == ROUND_TRIPS;
+        }
+
+        client& device_;
+        std::shared_ptr<mock::session> server_;
+        size_t messages_;
+        uint16_t echo_port_ = 0;
+    };
+
+    // TCP echo server, the target of the proxy sessions (on the server thread)
+    awaitable<void> echo(net::ip::tcp::socket socket) {
+        char data[16 * 1024];
+        boost::system::error_code ec;
+        for(;;) {
+            size_t n = co_await socket.async_read_some(net::buffer(data), net::redirect_error(mock::use_awaitable, ec));
+            if(ec) break;
+            co_await net::async_write(socket, net::buffer(data, n), net::redirect_error(mock::use_awaitable, ec));
+            if(ec) break;
+        }
+    }
+
+    awaitable<void> echo_server(net::ip::tcp::acceptor& acceptor) {
+        for(;;) {
+            boost::system::error_code ec;
+            auto socket = co_await acceptor.async_accept(net::redirect_error(mock::use_awaitable, ec));
+            if(ec) break;
+            net::co_spawn(acceptor.get_executor(), echo(std::move(socket)), net::detached);
+        }
+    }
+
+}
+
+int main(int argc, char* argv[]) {
+    std::string scenario = "all";
+    size_t messages = 10000;
+    double budget = 0;
+    std::vector<std::string> positional;
+    for(int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if(arg == "--budget" && i + 1 < argc) budget = std::strtod(argv[++i], nullptr);
+        else positional.push_back(arg);
+    }
+    if(!positional.empty()) scenario = positional[0];
+    if(positional.size() > 1) messages = std::max<size_t>(std::strtoul(positional[1].c_str(), nullptr, 10), 1);
+
+    const std::vector<std::string> all = {"stream", "upload", "interval", "terminal", "proxy"};
+    std::vector<std::string> scenarios;
+    if(scenario == "all") scenarios = all;
+    else if(std::find(all.begin(), all.end(), scenario) != all.end()) scenarios = {scenario};
+    else {
+        std::fprintf(stderr, "unknown scenario '%s'\n", scenario.c_str());
+        return 1;
+    }
+
+    spdlog::set_level(spdlog::level::warn);
+    auto directory = std::filesystem::temp_directory_path() / ("iotmp_alloc_check_" + std::to_string(::getpid()));
+    std::filesystem::create_directories(directory);
+
+    client device;
+    mock::server server(mock::transport::TCP);
+    net::ip::tcp::acceptor echo_acceptor(server.get_io_context(),
+        net::ip::tcp::endpoint(net::ip::make_address("127.0.0.1"), 0));
+    uint16_t echo_port = echo_acceptor.local_endpoint().port();
+    net::co_spawn(server.get_io_context(), echo_server(echo_acceptor), net::detached);
+    std::promise<std::vector<result>> finished;
+    bool started = false;
+    server.set_session_handler([&](std::shared_ptr<mock::session> session) -> mock::awaitable<void> {
+        // a reconnect after a failure is not checked again
+        if(started) co_return;
+        started = true;
+
+        // count the connection thread from now on
+        net::post(device.get_io_context(), [] { connection_thread = true; });
+        co_await sleep_for(milliseconds(100));
+
+        check runner(device, session, messages);
+        runner.set_echo_port(echo_port);
+        std::vector<result> results;
+        for(auto& name : scenarios) {
+            result entry;
+            entry.scenario = name.c_str();
+            if(name == "stream") co_await runner.stream(entry);
+            else if(name == "upload") co_await runner.upload(entry);
+            else if(name == "interval") co_await runner.interval(entry);
+            else if(name == "terminal") co_await runner.terminal(entry);
+            else if(name == "proxy") co_await runner.proxy(entry);
+            results.push_back(entry);
+        }
+        finished.set_value(std::move(results));
+    });
+
+    device.set_credentials("bench", "alloc", "credential");
+    device.set_host("127.0.0.1");
+    device.set_transport(transport_type::TCP);
+    device.set_port(server.get_port());
+    device["sensor"] = [](output& out) {
+        out["temperature"] = 21.5;
+        out["humidity"] = 48.0;
+    };
+    device["sensor"].set_fixed_output();
+
+    filesystem fs(device, directory);
+    terminal shell(device);
+    proxy tcp_proxy(device);
+
+    server.start();
+    device.start();
+
+    auto done = finished.get_future();
+    int status = 0;
+    if(done.wait_for(CONNECT_TIMEOUT + STALL_TIMEOUT * (scenarios.size() + 1)) == std::future_status::ready) {
+        std::printf("%-10s %10s %12s %14s\n", "scenario", "messages", "allocations", "allocs/message");
+        for(auto& entry : done.get()) {
+            double per_message = entry.messages ? static_cast<double>(entry.allocations) / entry.messages : 0.0;
+            std::printf("%-10s %10llu %12llu %14.3f%s\n", entry.scenario,
+                static_cast<unsigned long long>(entry.messages), static_cast<unsigned long long>(entry.allocations),
+                per_message, entry.completed ? "" : "  (incomplete)");
+            if(!entry.completed || per_message > budget) status = 1;
+        }
+    } else {
+        std::fprintf(stderr, "timed out (is the client connecting?)\n");
+        status = 1;
+    }
+
+    device.stop();
+    server.stop();
+    std::filesystem::remove_all(directory);
+    return status;
+}
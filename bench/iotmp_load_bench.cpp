@@ -0,0 +1,649 @@
+// End-to-end load test of the client against the mock IOTMP server.
+//
+// A client with an echo resource and the terminal, filesystem and proxy
+// extensions runs in-process and connects to a mock::server over loopback,
+// which drives it one scenario at a time, the way the Thinger.io server
+// does:
+//
+//   rpc       RUN of the echo resource
+//   describe  DESCRIBE of the device API
+//   download  $fs/download of a file, acknowledging every chunk
+//   upload    $fs/upload of a file, within the device window
+//   terminal  keystrokes to a $terminal session, timed until echoed
+//   proxy     payloads through a $proxy session to a local TCP echo server
+//
+// Reports messages (requests, chunks, keystrokes or payloads) per second,
+// MB/s on the wire (both directions, as seen by the server) and latency
+// percentiles in microseconds: response time for rpc, describe, terminal
+// and proxy; time from chunk sent to acknowledged for uploads, and gap
+// between chunks for downloads.
+//
+//   iotmp_load_bench [tcp|tls|ws] [scenario|all] [seconds] [rate] [client [args...]]
+//
+// rate is requests, keystrokes or payloads per second, and megabits per
+// second for the file transfers. 0 (the default) runs closed-loop: WINDOW
+// requests or payloads in flight, one keystroke at a time, and transfers
+// as fast as the device window allows. Paced latencies are measured from
+// the time each request was scheduled, so a stall delays every request
+// behind it in the results too.
+//
+// With a client binary (i.e., the thinger_iotmp standalone client), the
+// scenarios drive that process instead of the in-process client, which is
+// how bench/pgo_build.sh trains the shipped binary. It is started with the
+// server address, credentials and filesystem path, followed by args, and
+// stopped with SIGTERM. It has no echo resource, so all skips rpc.
+
+#include "mock_server.hpp"
+
+#include <thinger/iotmp/client.hpp>
+#include <thinger/iotmp/core/iotmp_histogram.hpp>
+#include <thinger/iotmp/extensions/fs/filesystem.hpp>
+#include <thinger/iotmp/extensions/proxy/proxy.hpp>
+#include <thinger/iotmp/extensions/terminal/terminal.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <string>
+#include <vector>
+
+#include <csignal>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace thinger::iotmp;
+using namespace std::chrono;
+
+namespace {
+
+    constexpr size_t WINDOW = 16;                       // closed-loop requests in flight
+    constexpr size_t RPC_PAYLOAD = 64;
+    constexpr size_t PROXY_PAYLOAD = 1024;
+    constexpr size_t TRANSFER_SIZE = 32 * 1024 * 1024;  // bytes per file transfer
+    constexpr size_t UPLOAD_CHUNK = 64 * 1024;
+    constexpr size_t UPLOAD_WINDOW = 2 * 1024 * 1024;
+    constexpr auto SHELL_STARTUP = milliseconds(1000);  // let the shell print its prompt
+    constexpr auto ECHO_TIMEOUT = seconds(5);
+    constexpr auto CONNECT_TIMEOUT = seconds(30);
+
+    using mock::awaitable;
+    using mock::use_awaitable;
+    namespace net = mock::net;
+
+    struct report {
+        const char* scenario = nullptr;
+        uint64_t messages = 0;
+        uint64_t wire_bytes = 0;
+        double seconds = 0;
+        uint64_t errors = 0;
+        histogram latency;                              // microseconds
+    };
+
+    uint64_t micros(steady_clock::duration duration) {
+        return static_cast<uint64_t>(duration_cast<microseconds>(duration).count());
+    }
+
+    // Send slots at a fixed rate, or right away with rate 0
+    class pacer {
+    public:
+        explicit pacer(double rate) :
+            interval_(rate > 0 ? duration_cast<steady_clock::duration>(duration<double>(1.0 / rate)) : steady_clock::duration::zero()),
+            next_(steady_clock::now()) {}
+
+        steady_clock::time_point next() {
+            if(interval_ == steady_clock::duration::zero()) return steady_clock::now();
+            auto slot = next_;
+            next_ += interval_;
+            return slot;
+        }
+
+    private:
+        steady_clock::duration interval_;
+        steady_clock::time_point next_;
+    };
+
+    awaitable<void> sleep_until(steady_clock::time_point when) {
+        if(when <= steady_clock::now()) co_return;
+        net::steady_timer timer(co_await net::this_coro::executor, when);
+        boost::system::error_code ec;
+        co_await timer.async_wait(net::redirect_error(use_awaitable, ec));
+    }
+
+    // Wakes a coroutine waiting for stream data. Everything runs on the
+    // server thread, so a condition checked right before wait() cannot
+    // change before the wait starts.
+    class wakeup {
+    public:
+        explicit wakeup(net::io_context& io) : timer_(io) {}
+
+        awaitable<void> wait(steady_clock::time_point deadline) {
+            timer_.expires_at(deadline);
+            boost::system::error_code ec;
+            co_await timer_.async_wait(net::redirect_error(use_awaitable, ec));
+        }
+
+        void notify() {
+            timer_.cancel();
+        }
+
+    private:
+        net::steady_timer timer_;
+    };
+
+    // Run count copies of a coroutine and wait for all of them
+    template<class Worker>
+    awaitable<void> run_workers(net::io_context& io, size_t count, Worker worker) {
+        size_t running = count;
+        wakeup done(io);
+        for(size_t i = 0; i < count; ++i) {
+            net::co_spawn(io, [&]() -> awaitable<void> {
+                co_await worker();
+                if(--running == 0) done.notify();
+            }, net::detached);
+        }
+        while(running > 0) co_await done.wait(steady_clock::time_point::max());
+    }
+
+    json_t rpc_payload() {
+        json_t payload;
+        payload["data"] = std::string(RPC_PAYLOAD, 'x');
+        return payload;
+    }
+
+    json_t ack(uint64_t number, size_t bytes) {
+        json_t payload;
+        payload["ack"] = number;
+        payload["bytes"] = bytes;
+        return payload;
+    }
+
+    json_t binary(const std::string& data) {
+        return json_t::binary(std::vector<uint8_t>(data.begin(), data.end()));
+    }
+
+    class load {
+    public:
+        load(net::io_context& io, std::shared_ptr<mock::session> device, double rate, steady_clock::duration length,
+             std::filesystem::path directory, uint16_t echo_port) :
+            io_(io), device_(std::move(device)), rate_(rate), length_(length),
+            directory_(std::move(directory)), echo_port_(echo_port) {}
+
+        awaitable<void> rpc(report& result) {
+            pacer pace(rate_);
+            auto deadline = steady_clock::now() + length_;
+            auto payload = rpc_payload();
+            co_await run_workers(io_, rate_ > 0 ? WINDOW * 4 : WINDOW, [&]() -> awaitable<void> {
+                while(device_->is_connected()) {
+                    auto scheduled = pace.next();
+                    if(scheduled >= deadline) break;
+                    co_await sleep_until(scheduled);
+                    auto response = co_await device_->run("echo", payload);
+                    record(result, response.ok, scheduled);
+                }
+            });
+        }
+
+        awaitable<void> describe(report& result) {
+            pacer pace(rate_);
+            auto deadline = steady_clock::now() + length_;
+            co_await run_workers(io_, rate_ > 0 ? WINDOW * 4 : WINDOW, [&]() -> awaitable<void> {
+                while(device_->is_connected()) {
+                    auto scheduled = pace.next();
+                    if(scheduled >= deadline) break;
+                    co_await sleep_until(scheduled);
+                    auto response = co_await device_->describe();
+                    record(result, response.ok, scheduled);
+                }
+            });
+        }
+
+        // Download the transfer file over and over
+        awaitable<void> download(report& result) {
+            auto deadline = steady_clock::now() + length_;
+            while(steady_clock::now() < deadline && device_->is_connected()) {
+                size_t received = 0;
+                uint64_t acks = 0;
+                bool ended = false;
+                auto last = steady_clock::now();
+                wakeup wake(io_);
+
+                auto handler = [&](iotmp_message& message) {
+                    if(message.get_message_type() == message::type::STOP_STREAM) {
+                        ended = true;
+                    } else if(message.payload().is_binary()) {
+                        size_t size = message.payload().get_binary().size();
+                        received += size;
+                        auto now = steady_clock::now();
+                        result.latency.record(micros(now - last));
+                        last = now;
+                        ++result.messages;
+                        // the first chunks can arrive before start_stream() returns
+                        device_->stream_data(message.get_stream_id(), ack(++acks, size));
+                        if(received < TRANSFER_SIZE) return;
+                    }
+                    wake.notify();
+                };
+
+                auto stream_id = co_await device_->start_stream("$fs/download/bench", download_params(), handler);
+                if(!stream_id) {
+                    ++result.errors;
+                    break;
+                }
+                last = steady_clock::now();
+                while(!ended && received < TRANSFER_SIZE && device_->is_connected()) {
+                    co_await wake.wait(steady_clock::now() + ECHO_TIMEOUT);
+                    if(steady_clock::now() - last >= ECHO_TIMEOUT) break;
+                }
+                if(received < TRANSFER_SIZE) ++result.errors;
+                if(!ended) co_await device_->stop_stream(stream_id);
+            }
+        }
+
+        // Upload the transfer file over and over
+        awaitable<void> upload(report& result) {
+            auto deadline = steady_clock::now() + length_;
+            auto chunk = binary(std::string(UPLOAD_CHUNK, 'u'));
+            while(steady_clock::now() < deadline && device_->is_connected()) {
+                size_t sent = 0, acked = 0;
+                bool ended = false;
+                std::deque<std::pair<size_t, steady_clock::time_point>> in_flight;  // chunk end offset, sent at
+                wakeup wake(io_);
+
+                auto handler = [&](iotmp_message& message) {
+                    if(message.get_message_type() == message::type::STOP_STREAM) {
+                        ended = true;
+                    } else {
+                        acked += get_value(message.payload(), "bytes", static_cast<size_t>(0));
+                        auto now = steady_clock::now();
+                        while(!in_flight.empty() && in_flight.front().first <= acked) {
+                            result.latency.record(micros(now - in_flight.front().second));
+                            ++result.messages;
+                            in_flight.pop_front();
+                        }
+                    }
+                    wake.notify();
+                };
+
+                auto stream_id = co_await device_->start_stream("$fs/upload/bench", upload_params(), handler);
+                if(!stream_id) {
+                    ++result.errors;
+                    break;
+                }
+
+                auto started = steady_clock::now();
+                while(sent < TRANSFER_SIZE && !ended && device_->is_connected()) {
+                    if(rate_ > 0) {
+                        auto due = started + duration_cast<steady_clock::duration>(duration<double>(sent * 8.0 / (rate_ * 1e6)));
+                        co_await sleep_until(due);
+                    }
+                    if(sent - acked >= UPLOAD_WINDOW) {
+                        auto before = acked;
+                        co_await wake.wait(steady_clock::now() + ECHO_TIMEOUT);
+                        if(acked == before) break;
+                        continue;
+                    }
+                    sent += UPLOAD_CHUNK;
+                    in_flight.emplace_back(sent, steady_clock::now());
+                    device_->stream_data(stream_id, chunk);
+                }
+                while(acked < TRANSFER_SIZE && !ended && device_->is_connected()) {
+                    auto before = acked;
+                    co_await wake.wait(steady_clock::now() + ECHO_TIMEOUT);
+                    if(acked == before) break;
+                }
+                if(acked < TRANSFER_SIZE) ++result.errors;
+                if(!ended) co_await device_->stop_stream(stream_id);
+            }
+        }
+
+        // One keystroke at a time, timed until the shell echoes it
+        awaitable<void> terminal(report& result) {
+            bool output = false, ended = false;
+            wakeup wake(io_);
+            auto handler = [&](iotmp_message& message) {
+                if(message.get_message_type() == message::type::STOP_STREAM) ended = true;
+                output = true;
+                wake.notify();
+            };
+
+            auto stream_id = co_await device_->start_stream("$terminal/bench", terminal_params(), handler);
+            if(!stream_id) {
+                ++result.errors;
+                co_return;
+            }
+            co_await sleep_until(steady_clock::now() + SHELL_STARTUP);
+
+            pacer pace(rate_);
+            auto deadline = steady_clock::now() + length_;
+            auto keystroke = binary("x");
+            while(!ended && device_->is_connected()) {
+                auto scheduled = pace.next();
+                if(scheduled >= deadline) break;
+                co_await sleep_until(scheduled);
+                output = false;
+                device_->stream_data(stream_id, keystroke);
+                auto timeout = steady_clock::now() + ECHO_TIMEOUT;
+                while(!output && !ended && steady_clock::now() < timeout) co_await wake.wait(timeout);
+                record(result, output, scheduled);
+            }
+
+            // clear the line before closing the shell
+            device_->stream_data(stream_id, binary("\x15"));
+            if(!ended) co_await device_->stop_stream(stream_id);
+        }
+
+        // Payloads through a proxy session, timed until echoed back
+        awaitable<void> proxy(report& result) {
+            size_t sent = 0, received = 0;
+            bool ended = false;
+            std::deque<std::pair<size_t, steady_clock::time_point>> in_flight;   // payload end offset, scheduled at
+            wakeup wake(io_);
+            auto handler = [&](iotmp_message& message) {
+                if(message.get_message_type() == message::type::STOP_STREAM) {
+                    ended = true;
+                } else if(message.payload().is_binary()) {
+                    received += message.payload().get_binary().size();
+                    auto now = steady_clock::now();
+                    while(!in_flight.empty() && in_flight.front().first <= received) {
+                        result.latency.record(micros(now - in_flight.front().second));
+                        ++result.messages;
+                        in_flight.pop_front();
+                    }
+                }
+                wake.notify();
+            };
+
+            auto stream_id = co_await device_->start_stream("$proxy/bench", proxy_params(), handler);
+            if(!stream_id) {
+                ++result.errors;
+                co_return;
+            }
+
+            pacer pace(rate_);
+            auto deadline = steady_clock::now() + length_;
+            auto payload = binary(std::string(PROXY_PAYLOAD, 'p'));
+            while(!ended && device_->is_connected()) {
+                auto scheduled = pace.next();
+                if(scheduled >= deadline) break;
+                co_await sleep_until(scheduled);
+                bool stalled = false;
+                while(in_flight.size() >= WINDOW * (rate_ > 0 ? 4 : 1) && !ended && !stalled) {
+                    auto before = received;
+                    co_await wake.wait(steady_clock::now() + ECHO_TIMEOUT);
+                    stalled = received == before;
+                }
+                if(stalled || ended) break;
+                sent += PROXY_PAYLOAD;
+                in_flight.emplace_back(sent, scheduled);
+                device_->stream_data(stream_id, payload);
+            }
+            while(!in_flight.empty() && !ended && device_->is_connected()) {
+                auto before = received;
+                co_await wake.wait(steady_clock::now() + ECHO_TIMEOUT);
+                if(received == before) break;
+            }
+            result.errors += in_flight.size();
+            if(!ended) co_await device_->stop_stream(stream_id);
+        }
+
+    private:
+        static void record(report& result, bool ok, steady_clock::time_point scheduled) {
+            if(!ok) {
+                ++result.errors;
+                return;
+            }
+            result.latency.record(micros(steady_clock::now() - scheduled));
+            ++result.messages;
+        }
+
+        json_t download_params() const {
+            json_t params;
+            params["path"] = "download.bin";
+            if(rate_ > 0) params["max_bandwidth_mbps"] = rate_;
+            return params;
+        }
+
+        json_t upload_params() const {
+            json_t params;
+            params["path"] = "upload.bin";
+            params["size"] = TRANSFER_SIZE;
+            if(rate_ > 0) params["max_bandwidth_mbps"] = rate_;
+            return params;
+        }
+
+        static json_t terminal_params() {
+            json_t params;
+            params["cols"] = 80;
+            params["rows"] = 24;
+            return params;
+        }
+
+        json_t proxy_params() const {
+            json_t params;
+            params["protocol"] = "tcp";
+            params["address"] = "127.0.0.1";
+            params["port"] = echo_port_;
+            return params;
+        }
+
+        net::io_context& io_;
+        std::shared_ptr<mock::session> device_;
+        double rate_;
+        steady_clock::duration length_;
+        std::filesystem::path directory_;
+        uint16_t echo_port_;
+    };
+
+    // TCP echo server, the target of the proxy sessions
+    awaitable<void> echo(net::ip::tcp::socket socket) {
+        char data[16 * 1024];
+        boost::system::error_code ec;
+        for(;;) {
+            size_t n = co_await socket.async_read_some(net::buffer(data), net::redirect_error(use_awaitable, ec));
+            if(ec) break;
+            co_await net::async_write(socket, net::buffer(data, n), net::redirect_error(use_awaitable, ec));
+            if(ec) break;
+        }
+    }
+
+    awaitable<void> echo_server(net::ip::tcp::acceptor& acceptor) {
+        for(;;) {
+            boost::system::error_code ec;
+            auto socket = co_await acceptor.async_accept(net::redirect_error(use_awaitable, ec));
+            if(ec) break;
+            net::co_spawn(acceptor.get_executor(), echo(std::move(socket)), net::detached);
+        }
+    }
+
+    void print(const report& result) {
+        double seconds = result.seconds > 0 ? result.seconds : 1;
+        std::printf("%-10s %12.0f %10.2f %9llu %9llu %9llu %9llu %7llu\n",
+            result.scenario,
+            result.messages / seconds,
+            result.wire_bytes / seconds / 1e6,
+            static_cast<unsigned long long>(result.latency.percentile(50)),
+            static_cast<unsigned long long>(result.latency.percentile(90)),
+            static_cast<unsigned long long>(result.latency.percentile(99)),
+            static_cast<unsigned long long>(result.latency.max()),
+            static_cast<unsigned long long>(result.errors));
+    }
+
+    void create_file(const std::filesystem::path& path, size_t size) {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        std::string block(64 * 1024, 'd');
+        for(size_t written = 0; written < size; written += block.size()) {
+            file.write(block.data(), static_cast<std::streamsize>(std::min(block.size(), size - written)));
+        }
+    }
+
+    // Client with the extensions the scenarios use, in this process
+    struct in_process_client {
+        client device;
+        terminal shell{device};
+        filesystem fs;
+        proxy tcp_proxy{device};
+
+        in_process_client(transport_type transport, uint16_t port, const std::filesystem::path& directory) :
+            fs(device, directory)
+        {
+            device.set_credentials("bench", "load", "credential");
+            device.set_host("127.0.0.1");
+            device.set_transport(transport);
+            device.set_port(port);
+            // the mock server certificate is self-signed
+            device.set_websocket_verify(false);
+            device["echo"] = [](input& in, output& out) { out = in; };
+        }
+    };
+
+    // Start an external client binary against the mock server
+    pid_t spawn_client(const char* binary, char** extra, int extra_count, const char* transport, uint16_t port,
+                       const std::filesystem::path& directory) {
+        std::vector<std::string> args = {binary, "-u", "bench", "-d", "load", "-p", "credential",
+                                         "-h", "127.0.0.1", "-t", transport, "--port", std::to_string(port),
+                                         "-f", directory.string()};
+        for(int i = 0; i < extra_count; ++i) args.emplace_back(extra[i]);
+        std::vector<char*> argv;
+        for(auto& arg : args) argv.push_back(arg.data());
+        argv.push_back(nullptr);
+
+        pid_t pid = ::fork();
+        if(pid == 0) {
+            ::execv(binary, argv.data());
+            std::perror(binary);
+            ::_exit(127);
+        }
+        return pid;
+    }
+
+}
+
+int main(int argc, char* argv[]) {
+    std::string transport_name = argc > 1 ? argv[1] : "tcp";
+    std::string scenario = argc > 2 ? argv[2] : "all";
+    auto length = seconds(argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 5);
+    double rate = argc > 4 ? std::strtod(argv[4], nullptr) : 0;
+    const char* client_binary = argc > 5 ? argv[5] : nullptr;
+
+    mock::transport kind;
+    transport_type client_transport;
+    const char* client_transport_name;
+    if(transport_name == "tcp") {
+        kind = mock::transport::TCP;
+        client_transport = transport_type::TCP;
+        client_transport_name = "tcp";
+    } else if(transport_name == "tls" || transport_name == "ssl") {
+        kind = mock::transport::TLS;
+        client_transport = transport_type::SSL;
+        client_transport_name = "ssl";
+    } else if(transport_name == "ws" || transport_name == "websocket") {
+        kind = mock::transport::WEBSOCKET;
+        client_transport = transport_type::WEBSOCKET;
+        client_transport_name = "ws";
+    } else {
+        std::fprintf(stderr, "unknown transport '%s': use tcp, tls or ws\n", transport_name.c_str());
+        return 1;
+    }
+
+    if(client_binary && kind == mock::transport::WEBSOCKET) {
+        std::fprintf(stderr, "ws needs the in-process client: the mock server certificate is self-signed\n");
+        return 1;
+    }
+
+    const std::vector<std::string> all = {"rpc", "describe", "download", "upload", "terminal", "proxy"};
+    std::vector<std::string> scenarios;
+    if(scenario == "all") {
+        scenarios = all;
+        if(client_binary) scenarios.erase(scenarios.begin());
+    }
+    else if(std::find(all.begin(), all.end(), scenario) != all.end()) scenarios = {scenario};
+    else {
+        std::fprintf(stderr, "unknown scenario '%s'\n", scenario.c_str());
+        return 1;
+    }
+
+    auto directory = std::filesystem::temp_directory_path() / ("iotmp_load_bench_" + std::to_string(::getpid()));
+    std::filesystem::create_directories(directory);
+    if(std::find(scenarios.begin(), scenarios.end(), "download") != scenarios.end()) {
+        create_file(directory / "download.bin", TRANSFER_SIZE);
+    }
+
+    mock::server server(kind);
+    net::ip::tcp::acceptor echo_acceptor(server.get_io_context(),
+        net::ip::tcp::endpoint(net::ip::make_address("127.0.0.1"), 0));
+    uint16_t echo_port = echo_acceptor.local_endpoint().port();
+    net::co_spawn(server.get_io_context(), echo_server(echo_acceptor), net::detached);
+
+    std::promise<void> finished;
+    bool started = false;
+    uint64_t errors = 0;    // over all scenarios, read once finished
+    server.set_session_handler([&](std::shared_ptr<mock::session> device) -> mock::awaitable<void> {
+        // a reconnect after a failure is not driven again
+        if(started) co_return;
+        started = true;
+
+        load runner(server.get_io_context(), device, rate, length, directory, echo_port);
+        std::printf("%-10s %12s %10s %9s %9s %9s %9s %7s\n",
+            "scenario", "messages/s", "MB/s", "p50 us", "p90 us", "p99 us", "max us", "errors");
+        for(auto& name : scenarios) {
+            report result;
+            result.scenario = name.c_str();
+            uint64_t bytes_before = device->get_bytes_in() + device->get_bytes_out();
+            auto start = steady_clock::now();
+            if(name == "rpc") co_await runner.rpc(result);
+            else if(name == "describe") co_await runner.describe(result);
+            else if(name == "download") co_await runner.download(result);
+            else if(name == "upload") co_await runner.upload(result);
+            else if(name == "terminal") co_await runner.terminal(result);
+            else if(name == "proxy") co_await runner.proxy(result);
+            result.seconds = duration<double>(steady_clock::now() - start).count();
+            result.wire_bytes = device->get_bytes_in() + device->get_bytes_out() - bytes_before;
+            print(result);
+            std::fflush(stdout);
+            errors += result.errors;
+        }
+        finished.set_value();
+    });
+
+    std::unique_ptr<in_process_client> local;
+    if(!client_binary) local = std::make_unique<in_process_client>(client_transport, server.get_port(), directory);
+
+    std::printf("transport %s, %lld s per scenario, %s\n\n", mock::to_string(kind),
+        static_cast<long long>(length.count()),
+        rate > 0 ? (std::to_string(rate) + " per second (Mbps for transfers)").c_str() : "closed loop");
+
+    server.start();
+    pid_t child = -1;
+    if(local) {
+        local->device.start();
+    } else {
+        child = spawn_client(client_binary, argv + 6, argc - 6, client_transport_name, server.get_port(), directory);
+        if(child < 0) {
+            std::perror("fork");
+            server.stop();
+            std::filesystem::remove_all(directory);
+            return 1;
+        }
+    }
+
+    auto done = finished.get_future();
+    bool completed = done.wait_for(CONNECT_TIMEOUT + length * scenarios.size() * 2) == std::future_status::ready;
+    if(!completed) std::fprintf(stderr, "timed out (is the client connecting?)\n");
+    else if(errors) std::fprintf(stderr, "%llu errors\n", static_cast<unsigned long long>(errors));
+
+    if(local) {
+        local->device.stop();
+    } else {
+        // a clean exit, so an instrumented client writes its profile
+        ::kill(child, SIGTERM);
+        ::waitpid(child, nullptr, 0);
+    }
+    server.stop();
+    std::filesystem::remove_all(directory);
+    return completed && errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,363 @@
+// Replay of a wire capture against the client.
+//
+// Feeds the frames a client received from the server, as recorded with
+// client::set_capture() (--capture in the standalone client), to an
+// in-process client through the mock server over loopback TCP, so field
+// traffic becomes a repeatable benchmark. The answer to CONNECT is left out
+// (the mock server authenticates the device itself) and everything else is
+// sent as captured, either back-to-back (fast) or at the captured pace
+// (timed).
+//
+// The client runs the filesystem (on a scratch directory) and proxy
+// extensions. Terminal and cmd are left out on purpose, so recorded
+// keystrokes and commands are never executed again. Requests for them, and
+// for resources the replay client does not define, are answered with ERROR.
+// Answers to calls the client made at capture time arrive on streams it
+// does not know and are ignored, as they would be after a reconnect.
+//
+// Reports CPU time per stage:
+//
+//   decode     iotmp_decoder over every captured inbound frame, per message
+//              type (offline, one thread)
+//   encode     encode_message of every captured outbound frame (offline)
+//   client     CPU time of the process during the replay, less the mock
+//              server thread: reading, decoding, routing, extensions and
+//              writing the answers
+//   dispatch   client less the decode and encode estimates
+//
+// and the time spent in every resource handler, from the client metrics.
+//
+//   iotmp_replay <capture> [fast|timed] [connection]
+//
+// connection is the connection of the capture to replay (0, the first, by
+// default), as a capture spans every reconnection of the client.
+
+#include "mock_server.hpp"
+
+#include <thinger/iotmp/client.hpp>
+#include <thinger/iotmp/core/iotmp_capture.hpp>
+#include <thinger/iotmp/extensions/fs/filesystem.hpp>
+#include <thinger/iotmp/extensions/proxy/proxy.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+#include <future>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace thinger::iotmp;
+using namespace std::chrono;
+
+namespace {
+
+    constexpr auto MIN_CPU = milliseconds(200);     // per offline measurement
+    constexpr auto QUIET = milliseconds(500);       // replay done once the connection is idle this long
+    constexpr auto POLL = milliseconds(10);
+    constexpr auto CONNECT_TIMEOUT = seconds(30);
+
+    using mock::awaitable;
+    namespace net = mock::net;
+
+    struct frame {
+        microseconds offset{0};
+        uint8_t type = 0;
+        std::string data;
+    };
+
+    struct stage {
+        uint64_t frames = 0;
+        uint64_t bytes = 0;
+        nanoseconds cpu{0};
+    };
+
+    nanoseconds cpu_time(clockid_t clock) {
+        timespec ts{};
+        ::clock_gettime(clock, &ts);
+        return seconds(ts.tv_sec) + nanoseconds(ts.tv_nsec);
+    }
+
+    iotmp_message decode(const std::string& data) {
+        frame_header header;
+        parse_frame_header(reinterpret_cast<const uint8_t*>(data.data()), data.size(), header);
+        iotmp_message message(static_cast<message::type>(header.type));
+        if(header.size > 0) {
+            memory_reader reader(reinterpret_cast<const uint8_t*>(data.data()) + header.length, header.size);
+            iotmp_decoder<memory_reader> decoder(reader);
+            decoder.decode(message, header.size);
+        }
+        return message;
+    }
+
+    // Split a record into its frames (outbound records may hold several)
+    bool split(const capture::record& record, std::vector<frame>& out) {
+        auto data = reinterpret_cast<const uint8_t*>(record.data.data());
+        size_t position = 0;
+        while(position < record.data.size()) {
+            frame_header header;
+            if(parse_frame_header(data + position, record.data.size() - position, header) != frame_parse::COMPLETE ||
+               position + header.length + header.size > record.data.size()) {
+                return false;
+            }
+            size_t size = header.length + header.size;
+            out.push_back({record.offset, header.type, record.data.substr(position, size)});
+            position += size;
+        }
+        return true;
+    }
+
+    // Frames of one connection of a capture
+    bool load(const std::filesystem::path& path, size_t connection, std::vector<frame>& inbound,
+              std::vector<frame>& outbound) {
+        capture_reader reader;
+        if(!reader.open(path)) return false;
+
+        capture::record record;
+        size_t current = 0;
+        bool started = false;
+        while(reader.next(record)) {
+            if(record.type == capture::kind::CONNECTED) {
+                if(started) ++current;
+                started = true;
+                continue;
+            }
+            started = true;
+            if(current < connection) continue;
+            if(current > connection) break;
+            if(!split(record, record.type == capture::kind::INBOUND ? inbound : outbound)) {
+                std::fprintf(stderr, "malformed frame at %.3f s\n", duration<double>(record.offset).count());
+                return false;
+            }
+        }
+
+        // the mock server answers CONNECT by itself
+        for(auto& sent : outbound) {
+            if(sent.type != message::type::CONNECT) continue;
+            uint16_t stream_id = decode(sent.data).get_stream_id();
+            for(auto it = inbound.begin(); it != inbound.end(); ++it) {
+                if(it->type != message::type::OK && it->type != message::type::ERROR) continue;
+                if(decode(it->data).get_stream_id() != stream_id) continue;
+                inbound.erase(it);
+                break;
+            }
+            break;
+        }
+        return true;
+    }
+
+    // Average CPU time of a pass over some frames, repeating it until
+    // MIN_CPU went by
+    template<class Pass>
+    nanoseconds measure(Pass pass) {
+        uint64_t passes = 0;
+        auto start = cpu_time(CLOCK_THREAD_CPUTIME_ID);
+        nanoseconds elapsed{0};
+        do {
+            pass();
+            ++passes;
+            elapsed = cpu_time(CLOCK_THREAD_CPUTIME_ID) - start;
+        } while(elapsed < MIN_CPU);
+        return elapsed / passes;
+    }
+
+    std::map<std::string, stage> measure_decode(const std::vector<frame>& frames) {
+        std::map<uint8_t, std::vector<const frame*>> by_type;
+        for(auto& f : frames) by_type[f.type].push_back(&f);
+
+        std::map<std::string, stage> result;
+        for(auto& [type, group] : by_type) {
+            auto& entry = result[iotmp_message(static_cast<message::type>(type)).message_type()];
+            for(auto* f : group) {
+                ++entry.frames;
+                entry.bytes += f->data.size();
+            }
+            entry.cpu += measure([&group]() {
+                for(auto* f : group) {
+                    auto message = decode(f->data);
+                    asm volatile("" : : "r"(&message) : "memory");
+                }
+            });
+        }
+        return result;
+    }
+
+    stage measure_encode(const std::vector<frame>& frames) {
+        std::vector<iotmp_message> messages;
+        stage result;
+        for(auto& f : frames) {
+            messages.push_back(decode(f.data));
+            ++result.frames;
+            result.bytes += f.data.size();
+        }
+        result.cpu = measure([&messages]() {
+            for(auto& message : messages) {
+                auto encoded = encode_message(message);
+                asm volatile("" : : "r"(encoded.data()) : "memory");
+            }
+        });
+        return result;
+    }
+
+    void print(const char* name, const stage& entry) {
+        std::printf("%-14s %10llu %12llu %12.3f %10.3f\n", name,
+            static_cast<unsigned long long>(entry.frames), static_cast<unsigned long long>(entry.bytes),
+            duration<double, std::milli>(entry.cpu).count(),
+            entry.frames ? duration<double, std::micro>(entry.cpu).count() / entry.frames : 0.0);
+    }
+
+    awaitable<void> sleep_until(steady_clock::time_point when) {
+        if(when <= steady_clock::now()) co_return;
+        net::steady_timer timer(co_await net::this_coro::executor, when);
+        boost::system::error_code ec;
+        co_await timer.async_wait(net::redirect_error(mock::use_awaitable, ec));
+    }
+
+    struct replay_result {
+        double seconds = 0;
+        uint64_t frames = 0;
+        uint64_t bytes = 0;
+        uint64_t answers = 0;
+        nanoseconds client_cpu{0};
+        nanoseconds server_cpu{0};
+    };
+
+}
+
+int main(int argc, char* argv[]) {
+    if(argc < 2) {
+        std::fprintf(stderr, "usage: %s <capture> [fast|timed] [connection]\n", argv[0]);
+        return 1;
+    }
+    std::filesystem::path path = argv[1];
+    std::string mode = argc > 2 ? argv[2] : "fast";
+    size_t connection = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 0;
+    if(mode != "fast" && mode != "timed") {
+        std::fprintf(stderr, "unknown mode '%s': use fast or timed\n", mode.c_str());
+        return 1;
+    }
+    bool timed = mode == "timed";
+
+    std::vector<frame> inbound, outbound;
+    if(!load(path, connection, inbound, outbound)) return 1;
+    if(inbound.empty()) {
+        std::fprintf(stderr, "connection %zu of %s has no inbound frames\n", connection, path.string().c_str());
+        return 1;
+    }
+    auto captured = duration<double>(inbound.back().offset - inbound.front().offset).count();
+    std::printf("%s, connection %zu: %zu inbound and %zu outbound frames over %.3f s\n\n",
+        path.string().c_str(), connection, inbound.size(), outbound.size(), captured);
+
+    // offline stages
+    std::printf("%-14s %10s %12s %12s %10s\n", "decode", "frames", "bytes", "cpu ms", "us/frame");
+    stage decode_total;
+    for(auto& [type, entry] : measure_decode(inbound)) {
+        print(type.c_str(), entry);
+        decode_total.frames += entry.frames;
+        decode_total.bytes += entry.bytes;
+        decode_total.cpu += entry.cpu;
+    }
+    print("total", decode_total);
+    auto encode_total = measure_encode(outbound);
+    std::printf("\n%-14s %10s %12s %12s %10s\n", "encode", "frames", "bytes", "cpu ms", "us/frame");
+    print("total", encode_total);
+    std::fflush(stdout);
+
+    // live replay
+    auto directory = std::filesystem::temp_directory_path() / ("iotmp_replay_" + std::to_string(::getpid()));
+    std::filesystem::create_directories(directory);
+
+    mock::server server(mock::transport::TCP);
+    std::promise<replay_result> finished;
+    bool started = false;
+    server.set_session_handler([&](std::shared_ptr<mock::session> device) -> mock::awaitable<void> {
+        // a reconnect after a failure is not replayed again
+        if(started) co_return;
+        started = true;
+
+        replay_result result;
+        auto server_cpu = cpu_time(CLOCK_THREAD_CPUTIME_ID);
+        auto process_cpu = cpu_time(CLOCK_PROCESS_CPUTIME_ID);
+        auto start = steady_clock::now();
+        uint64_t messages_in = device->get_messages_in();
+        for(auto& f : inbound) {
+            if(timed) co_await sleep_until(start + (f.offset - inbound.front().offset));
+            if(!device->is_connected()) break;
+            device->send_raw(f.data);
+            ++result.frames;
+            result.bytes += f.data.size();
+        }
+
+        // done once nothing moves in either direction
+        auto last = steady_clock::now();
+        uint64_t activity = device->get_messages_in() + device->get_bytes_out();
+        while(device->is_connected() && steady_clock::now() - last < QUIET) {
+            co_await sleep_until(steady_clock::now() + POLL);
+            uint64_t now = device->get_messages_in() + device->get_bytes_out();
+            if(now != activity) {
+                activity = now;
+                last = steady_clock::now();
+            }
+        }
+
+        result.seconds = duration<double>(last - start).count();
+        result.answers = device->get_messages_in() - messages_in;
+        result.server_cpu = cpu_time(CLOCK_THREAD_CPUTIME_ID) - server_cpu;
+        result.client_cpu = cpu_time(CLOCK_PROCESS_CPUTIME_ID) - process_cpu - result.server_cpu;
+        finished.set_value(result);
+    });
+
+    client device;
+    device.set_credentials("bench", "replay", "credential");
+    device.set_host("127.0.0.1");
+    device.set_transport(transport_type::TCP);
+    device.set_port(server.get_port());
+
+    filesystem fs(device, directory);
+    proxy tcp_proxy(device);
+
+    server.start();
+    device.start();
+
+    auto done = finished.get_future();
+    auto timeout = CONNECT_TIMEOUT + duration_cast<seconds>(duration<double>(captured)) * 2;
+    bool completed = done.wait_for(timeout) == std::future_status::ready;
+    if(completed) {
+        auto result = done.get();
+        auto dispatch = result.client_cpu - decode_total.cpu - encode_total.cpu;
+        std::printf("\nreplay (%s): %llu frames, %.2f MB in %.3f s (%.0f frames/s), %llu messages back\n",
+            mode.c_str(), static_cast<unsigned long long>(result.frames), result.bytes / 1e6, result.seconds,
+            result.seconds > 0 ? result.frames / result.seconds : 0.0, static_cast<unsigned long long>(result.answers));
+        std::printf("%-14s %12s\n", "stage", "cpu ms");
+        std::printf("%-14s %12.3f\n", "client", duration<double, std::milli>(result.client_cpu).count());
+        std::printf("%-14s %12.3f\n", "  decode", duration<double, std::milli>(decode_total.cpu).count());
+        std::printf("%-14s %12.3f\n", "  encode", duration<double, std::milli>(encode_total.cpu).count());
+        std::printf("%-14s %12.3f\n", "  dispatch", duration<double, std::milli>(dispatch).count());
+        std::printf("%-14s %12.3f\n", "mock server", duration<double, std::milli>(result.server_cpu).count());
+
+        // time in resource handlers (microseconds)
+        auto stats = device.get_metrics().to_json();
+        if(stats.contains("iotmp_resource_run_seconds")) {
+            std::printf("\n%-30s %10s %12s %10s %10s\n", "resource", "calls", "total ms", "p99 us", "max us");
+            for(auto& entry : stats["iotmp_resource_run_seconds"]["metrics"]) {
+                std::printf("%-30s %10llu %12.3f %10llu %10llu\n",
+                    entry["labels"].value("resource", std::string{}).c_str(),
+                    static_cast<unsigned long long>(entry["count"].get<uint64_t>()),
+                    entry["sum"].get<double>() / 1000.0,
+                    static_cast<unsigned long long>(entry["p99"].get<uint64_t>()),
+                    static_cast<unsigned long long>(entry["max"].get<uint64_t>()));
+            }
+        }
+    } else {
+        std::fprintf(stderr, "timed out (is the client connecting?)\n");
+    }
+
+    device.stop();
+    server.stop();
+    std::filesystem::remove_all(directory);
+    return completed ? 0 : 1;
+}
@@ -0,0 +1,279 @@
+// Cold start of the client against the mock IOTMP server.
+//
+// Each iteration builds a client with the extensions of the standalone one
+// (terminal, filesystem, proxy, version, cmd and cmd_stream), starts it and
+// times, from before the client is constructed:
+//
+//   setup          client and extensions constructed
+//   connected      transport connected (CONNECTED)
+//   authenticated  credentials accepted (AUTHENTICATED)
+//   ready          server event subscriptions answered (STREAMS_READY)
+//   described      first DESCRIBE of the device API answered, as seen by
+//                  the mock server
+//
+// The client is then stopped and destroyed. Reports min, median and max
+// over the iterations in milliseconds, and the first iteration on its own:
+// it is the only one that pays for the process-wide state (worker threads
+// startup, OpenSSL and the shared TLS context).
+//
+//   iotmp_startup_bench [tcp|tls|ws] [iterations] [client [args...]]
+//
+// With a client binary (i.e., the thinger_iotmp standalone client), every
+// iteration starts that process instead and times from fork() until the
+// mock server authenticates it (authenticated) and until it answers the
+// DESCRIBE (described), which covers the dynamic loader and the static
+// initialization too. It is started like iotmp_load_bench does, and
+// stopped with SIGTERM.
+
+#include "mock_server.hpp"
+
+#include <thinger/iotmp/client.hpp>
+#include <thinger/iotmp/extensions/cmd/cmd.hpp>
+#include <thinger/iotmp/extensions/cmd/cmd_stream.hpp>
+#include <thinger/iotmp/extensions/fs/filesystem.hpp>
+#include <thinger/iotmp/extensions/proxy/proxy.hpp>
+#include <thinger/iotmp/extensions/terminal/terminal.hpp>
+#include <thinger/iotmp/extensions/version/version.hpp>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace thinger::iotmp;
+using namespace std::chrono;
+
+namespace {
+
+    constexpr auto STARTUP_TIMEOUT = seconds(30);
+
+    enum phase { SETUP, CONNECTED, AUTHENTICATED, READY, DESCRIBED, PHASES };
+
+    const char* const PHASE_NAMES[PHASES] = {"setup", "connected", "authenticated", "ready", "described"};
+
+    // Milliseconds since the iteration started, per phase (unset if not reached)
+    using sample = std::array<std::optional<double>, PHASES>;
+
+    double elapsed_ms(steady_clock::time_point since) {
+        return duration<double, std::milli>(steady_clock::now() - since).count();
+    }
+
+    /**
+     * Timings of the iteration in progress. Written by the client connection
+     * thread and by the mock server thread.
+     */
+    class iteration {
+    public:
+        iteration() : started_(steady_clock::now()) {}
+
+        void record(phase which) {
+            std::scoped_lock lock(mutex_);
+            if(!times_[which]) times_[which] = elapsed_ms(started_);
+        }
+
+        void complete() {
+            std::scoped_lock lock(mutex_);
+            if(!completed_) {
+                completed_ = true;
+                done_.set_value();
+            }
+        }
+
+        bool wait(steady_clock::duration timeout) {
+            return done_.get_future().wait_for(timeout) == std::future_status::ready;
+        }
+
+        sample get() const {
+            std::scoped_lock lock(mutex_);
+            return times_;
+        }
+
+    private:
+        steady_clock::time_point started_;
+        mutable std::mutex mutex_;
+        sample times_;
+        std::promise<void> done_;
+        bool completed_ = false;
+    };
+
+    // The client and extensions of the standalone client (see main.cpp)
+    struct standalone_client {
+        client device;
+        terminal shell{device};
+        filesystem fs;
+        proxy tcp_proxy{device};
+        version ver{device};
+        cmd cmd_extension{device};
+        cmd_stream cmd_stream_extension{device};
+
+        explicit standalone_client(const std::filesystem::path& directory) : fs(device, directory) {}
+    };
+
+    // Start an external client binary against the mock server
+    pid_t spawn_client(const char* binary, char** extra, int extra_count, const char* transport, uint16_t port,
+                       const std::filesystem::path& directory) {
+        std::vector<std::string> args = {binary, "-u", "bench", "-d", "startup", "-p", "credential",
+                                         "-h", "127.0.0.1", "-t", transport, "--port", std::to_string(port),
+                                         "-f", directory.string()};
+        for(int i = 0; i < extra_count; ++i) args.emplace_back(extra[i]);
+        std::vector<char*> argv;
+        for(auto& arg : args) argv.push_back(arg.data());
+        argv.push_back(nullptr);
+
+        pid_t pid = ::fork();
+        if(pid == 0) {
+            ::execv(binary, argv.data());
+            std::perror(binary);
+            ::_exit(127);
+        }
+        return pid;
+    }
+
+    void print(const char* name, const std::vector<sample>& samples, phase which) {
+        std::vector<double> values;
+        for(auto& entry : samples) {
+            if(entry[which]) values.push_back(*entry[which]);
+        }
+        if(values.empty()) {
+            std::printf("%-14s %10s %10s %10s %10s\n", name, "-", "-", "-", "-");
+            return;
+        }
+        char first[32] = "-";
+        if(auto& value = samples.front()[which]) std::snprintf(first, sizeof(first), "%.2f", *value);
+        std::sort(values.begin(), values.end());
+        std::printf("%-14s %10s %10.2f %10.2f %10.2f%s\n", name, first,
+            values.front(), values[values.size() / 2], values.back(),
+            values.size() < samples.size() ? "  (incomplete)" : "");
+    }
+
+}
+
+int main(int argc, char* argv[]) {
+    std::string transport_name = argc > 1 ? argv[1] : "tcp";
+    size_t iterations = std::max<size_t>(argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 20, 1);
+    const char* client_binary = argc > 3 ? argv[3] : nullptr;
+
+    mock::transport kind;
+    transport_type client_transport;
+    const char* client_transport_name;
+    if(transport_name == "tcp") {
+        kind = mock::transport::TCP;
+        client_transport = transport_type::TCP;
+        client_transport_name = "tcp";
+    } else if(transport_name == "tls" || transport_name == "ssl") {
+        kind = mock::transport::TLS;
+        client_transport = transport_type::SSL;
+        client_transport_name = "ssl";
+    } else if(transport_name == "ws" || transport_name == "websocket") {
+        kind = mock::transport::WEBSOCKET;
+        client_transport = transport_type::WEBSOCKET;
+        client_transport_name = "ws";
+    } else {
+        std::fprintf(stderr, "unknown transport '%s': use tcp, tls or ws\n", transport_name.c_str());
+        return 1;
+    }
+
+    spdlog::set_level(spdlog::level::warn);
+    auto directory = std::filesystem::temp_directory_path() / ("iotmp_startup_bench_" + std::to_string(::getpid()));
+    std::filesystem::create_directories(directory);
+
+    mock::server server(kind);
+    std::mutex current_mutex;
+    std::shared_ptr<iteration> current;
+    auto current_iteration = [&] {
+        std::scoped_lock lock(current_mutex);
+        return current;
+    };
+
+    server.set_session_handler([&](std::shared_ptr<mock::session> session) -> mock::awaitable<void> {
+        auto timing = current_iteration();
+        if(!timing) co_return;
+        // the in-process client reports its own authentication
+        if(client_binary) timing->record(AUTHENTICATED);
+        auto api = co_await session->describe();
+        if(api.ok) timing->record(DESCRIBED);
+        // in-process, the iteration also waits for STREAMS_READY
+        if(client_binary || timing->get()[READY]) timing->complete();
+    });
+    server.start();
+
+    std::printf("transport %s, %zu iterations, %s\n\n", mock::to_string(kind), iterations,
+        client_binary ? client_binary : "in-process client");
+
+    std::vector<sample> samples;
+    bool completed = true;
+    for(size_t i = 0; i < iterations && completed; ++i) {
+        auto timing = std::make_shared<iteration>();
+        {
+            std::scoped_lock lock(current_mutex);
+            current = timing;
+        }
+
+        if(client_binary) {
+            pid_t child = spawn_client(client_binary, argv + 4, argc - 4, client_transport_name,
+                                       server.get_port(), directory);
+            if(child < 0) {
+                std::perror("fork");
+                completed = false;
+                break;
+            }
+            completed = timing->wait(STARTUP_TIMEOUT);
+            ::kill(child, SIGTERM);
+            ::waitpid(child, nullptr, 0);
+        } else {
+            auto local = std::make_unique<standalone_client>(directory);
+            timing->record(SETUP);
+            auto& device = local->device;
+            device.set_credentials("bench", "startup", "credential");
+            device.set_host("127.0.0.1");
+            device.set_transport(client_transport);
+            device.set_port(server.get_port());
+            // the mock server certificate is self-signed
+            device.set_websocket_verify(false);
+            device.set_state_callback([timing](client_state state, const std::string&) {
+                switch(state) {
+                    case client_state::CONNECTED: timing->record(CONNECTED); break;
+                    case client_state::AUTHENTICATED: timing->record(AUTHENTICATED); break;
+                    case client_state::STREAMS_READY:
+                        timing->record(READY);
+                        if(timing->get()[DESCRIBED]) timing->complete();
+                        break;
+                    default: break;
+                }
+            });
+            device.start();
+            completed = timing->wait(STARTUP_TIMEOUT);
+            device.stop();
+        }
+        samples.push_back(timing->get());
+    }
+
+    {
+        std::scoped_lock lock(current_mutex);
+        current.reset();
+    }
+
+    std::printf("%-14s %10s %10s %10s %10s\n", "ms", "first", "min", "median", "max");
+    for(size_t p = 0; p < PHASES && !samples.empty(); ++p) {
+        // the server only sees the external client from the authentication on
+        if(client_binary && p != AUTHENTICATED && p != DESCRIBED) continue;
+        print(PHASE_NAMES[p], samples, static_cast<phase>(p));
+    }
+    if(!completed) std::fprintf(stderr, "timed out (is the client connecting?)\n");
+
+    server.stop();
+    std::filesystem::remove_all(directory);
+    return completed ? 0 : 1;
+}
@@ -0,0 +1,617 @@
+// Mock IOTMP server for benchmarks.
+//
+// Accepts devices on localhost over TCP, TLS or WebSocket (over TLS, as the
+// client connects to wss://host:port/iotmp), authenticates them, echoes
+// keep-alives and answers the requests devices make (bucket writes,
+// endpoint calls, event subscriptions) with OK. Frames are encoded and
+// decoded with the client iotmp_encoder / iotmp_decoder.
+//
+// For every authenticated device a mock::session drives the device the way
+// the server does: RUN, DESCRIBE, START_STREAM / STREAM_DATA / STOP_STREAM.
+// Everything runs on the server io_context, from a single thread, so
+// session methods must be called from coroutines spawned on it (i.e., the
+// on_session handler).
+//
+// TLS uses a throwaway self-signed certificate, which the client SSL
+// transport accepts as it does not verify the server.
+
+#ifndef THINGER_IOTMP_BENCH_MOCK_SERVER_HPP
+#define THINGER_IOTMP_BENCH_MOCK_SERVER_HPP
+
+#include <thinger/iotmp/core/iotmp_decoder.hpp>
+#include <thinger/iotmp/core/iotmp_encoder.hpp>
+#include <thinger/iotmp/core/iotmp_input_buffer.hpp>
+
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+#include <openssl/x509.h>
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+
+namespace thinger::iotmp::mock {
+
+    namespace net = boost::asio;
+    using net::awaitable;
+    using net::use_awaitable;
+    using net::ip::tcp;
+
+    enum class transport { TCP, TLS, WEBSOCKET };
+
+    inline const char* to_string(transport value) {
+        switch(value) {
+            case transport::TCP: return "tcp";
+            case transport::TLS: return "tls";
+            case transport::WEBSOCKET: return "websocket";
+        }
+        return "unknown";
+    }
+
+    // Throwaway self-signed certificate for the TLS transports
+    inline void set_self_signed_certificate(SSL_CTX* ctx) {
+        EVP_PKEY* key = EVP_EC_gen("P-256");
+        X509* cert = X509_new();
+        if(!key || !cert) throw std::runtime_error("cannot generate the mock server certificate");
+        ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+        X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+        X509_gmtime_adj(X509_getm_notAfter(cert), 24 * 3600);
+        X509_set_pubkey(cert, key);
+        X509_NAME_add_entry_by_txt(X509_get_subject_name(cert), "CN", MBSTRING_ASC,
+            reinterpret_cast<const unsigned char*>("localhost"), -1, -1, 0);
+        X509_set_issuer_name(cert, X509_get_subject_name(cert));
+        bool ok = X509_sign(cert, key, EVP_sha256()) &&
+                  SSL_CTX_use_certificate(ctx, cert) == 1 &&
+                  SSL_CTX_use_PrivateKey(ctx, key) == 1;
+        X509_free(cert);
+        EVP_PKEY_free(key);
+        if(!ok) throw std::runtime_error("cannot set the mock server certificate");
+    }
+
+    /**
+     * Byte stream of an accepted connection. Plain TCP, TLS, or WebSocket
+     * binary messages over TLS: reads return the message payloads, and each
+     * write goes out as one unmasked binary message.
+     */
+    class connection {
+    public:
+        connection(tcp::socket socket, net::ssl::context& tls, transport kind) :
+            stream_(std::move(socket), tls), transport_(kind) {}
+
+        // TLS handshake and WebSocket upgrade
+        awaitable<bool> handshake() {
+            boost::system::error_code ec;
+            stream_.next_layer().set_option(tcp::no_delay(true));
+            if(transport_ == transport::TCP) co_return true;
+            co_await stream_.async_handshake(net::ssl::stream_base::server, net::redirect_error(use_awaitable, ec));
+            if(ec) co_return false;
+            if(transport_ == transport::WEBSOCKET) co_return co_await upgrade();
+            co_return true;
+        }
+
+        awaitable<size_t> read_some(uint8_t* data, size_t size) {
+            if(transport_ != transport::WEBSOCKET) co_return co_await read_raw(data, size);
+            while(payload_.empty()) {
+                if(!co_await read_websocket_message()) co_return 0;
+            }
+            size_t n = std::min(size, payload_.size());
+            std::memcpy(data, payload_.data(), n);
+            payload_.erase(0, n);
+            co_return n;
+        }
+
+        awaitable<bool> write(const std::string& data) {
+            if(transport_ != transport::WEBSOCKET) co_return co_await write_raw(data);
+            std::string message;
+            websocket_header(0x2, data.size(), message);
+            message.append(data);
+            co_return co_await write_raw(message);
+        }
+
+        void close() {
+            boost::system::error_code ec;
+            stream_.next_layer().close(ec);
+        }
+
+    private:
+        awaitable<size_t> read_raw(uint8_t* data, size_t size) {
+            boost::system::error_code ec;
+            size_t n = transport_ == transport::TCP ?
+                co_await stream_.next_layer().async_read_some(net::buffer(data, size), net::redirect_error(use_awaitable, ec)) :
+                co_await stream_.async_read_some(net::buffer(data, size), net::redirect_error(use_awaitable, ec));
+            co_return ec ? 0 : n;
+        }
+
+        awaitable<bool> write_raw(const std::string& data) {
+            boost::system::error_code ec;
+            if(transport_ == transport::TCP) {
+                co_await net::async_write(stream_.next_layer(), net::buffer(data), net::redirect_error(use_awaitable, ec));
+            } else {
+                co_await net::async_write(stream_, net::buffer(data), net::redirect_error(use_awaitable, ec));
+            }
+            co_return !ec;
+        }
+
+        // Make sure raw_ holds at least size bytes
+        awaitable<bool> fill(size_t size) {
+            uint8_t chunk[16 * 1024];
+            while(raw_.size() < size) {
+                size_t n = co_await read_raw(chunk, sizeof(chunk));
+                if(n == 0) co_return false;
+                raw_.append(reinterpret_cast<char*>(chunk), n);
+            }
+            co_return true;
+        }
+
+        // Answer the HTTP upgrade request (RFC 6455, section 4.2)
+        awaitable<bool> upgrade() {
+            size_t end;
+            while((end = raw_.find("\r\n\r\n")) == std::string::npos) {
+                if(raw_.size() > 16 * 1024 || !co_await fill(raw_.size() + 1)) co_return false;
+            }
+            std::string request = raw_.substr(0, end + 2);
+            raw_.erase(0, end + 4);
+
+            std::string key;
+            for(size_t pos = 0; pos < request.size();) {
+                size_t eol = request.find("\r\n", pos);
+                std::string line = request.substr(pos, eol - pos);
+                pos = eol + 2;
+                size_t colon = line.find(':');
+                if(colon == std::string::npos) continue;
+                std::string name = line.substr(0, colon);
+                for(auto& c : name) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+                if(name == "sec-websocket-key") {
+                    key = line.substr(colon + 1);
+                    key.erase(0, key.find_first_not_of(' '));
+                    key.erase(key.find_last_not_of(" \r") + 1);
+                }
+            }
+            if(key.empty()) co_return false;
+
+            key += "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+            unsigned char digest[SHA_DIGEST_LENGTH];
+            SHA1(reinterpret_cast<const unsigned char*>(key.data()), key.size(), digest);
+            char accept[4 * ((SHA_DIGEST_LENGTH + 2) / 3) + 1];
+            EVP_EncodeBlock(reinterpret_cast<unsigned char*>(accept), digest, SHA_DIGEST_LENGTH);
+
+            co_return co_await write_raw(
+                "HTTP/1.1 101 Switching Protocols\r\n"
+                "Upgrade: websocket\r\n"
+                "Connection: Upgrade\r\n"
+                "Sec-WebSocket-Protocol: iotmp\r\n"
+                "Sec-WebSocket-Accept: " + std::string(accept) + "\r\n\r\n");
+        }
+
+        // Read one WebSocket frame, appending data frames to payload_ and
+        // answering pings
+        awaitable<bool> read_websocket_message() {
+            if(!co_await fill(2)) co_return false;
+            auto* header = reinterpret_cast<const uint8_t*>(raw_.data());
+            uint8_t opcode = header[0] & 0x0F;
+            bool masked = header[1] & 0x80;
+            uint64_t size = header[1] & 0x7F;
+            size_t length = 2;
+            if(size == 126) length = 4;
+            else if(size == 127) length = 10;
+            if(masked) length += 4;
+            if(!co_await fill(length)) co_return false;
+            header = reinterpret_cast<const uint8_t*>(raw_.data());
+            if(size >= 126) {
+                size = 0;
+                for(size_t i = 2; i < (length - (masked ? 4 : 0)); ++i) size = (size << 8) | header[i];
+            }
+            if(!co_await fill(length + size)) co_return false;
+
+            std::string data = raw_.substr(length, size);
+            if(masked) {
+                const char* mask = raw_.data() + length - 4;
+                for(size_t i = 0; i < data.size(); ++i) data[i] ^= mask[i % 4];
+            }
+            raw_.erase(0, length + size);
+
+            switch(opcode) {
+                case 0x0: case 0x1: case 0x2:
+                    payload_.append(data);
+                    co_return true;
+                case 0x8:
+                    co_return false;
+                case 0x9: {
+                    std::string pong;
+                    websocket_header(0xA, data.size(), pong);
+                    pong.append(data);
+                    co_return co_await write_raw(pong);
+                }
+                default:
+                    co_return true;
+            }
+        }
+
+        static void websocket_header(uint8_t opcode, size_t size, std::string& out) {
+            out.push_back(static_cast<char>(0x80 | opcode));
+            if(size < 126) {
+                out.push_back(static_cast<char>(size));
+            } else if(size <= 0xFFFF) {
+                out.push_back(static_cast<char>(126));
+                out.push_back(static_cast<char>(size >> 8));
+                out.push_back(static_cast<char>(size));
+            } else {
+                out.push_back(static_cast<char>(127));
+                for(int shift = 56; shift >= 0; shift -= 8) out.push_back(static_cast<char>(size >> shift));
+            }
+        }
+
+        net::ssl::stream<tcp::socket> stream_;
+        transport transport_;
+        std::string raw_;           // WebSocket bytes not parsed yet
+        std::string payload_;       // WebSocket payload not read yet
+    };
+
+    /**
+     * Server side of one authenticated device.
+     */
+    class session : public std::enable_shared_from_this<session> {
+    public:
+        static constexpr auto REQUEST_TIMEOUT = std::chrono::seconds(30);
+
+        // Called with every STREAM_DATA of a stream, and with the STOP_STREAM
+        // if the device ends it
+        using stream_handler = std::function<void(iotmp_message&)>;
+
+        struct response {
+            bool ok = false;
+            json_t payload;
+            json_t params;
+        };
+
+        session(std::unique_ptr<connection> conn, net::io_context& io, std::string device) :
+            connection_(std::move(conn)), io_(io), device_(std::move(device)) {}
+
+        const std::string& get_device() const { return device_; }
+
+        bool is_connected() const { return connected_; }
+
+        /**
+         * Send a request on a new stream id and wait for its OK or ERROR
+         * (ERROR if the device disconnects or does not answer in time)
+         */
+        awaitable<iotmp_message> request(iotmp_message message) {
+            uint16_t stream_id = message.get_stream_id();
+            if(stream_id == 0) {
+                stream_id = next_stream_id();
+                message.set_stream_id(stream_id);
+            }
+            auto waiter = std::make_shared<pending>(io_);
+            pending_[stream_id] = waiter;
+            send(message);
+            co_await waiter->signal.async_wait(net::redirect_error(use_awaitable, waiter->ec));
+            pending_.erase(stream_id);
+            if(waiter->result) co_return std::move(*waiter->result);
+            co_return iotmp_message(stream_id, message::type::ERROR);
+        }
+
+        awaitable<response> run(const std::string& resource, json_t payload = {}, json_t params = {}) {
+            iotmp_message message(message::type::RUN);
+            message[message::field::RESOURCE] = resource;
+            if(!payload.is_null()) message[message::field::PAYLOAD] = std::move(payload);
+            if(!params.is_null()) message[message::field::PARAMETERS] = std::move(params);
+            co_return to_response(co_await request(std::move(message)));
+        }
+
+        // Describe a resource, or the whole API with an empty path
+        awaitable<response> describe(const std::string& resource = {}) {
+            iotmp_message message(message::type::DESCRIBE);
+            if(!resource.empty()) message[message::field::RESOURCE] = resource;
+            co_return to_response(co_await request(std::move(message)));
+        }
+
+        /**
+         * Open a stream on a device resource
+         * @return the stream id, or 0 if the device refused it
+         */
+        awaitable<uint16_t> start_stream(const std::string& resource, json_t params, stream_handler handler,
+                                         response* result = nullptr) {
+            uint16_t stream_id = next_stream_id();
+            streams_[stream_id] = std::move(handler);
+            iotmp_message message(stream_id, message::type::START_STREAM);
+            message[message::field::RESOURCE] = resource;
+            message[message::field::PARAMETERS] = std::move(params);
+            auto answer = to_response(co_await request(std::move(message)));
+            if(result) *result = answer;
+            if(!answer.ok) {
+                streams_.erase(stream_id);
+                co_return 0;
+            }
+            co_return stream_id;
+        }
+
+        void stream_data(uint16_t stream_id, json_t payload) {
+            iotmp_message message(stream_id, message::type::STREAM_DATA);
+            message[message::field::PAYLOAD] = std::move(payload);
+            send(message);
+        }
+
+        awaitable<bool> stop_stream(uint16_t stream_id) {
+            streams_.erase(stream_id);
+            co_return to_response(co_await request(iotmp_message(stream_id, message::type::STOP_STREAM))).ok;
+        }
+
+        void close() {
+            connection_->close();
+        }
+
+        // Queue already encoded frames as they are (i.e., from a capture)
+        void send_raw(std::string_view frames, uint64_t count = 1) {
+            output_.append(frames);
+            messages_out_ += count;
+            if(!writing_) {
+                writing_ = true;
+                net::co_spawn(io_, write_loop(shared_from_this()), net::detached);
+            }
+        }
+
+        // Frames and bytes exchanged with the device
+        uint64_t get_messages_in() const { return messages_in_; }
+        uint64_t get_messages_out() const { return messages_out_; }
+        uint64_t get_bytes_in() const { return bytes_in_; }
+        uint64_t get_bytes_out() const { return bytes_out_; }
+
+        // Requests the device sent (bucket writes, endpoint calls, ...)
+        uint64_t get_device_requests() const { return device_requests_; }
+
+        // Read frames until the device disconnects
+        awaitable<void> read_loop(input_buffer input) {
+            input_ = std::move(input);
+            while(connected_) {
+                while(auto message = next_message()) dispatch(*message);
+                auto space = input_.prepare(4096);
+                size_t n = co_await connection_->read_some(space.data(), space.size());
+                if(n == 0) break;
+                input_.commit(n);
+                bytes_in_ += n;
+            }
+            connected_ = false;
+            for(auto& [id, waiter] : pending_) waiter->signal.cancel();
+            auto streams = std::move(streams_);
+            streams_.clear();
+            for(auto& [id, handler] : streams) {
+                iotmp_message stop(id, message::type::STOP_STREAM);
+                handler(stop);
+            }
+        }
+
+        // Decode the next complete frame of a buffer
+        static std::optional<iotmp_message> decode(input_buffer& input) {
+            frame_header header;
+            if(parse_frame_header(input.data(), input.size(), header) != frame_parse::COMPLETE) return std::nullopt;
+            if(input.size() < header.length + header.size) return std::nullopt;
+            iotmp_message message(static_cast<message::type>(header.type));
+            if(header.size > 0) {
+                iotmp_decoder<memory_reader> decoder(input.data() + header.length, header.size);
+                decoder.decode(message, header.size);
+            }
+            input.consume(header.length + header.size);
+            return message;
+        }
+
+    private:
+        struct pending {
+            explicit pending(net::io_context& io) : signal(io, REQUEST_TIMEOUT) {}
+            net::steady_timer signal;
+            std::optional<iotmp_message> result;
+            boost::system::error_code ec;
+        };
+
+        static response to_response(iotmp_message message) {
+            response result;
+            result.ok = message.get_message_type() == message::type::OK;
+            result.payload = std::move(message.payload());
+            result.params = std::move(message.params());
+            return result;
+        }
+
+        uint16_t next_stream_id() {
+            do {
+                if(++stream_id_ == 0) stream_id_ = 1;
+            } while(pending_.contains(stream_id_) || streams_.contains(stream_id_));
+            return stream_id_;
+        }
+
+        std::optional<iotmp_message> next_message() {
+            auto message = decode(input_);
+            if(message) ++messages_in_;
+            return message;
+        }
+
+        void dispatch(iotmp_message& message) {
+            uint16_t stream_id = message.get_stream_id();
+            switch(message.get_message_type()) {
+                case message::type::KEEP_ALIVE:
+                    send(iotmp_message(message::type::KEEP_ALIVE));
+                    break;
+                case message::type::OK:
+                case message::type::ERROR: {
+                    auto it = pending_.find(stream_id);
+                    if(it != pending_.end()) {
+                        it->second->result = std::move(message);
+                        it->second->signal.cancel();
+                    }
+                    break;
+                }
+                case message::type::STREAM_DATA: {
+                    auto it = streams_.find(stream_id);
+                    if(it != streams_.end()) it->second(message);
+                    break;
+                }
+                case message::type::STOP_STREAM: {
+                    auto it = streams_.find(stream_id);
+                    if(it != streams_.end()) {
+                        auto handler = std::move(it->second);
+                        streams_.erase(it);
+                        handler(message);
+                    }
+                    break;
+                }
+                case message::type::RUN:
+                case message::type::START_STREAM:
+                case message::type::DESCRIBE:
+                    // device requests: bucket writes, endpoint calls, event subscriptions
+                    ++device_requests_;
+                    send(iotmp_message(stream_id, message::type::OK));
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        // Queue a frame; frames queued while a write is in progress go out
+        // together in the next one
+        void send(iotmp_message& message) {
+            send_raw(encode_message(message));
+        }
+
+        void send(iotmp_message&& message) {
+            send(message);
+        }
+
+        static awaitable<void> write_loop(std::shared_ptr<session> self) {
+            std::string batch;
+            while(!self->output_.empty() && self->connected_) {
+                batch.clear();
+                batch.swap(self->output_);
+                self->bytes_out_ += batch.size();
+                if(!co_await self->connection_->write(batch)) {
+                    self->connection_->close();
+                    break;
+                }
+            }
+            self->writing_ = false;
+        }
+
+        std::unique_ptr<connection> connection_;
+        net::io_context& io_;
+        std::string device_;
+        bool connected_ = true;
+        input_buffer input_;
+        std::string output_;
+        bool writing_ = false;
+        uint16_t stream_id_ = 0;
+        std::unordered_map<uint16_t, std::shared_ptr<pending>> pending_;
+        std::map<uint16_t, stream_handler> streams_;
+        uint64_t messages_in_ = 0;
+        uint64_t messages_out_ = 0;
+        uint64_t bytes_in_ = 0;
+        uint64_t bytes_out_ = 0;
+        uint64_t device_requests_ = 0;
+    };
+
+    /**
+     * Listening server. Runs its io_context on its own thread between start()
+     * and stop().
+     */
+    class server {
+    public:
+        using session_handler = std::function<awaitable<void>(std::shared_ptr<session>)>;
+
+        // Port 0 picks a free one, see get_port()
+        explicit server(transport kind, uint16_t port = 0) :
+            transport_(kind),
+            tls_(net::ssl::context::tls_server),
+            acceptor_(io_, tcp::endpoint(net::ip::make_address("127.0.0.1"), port))
+        {
+            if(kind != transport::TCP) set_self_signed_certificate(tls_.native_handle());
+        }
+
+        ~server() {
+            stop();
+        }
+
+        uint16_t get_port() const {
+            return acceptor_.local_endpoint().port();
+        }
+
+        transport get_transport() const {
+            return transport_;
+        }
+
+        net::io_context& get_io_context() {
+            return io_;
+        }
+
+        // Only accept these credentials (any are accepted by default)
+        void set_credentials(std::string user, std::string device, std::string password) {
+            credentials_ = json_t::array({std::move(user), std::move(device), std::move(password)});
+        }
+
+        // Run for every authenticated device, on the server io_context
+        void set_session_handler(session_handler handler) {
+            handler_ = std::move(handler);
+        }
+
+        void start() {
+            net::co_spawn(io_, accept_loop(), net::detached);
+            thread_ = std::thread([this] { io_.run(); });
+        }
+
+        void stop() {
+            io_.stop();
+            if(thread_.joinable()) thread_.join();
+        }
+
+    private:
+        awaitable<void> accept_loop() {
+            while(acceptor_.is_open()) {
+                boost::system::error_code ec;
+                auto socket = co_await acceptor_.async_accept(net::redirect_error(use_awaitable, ec));
+                if(ec) break;
+                net::co_spawn(io_, serve(std::make_unique<connection>(std::move(socket), tls_, transport_)), net::detached);
+            }
+        }
+
+        awaitable<void> serve(std::unique_ptr<connection> conn) {
+            if(!co_await conn->handshake()) co_return;
+
+            // CONNECT: [user, device, password]
+            input_buffer input;
+            std::optional<iotmp_message> connect;
+            while(!(connect = session::decode(input))) {
+                auto space = input.prepare(4096);
+                size_t n = co_await conn->read_some(space.data(), space.size());
+                if(n == 0) co_return;
+                input.commit(n);
+            }
+
+            auto& credentials = (*connect)[message::field::PAYLOAD];
+            bool valid = connect->get_message_type() == message::type::CONNECT &&
+                         credentials.is_array() && credentials.size() == 3 &&
+                         (credentials_.is_null() || credentials == credentials_);
+            iotmp_message answer(connect->get_stream_id(), valid ? message::type::OK : message::type::ERROR);
+            if(!co_await conn->write(encode_message(answer)) || !valid) co_return;
+
+            auto device = std::make_shared<session>(std::move(conn), io_, credentials[1].get<std::string>());
+            if(handler_) net::co_spawn(io_, handler_(device), net::detached);
+            co_await device->read_loop(std::move(input));
+        }
+
+        net::io_context io_;
+        transport transport_;
+        net::ssl::context tls_;
+        tcp::acceptor acceptor_;
+        json_t credentials_;
+        session_handler handler_;
+        std::thread thread_;
+    };
+
+}
+
+#endif
@@ -0,0 +1,89 @@
+#!/usr/bin/env bash
+# Link-time and profile-guided optimized build of thinger_iotmp.
+#
+#   bench/pgo_build.sh [work-dir] [seconds]
+#
+# 1. Builds a baseline tree (Release) and an instrumented one (LTO, PGO
+#    GENERATE), both with the benchmarks.
+# 2. Trains the instrumented tree: the standalone client driven through every
+#    load scenario by iotmp_load_bench (recording a wire capture on the way),
+#    the in-process load bench, the replay of that capture, and the write
+#    queue and frame coalescing benchmarks.
+# 3. Rebuilds the same tree with the profile (PGO USE), so object files keep
+#    the paths their profile was recorded with.
+# 4. Runs the benchmarks on both trees and reports the speedup: messages/s
+#    per load scenario (routing and streaming), decoded and encoded frames/s
+#    of the capture (codec) and frames/s per transport (framing).
+#
+# The optimized client is <work-dir>/pgo/thinger_iotmp (build-pgo by default)
+# and seconds is the length of each load scenario (5 by default). CC and CXX
+# select the compiler; with Clang, LLVM_PROFDATA is the llvm-profdata to merge
+# the profiles with. Cross builds (i.e., static ARM binaries) need the
+# training to run on the target: build the instrumented tree with the
+# toolchain, run the same workload on the device, copy the profile directory
+# back and configure with -DTHINGER_IOTMP_PGO=USE.
+
+set -euo pipefail
+
+root=$(cd "$(dirname "$0")/.." && pwd)
+work=$(realpath -m "${1:-$root/build-pgo}")
+seconds=${2:-5}
+jobs=$(nproc 2>/dev/null || echo 4)
+profile="$work/profile"
+capture="$work/training.cap"
+
+build() {
+    local dir=$1
+    shift
+    cmake -S "$root" -B "$dir" -DCMAKE_BUILD_TYPE=Release -DTHINGER_IOTMP_BUILD_BENCHMARKS=ON "$@" > /dev/null
+    cmake --build "$dir" -j"$jobs"
+}
+
+# Training workload, also used to compare the builds
+train() {
+    local dir=$1
+    "$dir/bench/iotmp_load_bench" tcp all "$seconds" 0 "$dir/thinger_iotmp" --capture "$capture"
+    "$dir/bench/iotmp_load_bench" tcp all "$seconds"
+    "$dir/bench/iotmp_replay" "$capture" fast
+    "$dir/bench/write_queue_bench"
+    "$dir/bench/frame_coalescing_bench"
+}
+
+# "name value" lines, higher is better
+measure() {
+    local dir=$1
+    "$dir/bench/iotmp_load_bench" tcp all "$seconds" |
+        awk 'started && NF >= 8 { print "load/" $1 "_messages_per_s", $2 } /^scenario/ { started = 1 }'
+    "$dir/bench/iotmp_replay" "$capture" fast |
+        awk '/^total/ && $5 > 0 { print (++n == 1 ? "codec/decode" : "codec/encode") "_frames_per_s", 1e6 / $5 }'
+    "$dir/bench/frame_coalescing_bench" |
+        awk 'started && NF { name = substr($0, 1, 24); sub(/ +$/, "", name); gsub(/[ ,]+/, "_", name)
+                             split(substr($0, 25), f, " "); print "framing/" name "_frames_per_s", f[1] }
+             /^transport/ { started = 1 }'
+}
+
+echo "== baseline build"
+build "$work/baseline" -DTHINGER_IOTMP_LTO=OFF -DTHINGER_IOTMP_PGO=OFF
+
+echo "== instrumented build"
+rm -rf "$profile"
+mkdir -p "$profile"
+build "$work/pgo" -DTHINGER_IOTMP_LTO=ON -DTHINGER_IOTMP_PGO=GENERATE -DTHINGER_IOTMP_PGO_DIR="$profile"
+
+echo "== training"
+train "$work/pgo"
+if compgen -G "$profile/*.profraw" > /dev/null; then
+    "${LLVM_PROFDATA:-llvm-profdata}" merge -output="$profile/default.profdata" "$profile"/*.profraw
+fi
+
+echo "== optimized build"
+build "$work/pgo" -DTHINGER_IOTMP_PGO=USE
+
+echo "== comparison"
+measure "$work/baseline" | sort > "$work/baseline.txt"
+measure "$work/pgo" | sort > "$work/pgo.txt"
+printf "%-44s %14s %14s %9s\n" "benchmark" "baseline" "lto+pgo" "speedup"
+join "$work/baseline.txt" "$work/pgo.txt" |
+    awk '{ printf "%-44s %14.1f %14.1f %8.1f%%\n", $1, $2, $3, $2 > 0 ? ($3 / $2 - 1) * 100 : 0 }'
+echo
+echo "optimized client: $work/pgo/thinger_iotmp"
@@ -0,0 +1,94 @@
+// Checks of the stream id allocator.
+//
+// Allocates the whole id space from a random start (so the search wraps
+// around the end of the bitmap), and checks that id 0 is never handed out,
+// that a full allocator returns 0, that a released id is only reused once
+// the cursor walked past it, and that mark() and release() report the state
+// of the id. Exits with 1 on the first failed check.
+//
+//   stream_id_check
+
+#include <thinger/iotmp/core/iotmp_stream_id_allocator.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace thinger::iotmp;
+
+namespace {
+
+    constexpr size_t RESETS = 16;
+
+    int failures = 0;
+
+    void check(bool condition, const char* what) {
+        if(condition) return;
+        std::fprintf(stderr, "FAILED: %s\n", what);
+        ++failures;
+    }
+
+}
+
+int main() {
+    stream_id_allocator ids;
+
+    // every id but 0 exactly once, wrapping around from the random start
+    std::vector<bool> seen(stream_id_allocator::MAX_IDS);
+    uint16_t first = ids.allocate();
+    uint16_t previous = first;
+    seen[first] = true;
+    bool wrapped = false;
+    bool unique = true;
+    for(size_t i = 2; i < stream_id_allocator::MAX_IDS; ++i) {
+        uint16_t id = ids.allocate();
+        if(id == 0 || seen[id]) unique = false;
+        if(id < previous) wrapped = true;
+        seen[id] = true;
+        previous = id;
+    }
+    check(first != 0, "first id is not 0");
+    check(unique, "every allocated id is new and not 0");
+    check(first == 1 || wrapped, "allocation wraps around the end of the id space");
+    check(ids.size() == stream_id_allocator::MAX_IDS, "allocator is full");
+    check(ids.allocate() == 0, "full allocator returns 0");
+
+    // a released id is the only free one, so it is the next allocated
+    check(ids.release(first), "release of a used id");
+    check(!ids.release(first), "release of a free id");
+    check(!ids.is_used(first), "released id is free");
+    check(ids.allocate() == first, "released id is reused when it is the only one");
+
+    // the cursor keeps going: a released id waits for the whole space
+    ids.reset();
+    uint16_t a = ids.allocate();
+    uint16_t b = ids.allocate();
+    check(b == (a == stream_id_allocator::MAX_IDS - 1 ? 1 : a + 1), "ids are handed out in sequence");
+    check(ids.release(a), "release of the first id");
+    check(ids.allocate() != a, "released id is not reused right away");
+
+    // ids chosen by the server
+    ids.reset();
+    check(!ids.mark(0), "id 0 cannot be marked");
+    check(!ids.release(0), "id 0 cannot be released");
+    uint16_t server_id = ids.allocate() ^ 0x8000;
+    if(server_id == 0) server_id = 0x8000;
+    check(ids.mark(server_id), "mark of a free id");
+    check(!ids.mark(server_id), "mark of a used id");
+    check(ids.size() == 3, "size counts id 0, the allocated and the marked ids");
+    check(ids.release(server_id), "release of a marked id");
+
+    // the start is random on every reset
+    bool varies = false;
+    for(size_t i = 0; i < RESETS && !varies; ++i) {
+        ids.reset();
+        uint16_t start = ids.allocate();
+        ids.reset();
+        varies = ids.allocate() != start;
+    }
+    check(varies, "reset() starts at a random id");
+
+    if(failures) return 1;
+    std::printf("stream id allocator: all checks passed\n");
+    return 0;
+}
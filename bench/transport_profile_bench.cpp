@@ -0,0 +1,235 @@
+// Latency and throughput of each transport profile over loopback TCP.
+//
+// A sender mimics the client write path: frames wait in an application
+// queue where terminal frames (64 bytes every 20 ms) go before file chunks
+// (16 KB), and are only written when poll() reports the socket writable.
+// Two runs per profile:
+//
+//   - slow link: the receiver drains at uplink_kbps, so the backlog builds
+//     up in the sender kernel. Reports terminal frame latency (time from
+//     queued to received, waiting for the backlog to drain at the end) and
+//     the file goodput.
+//   - fast link: the receiver drains as fast as it can. Reports goodput.
+//
+//   transport_profile_bench [uplink_kbps] [seconds]
+
+#include <thinger/iotmp/core/iotmp_histogram.hpp>
+#include <thinger/iotmp/core/iotmp_transport_profile.hpp>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace thinger::iotmp;
+using namespace std::chrono;
+
+namespace {
+
+    constexpr size_t CHUNK_SIZE = 16 * 1024;
+    constexpr size_t KEYSTROKE_SIZE = 64;
+    constexpr auto KEYSTROKE_INTERVAL = milliseconds(20);
+    constexpr int RECEIVE_WINDOW = 64 * 1024;           // bytes the slow link keeps in flight
+    constexpr size_t HEADER_SIZE = 4 + 1 + 8;           // length, kind, queued timestamp
+
+    enum frame_kind : uint8_t { KEYSTROKE = 1, CHUNK = 2 };
+
+    constexpr auto DRAIN_TIMEOUT = seconds(60);
+
+    struct result {
+        histogram latency;                              // keystrokes, in microseconds
+        uint64_t chunk_bytes = 0;                       // received before the sender stopped
+        std::atomic<int64_t> keystrokes_sent{-1};       // set when the sender stops
+    };
+
+    int64_t timestamp() {
+        return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+    }
+
+    std::string make_frame(frame_kind kind, size_t size) {
+        std::string frame(HEADER_SIZE + size, '\0');
+        auto length = static_cast<uint32_t>(size);
+        int64_t queued = timestamp();
+        std::memcpy(frame.data(), &length, 4);
+        frame[4] = static_cast<char>(kind);
+        std::memcpy(frame.data() + 5, &queued, 8);
+        return frame;
+    }
+
+    // Connected loopback pair: {sender, receiver}
+    std::pair<int, int> connect_pair(int receive_buffer) {
+        int listener = ::socket(AF_INET, SOCK_STREAM, 0);
+        // the window is negotiated on the handshake, so size it before listen()
+        if(receive_buffer) ::setsockopt(listener, SOL_SOCKET, SO_RCVBUF, &receive_buffer, sizeof(receive_buffer));
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(address);
+        if(::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+           ::listen(listener, 1) != 0 ||
+           ::getsockname(listener, reinterpret_cast<sockaddr*>(&address), &length) != 0) {
+            std::perror("listen");
+            std::exit(1);
+        }
+        int sender = ::socket(AF_INET, SOCK_STREAM, 0);
+        if(::connect(sender, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+            std::perror("connect");
+            std::exit(1);
+        }
+        int receiver = ::accept(listener, nullptr, nullptr);
+        ::close(listener);
+        return {sender, receiver};
+    }
+
+    void receive(int fd, size_t rate, steady_clock::time_point deadline, result& out) {
+        std::vector<char> buffer;
+        std::vector<char> chunk(4096);
+        auto started = steady_clock::now();
+        uint64_t received = 0;
+
+        // every keystroke written must arrive, so its latency is counted
+        auto pending = [&]() {
+            auto sent = out.keystrokes_sent.load();
+            return sent < 0 || out.latency.count() < static_cast<uint64_t>(sent);
+        };
+        while(pending() && steady_clock::now() < deadline + DRAIN_TIMEOUT) {
+            size_t allowed = chunk.size();
+            if(rate) {
+                // token bucket: never get ahead of the link rate
+                auto elapsed = duration<double>(steady_clock::now() - started).count();
+                auto budget = static_cast<int64_t>(elapsed * rate) - static_cast<int64_t>(received);
+                if(budget <= 0) {
+                    std::this_thread::sleep_for(microseconds(500));
+                    continue;
+                }
+                allowed = std::min<size_t>(allowed, budget);
+            }
+            pollfd p{fd, POLLIN, 0};
+            if(::poll(&p, 1, 50) <= 0) continue;
+            ssize_t n = ::read(fd, chunk.data(), allowed);
+            if(n <= 0) break;
+            received += n;
+            buffer.insert(buffer.end(), chunk.begin(), chunk.begin() + n);
+
+            size_t offset = 0;
+            while(buffer.size() - offset >= HEADER_SIZE) {
+                uint32_t size;
+                int64_t queued;
+                std::memcpy(&size, buffer.data() + offset, 4);
+                if(buffer.size() - offset < HEADER_SIZE + size) break;
+                std::memcpy(&queued, buffer.data() + offset + 5, 8);
+                if(buffer[offset + 4] == KEYSTROKE) {
+                    out.latency.record(static_cast<uint64_t>((timestamp() - queued) / 1000));
+                } else if(steady_clock::now() < deadline) {
+                    out.chunk_bytes += size;
+                }
+                offset += HEADER_SIZE + size;
+            }
+            buffer.erase(buffer.begin(), buffer.begin() + offset);
+        }
+    }
+
+    // Application side: keystrokes first, chunks otherwise, one frame at a
+    // time while the socket is writable. Returns the keystrokes written.
+    int64_t send(int fd, const std::optional<socket_options>& options, bool keystrokes,
+                 steady_clock::time_point deadline) {
+        ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+        if(options) {
+            if(auto error = apply_socket_options(fd, *options)) {
+                std::fprintf(stderr, "cannot set %s: %s\n", error->option, std::strerror(error->error));
+            }
+            // chunks are always queued back-to-back here
+            if(options->cork) set_cork(fd, true);
+        }
+
+        auto next_keystroke = steady_clock::now();
+        std::vector<std::string> pending_keystrokes;
+        std::string current;
+        size_t written = 0;
+        int64_t sent = 0;
+
+        while(steady_clock::now() < deadline) {
+            auto now = steady_clock::now();
+            if(keystrokes && now >= next_keystroke) {
+                pending_keystrokes.emplace_back(make_frame(KEYSTROKE, KEYSTROKE_SIZE));
+                next_keystroke += KEYSTROKE_INTERVAL;
+            }
+
+            if(written == current.size()) {
+                if(!current.empty() && current[4] == KEYSTROKE) ++sent;
+                if(!pending_keystrokes.empty()) {
+                    current = std::move(pending_keystrokes.front());
+                    pending_keystrokes.erase(pending_keystrokes.begin());
+                } else {
+                    current = make_frame(CHUNK, CHUNK_SIZE);
+                }
+                written = 0;
+            }
+
+            pollfd p{fd, POLLOUT, 0};
+            auto wait = keystrokes ? duration_cast<milliseconds>(next_keystroke - steady_clock::now()).count() : 50;
+            if(::poll(&p, 1, static_cast<int>(std::max<int64_t>(wait, 0))) <= 0) continue;
+            ssize_t n = ::write(fd, current.data() + written, current.size() - written);
+            if(n > 0) written += n;
+        }
+        if(written == current.size() && current[4] == KEYSTROKE) ++sent;
+        if(options && options->cork) set_cork(fd, false);
+        return sent;
+    }
+
+    void run(const std::optional<socket_options>& options, size_t rate, bool keystrokes, seconds duration, result& out) {
+        auto [sender, receiver] = connect_pair(rate ? RECEIVE_WINDOW : 0);
+        auto deadline = steady_clock::now() + duration;
+        std::thread reader(receive, receiver, rate, deadline, std::ref(out));
+        out.keystrokes_sent = send(sender, options, keystrokes, deadline);
+        reader.join();
+        ::close(sender);
+        ::close(receiver);
+    }
+
+}
+
+int main(int argc, char* argv[]) {
+    size_t uplink_kbps = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 8000;
+    seconds duration(argc > 2 ? std::strtol(argv[2], nullptr, 10) : 3);
+    size_t rate = uplink_kbps * 1000 / 8;
+
+    struct profile {
+        const char* name;
+        std::optional<socket_options> options;
+    };
+    const profile profiles[] = {
+        {"kernel default", std::nullopt},
+        {to_string(transport_profile::INTERACTIVE), profile_options(transport_profile::INTERACTIVE)},
+        {to_string(transport_profile::BULK), profile_options(transport_profile::BULK)},
+        {to_string(transport_profile::CONSTRAINED), profile_options(transport_profile::CONSTRAINED)},
+    };
+
+    std::printf("slow link: %zu kbps, fast link: loopback, %lld s per run\n\n",
+        uplink_kbps, static_cast<long long>(duration.count()));
+    std::printf("%-16s %14s %14s %16s %16s\n", "profile", "keys p50 (ms)", "keys p99 (ms)",
+        "slow (KB/s)", "fast (MB/s)");
+
+    for(auto& p : profiles) {
+        result slow, fast;
+        run(p.options, rate, true, duration, slow);
+        run(p.options, 0, false, duration, fast);
+        double seconds = static_cast<double>(duration.count());
+        std::printf("%-16s %14.1f %14.1f %16.0f %16.0f\n", p.name,
+            slow.latency.percentile(50) / 1000.0,
+            slow.latency.percentile(99) / 1000.0,
+            slow.chunk_bytes / seconds / 1024.0,
+            fast.chunk_bytes / seconds / (1024.0 * 1024.0));
+    }
+    return 0;
+}
@@ -0,0 +1,134 @@
+// Queueing delay per priority class under a concurrent file download and
+// terminal session, for the write_queue scheduler and a plain FIFO.
+//
+// The uplink is simulated on a virtual clock, so results are deterministic
+// and independent of the machine running the benchmark.
+//
+//   write_queue_bench [uplink_kbps] [seconds]
+
+#include <thinger/iotmp/core/iotmp_write_queue.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <string>
+
+using namespace thinger::iotmp;
+using namespace std::chrono;
+
+namespace {
+
+    constexpr uint16_t DOWNLOAD_STREAM = 10;
+    constexpr uint16_t TERMINAL_STREAM = 11;
+    constexpr size_t CHUNK_SIZE = 32 * 1024;             // download chunk
+    constexpr size_t WINDOW_SIZE = 512 * 1024;           // download flow control window
+    constexpr size_t KEYSTROKE_SIZE = 64;                // terminal echo frame
+    constexpr size_t CONTROL_SIZE = 200;                 // RUN response / keep-alive
+    constexpr auto KEYSTROKE_INTERVAL = milliseconds(20);
+    constexpr auto CONTROL_INTERVAL = milliseconds(100);
+    constexpr auto TICK = microseconds(100);
+
+    // FIFO baseline with the same interface as write_queue
+    class fifo_queue {
+    public:
+        void push(outbound_frame frame, steady_clock::time_point now) {
+            frame.enqueued = now;
+            frames_.emplace_back(std::move(frame));
+        }
+
+        std::optional<outbound_frame> pop(steady_clock::time_point now) {
+            if(frames_.empty()) return std::nullopt;
+            auto frame = std::move(frames_.front());
+            frames_.pop_front();
+            auto delay = duration_cast<microseconds>(now - frame.enqueued).count();
+            delays_[index(frame)].record(static_cast<uint64_t>(delay));
+            return frame;
+        }
+
+        const histogram& queue_delay(stream_priority priority) const {
+            return delays_[static_cast<size_t>(priority)];
+        }
+
+    private:
+        static size_t index(const outbound_frame& frame) {
+            if(frame.control) return static_cast<size_t>(stream_priority::CONTROL);
+            if(frame.stream_id == DOWNLOAD_STREAM) return static_cast<size_t>(stream_priority::BULK);
+            return static_cast<size_t>(stream_priority::INTERACTIVE);
+        }
+
+        std::deque<outbound_frame> frames_;
+        std::array<histogram, STREAM_PRIORITIES> delays_;
+    };
+
+    template<typename Queue>
+    void simulate(Queue& queue, double uplink_kbps, int seconds) {
+        const double bytes_per_us = uplink_kbps * 1000.0 / 8.0 / 1e6;
+        const auto start = steady_clock::time_point{};
+        const auto end = start + std::chrono::seconds(seconds);
+
+        auto link_free = start;
+        auto next_keystroke = start;
+        auto next_control = start;
+        size_t download_in_flight = 0;
+
+        for(auto now = start; now < end; now += TICK) {
+            // download keeps its window full; chunks leave the window once written
+            while(download_in_flight + CHUNK_SIZE <= WINDOW_SIZE) {
+                queue.push(outbound_frame{DOWNLOAD_STREAM, false, std::string(CHUNK_SIZE, 'd')}, now);
+                download_in_flight += CHUNK_SIZE;
+            }
+            if(now >= next_keystroke) {
+                queue.push(outbound_frame{TERMINAL_STREAM, false, std::string(KEYSTROKE_SIZE, 't')}, now);
+                next_keystroke += KEYSTROKE_INTERVAL;
+            }
+            if(now >= next_control) {
+                queue.push(outbound_frame{0, true, std::string(CONTROL_SIZE, 'c')}, now);
+                next_control += CONTROL_INTERVAL;
+            }
+
+            // one frame at a time on the wire, as in client::process_write_queue
+            while(link_free <= now) {
+                auto frame = queue.pop(now);
+                if(!frame) break;
+                auto wire_time = microseconds(static_cast<long>(frame->data.size() / bytes_per_us) + 1);
+                link_free = now + wire_time;
+                if(frame->stream_id == DOWNLOAD_STREAM) download_in_flight -= frame->data.size();
+            }
+        }
+    }
+
+    template<typename Queue>
+    void report(const char* name, const Queue& queue) {
+        std::printf("%s\n", name);
+        std::printf("  %-12s %10s %12s %12s %12s\n", "class", "frames", "p50 (ms)", "p99 (ms)", "max (ms)");
+        for(auto priority : {stream_priority::CONTROL, stream_priority::INTERACTIVE, stream_priority::BULK}) {
+            auto& delay = queue.queue_delay(priority);
+            std::printf("  %-12s %10llu %12.2f %12.2f %12.2f\n", to_string(priority),
+                        static_cast<unsigned long long>(delay.count()),
+                        delay.percentile(50) / 1000.0, delay.percentile(99) / 1000.0, delay.max() / 1000.0);
+        }
+    }
+
+}
+
+int main(int argc, char* argv[]) {
+    double uplink_kbps = argc > 1 ? std::atof(argv[1]) : 8000;
+    int seconds = argc > 2 ? std::atoi(argv[2]) : 60;
+
+    std::printf("uplink %.0f kbps, %d s, download window %zu KB in %zu KB chunks, "
+                "terminal frame every %lld ms\n\n",
+                uplink_kbps, seconds, WINDOW_SIZE / 1024, CHUNK_SIZE / 1024,
+                static_cast<long long>(KEYSTROKE_INTERVAL.count()));
+
+    fifo_queue fifo;
+    simulate(fifo, uplink_kbps, seconds);
+    report("fifo", fifo);
+
+    write_queue scheduler;
+    scheduler.set_priority(DOWNLOAD_STREAM, stream_priority::BULK);
+    simulate(scheduler, uplink_kbps, seconds);
+    report("priority + drr", scheduler);
+
+    return 0;
+}
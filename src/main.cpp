@@ -5,11 +5,14 @@
 #include <iostream>
 #include <csignal>
 #include <filesystem>
+#include <fstream>
 #include <boost/program_options.hpp>
 
 #include <spdlog/spdlog.h>
 #include <thinger/asio/workers.hpp>
 #include "thinger/iotmp/client.hpp"
+#include "thinger/iotmp/gateway.hpp"
+#include "thinger/iotmp/metrics_endpoint.hpp"
 #include "thinger/iotmp/extensions/fs/filesystem.hpp"
 #include "thinger/iotmp/extensions/terminal/terminal.hpp"
 #include "thinger/iotmp/extensions/proxy/proxy.hpp"
@@ -22,8 +25,13 @@ namespace po = boost::program_options;
 
 int main(int argc, char* argv[]) {
     // Parsear argumentos
-    std::string username, device, password, hostname, transport, fs_path;
+    std::string username, device, password, hostname, transport, fs_path, devices_file, tls_session_file, capture_file;
     int verbosity = 0;
+    uint16_t port = 0;
+    uint16_t metrics_port = 0;
+    unsigned int stall_threshold = 0;
+    bool shard_sessions = false;
+    bool shrink_buffers = false;
 
     po::options_description desc("IOTMP Async Client");
     desc.add_options()
@@ -33,7 +41,15 @@ int main(int argc, char* argv[]) {
         ("password,p", po::value<std::string>(&password), "device password")
         ("host,h", po::value<std::string>(&hostname)->default_value("iot.thinger.io"), "server hostname")
         ("transport,t", po::value<std::string>(&transport)->default_value("ssl"), "transport type: ssl, ws, tcp")
+        ("port", po::value<uint16_t>(&port), "server port (default depends on the transport)")
         ("fs-path,f", po::value<std::string>(&fs_path), "filesystem base path")
+        ("devices", po::value<std::string>(&devices_file), "gateway mode: JSON file with [{\"username\", \"device\", \"password\"}, ...]")
+        ("tls-session-file", po::value<std::string>(&tls_session_file), "file to persist TLS sessions for fast reconnects")
+        ("shard-sessions", po::bool_switch(&shard_sessions), "run stream sessions on all worker threads")
+        ("shrink-buffers", po::bool_switch(&shrink_buffers), "release connection buffers that grew during a burst of large frames")
+        ("metrics-port", po::value<uint16_t>(&metrics_port), "serve Prometheus metrics on http://127.0.0.1:<port>/metrics")
+        ("stall-threshold", po::value<unsigned int>(&stall_threshold), "report event loop stalls longer than this (ms), with a stack sample")
+        ("capture", po::value<std::string>(&capture_file), "record the wire traffic to this file (single device), see bench/iotmp_replay")
         ("verbosity,v", po::value<int>(&verbosity)->default_value(0), "verbosity level");
 
     po::variables_map vm;
@@ -52,7 +68,7 @@ int main(int argc, char* argv[]) {
         return 0;
     }
 
-    if(username.empty() || device.empty() || password.empty()) {
+    if(devices_file.empty() && (username.empty() || device.empty() || password.empty())) {
         std::cerr << "Error: username, device and password are required\n\n";
         std::cout << desc << "\n";
         return 1;
@@ -66,6 +82,13 @@ int main(int argc, char* argv[]) {
         thinger::logging::set_log_level(spdlog::level::info);
     }
 
+    // Log de mensajes IOTMP asíncrono: el formateo se hace fuera del bucle de lectura
+    std::unique_ptr<async_message_log> message_log;
+    if(message_logger::enabled()) {
+        message_log = std::make_unique<async_message_log>();
+        message_logger::set_async(message_log.get());
+    }
+
     // Determinar tipo de transporte
     transport_type trans = transport_type::SSL;
 
@@ -78,11 +101,82 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
+    // Sesiones TLS persistentes (compartidas por todos los clientes)
+    if(!tls_session_file.empty()) {
+        tls_context::shared()->set_session_file(tls_session_file);
+    }
+
+    // Modo gateway: una conexión por dispositivo, compartiendo workers y pool
+    if(!devices_file.empty()) {
+        json_t devices;
+        try {
+            std::ifstream file(devices_file);
+            devices = json_t::parse(file);
+        } catch(const std::exception& e) {
+            std::cerr << "Error: cannot read devices file '" << devices_file << "': " << e.what() << "\n";
+            return 1;
+        }
+        if(!devices.is_array()) {
+            std::cerr << "Error: devices file must contain a JSON array\n";
+            return 1;
+        }
+
+        gateway gw;
+        gw.set_host(hostname);
+        gw.set_transport(trans);
+        gw.set_port(port);
+        gw.set_session_sharding(shard_sessions);
+        if(shrink_buffers) gw.set_buffer_shrink();
+        for(auto& entry : devices) {
+            auto user = entry.value("username", username);
+            auto id = entry.value("device", std::string{});
+            auto credential = entry.value("password", std::string{});
+            if(user.empty() || id.empty() || credential.empty()) {
+                std::cerr << "Error: devices entries require username, device and password\n";
+                return 1;
+            }
+            if(!gw.add_device(user, id, credential)) {
+                std::cerr << "Warning: duplicated device '" << id << "' ignored\n";
+                continue;
+            }
+        }
+
+        std::cout << "Starting gateway with " << gw.size() << " devices...\n";
+        gw.start();
+
+        // Métricas en formato Prometheus (opcional)
+        metrics_endpoint exporter(gw.get_metrics());
+        if(metrics_port) exporter.start(metrics_port);
+
+        // Watchdog de bloqueos en los event loops (opcional)
+        loop_watchdog watchdog({loop_watchdog::DEFAULT_INTERVAL, std::chrono::milliseconds(stall_threshold), true});
+        if(stall_threshold) {
+            watchdog.watch_workers();
+            watchdog.register_metrics(gw.get_metrics());
+            watchdog.start();
+        }
+
+        thinger::asio::get_workers().wait();
+        gw.stop();
+
+        std::cout << "Gateway stopped.\n";
+        return 0;
+    }
+
     // Crear cliente
     client iotmp_client;
     iotmp_client.set_credentials(username, device, password);
     iotmp_client.set_host(hostname);
     iotmp_client.set_transport(trans);
+    if(port) iotmp_client.set_port(port);
+    iotmp_client.set_session_sharding(shard_sessions);
+    if(shrink_buffers) iotmp_client.set_buffer_shrink();
+
+    // Captura del tráfico para reproducirlo después (opcional)
+    if(!capture_file.empty() && !iotmp_client.set_capture(capture_file)) {
+        std::cerr << "Error: cannot create capture file '" << capture_file << "'\n";
+        return 1;
+    }
 
     // Inicializar extensiones
     terminal shell(iotmp_client);
@@ -96,6 +190,18 @@ int main(int argc, char* argv[]) {
     std::cout << "Starting async client...\n";
     iotmp_client.start();
 
+    // Métricas en formato Prometheus (opcional)
+    metrics_endpoint exporter(iotmp_client.get_metrics());
+    if(metrics_port) exporter.start(metrics_port);
+
+    // Watchdog de bloqueos en los event loops (opcional)
+    loop_watchdog watchdog({loop_watchdog::DEFAULT_INTERVAL, std::chrono::milliseconds(stall_threshold), true});
+    if(stall_threshold) {
+        watchdog.watch_workers();
+        watchdog.register_metrics(iotmp_client.get_metrics());
+        watchdog.start();
+    }
+
     // Esperar señales de cierre (Ctrl+C o SIGTERM)
     thinger::asio::get_workers().wait();
 
@@ -0,0 +1,218 @@
+#ifndef THINGER_IOTMP_BUCKET_WRITER_HPP
+#define THINGER_IOTMP_BUCKET_WRITER_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "client.hpp"
+#include "core/iotmp_adapters.hpp"
+#include "core/iotmp_histogram.hpp"
+#include "core/pson_encoder.hpp"
+
+namespace thinger::iotmp {
+
+    // Why a bucket batch was flushed
+    enum class flush_cause : uint8_t {
+        COUNT,          // max_samples reached
+        BYTES,          // max_bytes reached
+        DEADLINE,       // oldest sample waited max_delay
+        EXPLICIT        // flush() or destruction
+    };
+
+    inline const char* to_string(flush_cause cause) {
+        switch(cause) {
+            case flush_cause::COUNT: return "count";
+            case flush_cause::BYTES: return "bytes";
+            case flush_cause::DEADLINE: return "deadline";
+            case flush_cause::EXPLICIT: return "explicit";
+        }
+        return "unknown";
+    }
+
+    /**
+     * Batching writer for a data bucket.
+     *
+     * Samples are stamped when written and accumulated, and the whole batch
+     * goes out as a single write_bucket() call with an array payload once it
+     * holds max_samples, reaches max_bytes on the wire, or its oldest sample has
+     * waited max_delay. Every element of the array is the sample with its
+     * timestamp in "ts" (milliseconds since epoch); samples that are not
+     * objects are wrapped as {"ts": ..., "value": sample}.
+     *
+     * write() can be called from any thread once the client is started.
+     * Batches are sent from the client io_context, and the client must
+     * outlive the writer.
+     */
+    class bucket_writer {
+    public:
+        using clock = std::chrono::system_clock;
+
+        struct flush_policy {
+            size_t max_samples = 100;
+            size_t max_bytes = 16 * 1024;
+            std::chrono::milliseconds max_delay{1000};
+            bool confirm = false;               // wait for the server to acknowledge every batch
+        };
+
+        bucket_writer(client& device, std::string bucket) :
+            bucket_writer(device, std::move(bucket), flush_policy{})
+        {}
+
+        bucket_writer(client& device, std::string bucket, flush_policy policy) :
+            state_(std::make_shared<state>(device, std::move(bucket), policy))
+        {}
+
+        ~bucket_writer() {
+            state_->flush(flush_cause::EXPLICIT);
+        }
+
+        bucket_writer(const bucket_writer&) = delete;
+        bucket_writer& operator=(const bucket_writer&) = delete;
+
+        // Add a sample to the current batch
+        void write(json_t sample, clock::time_point timestamp = clock::now()) {
+            state_->add(std::move(sample), timestamp);
+        }
+
+        /**
+         * Add a sample and wait for the batch carrying it to be sent
+         * @return whether the batch was acknowledged (queued, without confirm)
+         */
+        awaitable<bool> write_async(json_t sample, clock::time_point timestamp = clock::now()) {
+            auto done = state_->add(std::move(sample), timestamp);
+            co_return co_await state_->wait(std::move(done));
+        }
+
+        // Send the current batch now and wait for it
+        awaitable<bool> flush() {
+            auto done = state_->flush(flush_cause::EXPLICIT);
+            if(!done) co_return true;
+            co_return co_await state_->wait(std::move(done));
+        }
+
+        const std::string& get_bucket() const { return state_->bucket; }
+
+        // Samples per batch sent
+        const histogram& get_batch_size() const { return state_->batch_size; }
+
+        // Batches flushed for a given cause
+        uint64_t get_flushes(flush_cause cause) const {
+            return state_->flushes[static_cast<size_t>(cause)].load(std::memory_order_relaxed);
+        }
+
+        // Batches the client did not send or the server did not acknowledge
+        uint64_t get_failed_batches() const { return state_->failed.load(std::memory_order_relaxed); }
+
+        uint64_t get_samples() const { return state_->samples.load(std::memory_order_relaxed); }
+
+    private:
+        // Completion of one batch, signalled on the client io_context
+        struct completion {
+            explicit completion(asio::io_context& io) : signal(io, asio::steady_timer::time_point::max()) {}
+            asio::steady_timer signal;
+            std::optional<bool> result;
+        };
+
+        // Shared with the coroutines sending batches, which may outlive the writer
+        struct state : std::enable_shared_from_this<state> {
+            state(client& device, std::string bucket, flush_policy policy) :
+                device(device), bucket(std::move(bucket)), policy(policy) {}
+
+            std::shared_ptr<completion> add(json_t sample, clock::time_point timestamp) {
+                auto ts = std::chrono::duration_cast<std::chrono::milliseconds>(timestamp.time_since_epoch()).count();
+                if(!sample.is_object()) sample = json_t{{"value", std::move(sample)}};
+                sample["ts"] = ts;
+                // encoded size, as sent, without serializing the sample
+                null_writer sizer;
+                pson_encoder<null_writer>(sizer).encode(sample);
+                size_t size = sizer.bytes_written();
+
+                std::unique_lock lock(mutex);
+                if(pending.empty()) open_batch();
+                pending.emplace_back(std::move(sample));
+                pending_bytes += size;
+                samples.fetch_add(1, std::memory_order_relaxed);
+                auto done = pending_done;
+
+                if(pending.size() >= policy.max_samples) send_locked(flush_cause::COUNT);
+                else if(pending_bytes >= policy.max_bytes) send_locked(flush_cause::BYTES);
+                return done;
+            }
+
+            std::shared_ptr<completion> flush(flush_cause cause) {
+                std::scoped_lock lock(mutex);
+                if(pending.empty()) return nullptr;
+                auto done = pending_done;
+                send_locked(cause);
+                return done;
+            }
+
+            awaitable<bool> wait(std::shared_ptr<completion> done) {
+                // the signal belongs to the client io_context
+                co_return co_await co_spawn(device.get_io_context(), wait_signal(std::move(done)), use_awaitable);
+            }
+
+            static awaitable<bool> wait_signal(std::shared_ptr<completion> done) {
+                if(!done->result) co_await done->signal.async_wait(use_nothrow_awaitable);
+                co_return done->result.value_or(false);
+            }
+
+            // First sample of a batch: arm its deadline
+            void open_batch() {
+                auto& io = device.get_io_context();
+                pending_done = std::make_shared<completion>(io);
+                auto id = ++batch_id;
+                auto self = shared_from_this();
+                asio::post(io, [self, id]() {
+                    auto timer = std::make_shared<asio::steady_timer>(self->device.get_io_context(), self->policy.max_delay);
+                    timer->async_wait([self, id, timer](const boost::system::error_code& ec) {
+                        if(ec) return;
+                        std::scoped_lock lock(self->mutex);
+                        if(self->batch_id == id && !self->pending.empty()) self->send_locked(flush_cause::DEADLINE);
+                    });
+                });
+            }
+
+            void send_locked(flush_cause cause) {
+                json_t batch = json_t::array();
+                batch.get_ref<json_t::array_t&>().swap(pending);
+                pending_bytes = 0;
+                ++batch_id;         // disarms the deadline of the batch sent
+                flushes[static_cast<size_t>(cause)].fetch_add(1, std::memory_order_relaxed);
+                batch_size.record(batch.size());
+                co_spawn(device.get_io_context(), send(shared_from_this(), std::move(batch), std::move(pending_done)), detached);
+            }
+
+            static awaitable<void> send(std::shared_ptr<state> self, json_t batch, std::shared_ptr<completion> done) {
+                bool ok = co_await self->device.write_bucket(self->bucket, std::move(batch), self->policy.confirm);
+                if(!ok) self->failed.fetch_add(1, std::memory_order_relaxed);
+                done->result = ok;
+                done->signal.cancel();
+            }
+
+            client& device;
+            const std::string bucket;
+            const flush_policy policy;
+
+            std::mutex mutex;
+            json_t::array_t pending;
+            size_t pending_bytes = 0;
+            std::shared_ptr<completion> pending_done;
+            uint64_t batch_id = 0;
+
+            histogram batch_size;
+            std::array<std::atomic<uint64_t>, 4> flushes{};
+            std::atomic<uint64_t> failed{0};
+            std::atomic<uint64_t> samples{0};
+        };
+
+        std::shared_ptr<state> state_;
+    };
+
+}
+
+#endif
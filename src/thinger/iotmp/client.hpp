@@ -14,6 +14,11 @@
 #include <queue>
 #include <future>
 #include <optional>
+#include <unordered_map>
+#include <atomic>
+#include <mutex>
+#include <cerrno>
+#include <cstring>
 
 #include "core/iotmp_types.hpp"
 #include "core/iotmp_message.hpp"
@@ -22,6 +27,23 @@
 #include "core/iotmp_resource.hpp"
 #include "core/iotmp_server_event.hpp"
 #include "core/iotmp_logger.hpp"
+#include "core/iotmp_stream_id_allocator.hpp"
+#include "core/iotmp_mpsc_queue.hpp"
+#include "core/iotmp_write_queue.hpp"
+#include "core/iotmp_tls_context.hpp"
+#include "core/iotmp_backoff.hpp"
+#include "core/iotmp_dns_cache.hpp"
+#include "core/iotmp_keep_alive.hpp"
+#include "core/iotmp_transport_profile.hpp"
+#include "core/iotmp_input_buffer.hpp"
+#include "core/iotmp_journal.hpp"
+#include "core/iotmp_metrics.hpp"
+#include "core/iotmp_loop_watchdog.hpp"
+#include "core/iotmp_trace.hpp"
+#include "core/iotmp_capture.hpp"
+#include "core/iotmp_memory.hpp"
+#include "core/iotmp_frame_pool.hpp"
+#include "core/iotmp_stream_stats.hpp"
 
 // Use thinger-http sockets and client (modern coroutine-based API)
 #include <thinger/asio/sockets/socket.hpp>
@@ -67,17 +89,74 @@ namespace thinger::iotmp {
         iotmp_resource* resource = nullptr;
         unsigned int interval = 0;
         unsigned long last_streaming = 0;
+        counter* received = nullptr;    // stream data bytes of the resource, both ways
+        counter* sent = nullptr;
+        const char* path = nullptr;     // resource path, for loop_activity
+        std::string target;             // resource requested by the server (i.e., $terminal/abc)
+        stream_stats stats;             // traffic, for the $streams resource
+        std::optional<iotmp_message> output;    // kept between rounds for fixed-shape outputs
+    };
+
+    // Result of a non-blocking send
+    enum class send_result {
+        SENT,           // queued for writing
+        CONGESTED,      // queued, but the stream is over its watermark: pause producing
+        QUEUE_FULL,     // send queue at capacity, message dropped
+        DISCONNECTED    // not connected, message dropped
+    };
+
+    // Handler for a request response: receives the OK/ERROR message, or
+    // nullptr if the request timed out or the connection was lost
+    typedef std::function<void(iotmp_message* response)> response_handler;
+
+    // Request waiting for its response on a given stream id
+    struct pending_request {
+        std::shared_ptr<asio::steady_timer> deadline;
+        response_handler handler;
     };
 
     // Async IOTMP client using C++20 coroutines
     class client : public thinger::asio::worker_client {
     public:
         static constexpr size_t MAX_MESSAGE_SIZE = 256 * 1024;  // 256KB max (chunks + protocol overhead)
-        static constexpr auto KEEP_ALIVE_INTERVAL = std::chrono::seconds(60);
+        static constexpr auto KEEP_ALIVE_INTERVAL = std::chrono::seconds(60);   // idle time before a probe
         static constexpr auto CONNECT_TIMEOUT = std::chrono::seconds(15);
-        static constexpr auto RECONNECT_DELAY = std::chrono::seconds(5);
+        static constexpr auto RECONNECT_DELAY = std::chrono::seconds(5);      // first reconnect delay (base)
+        static constexpr auto MAX_RECONNECT_DELAY = std::chrono::minutes(2);
+        static constexpr auto CONNECTION_ATTEMPT_DELAY = std::chrono::milliseconds(250);
+        static constexpr auto REQUEST_TIMEOUT = std::chrono::seconds(30);
+        static constexpr size_t SEND_QUEUE_CAPACITY = 1024;     // frames queued from other threads
+        static constexpr auto PROFILE_ACTIVITY_WINDOW = std::chrono::seconds(1);    // see select_transport_profile()
+        static constexpr size_t COALESCE_BYTES = 16 * 1024;                         // see set_frame_coalescing()
+        static constexpr auto WEBSOCKET_COALESCE_DELAY = std::chrono::milliseconds(1);
+        static constexpr size_t JOURNAL_SIZE = 4 * 1024 * 1024;     // see set_journal()
+        static constexpr size_t JOURNAL_RATE = 32 * 1024;           // backlog bytes per second
+        static constexpr auto JOURNAL_DRAIN_INTERVAL = std::chrono::milliseconds(100);
+        static constexpr uint16_t JOURNAL_STREAM = 0;               // write queue stream of the backlog
+        static constexpr size_t CAPTURE_SIZE = 256 * 1024 * 1024;   // see set_capture()
+        static constexpr size_t BUFFER_SHRINK_BYTES = 64 * 1024;    // see set_buffer_shrink()
+        static constexpr auto BUFFER_SHRINK_DELAY = std::chrono::seconds(30);
+
+        client() : worker_client("iotmp") {
+            // built-in resource with the metrics of this client
+            (*this)["$metrics"] = [this](output& out) {
+                out = metrics_->to_json({this, tls_metrics_.load(std::memory_order_acquire)});
+            };
+
+            // built-in resource listing the open streams and their traffic,
+            // read on the connection thread, where the stream table lives
+            (*this)["$streams"] = [this](output& out) {
+                json_t& streams = out;
+                run([this, &streams]() {
+                    streams = describe_streams();
+                    return true;
+                });
+            };
+        }
 
-        client() : worker_client("iotmp") {}
+        ~client() {
+            metrics_->remove(this);
+        }
 
         // State callback
         void set_state_callback(std::function<void(client_state, const std::string&)> callback) {
@@ -94,6 +173,58 @@ namespace thinger::iotmp {
             host_ = std::move(host);
         }
 
+        // Server port. set_transport() resets it to the transport default,
+        // so it must be called afterwards.
+        void set_port(uint16_t port) {
+            port_ = port;
+        }
+
+        // Reconnect delays: decorrelated jitter between base and three times
+        // the previous delay, up to max
+        void set_reconnect_delay(std::chrono::milliseconds base, std::chrono::milliseconds max) {
+            backoff_.set_limits(base, max);
+        }
+
+        // Maximum time a request waits for its response (default REQUEST_TIMEOUT)
+        void set_request_timeout(std::chrono::milliseconds timeout) {
+            request_timeout_ = timeout;
+        }
+
+        // Keep-alive probing and dead-peer detection (see keep_alive_policy).
+        // Must be set before start().
+        void set_keep_alive(const keep_alive_policy& policy) {
+            keep_alive_ = policy;
+        }
+
+        const keep_alive_policy& get_keep_alive() const { return keep_alive_; }
+
+        // Round-trip time to the server on the current connection, measured
+        // from KEEP_ALIVE echoes. Can be read from any thread.
+        const rtt_estimator& get_rtt() const { return rtt_; }
+
+        // Socket tuning (SSL and TCP transports). AUTO, the default, uses BULK
+        // while only bulk streams (file downloads) are sending, and
+        // INTERACTIVE otherwise. Takes effect with the next write.
+        void set_transport_profile(transport_profile profile) {
+            transport_profile_.store(profile, std::memory_order_relaxed);
+        }
+
+        // Profile currently applied to the connection
+        transport_profile get_transport_profile() const {
+            return active_profile_.load(std::memory_order_relaxed);
+        }
+
+        // Frames queued back-to-back are written together, up to max_bytes per
+        // write (default COALESCE_BYTES). On the WebSocket transport this
+        // packs them into a single message, saving the frame header and the
+        // masking pass of each. A lone stream data frame may wait up to
+        // max_delay for others to join (default WEBSOCKET_COALESCE_DELAY on
+        // WebSocket, no wait otherwise). Must be set before start().
+        void set_frame_coalescing(size_t max_bytes, std::chrono::microseconds max_delay) {
+            coalesce_bytes_ = max_bytes;
+            coalesce_delay_ = max_delay;
+        }
+
         void set_transport(transport_type transport) {
             transport_ = transport;
             // Set default port based on transport
@@ -118,6 +249,9 @@ namespace thinger::iotmp {
         uint16_t get_port() const { return port_; }
         bool is_secure() const { return socket_ ? socket_->is_secure() : false; }
 
+        // Time from connection start to STREAMS_READY on the last connection
+        std::chrono::milliseconds get_streams_ready_time() const { return streams_ready_time_; }
+
         // Resource access
         iotmp_resource& operator[](std::string_view path) {
             std::string path_str(path);
@@ -132,11 +266,50 @@ namespace thinger::iotmp {
             return resources_.erase(std::string(path)) > 0;
         }
 
+        // TLS context for the SSL transport. By default all clients share a
+        // process-wide one, so they also share cached TLS sessions. It is only
+        // built (initializing OpenSSL) by the first SSL connection, on another
+        // worker thread while the host resolves. Must be set before start().
+        void set_tls_context(std::shared_ptr<tls_context> context) {
+            tls_context_ = std::move(context);
+        }
+
+        // Handshake count, resumption rate and handshake times
+        tls_context& get_tls_context() {
+            return *tls();
+        }
+
+        // Verify the server certificate of WebSocket (wss) connections, which
+        // is the default. Only meant to be disabled against test servers with
+        // self-signed certificates. Must be set before start().
+        void set_websocket_verify(bool verify) {
+            websocket_verify_ = verify;
+        }
+
+        // Share a thread pool for blocking resource executions with other
+        // clients (i.e., in a gateway). Must be set before start(); by default
+        // each client creates its own pool on the first resource call.
+        void set_resource_pool(std::shared_ptr<asio::thread_pool> pool) {
+            resource_pool_ = std::move(pool);
+            owns_resource_pool_ = false;
+        }
+
+        // Capacity, in frames, of the queue for messages sent from other
+        // threads (default SEND_QUEUE_CAPACITY). Must be set before start().
+        void set_send_queue_capacity(size_t capacity) {
+            send_queue_capacity_ = capacity;
+            outbox_.reset();
+        }
+
         // Start the client
         bool start() override {
             if(!worker_client::start()) return false;
+            if(!outbox_) outbox_ = std::make_unique<mpsc_queue<outbound_frame>>(send_queue_capacity_);
+            register_metrics();
             // Use thinger-http worker pool
             auto& io = thinger::asio::get_workers().get_next_io_context();
+            io_.store(&io, std::memory_order_release);
+            loop_exited_.store(false, std::memory_order_release);
             co_spawn(io, run_loop(), detached);
             return true;
         }
@@ -146,7 +319,17 @@ namespace thinger::iotmp {
             if(!worker_client::stop()) return false;
             if(keep_alive_timer_) keep_alive_timer_->cancel();
             if(stream_timer_) stream_timer_->cancel();
-            resource_pool_.join();
+            if(write_timer_) write_timer_->cancel();
+            cancel_tls_preparation();
+            if(journal_) journal_->commit();
+            if(capture_) capture_->flush();
+            // a shared pool belongs to whoever shares it (i.e., the gateway)
+            std::shared_ptr<asio::thread_pool> pool;
+            {
+                std::scoped_lock lock(resource_pool_mutex_);
+                if(owns_resource_pool_) pool = std::move(resource_pool_);
+            }
+            if(pool) pool->join();
             if(socket_) {
                 socket_->close();
                 socket_.reset();
@@ -155,14 +338,35 @@ namespace thinger::iotmp {
             return true;
         }
 
+        // Whether the connection coroutine has exited after stop() (or was
+        // never started), so the client can be destroyed
+        bool is_stopped() const {
+            return loop_exited_.load(std::memory_order_acquire);
+        }
+
         // Implements client
         bool is_connected() const {
             return connected_ && socket_ && socket_->is_open();
         }
 
-        // Get io_context from socket (available after connect)
+        // Get the connection io_context (available after start)
         asio::io_context& get_io_context() {
-            return socket_->get_io_context();
+            auto* io = io_.load(std::memory_order_acquire);
+            return io ? *io : socket_->get_io_context();
+        }
+
+        // Run stream sessions (terminal, proxy, commands, file transfers) on
+        // the thinger-http worker io_contexts, spread round-robin, instead of
+        // the connection one. Their upstream I/O then scales with the worker
+        // threads, and only finished frames reach the connection thread.
+        void set_session_sharding(bool enabled) {
+            session_sharding_ = enabled;
+        }
+
+        // io_context for a new stream session
+        asio::io_context& get_session_io_context() {
+            if(session_sharding_) return thinger::asio::get_workers().get_next_io_context();
+            return get_io_context();
         }
 
         // Stop a stream
@@ -174,66 +378,293 @@ namespace thinger::iotmp {
             return true;
         }
 
-        // Stream binary data
+        // Stream binary data (any thread). Returns false if the data was dropped.
         bool stream_resource(uint16_t stream_id, const uint8_t* data, size_t size) {
-            if(!connected_) return false;
-            iotmp_message msg(message::type::STREAM_DATA);
-            msg[message::field::STREAM_ID] = stream_id;
-            msg[message::field::PAYLOAD] = json_t::binary({data, data + size});
-            send_message(msg);
-            return true;
+            return is_queued(try_stream_resource(stream_id, data, size));
         }
 
-        // Stream JSON data
+        // Stream JSON data (any thread). Returns false if the data was dropped.
         bool stream_resource(uint16_t stream_id, json_t&& data) {
-            if(!connected_) return false;
-            iotmp_message msg(message::type::STREAM_DATA);
-            msg[message::field::STREAM_ID] = stream_id;
-            msg[message::field::PAYLOAD].swap(data);
-            send_message(msg);
-            return true;
+            return is_queued(try_stream_resource(stream_id, data));
         }
 
-        // ============== Request-Response API (coroutines) ==============
+        // Stream JSON data the caller keeps, i.e., to fill it again for the
+        // next chunk (any thread)
+        bool stream_resource(uint16_t stream_id, const json_t& data) {
+            return is_queued(try_stream_resource(stream_id, data));
+        }
 
-        // Wait for response with specific stream_id, processing other messages meanwhile
-        awaitable<bool> wait_response(iotmp_message& request, json_t* payload = nullptr) {
-            uint16_t request_stream_id = request.get_stream_id();
-            while(true) {
-                auto response = co_await read_message();
-                if(!response) co_return false;
+        // Stream data is encoded straight into a pooled frame buffer, without
+        // building a message, so a steady stream does not allocate per chunk
+        send_result try_stream_resource(uint16_t stream_id, const uint8_t* data, size_t size) {
+            if(!connected_) return send_result::DISCONNECTED;
+            if(write_queue_.full()) return send_result::QUEUE_FULL;
+            auto buffer = frame_pool_.acquire();
+            encode_stream_data(buffer, stream_id, data, size);
+            return try_queue(outbound_frame{stream_id, false, std::move(buffer)});
+        }
 
-                uint16_t response_stream_id = response->get_stream_id();
+        send_result try_stream_resource(uint16_t stream_id, const json_t& data) {
+            if(!connected_) return send_result::DISCONNECTED;
+            if(write_queue_.full()) return send_result::QUEUE_FULL;
+            auto buffer = frame_pool_.acquire();
+            encode_stream_data(buffer, stream_id, data);
+            return try_queue(outbound_frame{stream_id, false, std::move(buffer)});
+        }
 
-                if(request_stream_id == response_stream_id &&
-                   response->get_message_type() <= message::type::ERROR) {
-                    if(payload && response->has_field(message::field::PAYLOAD)) {
-                        payload->swap((*response)[message::field::PAYLOAD]);
-                    }
-                    co_return response->get_message_type() == message::type::OK;
-                } else {
-                    co_await handle_message(std::move(*response));
+        // Send a message from any thread without blocking. On the connection
+        // thread the frame goes straight to the write queue; other threads
+        // encode it themselves and push it into a bounded lock-free queue
+        // that the connection thread drains.
+        // Stream data is rejected once the write queue reaches its hard limit,
+        // while control messages are always admitted.
+        send_result try_send(iotmp_message& message) {
+            if(!connected_) return send_result::DISCONNECTED;
+
+            bool control = message.get_message_type() != message::STREAM_DATA;
+            if(control) {
+                message_logger::log_outgoing(message);
+            } else if(write_queue_.full()) {
+                return send_result::QUEUE_FULL;
+            }
+
+            auto buffer = frame_pool_.acquire();
+            encode_message(message, buffer);
+            return try_queue(outbound_frame{message.get_stream_id(), control, std::move(buffer)});
+        }
+
+        // Queue an encoded frame from any thread (see try_send)
+        send_result try_queue(outbound_frame&& frame) {
+            auto* io = io_.load(std::memory_order_acquire);
+            if(!io) return send_result::DISCONNECTED;
+
+            uint16_t stream_id = frame.stream_id;
+            bool control = frame.control;
+            if(io->get_executor().running_in_this_thread()) {
+                send_frame(std::move(frame));
+            } else {
+                // account the frame before it reaches the write queue, so
+                // producers on other threads see the limit and watermarks too
+                size_t size = frame.data.size();
+                if(!write_queue_.reserve(size, control)) return send_result::QUEUE_FULL;
+                if(!outbox_->try_push(frame)) {
+                    write_queue_.cancel_reservation(size);
+                    return send_result::QUEUE_FULL;
                 }
+                schedule_outbox_drain(*io);
+            }
+
+            if(!control && !write_queue_.writable(stream_id)) return send_result::CONGESTED;
+            return send_result::SENT;
+        }
+
+        static bool is_queued(send_result result) {
+            return result == send_result::SENT || result == send_result::CONGESTED;
+        }
+
+        // ============== Backpressure ==============
+
+        // Whether a stream may produce more data without piling up in the
+        // write queue (any thread)
+        bool is_writable(uint16_t stream_id) const {
+            return write_queue_.writable(stream_id);
+        }
+
+        // Suspend until the write queue has drained below its low watermarks
+        // for this stream. Sessions await it before reading more from their
+        // source (PTY, socket, pipe). Returns false if the connection is lost.
+        awaitable<bool> wait_writable(uint16_t stream_id) {
+            if(!connected_) co_return false;
+            if(write_queue_.writable(stream_id)) co_return true;
+            co_return co_await on_connection(writable_wait(stream_id));
+        }
+
+        // Global write queue watermarks, in bytes
+        void set_write_watermarks(size_t low, size_t high) {
+            write_queue_.set_watermarks(low, high);
+            size_frame_pool();
+        }
+
+        // Per-stream write queue watermarks, in bytes
+        void set_stream_write_watermarks(size_t low, size_t high) {
+            write_queue_.set_stream_watermarks(low, high);
+            size_frame_pool();
+        }
+
+        // Scheduling class for the data of a stream (default INTERACTIVE).
+        // Control frames always go first, then interactive and bulk data,
+        // sharing each class fairly between streams. Reset when the stream
+        // ends. Any thread.
+        void set_stream_priority(uint16_t stream_id, stream_priority priority) {
+            auto* io = io_.load(std::memory_order_acquire);
+            if(!io) return;
+            asio::dispatch(*io, [this, stream_id, priority]() {
+                write_queue_.set_priority(stream_id, priority);
+            });
+        }
+
+        // Time outbound frames of a class spent queued, in microseconds
+        const histogram& get_queue_delay(stream_priority priority) const {
+            return write_queue_.queue_delay(priority);
+        }
+
+        // ============== Store and Forward ==============
+
+        /**
+         * Keep the fire-and-forget server calls made while offline (bucket
+         * writes, endpoint and device calls, property writes without confirm)
+         * in a durable journal of up to max_bytes, and send them after the
+         * next connection, behind live traffic. Must be set before start().
+         * @return false if the journal file cannot be opened
+         */
+        bool set_journal(const std::filesystem::path& path, size_t max_bytes = JOURNAL_SIZE) {
+            auto store = std::make_shared<journal>();
+            if(!store->open(path, max_bytes)) return false;
+            journal_ = std::move(store);
+            return true;
+        }
+
+        // Bytes per second of journal backlog sent after reconnecting
+        // (default JOURNAL_RATE)
+        void set_journal_rate(size_t bytes_per_second) {
+            journal_rate_ = bytes_per_second;
+        }
+
+        // Pending and dropped journal records (nullptr without journal)
+        const journal* get_journal() const {
+            return journal_.get();
+        }
+
+        // ============== Wire Capture ==============
+
+        /**
+         * Record the raw frames exchanged with the server, with their
+         * timestamps, to a capture file of up to max_bytes (see
+         * core/iotmp_capture.hpp), i.e., to replay them later with
+         * bench/iotmp_replay. Must be set before start().
+         * @return false if the capture file cannot be created
+         */
+        bool set_capture(const std::filesystem::path& path, size_t max_bytes = CAPTURE_SIZE) {
+            auto writer = std::make_unique<capture_writer>();
+            if(!writer->open(path, max_bytes)) return false;
+            capture_ = std::move(writer);
+            return true;
+        }
+
+        // Capture in progress (nullptr without capture)
+        const capture_writer* get_capture() const {
+            return capture_.get();
+        }
+
+        // ============== Memory ==============
+
+        // Buffer bytes and live sessions per subsystem, also exported as
+        // the iotmp_memory_bytes and iotmp_sessions metrics. Sessions account
+        // what they queue here.
+        memory_accounting& get_memory() {
+            return memory_;
+        }
+
+        const memory_accounting& get_memory() const {
+            return memory_;
+        }
+
+        /**
+         * Shrink policy for the connection buffers. The receive buffer grows
+         * to the largest frame received (up to MAX_MESSAGE_SIZE) and the write
+         * batch to the largest batch written, and both keep that size by
+         * default. With a limit set, a buffer larger than max_bytes goes back
+         * to its default size once no inbound frame larger than max_bytes has
+         * been received for the given delay, so a burst of large frames
+         * (i.e., an upload) does not pin its peak memory afterwards. The
+         * frame pool is trimmed to max_bytes after the same delay. The
+         * check runs as frames arrive, keep-alives included. 0 disables it.
+         */
+        void set_buffer_shrink(size_t max_bytes = BUFFER_SHRINK_BYTES,
+                               std::chrono::milliseconds delay = BUFFER_SHRINK_DELAY) {
+            shrink_bytes_ = max_bytes;
+            shrink_delay_ = delay;
+        }
+
+        // ============== Metrics ==============
+
+        // Registry for the metrics of this client, labelled with its device
+        // id. Every client has its own by default; a gateway shares one
+        // between its devices. Must be set before start().
+        void set_metrics(std::shared_ptr<metrics> registry) {
+            metrics_ = std::move(registry);
+        }
+
+        // Messages per type, stream bytes per resource, write queue depth,
+        // resource pool wait and run times, reconnects, connection and
+        // handshake times. Also readable through the $metrics resource.
+        metrics& get_metrics() {
+            return *metrics_;
+        }
+
+        // Open streams with their resource, type, age, traffic and rate in
+        // each direction (bytes per second), queued bytes and idle time.
+        // Connection thread only; other threads read it through the
+        // $streams resource, which can also be streamed with an interval.
+        json_t describe_streams() const {
+            auto now = std::chrono::steady_clock::now();
+            auto millis = [](std::chrono::steady_clock::duration elapsed) {
+                return std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+            };
+            auto traffic = [&](const stream_stats::direction& stats) {
+                json_t entry;
+                entry["bytes"] = stats.bytes();
+                entry["frames"] = stats.frames();
+                entry["rate"] = stats.rate(now);
+                return entry;
+            };
+
+            json_t streams = json_t::array();
+            for(const auto& [stream_id, config] : streams_) {
+                json_t entry;
+                entry["stream_id"] = stream_id;
+                entry["resource"] = config.target;
+                entry["type"] = stream_type(config);
+                entry["priority"] = to_string(write_queue_.stream_priority_of(stream_id));
+                entry["age_ms"] = millis(now - config.stats.started());
+                entry["idle_ms"] = millis(now - config.stats.last_activity());
+                entry["sent"] = traffic(config.stats.sent());
+                entry["received"] = traffic(config.stats.received());
+                entry["queued_bytes"] = write_queue_.bytes(stream_id);
+                streams.push_back(std::move(entry));
             }
+            return streams;
+        }
+
+        // ============== Request-Response API (coroutines) ==============
+
+        // Send a request and wait for its OK/ERROR response. Every request gets
+        // its own stream id and deadline, and the read loop hands the response
+        // to its waiter, so any number of requests can be in flight at once.
+        // Returns std::nullopt on timeout or disconnection.
+        awaitable<std::optional<iotmp_message>> send_request(iotmp_message& request) {
+            if(!connected_ || !socket_) co_return std::nullopt;
+            co_return co_await on_connection(request_response(request));
         }
 
         // Send message and wait for acknowledgement
-        awaitable<bool> send_message_with_ack(iotmp_message& message, bool wait_ack = true) {
-            if(wait_ack && message.get_stream_id() == 0) {
-                message.set_random_stream_id();
+        awaitable<bool> send_message_with_ack(iotmp_message& request, bool wait_ack = true) {
+            if(!wait_ack) {
+                if(!connected_ || !socket_) co_return store_offline(request);
+                co_return co_await on_connection(enqueue_message(request));
             }
-            if(!co_await write_message(message)) co_return false;
-            if(!wait_ack) co_return true;
-            co_return co_await wait_response(message);
+            auto response = co_await send_request(request);
+            co_return response && response->get_message_type() == message::type::OK;
         }
 
         // Send message and wait for response payload
-        awaitable<bool> send_message_with_response(iotmp_message& message, json_t& response_payload) {
-            if(message.get_stream_id() == 0) {
-                message.set_random_stream_id();
+        awaitable<bool> send_message_with_response(iotmp_message& request, json_t& response_payload) {
+            auto response = co_await send_request(request);
+            if(!response) co_return false;
+            if(response->has_field(message::field::PAYLOAD)) {
+                response_payload.swap((*response)[message::field::PAYLOAD]);
             }
-            if(!co_await write_message(message)) co_return false;
-            co_return co_await wait_response(message, &response_payload);
+            co_return response->get_message_type() == message::type::OK;
         }
 
         // ============== Server API (coroutines) ==============
@@ -376,6 +807,8 @@ namespace thinger::iotmp {
             while(running_) {
                 try {
                     auto ec = co_await connect();
+                    if(!ec) connect_time_->record(elapsed_us(connect_started_));
+                    if(!ec && capture_) capture_->record(capture::kind::CONNECTED, nullptr, 0);
                     if(ec) {
                         notify_state(client_state::CONNECTION_ERROR, ec.message());
                         LOG_ERROR("Connection error: {}", ec.message());
@@ -384,9 +817,12 @@ namespace thinger::iotmp {
                     } else {
                         LOG_INFO("Authenticated successfully!");
                         connected_ = true;
+                        ++connection_id_;
+                        backoff_.reset();
 
-                        // Initialize server event streams (MQTT topics, properties, etc.)
-                        co_await initialize_streams();
+                        // Writer of the connection, woken by send_frame()
+                        write_in_progress_ = true;
+                        co_spawn(get_io_context(), write_loop(), detached);
 
                         // Launch keep-alive in parallel (use socket's io_context)
                         co_spawn(get_io_context(), keep_alive_loop(), detached);
@@ -394,7 +830,15 @@ namespace thinger::iotmp {
                         // Launch stream interval loop for periodic streaming
                         co_spawn(get_io_context(), stream_interval_loop(), detached);
 
-                        notify_state(client_state::STREAMS_READY);
+                        // Initialize server event streams (MQTT topics, properties, etc.).
+                        // Responses are delivered by the read loop, which then
+                        // notifies STREAMS_READY.
+                        initialize_streams();
+
+                        // Deliver what was kept while offline
+                        if(journal_ && !journal_->empty()) {
+                            co_spawn(get_io_context(), drain_journal(), detached);
+                        }
 
                         // Message read loop
                         co_await read_loop();
@@ -408,20 +852,30 @@ namespace thinger::iotmp {
                 }
 
                 connected_ = false;
+                if(capture_) capture_->flush();
+                fail_pending_requests();
+                reset_streams();
+                write_queue_.clear();
+                wake_writable_waiters();
                 notify_state(client_state::DISCONNECTED);
                 if(keep_alive_timer_) keep_alive_timer_->cancel();
                 if(stream_timer_) stream_timer_->cancel();
+                if(write_timer_) write_timer_->cancel();
 
                 if(running_) {
-                    LOG_INFO("Reconnecting in {} seconds...", RECONNECT_DELAY.count());
-                    co_await delay(RECONNECT_DELAY);
+                    reconnects_->add();
+                    auto wait = backoff_.next();
+                    LOG_INFO("Reconnecting in {:.1f} seconds...", wait.count() / 1000.0);
+                    co_await delay(wait);
                 }
             }
+            loop_exited_.store(true, std::memory_order_release);
         }
 
         // Connect to server
         awaitable<boost::system::error_code> connect() {
             LOG_INFO("Connecting to {}:{}...", host_, port_);
+            connect_started_ = std::chrono::steady_clock::now();
             notify_state(client_state::CONNECTING);
 
             if(transport_ == transport_type::WEBSOCKET) {
@@ -429,31 +883,157 @@ namespace thinger::iotmp {
                 auto ec = co_await websocket_connect();
                 if(ec) co_return ec;
             } else {
-                // Create socket based on transport type (runtime dispatch)
-                socket_ = create_socket();
-                // Connect (thinger-http socket handles handshake internally if needed)
-                auto ec = co_await socket_->connect(host_, std::to_string(port_), CONNECT_TIMEOUT);
+                auto ec = co_await race_connect();
                 if(ec) co_return ec;
             }
 
             // Initialize timers using socket's io_context (ensures same thread)
             auto& io = socket_->get_io_context();
+            io_.store(&io, std::memory_order_release);
             keep_alive_timer_.emplace(io);
             stream_timer_.emplace(io);
+            write_timer_.emplace(io);
+            input_.clear();
+
+            // fresh liveness state for the new connection
+            rtt_.reset();
+            probe_sent_.reset();
+            probe_queued_ = false;
+            missed_probes_ = 0;
+            last_rx_ = last_tx_ = std::chrono::steady_clock::now();
+            configure_keep_alive();
+            apply_transport_profile(select_transport_profile(std::chrono::steady_clock::now()));
 
             notify_state(client_state::CONNECTED);
             LOG_INFO("Connected!");
             co_return boost::system::error_code{};
         }
 
+        // Resolve the host (through the DNS cache) and race connections to its
+        // addresses, Happy Eyeballs style (RFC 8305): attempts start every
+        // CONNECTION_ATTEMPT_DELAY, or as soon as the previous one fails,
+        // alternating address families. The first socket to connect (and
+        // complete the TLS handshake) wins, and the others are closed.
+        awaitable<boost::system::error_code> race_connect() {
+            auto& io = thinger::asio::get_workers().get_thread_io_context();
+            auto port = std::to_string(port_);
+            auto tls_ready = transport_ == transport_type::SSL ? prepare_tls(io) : nullptr;
+            auto [resolve_ec, addresses] = co_await dns_cache::instance().resolve(io, host_, port);
+            if(resolve_ec) co_return resolve_ec;
+            if(tls_ready) {
+                if(!tls_ready->context) co_await tls_ready->done.async_wait(use_nothrow_awaitable);
+                if(!running_) co_return asio::error::operation_aborted;
+                if(!tls_ready->context) co_return asio::error::timed_out;
+                register_tls_metrics(tls_ready->context);
+            }
+
+            struct race_state {
+                explicit race_state(asio::io_context& io) : done(io, asio::steady_timer::time_point::max()) {}
+                asio::steady_timer done;
+                std::vector<std::shared_ptr<asio::steady_timer>> starts;
+                std::vector<std::shared_ptr<thinger::asio::socket>> sockets;
+                std::shared_ptr<thinger::asio::socket> winner;
+                boost::system::error_code error;
+                size_t pending = 0;
+            };
+
+            auto state = std::make_shared<race_state>(io);
+            state->pending = addresses.size();
+            state->sockets.resize(addresses.size());
+            for(size_t i = 0; i < addresses.size(); ++i) {
+                state->starts.push_back(std::make_shared<asio::steady_timer>(io, CONNECTION_ATTEMPT_DELAY * i));
+            }
+
+            for(size_t i = 0; i < addresses.size(); ++i) {
+                auto address = addresses[i].address().to_string();
+                if(tls_ready) tls_ready->context->set_server_name(address, host_);
+
+                co_spawn(io, [this, state, i, address, port]() -> awaitable<void> {
+                    auto [wait_ec] = co_await state->starts[i]->async_wait(use_nothrow_awaitable);
+                    boost::system::error_code ec = asio::error::operation_aborted;
+                    if(!state->winner) {
+                        auto socket = create_socket();
+                        state->sockets[i] = socket;
+                        LOG_DEBUG("Connecting to {} ({})", address, host_);
+                        ec = co_await socket->connect(address, port, CONNECT_TIMEOUT);
+                        if(!ec && !state->winner) {
+                            state->winner = socket;
+                            for(auto& other : state->sockets) {
+                                if(other && other != socket) other->close();
+                            }
+                        } else {
+                            socket->close();
+                            if(ec) LOG_DEBUG("Connection to {} failed: {}", address, ec.message());
+                        }
+                    }
+                    if(ec && ec != asio::error::operation_aborted) state->error = ec;
+                    // a failed attempt starts the next one right away
+                    if(i + 1 < state->starts.size()) state->starts[i + 1]->cancel();
+                    if(--state->pending == 0 || state->winner) state->done.cancel();
+                }, detached);
+            }
+
+            auto [ec] = co_await state->done.async_wait(use_nothrow_awaitable);
+            if(!state->winner) co_return state->error ? state->error : asio::error::host_unreachable;
+            socket_ = state->winner;
+            co_return boost::system::error_code{};
+        }
+
+        // TLS context in use: the one set, or the process-wide one
+        std::shared_ptr<tls_context> tls() const {
+            return tls_context_ ? tls_context_ : tls_context::shared();
+        }
+
+        // TLS context being made ready for a connection. done expires after
+        // CONNECT_TIMEOUT, and is canceled once the context is set (or by stop()).
+        struct tls_preparation {
+            explicit tls_preparation(asio::io_context& io) : done(io, CONNECT_TIMEOUT) {}
+            asio::steady_timer done;
+            std::shared_ptr<tls_context> context;
+        };
+
+        // Get the TLS context on another worker thread, so building it (and
+        // initializing OpenSSL, the first time) overlaps with resolving the
+        // host. Completes on io. The handlers only hold the preparation, so
+        // they are safe to run after the client is stopped or destroyed.
+        std::shared_ptr<tls_preparation> prepare_tls(asio::io_context& io) {
+            auto preparation = std::make_shared<tls_preparation>(io);
+            asio::post(thinger::asio::get_workers().get_next_io_context(), [preferred = tls_context_, preparation]() {
+                auto context = preferred ? preferred : tls_context::shared();
+                asio::post(preparation->done.get_executor(), [preparation, context]() {
+                    preparation->context = context;
+                    preparation->done.cancel();
+                });
+            });
+            std::scoped_lock lock(tls_preparation_mutex_);
+            tls_preparation_ = preparation;
+            return preparation;
+        }
+
+        // Wake a connection waiting for its TLS context (from stop())
+        void cancel_tls_preparation() {
+            std::shared_ptr<tls_preparation> preparation;
+            {
+                std::scoped_lock lock(tls_preparation_mutex_);
+                preparation = std::move(tls_preparation_);
+            }
+            if(preparation) asio::post(preparation->done.get_executor(), [preparation]() { preparation->done.cancel(); });
+        }
+
         // WebSocket connection using thinger-http pool_client (async)
         awaitable<boost::system::error_code> websocket_connect() {
             // Build WebSocket URL
             std::string ws_url = "wss://" + host_ + ":" + std::to_string(port_) + "/iotmp";
 
-            // Use async client for WebSocket upgrade
-            thinger::http::async_client http_client;
-            auto ws_client = co_await http_client.request(ws_url).protocol("iotmp").websocket();
+            // Use async client for WebSocket upgrade. It is kept across
+            // reconnects instead of being built on every attempt, but its TLS
+            // connections are made with its own context: sessions are neither
+            // cached nor resumed for wss, only tls() connections resume.
+            if(!http_client_) {
+                http_client_ = std::make_unique<thinger::http::async_client>();
+                http_client_->verify_ssl(websocket_verify_);
+            }
+            auto ws_client = co_await http_client_->request(ws_url).protocol("iotmp").websocket();
 
             if(!ws_client) {
                 co_return boost::asio::error::connection_refused;
@@ -472,14 +1052,9 @@ namespace thinger::iotmp {
             auto& io = thinger::asio::get_workers().get_thread_io_context();
 
             switch(transport_) {
-                case transport_type::SSL: {
-                    if(!ssl_context_) {
-                        ssl_context_ = std::make_shared<boost::asio::ssl::context>(
-                            boost::asio::ssl::context::tlsv12_client);
-                        ssl_context_->set_verify_mode(boost::asio::ssl::verify_none);
-                    }
-                    return std::make_shared<thinger::asio::ssl_socket>("iotmp_client", io, ssl_context_);
-                }
+                case transport_type::SSL:
+                    // the TLS context resumes cached sessions on reconnect
+                    return std::make_shared<thinger::asio::ssl_socket>("iotmp_client", io, tls()->get());
                 case transport_type::TCP:
                     return std::make_shared<thinger::asio::tcp_socket>("iotmp_client", io);
                 case transport_type::WEBSOCKET:
@@ -493,6 +1068,7 @@ namespace thinger::iotmp {
         awaitable<bool> authenticate() {
             LOG_INFO("Authenticating as {}@{}...", device_id_, username_);
             notify_state(client_state::AUTHENTICATING);
+            auto started = std::chrono::steady_clock::now();
 
             iotmp_message connect_msg(message::type::CONNECT);
             connect_msg.set_random_stream_id();
@@ -509,134 +1085,569 @@ namespace thinger::iotmp {
             }
 
             bool success = response->get_message_type() == message::type::OK;
+            if(success) authentication_time_->record(elapsed_us(started));
             notify_state(success ? client_state::AUTHENTICATED : client_state::AUTH_FAILED);
             co_return success;
         }
 
         // Initialize server event streams (MQTT topics, properties, etc.)
-        awaitable<void> initialize_streams() {
-            static json_t dummy;
+        // All subscription requests are written back-to-back in a single batch
+        // and each response is handled as it arrives, so subscribing costs one
+        // round trip regardless of the number of events. STREAMS_READY is
+        // notified once every subscription has been answered (or failed).
+        void initialize_streams() {
+            auto remaining = std::make_shared<size_t>(events_.size());
+            std::string batch;
 
             for(auto& [event_id, event] : events_) {
-                iotmp_message request(message::type::START_STREAM);
-                request.set_random_stream_id();
-                request[message::field::RESOURCE] = static_cast<uint32_t>(event.get_resource());
-                request[message::field::PARAMETERS].swap(event.get_params());
-
-                // Send start stream request
-                if(!co_await write_message(request)) continue;
-
-                // Wait for response
-                json_t response_data;
-                bool success = co_await wait_response(request, &response_data);
-
-                if(success) {
+                uint16_t stream_id = register_request([this, &event, remaining](iotmp_message* response) {
                     // Register stream
-                    uint16_t stream_id = request.get_stream_id();
-                    auto& stream_cfg = streams_[stream_id];
-                    stream_cfg.resource = &event;
-                    stream_cfg.interval = 0;
-                    event.set_stream_id(stream_id);
-
-                    // If response has data, run the event handler with it
-                    if(!response_data.is_null() && !response_data.empty()) {
-                        iotmp_message req(message::type::RUN);
-                        req[message::field::PAYLOAD].swap(response_data);
-                        iotmp_message resp(message::type::OK);
-                        event.run_resource(req, resp);
+                    if(response && response->get_message_type() == message::type::OK &&
+                       register_stream(response->get_stream_id(), event, "$events")) {
+                        uint16_t stream_id = response->get_stream_id();
+                        event.set_stream_id(stream_id);
+
+                        // If response has data, run the event handler with it
+                        auto& response_data = (*response)[message::field::PAYLOAD];
+                        if(!response_data.is_null() && !response_data.empty()) {
+                            loop_activity activity("event");
+                            iotmp_message req(message::type::RUN);
+                            req[message::field::PAYLOAD].swap(response_data);
+                            iotmp_message resp(message::type::OK);
+                            event.run_resource(req, resp);
+                        }
                     }
+                    if(--*remaining == 0) on_streams_ready();
+                });
+
+                if(stream_id == 0) {
+                    LOG_ERROR("Cannot subscribe event {}: no free stream ids", event_id);
+                    --*remaining;
+                    continue;
                 }
 
-                // Restore params
+                iotmp_message request(stream_id, message::type::START_STREAM);
+                request[message::field::RESOURCE] = static_cast<uint32_t>(event.get_resource());
+                request[message::field::PARAMETERS].swap(event.get_params());
+                message_logger::log_outgoing(request);
+                batch.append(encode_message(request));
+                // Restore params (required again on reconnect)
                 event.get_params().swap(request[message::field::PARAMETERS]);
             }
+
+            if(!batch.empty()) send_frame(outbound_frame{0, true, std::move(batch)});
+            if(*remaining == 0) on_streams_ready();
+        }
+
+        void on_streams_ready() {
+            if(!connected_) return;
+            streams_ready_time_ = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - connect_started_);
+            streams_ready_->record(elapsed_us(connect_started_));
+            LOG_INFO("Streams ready in {} ms ({} subscriptions)", streams_ready_time_.count(), events_.size());
+            notify_state(client_state::STREAMS_READY);
         }
 
-        // Message read loop
+        // Message read loop. Frames already buffered are read without
+        // suspending, and stream data for open streams is handled in place.
         awaitable<void> read_loop() {
+            frame_header header;
             while(running_ && connected_) {
-                auto message = co_await read_message();
-                if(!message) break;
-                co_spawn(get_io_context(), handle_message(std::move(*message)), detached);
+                if(!frame_buffered(header) && !co_await read_frame(header)) break;
+                last_rx_ = std::chrono::steady_clock::now();
+
+                if(header.type == message::STREAM_DATA) {
+                    reset_stream_data();
+                    decode_frame(header, stream_data_);
+                    auto it = streams_.find(stream_data_.get_stream_id());
+                    if(it != streams_.end() && it->second.resource) {
+                        handle_stream_data(*it->second.resource, stream_data_);
+                    } else {
+                        co_spawn(get_io_context(), handle_message(stream_data_), detached);
+                    }
+                    continue;
+                }
+
+                iotmp_message message(static_cast<message::type>(header.type));
+                decode_frame(header, message);
+                if(message.get_message_type() == message::KEEP_ALIVE) {
+                    on_keep_alive();
+                    continue;
+                }
+                // Responses to our own requests go straight to their waiter
+                if(is_response(message) && complete_request(message.get_stream_id(), &message)) {
+                    continue;
+                }
+                co_spawn(get_io_context(), handle_message(std::move(message)), detached);
             }
         }
 
-        // Read a complete message (returns nullopt on connection error)
-        awaitable<std::optional<iotmp_message>> read_message() {
-            // Read header: type (1 byte) + size (varint)
-            uint8_t type_byte;
-            {
-                auto [ec, n] = co_await socket_->read(&type_byte, 1);
-                if(ec) co_return std::nullopt;
+        static bool is_response(const iotmp_message& msg) {
+            return msg.get_message_type() <= message::type::ERROR;
+        }
+
+        // Run an operation on the connection io_context, hopping there first
+        // when the caller lives on another executor
+        template<typename T>
+        awaitable<T> on_connection(awaitable<T> operation) {
+            auto& io = get_io_context();
+            if(io.get_executor().running_in_this_thread()) {
+                co_return co_await std::move(operation);
             }
+            co_return co_await co_spawn(io, std::move(operation), use_awaitable);
+        }
+
+        // Queue a message without waiting for any response
+        awaitable<bool> enqueue_message(iotmp_message& msg) {
+            if(!connected_) co_return false;
+            send_message(msg);
+            co_return true;
+        }
 
-            auto size = co_await read_varint();
-            if(!size) co_return std::nullopt;
+        // Register a request and send it, suspending until its response arrives
+        awaitable<std::optional<iotmp_message>> request_response(iotmp_message& request) {
+            struct response_state {
+                explicit response_state(asio::io_context& io)
+                    : signal(io, asio::steady_timer::time_point::max()) {}
+                asio::steady_timer signal;
+                std::optional<iotmp_message> response;
+                bool done = false;
+            };
+
+            if(!connected_) co_return std::nullopt;
+
+            auto state = std::make_shared<response_state>(get_io_context());
+            uint16_t stream_id = register_request([state](iotmp_message* response) {
+                if(response) state->response.emplace(std::move(*response));
+                state->done = true;
+                state->signal.cancel();
+            });
 
-            if(*size > MAX_MESSAGE_SIZE) {
-                LOG_ERROR("Message too large: {} bytes", *size);
+            if(stream_id == 0) {
+                LOG_ERROR("Cannot send request: no free stream ids");
                 co_return std::nullopt;
             }
 
-            iotmp_message message(static_cast<message::type>(type_byte));
+            request.set_stream_id(stream_id);
+            send_message(request);
+
+            if(!state->done) {
+                auto [ec] = co_await state->signal.async_wait(use_nothrow_awaitable);
+            }
+            co_return std::move(state->response);
+        }
+
+        // Allocate a stream id and register the handler for its response. The
+        // handler runs exactly once: on response, deadline or disconnection.
+        // Returns 0 if no stream id is available.
+        uint16_t register_request(response_handler handler) {
+            uint16_t stream_id = stream_ids_.allocate();
+            if(stream_id == 0) return 0;
+
+            auto deadline = std::make_shared<asio::steady_timer>(get_io_context(), request_timeout_);
+            deadline->async_wait([this, stream_id, timer = deadline.get()](const boost::system::error_code& ec) {
+                if(ec) return;
+                // the id may already belong to a newer request
+                auto it = pending_requests_.find(stream_id);
+                if(it == pending_requests_.end() || it->second.deadline.get() != timer) return;
+                LOG_WARNING("Request timed out (stream id {})", stream_id);
+                complete_request(stream_id, nullptr);
+            });
+
+            pending_requests_[stream_id] = pending_request{std::move(deadline), std::move(handler)};
+            return stream_id;
+        }
+
+        awaitable<bool> writable_wait(uint16_t stream_id) {
+            while(connected_ && !write_queue_.writable(stream_id)) {
+                auto timer = std::make_shared<asio::steady_timer>(get_io_context(), asio::steady_timer::time_point::max());
+                auto it = writable_waiters_.emplace(stream_id, timer);
+                auto [ec] = co_await timer->async_wait(use_nothrow_awaitable);
+                writable_waiters_.erase(it);
+            }
+            co_return connected_.load();
+        }
+
+        // Resume the waiters whose stream is writable again (all on
+        // disconnect). Only called when a congestion clears, see take_relieved().
+        void wake_writable_waiters() {
+            for(auto& [stream_id, timer] : writable_waiters_) {
+                if(!connected_ || write_queue_.writable(stream_id)) timer->cancel();
+            }
+        }
+
+        // Complete a pending request, releasing its stream id
+        bool complete_request(uint16_t stream_id, iotmp_message* response) {
+            auto it = pending_requests_.find(stream_id);
+            if(it == pending_requests_.end()) return false;
+            auto pending = std::move(it->second);
+            pending_requests_.erase(it);
+            stream_ids_.release(stream_id);
+            pending.deadline->cancel();
+            pending.handler(response);
+            return true;
+        }
+
+        // Fail every in-flight request (connection lost)
+        void fail_pending_requests() {
+            auto pending = std::move(pending_requests_);
+            pending_requests_.clear();
+            for(auto& [stream_id, request] : pending) {
+                stream_ids_.release(stream_id);
+                request.deadline->cancel();
+                request.handler(nullptr);
+            }
+        }
 
-            if(*size > 0) {
-                read_buffer_.resize(*size);
-                auto [ec, n] = co_await socket_->read(read_buffer_.data(), *size);
-                if(ec) co_return std::nullopt;
+        // Track an open stream, reserving its id so requests cannot reuse it.
+        // Fails if the id belongs to a pending request, as their messages
+        // could not be told apart (a stream may be started again, though).
+        bool register_stream(uint16_t stream_id, iotmp_resource& resource, std::string_view path, unsigned int interval = 0,
+                             std::string_view target = {}) {
+            if(!stream_ids_.mark(stream_id) && !streams_.contains(stream_id)) {
+                LOG_WARNING("Cannot open stream {}: its id is in use by a pending request", stream_id);
+                return false;
+            }
+            auto& stats = resource_stats(path);
+            auto& stream_cfg = streams_[stream_id];
+            stream_cfg.resource = &resource;
+            stream_cfg.interval = interval;
+            stream_cfg.received = stats.received;
+            stream_cfg.sent = stats.sent;
+            stream_cfg.path = path.data();
+            stream_cfg.target = target.empty() ? path : target;
+            stream_cfg.stats = stream_stats();
+            write_queue_.reset_priority(stream_id);
+            return true;
+        }
+
+        void unregister_stream(uint16_t stream_id) {
+            streams_.erase(stream_id);
+            stream_ids_.release(stream_id);
+            write_queue_.reset_priority(stream_id);
+            write_queue_.forget(stream_id);
+        }
 
-                memory_reader reader(read_buffer_.data(), *size);
+        // Streams do not survive the connection, so forget them on disconnect
+        void reset_streams() {
+            for(auto& [stream_id, config] : streams_) {
+                if(config.resource && config.resource->get_stream_id() == stream_id) {
+                    config.resource->set_stream_id(0);
+                }
+            }
+            streams_.clear();
+            stream_ids_.reset();
+        }
+
+        // Read a complete message (returns nullopt on connection error).
+        // Frames are decoded from the input buffer, which only goes back to
+        // the socket once it holds no complete frame.
+        awaitable<std::optional<iotmp_message>> read_message() {
+            frame_header header;
+            if(!co_await read_frame(header)) co_return std::nullopt;
+            last_rx_ = std::chrono::steady_clock::now();
+            iotmp_message message(static_cast<message::type>(header.type));
+            decode_frame(header, message);
+            co_return message;
+        }
+
+        // Whether the input buffer holds a complete frame, parsing its header
+        bool frame_buffered(frame_header& header) const {
+            return parse_frame_header(input_.data(), input_.size(), header) == frame_parse::COMPLETE &&
+                   header.size <= MAX_MESSAGE_SIZE && input_.size() >= header.length + header.size;
+        }
+
+        // Fill the input buffer until it holds a complete frame (returns
+        // false on connection error)
+        awaitable<bool> read_frame(frame_header& header) {
+            // Header: type (1 byte) + size (varint)
+            for(;;) {
+                size_t needed = 1;
+                auto parsed = parse_frame_header(input_.data(), input_.size(), header);
+                if(parsed == frame_parse::INVALID) {
+                    LOG_ERROR("Varint too large");
+                    co_return false;
+                }
+                if(parsed == frame_parse::COMPLETE) {
+                    if(header.size > MAX_MESSAGE_SIZE) {
+                        LOG_ERROR("Message too large: {} bytes", header.size);
+                        co_return false;
+                    }
+                    size_t frame_size = header.length + header.size;
+                    if(input_.size() >= frame_size) co_return true;
+                    needed = frame_size - input_.size();
+                }
+                if(!co_await fill_input(needed)) co_return false;
+            }
+        }
+
+        // Decode the buffered frame into a message and consume it
+        void decode_frame(const frame_header& header, iotmp_message& message) {
+            size_t frame_size = header.length + header.size;
+            if(capture_) capture_->record(capture::kind::INBOUND, input_.data(), frame_size);
+
+            if(header.size > 0) {
+                memory_reader reader(input_.data() + header.length, header.size);
                 iotmp_decoder<memory_reader> decoder(reader);
-                decoder.decode(message, *size);
+                decoder.decode(message, header.size);
             }
+            input_.consume(frame_size);
+            if(shrink_bytes_) shrink_buffers(frame_size);
 
+            count_message(messages_received_, header.type);
+            // last_rx_ is the time the frame was read (only evaluated while traced)
+            IOTMP_TRACE(message_received, header.type, message.get_stream_id(), frame_size, elapsed_us(last_rx_));
             if(message.get_message_type() != message::STREAM_DATA) {
                 message_logger::log_incoming(message);
+            } else if(auto it = streams_.find(message.get_stream_id()); it != streams_.end()) {
+                if(it->second.received) it->second.received->add(frame_size);
+                it->second.stats.record_received(frame_size, last_rx_);
             }
+        }
 
-            co_return message;
+        // Get the message kept for inbound stream data ready for the next
+        // frame. Its payload keeps its storage: binary chunks are decoded
+        // into it, so a frame without payload reads as an empty one.
+        void reset_stream_data() {
+            auto& fields = stream_data_.get_fields();
+            for(auto it = fields.begin(); it != fields.end();) {
+                if(it->first == message::field::STREAM_ID || it->first == message::field::PAYLOAD) ++it;
+                else it = fields.erase(it);
+            }
+            stream_data_.set_stream_id(0);
+            auto& payload = stream_data_.payload();
+            if(payload.is_binary()) payload.get_binary().clear();
+            else payload = nullptr;
         }
 
-        // Read varint from socket (returns nullopt on error)
-        awaitable<std::optional<uint32_t>> read_varint() {
-            uint32_t value = 0;
-            uint8_t bit_pos = 0;
-            uint8_t byte;
+        // Read what the socket has available, making room for at least
+        // needed bytes
+        awaitable<bool> fill_input(size_t needed) {
+            static constexpr size_t MIN_READ = 4096;
+            auto space = input_.prepare(std::max(needed, MIN_READ));
+            memory_.set(memory_accounting::subsystem::INPUT_BUFFER, input_.capacity());
+            auto [ec, n] = co_await socket_->read_some(space.data(), space.size());
+            if(ec || n == 0) co_return false;
+            input_.commit(n);
+            co_return true;
+        }
 
-            do {
-                auto [ec, n] = co_await socket_->read(&byte, 1);
-                if(ec) co_return std::nullopt;
-                value |= static_cast<uint32_t>(byte & 0x7F) << bit_pos;
-                bit_pos += 7;
-                if(bit_pos >= 32) {
-                    LOG_ERROR("Varint too large");
-                    co_return std::nullopt;
+        // See set_buffer_shrink()
+        void shrink_buffers(size_t frame_size) {
+            auto now = std::chrono::steady_clock::now();
+            if(frame_size > shrink_bytes_) {
+                last_large_frame_ = now;
+                return;
+            }
+            if(now - last_large_frame_ < shrink_delay_) return;
+            if(input_.capacity() > shrink_bytes_ && input_.shrink(input_buffer::DEFAULT_CAPACITY)) {
+                LOG_DEBUG("Receive buffer shrunk to {} bytes", input_.capacity());
+                memory_.set(memory_accounting::subsystem::INPUT_BUFFER, input_.capacity());
+            }
+            // the batch is in use while a write is in progress
+            if(write_batch_.capacity() > shrink_bytes_ && !write_in_progress_) {
+                std::string().swap(write_batch_);
+                memory_.set(memory_accounting::subsystem::WRITE_BATCH, write_batch_.capacity());
+            }
+            frame_pool_.trim(shrink_bytes_);
+        }
+
+        // The pool keeps a buffer for every frame the write queue holds below
+        // its high watermarks, so producers that fill it still recycle them
+        void size_frame_pool() {
+            frame_pool_.set_max_bytes(std::max(write_queue_.high_watermark(), write_queue_.stream_high_watermark()));
+        }
+
+        // Keep a fire-and-forget call for the next connection. Bucket
+        // samples are stamped now, or the server would stamp them with the
+        // time they are delivered.
+        bool store_offline(iotmp_message& message) {
+            if(!journal_ || message.get_message_type() != message::RUN) return false;
+            if(message.has_field(message::field::RESOURCE) &&
+               message[message::field::RESOURCE] == static_cast<uint32_t>(server::run::WRITE_BUCKET) &&
+               message.has_field(message::field::PAYLOAD)) {
+                stamp_samples(message[message::field::PAYLOAD], std::chrono::system_clock::now());
+            }
+            if(!journal_->append(encode_message(message))) return false;
+            arm_journal_commit();
+            return true;
+        }
+
+        // Give bucket samples without a "ts" the given time (milliseconds
+        // since epoch), as bucket_writer does: an array is a batch of
+        // samples, and samples that are not objects are wrapped as
+        // {"value": sample}
+        static void stamp_samples(json_t& data, std::chrono::system_clock::time_point time) {
+            auto ts = std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count();
+            auto stamp = [ts](json_t& sample) {
+                if(!sample.is_object()) sample = json_t{{"value", std::move(sample)}};
+                if(!sample.contains("ts")) sample["ts"] = ts;
+            };
+            if(data.is_null()) return;
+            if(!data.is_array()) return stamp(data);
+            for(auto& sample : data) stamp(sample);
+        }
+
+        // Commit what was journaled within journal::COMMIT_INTERVAL, even if
+        // nothing is appended or consumed after it (i.e., a burst of offline
+        // calls followed by silence). The timer only holds the journal weakly.
+        void arm_journal_commit() {
+            if(!journal_->needs_deadline()) return;
+            auto timer = std::make_shared<asio::steady_timer>(thinger::asio::get_workers().get_next_io_context(),
+                                                             journal::COMMIT_INTERVAL);
+            timer->async_wait([timer, store = std::weak_ptr<journal>(journal_)](const boost::system::error_code&) {
+                if(auto pending = store.lock()) pending->commit_pending();
+            });
+        }
+
+        // Send the journal backlog as bulk data, so live traffic of every class
+        // goes first, and at most journal_rate_ bytes per second. A batch is
+        // only consumed once it left the write queue, so a disconnection
+        // mid-way sends it again on the next connection.
+        awaitable<void> drain_journal() {
+            asio::steady_timer timer(get_io_context());
+            write_queue_.set_priority(JOURNAL_STREAM, stream_priority::BULK);
+            LOG_INFO("Sending {} journaled messages", journal_->size());
+
+            // a batch queued on a previous connection was never sent
+            auto connection = connection_id_;
+            auto current = [this, connection]() { return connected_ && connection_id_ == connection; };
+
+            std::vector<std::string> frames;
+            size_t sent = 0;
+            while(running_ && current() && !journal_->empty()) {
+                frames.clear();
+                size_t budget = std::max<size_t>(journal_rate_ * JOURNAL_DRAIN_INTERVAL.count() / 1000, 1);
+                size_t bytes = journal_->peek(budget, frames);
+                size_t records = frames.size();
+                // consumed once written to this connection, not just dequeued
+                size_t written = journal_written_;
+                size_t queued = 0;
+                for(auto& frame : frames) {
+                    queued += frame.size();
+                    send_frame(outbound_frame{JOURNAL_STREAM, false, std::move(frame)});
                 }
-            } while(byte & 0x80);
 
-            co_return value;
+                do {
+                    timer.expires_after(JOURNAL_DRAIN_INTERVAL);
+                    auto [ec] = co_await timer.async_wait(use_nothrow_awaitable);
+                    if(ec) co_return;
+                } while(current() && journal_written_ - written < queued);
+                if(!current()) co_return;
+
+                journal_->consume(bytes, records);
+                arm_journal_commit();
+                sent += records;
+            }
+            LOG_INFO("Journal: {} messages sent, {} pending", sent, journal_->size());
         }
 
-        // Send message (fire-and-forget using co_spawn)
+        // Send message (fire-and-forget, any thread)
         void send_message(iotmp_message& message) {
-            if(message.get_message_type() != message::STREAM_DATA) {
-                message_logger::log_outgoing(message);
+            if(try_send(message) == send_result::QUEUE_FULL) {
+                LOG_WARNING("Send queue full, dropping message (stream id {})", message.get_stream_id());
             }
+        }
 
-            write_queue_.emplace(encode_message(message));
+        // Schedule a single drain of the cross-thread queue on the connection thread
+        void schedule_outbox_drain(asio::io_context& io) {
+            if(outbox_drain_scheduled_.exchange(true)) return;
+            asio::post(io, [this]() { drain_outbox(); });
+        }
 
+        void drain_outbox() {
+            // clear the flag before popping, so a producer pushing after the
+            // last pop always schedules a new drain
+            outbox_drain_scheduled_.store(false);
+            while(auto frame = outbox_->try_pop()) {
+                // frames queued for a previous connection are dropped
+                if(connected_) send_frame(std::move(*frame), true);
+                else write_queue_.cancel_reservation(frame->data.size());
+            }
+        }
+
+        // Queue an already encoded frame (or several, back-to-back). Frames
+        // from the outbox come with their bytes reserved, see try_queue().
+        void send_frame(outbound_frame frame, bool reserved = false) {
+            IOTMP_TRACE(message_queued, frame.stream_id, frame.control, frame.data.size(), write_queue_.bytes());
+            if(capture_) capture_->record(capture::kind::OUTBOUND, frame.data.data(), frame.data.size());
+            if(reserved) write_queue_.push_reserved(std::move(frame));
+            else write_queue_.push(std::move(frame));
+
+            // wake the writer up
             if(!write_in_progress_) {
                 write_in_progress_ = true;
-                co_spawn(get_io_context(), process_write_queue(), detached);
+                if(write_timer_) write_timer_->cancel();
             }
         }
 
-        // Process write queue (coroutine-based)
-        awaitable<void> process_write_queue() {
-            while(!write_queue_.empty() && connected_ && socket_) {
-                auto data = std::move(write_queue_.front());
-                write_queue_.pop();
+        // Writer of a connection (coroutine-based), spawned once it is
+        // authenticated. Writes the queued frames and sleeps on write_timer_
+        // while the queue is empty, so bursts do not spawn a coroutine each.
+        // Frames queued behind each other are written together, see
+        // set_frame_coalescing(). Written frame buffers go back to the pool.
+        awaitable<void> write_loop() {
+            auto connection = connection_id_;
+            auto current = [this, connection]() { return connected_ && connection_id_ == connection && socket_; };
+            bool corked = false;
+            while(current() && write_timer_) {
+                if(write_queue_.empty()) {
+                    if(corked) {
+                        set_cork(native_socket(), false);
+                        corked = false;
+                    }
+                    write_in_progress_ = false;
+                    write_timer_->expires_at(asio::steady_timer::time_point::max());
+                    co_await write_timer_->async_wait(use_nothrow_awaitable);
+                    continue;
+                }
 
+                auto now = std::chrono::steady_clock::now();
+                auto frame = write_queue_.pop(now);
+                count_sent(*frame, now);
+                if(write_queue_.take_relieved()) wake_writable_waiters();
+                size_t frames = 1;
+                bool probe = frame->probe;
+                size_t journal_bytes = journal_frame_bytes(*frame);
+
+                // a lone stream data frame waits a little for company
+                auto budget = coalesce_delay();
+                if(budget.count() > 0 && !frame->control && write_queue_.empty() &&
+                   now < frame->enqueued + budget) {
+                    asio::steady_timer timer(get_io_context(), frame->enqueued + budget);
+                    co_await timer.async_wait(use_nothrow_awaitable);
+                    if(!connected_ || !socket_) break;
+                    now = std::chrono::steady_clock::now();
+                }
+
+                std::string_view data = frame->data;
+                if(!write_queue_.empty() && data.size() < coalesce_bytes_) {
+                    write_batch_.assign(data);
+                    // a frame that would overflow the batch waits for the next write
+                    while(write_batch_.size() < coalesce_bytes_) {
+                        auto next = write_queue_.pop(now, coalesce_bytes_ - write_batch_.size());
+                        if(!next) break;
+                        count_sent(*next, now);
+                        probe |= next->probe;
+                        journal_bytes += journal_frame_bytes(*next);
+                        write_batch_.append(next->data);
+                        frame_pool_.release(std::move(next->data));
+                        ++frames;
+                    }
+                    if(write_queue_.take_relieved()) wake_writable_waiters();
+                    memory_.set(memory_accounting::subsystem::WRITE_BATCH, write_batch_.capacity());
+                    data = write_batch_;
+                }
+
+                auto profile = select_transport_profile(now);
+                if(profile != active_profile_.load(std::memory_order_relaxed)) apply_transport_profile(profile);
+                // more frames behind this one: let the kernel pack them
+                if(!corked && socket_options_.cork && !write_queue_.empty()) {
+                    corked = !set_cork(native_socket(), true);
+                }
+
+                // a probe only samples the RTT if nothing waits ahead of it
+                bool clean_probe = probe && frames == 1 && unsent_bytes(native_socket()) == 0;
                 auto [ec, bytes] = co_await socket_->write(reinterpret_cast<const uint8_t*>(data.data()), data.size());
                 if(ec) {
                     LOG_ERROR("Write error: {}", ec.message());
@@ -644,8 +1655,24 @@ namespace thinger::iotmp {
                     if(socket_) socket_->close();
                     break;
                 }
+                last_tx_ = std::chrono::steady_clock::now();
+                if(connection == connection_id_) journal_written_ += journal_bytes;
+                if(probe && connection == connection_id_) on_probe_written(clean_probe);
+                IOTMP_TRACE(write_done, frames, data.size(), elapsed_us(frame->enqueued, now), elapsed_us(now, last_tx_));
+                frame_pool_.release(std::move(frame->data));
             }
-            write_in_progress_ = false;
+            if(corked && current()) set_cork(native_socket(), false);
+            if(connection == connection_id_) write_in_progress_ = false;
+        }
+
+        static size_t journal_frame_bytes(const outbound_frame& frame) {
+            return !frame.control && frame.stream_id == JOURNAL_STREAM ? frame.data.size() : 0;
+        }
+
+        std::chrono::microseconds coalesce_delay() const {
+            if(coalesce_delay_) return *coalesce_delay_;
+            if(transport_ == transport_type::WEBSOCKET) return WEBSOCKET_COALESCE_DELAY;
+            return std::chrono::microseconds(0);
         }
 
         // Write message and wait for completion (coroutine)
@@ -654,7 +1681,10 @@ namespace thinger::iotmp {
                 message_logger::log_outgoing(message);
             }
 
+            count_message(messages_sent_, message.get_message_type());
             auto encoded = encode_message(message);
+            if(capture_) record_outbound(message, encoded);
+            auto started = std::chrono::steady_clock::now();
             auto [ec, bytes] = co_await socket_->write(reinterpret_cast<const uint8_t*>(encoded.data()), encoded.size());
             if(ec) {
                 LOG_ERROR("Write error: {}", ec.message());
@@ -662,24 +1692,201 @@ namespace thinger::iotmp {
                 if(socket_) socket_->close();
                 co_return false;
             }
+            IOTMP_TRACE(write_done, 1, encoded.size(), 0, elapsed_us(started));
             co_return true;
         }
 
-        // Keep-alive loop
+        // Captures are handed around as benchmarks: CONNECT is recorded
+        // without its payload, so the credentials never reach the file
+        void record_outbound(iotmp_message& message, const std::string& encoded) {
+            if(message.get_message_type() != message::type::CONNECT) {
+                capture_->record(capture::kind::OUTBOUND, encoded.data(), encoded.size());
+                return;
+            }
+            iotmp_message redacted(message.get_stream_id(), message::type::CONNECT);
+            auto frame = encode_message(redacted);
+            capture_->record(capture::kind::OUTBOUND, frame.data(), frame.size());
+        }
+
+        // Keep-alive loop: probes the server once either direction has been
+        // idle for the keep-alive interval, so no probes are sent while
+        // traffic flows both ways, and closes the connection when max_missed
+        // probes in a row go unanswered. A probe is timed from the moment it
+        // was written, and it is not missed while the uplink is still busy:
+        // its echo may be waiting behind our own data.
         awaitable<void> keep_alive_loop() {
-            while(running_ && connected_ && keep_alive_timer_) {
-                keep_alive_timer_->expires_after(KEEP_ALIVE_INTERVAL);
+            using clock = std::chrono::steady_clock;
+            auto connection = connection_id_;
+            std::optional<clock::time_point> miss_at;   // when the written probe counts as missed
+            clock::time_point tx_mark;                  // last_tx_ when it was last checked
+            while(running_ && connected_ && connection_id_ == connection && keep_alive_timer_) {
+                clock::time_point deadline;
+                if(probe_queued_) {
+                    // woken up by on_probe_written()
+                    deadline = clock::time_point::max();
+                } else if(probe_sent_) {
+                    if(!miss_at) {
+                        miss_at = *probe_sent_ + probe_timeout();
+                        tx_mark = last_tx_;
+                    }
+                    deadline = *miss_at;
+                } else {
+                    deadline = std::min(last_rx_, last_tx_) + keep_alive_.interval;
+                }
+                if(clock::now() < deadline) {
+                    keep_alive_timer_->expires_at(deadline);
+                    // expired, or canceled by a probe write, stop() or a disconnect
+                    co_await keep_alive_timer_->async_wait(use_nothrow_awaitable);
+                    continue;
+                }
+                if(!connected_ || connection_id_ != connection) break;
+
+                if(probe_sent_) {
+                    // no echo, but the server is still sending: it is alive
+                    if(last_rx_ > *probe_sent_) {
+                        probe_sent_.reset();
+                        miss_at.reset();
+                        missed_probes_ = 0;
+                        continue;
+                    }
+                    // still writing (or the kernel still holds our data, for
+                    // at most the dead peer timeout): wait for another timeout
+                    auto now = clock::now();
+                    bool progressing = last_tx_ > tx_mark;
+                    bool backlog = uplink_busy() && now - last_tx_ < keep_alive_.dead_peer_timeout();
+                    if(progressing || backlog) {
+                        miss_at = now + probe_timeout();
+                        tx_mark = last_tx_;
+                        continue;
+                    }
+                    if(++missed_probes_ >= std::max(keep_alive_.max_missed, 1u)) {
+                        LOG_WARNING("No response to {} keep-alive probes, closing connection", missed_probes_);
+                        connected_ = false;
+                        if(socket_) socket_->close();
+                        break;
+                    }
+                    LOG_DEBUG("Keep-alive probe {} unanswered", missed_probes_);
+                }
 
-                auto [ec] = co_await keep_alive_timer_->async_wait(use_nothrow_awaitable);
+                miss_at.reset();
+                send_probe();
+            }
+        }
 
-                if(ec) break;
+        // Queue a KEEP_ALIVE probe; probe_sent_ is set once it is written
+        void send_probe() {
+            iotmp_message ka(message::type::KEEP_ALIVE);
+            message_logger::log_outgoing(ka);
+            outbound_frame frame{ka.get_stream_id(), true, frame_pool_.acquire()};
+            frame.probe = true;
+            encode_message(ka, frame.data);
+            probe_sent_.reset();
+            probe_queued_ = true;
+            send_frame(std::move(frame));
+            LOG_DEBUG("Keep-alive queued");
+        }
 
-                if(connected_) {
-                    iotmp_message ka(message::type::KEEP_ALIVE);
-                    send_message(ka);
-                    LOG_DEBUG("Keep-alive sent");
-                }
+        // The probe left the write queue and the socket accepted it
+        void on_probe_written(bool sampled) {
+            if(!probe_queued_) return;
+            probe_queued_ = false;
+            probe_sampled_ = sampled;
+            probe_sent_ = last_tx_;
+            if(keep_alive_timer_) keep_alive_timer_->cancel();
+            LOG_DEBUG("Keep-alive sent");
+        }
+
+        // Data of ours not written or not acknowledged yet
+        bool uplink_busy() {
+            return write_in_progress_ || !write_queue_.empty() || unsent_bytes(native_socket()) > 0;
+        }
+
+        // KEEP_ALIVE from the server, normally the echo of our probe. Only
+        // first probes written with nothing queued ahead of them are sampled:
+        // the echo of a retried probe could belong to any of them (Karn's
+        // algorithm), and local queueing is not round-trip time.
+        void on_keep_alive() {
+            if(!probe_sent_) {
+                LOG_DEBUG("Keep-alive received");
+                return;
+            }
+            if(missed_probes_ == 0 && probe_sampled_) {
+                rtt_.sample(std::chrono::duration_cast<std::chrono::microseconds>(last_rx_ - *probe_sent_));
+                LOG_DEBUG("Keep-alive echo, rtt: {} us (srtt: {} us, rttvar: {} us)",
+                    rtt_.last().count(), rtt_.srtt().count(), rtt_.rttvar().count());
             }
+            probe_sent_.reset();
+            missed_probes_ = 0;
+        }
+
+        // Time to wait for a probe echo: the RTT based timeout, doubled on
+        // every miss and clamped by the policy
+        std::chrono::microseconds probe_timeout() const {
+            auto timeout = rtt_.timeout() * (1 << std::min(missed_probes_, 8u));
+            return std::clamp<std::chrono::microseconds>(timeout,
+                keep_alive_.min_probe_timeout, keep_alive_.max_probe_timeout);
+        }
+
+        // Native handle of the TCP connection, or -1 (WebSocket transport,
+        // closed socket)
+        int native_socket() {
+            auto tcp = std::dynamic_pointer_cast<thinger::asio::tcp_socket>(socket_);
+            return tcp ? tcp->get_socket().native_handle() : -1;
+        }
+
+        // Profile for the traffic queued right now. Streams count as active
+        // while they queued data within PROFILE_ACTIVITY_WINDOW; interactive
+        // activity wins, as a keystroke should not wait behind a deep kernel
+        // backlog.
+        transport_profile select_transport_profile(std::chrono::steady_clock::time_point now) const {
+            auto profile = transport_profile_.load(std::memory_order_relaxed);
+            if(profile != transport_profile::AUTO) return profile;
+            bool bulk = now - write_queue_.last_push(stream_priority::BULK) < PROFILE_ACTIVITY_WINDOW;
+            bool interactive = now - write_queue_.last_push(stream_priority::INTERACTIVE) < PROFILE_ACTIVITY_WINDOW;
+            return bulk && !interactive ? transport_profile::BULK : transport_profile::INTERACTIVE;
+        }
+
+        void apply_transport_profile(transport_profile profile) {
+            active_profile_.store(profile, std::memory_order_relaxed);
+            socket_options_ = profile_options(profile);
+            int fd = native_socket();
+            if(fd < 0) return;
+            if(auto error = apply_socket_options(fd, socket_options_)) {
+                LOG_WARNING("Cannot set {}: {}", error->option, std::strerror(error->error));
+            }
+            LOG_DEBUG("Transport profile: {}", to_string(profile));
+        }
+
+        // Mirror the keep-alive policy in the kernel (SSL and TCP transports):
+        // TCP keepalive probes an idle connection even if the io thread is
+        // busy, and TCP_USER_TIMEOUT aborts the connection when written data
+        // stays unacknowledged, so a half-open connection is also noticed
+        // while sending
+        void configure_keep_alive() {
+            int fd = native_socket();
+            if(fd < 0) return;
+
+            auto set_option = [fd](int level, int option, int value, const char* name) {
+                if(auto error = set_socket_option(fd, level, option, value, name)) {
+                    LOG_WARNING("Cannot set {}: {}", error->option, std::strerror(error->error));
+                }
+            };
+            set_option(SOL_SOCKET, SO_KEEPALIVE, 1, "SO_KEEPALIVE");
+            auto seconds = [](auto duration) {
+                return std::max(1, static_cast<int>(std::chrono::ceil<std::chrono::seconds>(duration).count()));
+            };
+#ifdef TCP_KEEPIDLE
+            set_option(IPPROTO_TCP, TCP_KEEPIDLE, seconds(keep_alive_.interval), "TCP_KEEPIDLE");
+#endif
+#ifdef TCP_KEEPINTVL
+            set_option(IPPROTO_TCP, TCP_KEEPINTVL, seconds(keep_alive_.max_probe_timeout), "TCP_KEEPINTVL");
+#endif
+#ifdef TCP_KEEPCNT
+            set_option(IPPROTO_TCP, TCP_KEEPCNT, static_cast<int>(std::max(keep_alive_.max_missed, 1u)), "TCP_KEEPCNT");
+#endif
+#ifdef TCP_USER_TIMEOUT
+            set_option(IPPROTO_TCP, TCP_USER_TIMEOUT, static_cast<int>(keep_alive_.dead_peer_timeout().count()), "TCP_USER_TIMEOUT");
+#endif
         }
 
         // Stream interval loop - handles periodic streaming of resources
@@ -712,7 +1919,7 @@ namespace thinger::iotmp {
         }
 
         // Delay helper
-        awaitable<void> delay(std::chrono::seconds duration) {
+        awaitable<void> delay(std::chrono::milliseconds duration) {
             try {
                 // Use current thread's io_context (works even without socket)
                 auto& io = thinger::asio::get_workers().get_thread_io_context();
@@ -726,10 +1933,6 @@ namespace thinger::iotmp {
         // Handle received message (coroutine - may dispatch blocking work to thread pool)
         awaitable<void> handle_message(iotmp_message message) {
             switch(message.get_message_type()) {
-                case message::KEEP_ALIVE:
-                    LOG_DEBUG("Keep-alive received");
-                    break;
-
                 case message::RUN:
                 case message::DESCRIBE:
                 case message::START_STREAM:
@@ -785,19 +1988,32 @@ namespace thinger::iotmp {
             return res_idx == res_path.size() && req_idx == req_path.size();
         }
 
-        // Find resource by path
-        iotmp_resource* get_resource(const std::string& request_path, json_t& path_matches) {
+        // Find resource by path, and the path it was defined with
+        iotmp_resource* get_resource(const std::string& request_path, json_t& path_matches, std::string_view* matched = nullptr) {
             for(auto& [resource_path, resource] : resources_) {
                 if(matches(resource_path, request_path, path_matches)) {
+                    if(matched) *matched = resource_path;
                     return &resource;
                 }
             }
             return nullptr;
         }
 
+        // Pool for blocking resource executions, started by the first call so
+        // its threads are not created before the client connects
+        asio::thread_pool& resource_pool() {
+            std::scoped_lock lock(resource_pool_mutex_);
+            if(!resource_pool_) {
+                resource_pool_ = std::make_shared<asio::thread_pool>(std::min(std::thread::hardware_concurrency(), 4u));
+                owns_resource_pool_ = true;
+            }
+            return *resource_pool_;
+        }
+
         // Handle resource request (coroutine - RUN dispatches to thread pool)
         awaitable<void> handle_resource_request(iotmp_message& request) {
             iotmp_resource* resource = nullptr;
+            std::string_view resource_path;
 
             auto msg_type = request.get_message_type();
             if(msg_type == message::STREAM_DATA || msg_type == message::STOP_STREAM) {
@@ -810,7 +2026,7 @@ namespace thinger::iotmp {
             if(!resource && request.has_field(message::field::RESOURCE)) {
                 const auto& res = request[message::field::RESOURCE];
                 if(res.is_string()) {
-                    resource = get_resource(res.get<std::string>(), request[0]);
+                    resource = get_resource(res.get<std::string>(), request[0], &resource_path);
                 }
             }
 
@@ -836,12 +2052,22 @@ namespace thinger::iotmp {
                 case message::RUN: {
                     iotmp_message response(request.get_stream_id(), message::type::OK);
                     std::function<void()> after_response;
+                    auto& stats = resource_stats(resource_path);
+                    auto queued = std::chrono::steady_clock::now();
                     // Dispatch blocking resource execution to thread pool
                     // After co_await, execution resumes on io_context (safe for send_message)
-                    bool success = co_await co_spawn(resource_pool_.get_executor(),
-                        [resource, &request, &response, &after_response]() -> awaitable<bool> {
-                            co_return resource->run_resource(request, response, after_response);
+                    resource_calls_.fetch_add(1, std::memory_order_relaxed);
+                    bool success = co_await co_spawn(resource_pool().get_executor(),
+                        [resource, &request, &response, &after_response, &stats, queued, path = resource_path.data()]() -> awaitable<bool> {
+                            auto started = std::chrono::steady_clock::now();
+                            stats.wait->record(elapsed_us(queued, started));
+                            IOTMP_TRACE(resource_begin, request.get_stream_id(), path, elapsed_us(queued, started));
+                            bool result = resource->run_resource(request, response, after_response);
+                            stats.run->record(elapsed_us(started));
+                            IOTMP_TRACE(resource_end, request.get_stream_id(), path, elapsed_us(started), result);
+                            co_return result;
                         }(), use_awaitable);
+                    resource_calls_.fetch_sub(1, std::memory_order_relaxed);
                     response.set_message_type(success ? message::type::OK : message::type::ERROR);
                     send_message(response);
                     // Run any continuation registered by the handler after
@@ -850,7 +2076,7 @@ namespace thinger::iotmp {
                     // the handler typically performs side effects (restart,
                     // exec, …) and does not feed back into the protocol.
                     if (after_response) {
-                        boost::asio::co_spawn(resource_pool_.get_executor(),
+                        boost::asio::co_spawn(resource_pool().get_executor(),
                             [cb = std::move(after_response)]() -> awaitable<void> {
                                 cb();
                                 co_return;
@@ -865,24 +2091,32 @@ namespace thinger::iotmp {
                     // work during describe (e.g. scripts that execute a
                     // subprocess to produce their sample output) don't block
                     // the io_context and stall keep-alives / other messages.
-                    co_await co_spawn(resource_pool_.get_executor(),
+                    resource_calls_.fetch_add(1, std::memory_order_relaxed);
+                    co_await co_spawn(resource_pool().get_executor(),
                         [resource, &response]() -> awaitable<void> {
                             resource->describe(response);
                             co_return;
                         }(), use_awaitable);
+                    resource_calls_.fetch_sub(1, std::memory_order_relaxed);
                     send_message(response);
                     break;
                 }
 
                 case message::START_STREAM: {
                     uint16_t stream_id = request.get_stream_id();
-                    auto& stream_cfg = streams_[stream_id];
-                    stream_cfg.resource = resource;
-                    stream_cfg.interval = get_value(request.params(), "interval", 0u);
-                    if(stream_cfg.interval == 0) {
+                    auto interval = get_value(request.params(), "interval", 0u);
+                    // the resource was found by the path in the request
+                    const auto& target = request[message::field::RESOURCE];
+                    if(!register_stream(stream_id, *resource, resource_path, interval, target.get_ref<const std::string&>())) {
+                        iotmp_message error(stream_id, message::type::ERROR);
+                        send_message(error);
+                        break;
+                    }
+                    if(interval == 0) {
                         resource->set_stream_id(stream_id);
                     }
 
+                    loop_activity activity("start_stream", resource_path.data());
                     if(resource->has_stream_handler()) {
                         resource->handle_stream(stream_id, request[0], request.params(), true,
                             [this, stream_id, resource](exec_result&& result) {
@@ -908,8 +2142,9 @@ namespace thinger::iotmp {
                     if(resource->get_stream_id() == stream_id) {
                         resource->set_stream_id(0);
                     }
-                    streams_.erase(stream_id);
+                    unregister_stream(stream_id);
 
+                    loop_activity activity("stop_stream");
                     if(resource->has_stream_handler()) {
                         json_t empty_params;
                         resource->handle_stream(stream_id, request.params(), empty_params, false,
@@ -925,25 +2160,41 @@ namespace thinger::iotmp {
                     break;
                 }
 
-                case message::STREAM_DATA: {
-                    iotmp_message response(request.get_stream_id(), message::type::STREAM_DATA);
-                    resource->run_resource(request, response);
-                    // after receiving input on a streamed resource, echo back current state
-                    if(resource->stream_echo() &&
-                       (resource->get_io_type() == iotmp_resource::input_wrapper ||
-                        resource->get_io_type() == iotmp_resource::input_output_wrapper)) {
-                        stream_resource(*resource, request.get_stream_id());
-                    }
+                case message::STREAM_DATA:
+                    handle_stream_data(*resource, request);
                     break;
-                }
 
                 default:
                     break;
             }
         }
 
+        // Stream data for a resource, inline on the connection thread. Its
+        // response is not sent, so it is not given a stream id.
+        void handle_stream_data(iotmp_resource& resource, iotmp_message& request) {
+            uint16_t stream_id = request.get_stream_id();
+            auto it = streams_.find(stream_id);
+            loop_activity activity("stream_data", it != streams_.end() ? it->second.path : nullptr);
+            try {
+                iotmp_message response(message::type::STREAM_DATA);
+                resource.run_resource(request, response);
+                // after receiving input on a streamed resource, echo back current state
+                if(resource.stream_echo() &&
+                   (resource.get_io_type() == iotmp_resource::input_wrapper ||
+                    resource.get_io_type() == iotmp_resource::input_output_wrapper)) {
+                    stream_resource(resource, stream_id);
+                }
+            } catch(const std::exception& e) {
+                LOG_ERROR("Stream data handler failed (stream id {}): {}", stream_id, e.what());
+            }
+        }
+
         // Stream resource data
         bool stream_resource(iotmp_resource& resource, uint16_t stream_id) {
+            loop_activity activity("stream_resource");
+            if(resource.fixed_output() && resource.get_io_type() == iotmp_resource::output_wrapper) {
+                if(auto it = streams_.find(stream_id); it != streams_.end()) return stream_output(resource, stream_id, it->second);
+            }
             iotmp_message request(message::type::STREAM_DATA), response(message::type::STREAM_DATA);
             resource.run_resource(request, response);
             // output resources write to response, input resources write to request
@@ -956,6 +2207,166 @@ namespace thinger::iotmp {
             return false;
         }
 
+        // Stream a fixed-shape output resource through the message kept for
+        // its stream: the handler assigns the same keys again, so the payload
+        // and its frame buffer are reused instead of built anew every round
+        bool stream_output(iotmp_resource& resource, uint16_t stream_id, stream_config& config) {
+            if(!config.output) config.output.emplace(stream_id, message::type::STREAM_DATA);
+            iotmp_message request(message::type::STREAM_DATA);
+            resource.run_resource(request, *config.output);
+            send_message(*config.output);
+            return true;
+        }
+
+        // ============== Metrics ==============
+
+        // Kind of stream for $streams: server events, extension sessions
+        // (terminal, proxy, file transfers...), interval or echo streams
+        static const char* stream_type(const stream_config& config) {
+            if(config.path && std::string_view(config.path) == "$events") return "event";
+            if(config.interval > 0) return "interval";
+            if(config.resource && config.resource->has_stream_handler()) return "session";
+            return "stream";
+        }
+
+        // Resource pool times and stream traffic of a resource
+        struct resource_metrics {
+            histogram* wait = nullptr;      // queued for the resource pool
+            histogram* run = nullptr;
+            counter* received = nullptr;
+            counter* sent = nullptr;
+        };
+
+        static const char* message_name(uint8_t type) {
+            static constexpr const char* names[] = {"reserved", "ok", "error", "connect", "disconnect", "keep_alive",
+                                                    "run", "describe", "start_stream", "stop_stream", "stream_data"};
+            return type < std::size(names) ? names[type] : "unknown";
+        }
+
+        static uint64_t elapsed_us(std::chrono::steady_clock::time_point from,
+                                   std::chrono::steady_clock::time_point to = std::chrono::steady_clock::now()) {
+            auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(to - from).count();
+            return elapsed > 0 ? static_cast<uint64_t>(elapsed) : 0;
+        }
+
+        // Client metrics, once per registry (start() may run again after stop())
+        void register_metrics() {
+            if(metrics_->contains(this)) return;
+            metrics::label_set device{{"device", device_id_}};
+            auto labelled = [&device](std::string key, std::string value) {
+                auto labels = device;
+                labels.emplace_back(std::move(key), std::move(value));
+                return labels;
+            };
+
+            for(uint8_t type = message::OK; type < messages_received_.size(); ++type) {
+                messages_received_[type] = &metrics_->add_counter("iotmp_messages_received_total",
+                    "IOTMP messages received, by type", labelled("type", message_name(type)), this);
+                messages_sent_[type] = &metrics_->add_counter("iotmp_messages_sent_total",
+                    "IOTMP messages written, by type", labelled("type", message_name(type)), this);
+            }
+            reconnects_ = &metrics_->add_counter("iotmp_reconnects_total",
+                "Connections lost or failed and retried", device, this);
+            connect_time_ = &metrics_->add_histogram("iotmp_connect_seconds",
+                "Time to open the transport (TCP, TLS and WebSocket upgrade)", device, this);
+            authentication_time_ = &metrics_->add_histogram("iotmp_authentication_seconds",
+                "Time from CONNECT to its OK response", device, this);
+            streams_ready_ = &metrics_->add_histogram("iotmp_streams_ready_seconds",
+                "Time from connecting to the server event streams being ready", device, this);
+
+            metrics_->add_gauge("iotmp_write_queue_frames", "Frames waiting in the write queue", device,
+                [this]() { return static_cast<double>(write_queue_.size()); }, this);
+            metrics_->add_gauge("iotmp_write_queue_bytes", "Bytes waiting in the write queue", device,
+                [this]() { return static_cast<double>(write_queue_.bytes()); }, this);
+            for(auto priority : {stream_priority::CONTROL, stream_priority::INTERACTIVE, stream_priority::BULK}) {
+                metrics_->add_histogram("iotmp_write_queue_delay_seconds", "Time frames spent in the write queue, by class",
+                    labelled("priority", to_string(priority)), write_queue_.queue_delay(priority), this);
+            }
+            metrics_->add_gauge("iotmp_resource_pool_calls", "Resource calls queued or running on the resource pool", device,
+                [this]() { return static_cast<double>(resource_calls_.load(std::memory_order_relaxed)); }, this);
+            for(size_t i = 0; i < memory_accounting::SUBSYSTEMS; ++i) {
+                auto owner = static_cast<memory_accounting::subsystem>(i);
+                metrics_->add_gauge("iotmp_memory_bytes", "Bytes held by the buffers of a subsystem",
+                    labelled("subsystem", memory_accounting::to_string(owner)),
+                    [this, owner]() { return static_cast<double>(memory_.bytes(owner)); }, this);
+                if(owner < memory_accounting::subsystem::TERMINAL) continue;
+                metrics_->add_gauge("iotmp_sessions", "Live stream sessions of a subsystem",
+                    labelled("subsystem", memory_accounting::to_string(owner)),
+                    [this, owner]() { return static_cast<double>(memory_.sessions(owner)); }, this);
+            }
+            metrics_->add_gauge("iotmp_rtt_seconds", "Smoothed round-trip time to the server", device,
+                [this]() { return static_cast<double>(rtt_.srtt().count()) / 1e6; }, this);
+            metrics_->add_gauge("iotmp_connected", "Whether the device is connected", device,
+                [this]() { return connected_ ? 1.0 : 0.0; }, this);
+
+            if(journal_) {
+                metrics_->add_gauge("iotmp_journal_records", "Offline calls waiting in the journal", device,
+                    [this]() { return static_cast<double>(journal_->size()); }, this);
+                metrics_->add_counter("iotmp_journal_dropped_total", "Offline calls dropped with the journal full", device,
+                    [this]() { return static_cast<double>(journal_->dropped()); }, this);
+            }
+
+            // the TLS context is registered once a connection uses it
+            if(tls_context_) register_tls_metrics(tls_context_);
+        }
+
+        // Metrics of a TLS context, which is usually shared by every client
+        void register_tls_metrics(const std::shared_ptr<tls_context>& context) {
+            static std::mutex registration;
+            tls_metrics_.store(context.get(), std::memory_order_release);
+            std::scoped_lock lock(registration);
+            if(!metrics_->contains(context.get())) {
+                metrics_->add_counter("iotmp_tls_handshakes_total", "Completed TLS handshakes", {},
+                    [context]() { return static_cast<double>(context->get_handshakes()); }, context.get());
+                metrics_->add_counter("iotmp_tls_resumed_handshakes_total", "TLS handshakes that resumed a session", {},
+                    [context]() { return static_cast<double>(context->get_resumed_handshakes()); }, context.get());
+                for(bool resumed : {false, true}) {
+                    metrics_->add_histogram("iotmp_tls_handshake_seconds", "TLS handshake time",
+                        {{"resumed", resumed ? "true" : "false"}}, context->get_handshake_time(resumed), context.get());
+                }
+            }
+        }
+
+        // Metrics of a resource, registered on its first use (connection thread)
+        resource_metrics& resource_stats(std::string_view path) {
+            auto it = resource_metrics_.find(path);
+            if(it != resource_metrics_.end()) return it->second;
+            metrics::label_set labels{{"device", device_id_}, {"resource", std::string(path)}};
+            resource_metrics stats;
+            stats.wait = &metrics_->add_histogram("iotmp_resource_wait_seconds",
+                "Time a resource request waited for the resource pool", labels, this);
+            stats.run = &metrics_->add_histogram("iotmp_resource_run_seconds", "Resource execution time", labels, this);
+            stats.received = &metrics_->add_counter("iotmp_stream_received_bytes_total",
+                "Stream data received by the streams of a resource", labels, this);
+            stats.sent = &metrics_->add_counter("iotmp_stream_sent_bytes_total",
+                "Stream data written by the streams of a resource", labels, this);
+            return resource_metrics_.emplace(std::string(path), stats).first->second;
+        }
+
+        template<size_t N>
+        static void count_message(const std::array<counter*, N>& counters, uint8_t type) {
+            if(type < N && counters[type]) counters[type]->add();
+        }
+
+        // Account a frame leaving the write queue, which may hold several
+        // messages back-to-back
+        void count_sent(const outbound_frame& frame, std::chrono::steady_clock::time_point now) {
+            const auto* data = reinterpret_cast<const uint8_t*>(frame.data.data());
+            size_t offset = 0, frames = 0;
+            frame_header header;
+            while(offset < frame.data.size() &&
+                  parse_frame_header(data + offset, frame.data.size() - offset, header) == frame_parse::COMPLETE) {
+                count_message(messages_sent_, header.type);
+                offset += header.length + header.size;
+                ++frames;
+            }
+            if(frame.control) return;
+            auto it = streams_.find(frame.stream_id);
+            if(it == streams_.end()) return;
+            if(it->second.sent) it->second.sent->add(frame.data.size());
+            it->second.stats.record_sent(frame.data.size(), frames, now);
+        }
+
         // Notify state change
         void notify_state(client_state state, const std::string& reason = "") {
             if(state_callback_) {
@@ -963,7 +2374,9 @@ namespace thinger::iotmp {
             }
         }
 
-        // Execute callback in io_context (synchronized)
+        // Execute callback in io_context (synchronized). Blocks the caller until
+        // the callback has run; producers that only send data should prefer
+        // try_send() / stream_resource(), which never block.
     public:
         bool run(std::function<bool()> callback) {
             if(!socket_) return false;
@@ -981,9 +2394,29 @@ namespace thinger::iotmp {
     private:
         transport_type transport_ = transport_type::SSL;
         std::shared_ptr<thinger::asio::socket> socket_;
-        std::shared_ptr<boost::asio::ssl::context> ssl_context_;
+        std::shared_ptr<tls_context> tls_context_;             // set_tls_context(), see tls()
+        std::atomic<const tls_context*> tls_metrics_{nullptr};  // context with registered metrics
+        reconnect_backoff backoff_{RECONNECT_DELAY, MAX_RECONNECT_DELAY};
+        std::unique_ptr<thinger::http::async_client> http_client_;
+        bool websocket_verify_ = true;                          // see set_websocket_verify()
         std::optional<asio::steady_timer> keep_alive_timer_;
+
+        // Liveness of the current connection (connection thread)
+        keep_alive_policy keep_alive_{KEEP_ALIVE_INTERVAL};
+        rtt_estimator rtt_;
+        std::chrono::steady_clock::time_point last_rx_;
+        std::chrono::steady_clock::time_point last_tx_;
+        std::optional<std::chrono::steady_clock::time_point> probe_sent_;  // write completion of the probe
+        bool probe_queued_ = false;     // probe waiting in the write queue
+        bool probe_sampled_ = false;    // probe written with nothing ahead of it, see on_keep_alive()
+        unsigned missed_probes_ = 0;
+
+        // Socket tuning: requested profile, and the one applied to the connection
+        std::atomic<transport_profile> transport_profile_{transport_profile::AUTO};
+        std::atomic<transport_profile> active_profile_{transport_profile::INTERACTIVE};
+        socket_options socket_options_;
         std::optional<asio::steady_timer> stream_timer_;
+        std::optional<asio::steady_timer> write_timer_;    // the idle writer waits on it
 
         std::string host_;
         uint16_t port_ = 25206;
@@ -994,16 +2427,77 @@ namespace thinger::iotmp {
         std::map<std::string, iotmp_resource> resources_;
         std::map<uint16_t, stream_config> streams_;
         std::map<uint8_t, iotmp_server_event> events_;
-        std::vector<uint8_t> read_buffer_;
-
-        // Thread pool for dispatching blocking resource executions (e.g., scripts)
-        asio::thread_pool resource_pool_{std::min(std::thread::hardware_concurrency(), 4u)};
+        input_buffer input_;
+        size_t shrink_bytes_ = 0;       // see set_buffer_shrink()
+        std::chrono::milliseconds shrink_delay_ = BUFFER_SHRINK_DELAY;
+        std::chrono::steady_clock::time_point last_large_frame_{};
+
+        // In-flight requests keyed by stream id, and the ids in use by
+        // requests and open streams
+        std::unordered_map<uint16_t, pending_request> pending_requests_;
+        stream_id_allocator stream_ids_;
+        std::chrono::milliseconds request_timeout_ = REQUEST_TIMEOUT;
+
+        std::chrono::steady_clock::time_point connect_started_;
+        std::chrono::milliseconds streams_ready_time_{0};
+
+        // Thread pool for dispatching blocking resource executions (e.g., scripts),
+        // created on the first call unless a shared one is provided
+        std::shared_ptr<asio::thread_pool> resource_pool_;
+        bool owns_resource_pool_ = false;
+        std::mutex resource_pool_mutex_;
+
+        // TLS context being prepared for the connection in progress, see prepare_tls()
+        std::shared_ptr<tls_preparation> tls_preparation_;
+        std::mutex tls_preparation_mutex_;
 
         // Write queue for serialized writes
-        std::queue<std::string> write_queue_;
+        write_queue write_queue_;
         bool write_in_progress_ = false;
-
-        bool connected_ = false;
+        std::string write_batch_;
+        size_t coalesce_bytes_ = COALESCE_BYTES;
+        std::optional<std::chrono::microseconds> coalesce_delay_;
+
+        // Sessions waiting for their stream to become writable
+        std::unordered_multimap<uint16_t, std::shared_ptr<asio::steady_timer>> writable_waiters_;
+
+        // Offline store and forward (see set_journal)
+        std::shared_ptr<journal> journal_;
+        size_t journal_rate_ = JOURNAL_RATE;
+        size_t journal_written_ = 0;    // journal frame bytes written to the socket
+        uint64_t connection_id_ = 0;    // authenticated connections so far
+
+        // Wire traffic recorder (see set_capture)
+        std::unique_ptr<capture_writer> capture_;
+
+        // Buffer accounting (see get_memory) and resource calls in flight
+        memory_accounting memory_;
+        std::atomic<int64_t> resource_calls_{0};
+
+        // Buffers for outbound frames, and the message inbound stream data is
+        // decoded into (see read_loop)
+        frame_pool frame_pool_{memory_, write_queue::DEFAULT_HIGH_WATERMARK};
+        iotmp_message stream_data_{message::type::STREAM_DATA};
+
+        // Metrics (see register_metrics), shared with the gateway if any
+        std::shared_ptr<metrics> metrics_ = std::make_shared<metrics>();
+        std::array<counter*, message::STREAM_DATA + 1> messages_received_{};
+        std::array<counter*, message::STREAM_DATA + 1> messages_sent_{};
+        counter* reconnects_ = nullptr;
+        histogram* connect_time_ = nullptr;
+        histogram* authentication_time_ = nullptr;
+        histogram* streams_ready_ = nullptr;
+        std::map<std::string, resource_metrics, std::less<>> resource_metrics_;
+
+        // Frames pushed by other threads, drained on the connection thread
+        std::unique_ptr<mpsc_queue<outbound_frame>> outbox_;
+        size_t send_queue_capacity_ = SEND_QUEUE_CAPACITY;
+        std::atomic<bool> outbox_drain_scheduled_{false};
+        std::atomic<asio::io_context*> io_{nullptr};
+
+        std::atomic<bool> connected_{false};
+        std::atomic<bool> loop_exited_{true};
+        bool session_sharding_ = false;
 
         // State callback
         std::function<void(client_state, const std::string&)> state_callback_;
@@ -0,0 +1,54 @@
+#ifndef THINGER_IOTMP_BACKOFF_HPP
+#define THINGER_IOTMP_BACKOFF_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+namespace thinger::iotmp {
+
+    /**
+     * Exponential backoff with decorrelated jitter.
+     *
+     * Each delay is drawn uniformly between the base delay and three times
+     * the previous one, capped. Delays grow exponentially on average but are
+     * spread out, so a fleet that lost its uplink at the same moment does not
+     * reconnect in lockstep.
+     */
+    class reconnect_backoff {
+    public:
+        using duration = std::chrono::milliseconds;
+
+        reconnect_backoff(duration base, duration cap) :
+            base_(base), cap_(cap), previous_(base), random_(std::random_device{}())
+        {}
+
+        void set_limits(duration base, duration cap) {
+            base_ = base;
+            cap_ = std::max(cap, base);
+            reset();
+        }
+
+        // Delay before the next attempt
+        duration next() {
+            auto upper = std::max(base_.count(), previous_.count() * 3);
+            std::uniform_int_distribution<duration::rep> distribution(base_.count(), upper);
+            previous_ = std::min(cap_, duration(distribution(random_)));
+            return previous_;
+        }
+
+        // Start over after a successful connection
+        void reset() {
+            previous_ = base_;
+        }
+
+    private:
+        duration base_;
+        duration cap_;
+        duration previous_;
+        std::minstd_rand random_;
+    };
+
+}
+
+#endif
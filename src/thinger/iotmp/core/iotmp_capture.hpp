@@ -0,0 +1,292 @@
+#ifndef THINGER_IOTMP_CAPTURE_HPP
+#define THINGER_IOTMP_CAPTURE_HPP
+
+#include <chrono>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "iotmp_logger.hpp"
+
+namespace thinger::iotmp {
+
+    /**
+     * Wire traffic capture file.
+     *
+     * A 24 byte header (magic "IOTMPCAP", version, reserved bytes and the
+     * wall clock start time in microseconds since the epoch, little endian)
+     * followed by one record per event:
+     *
+     *   varint   microseconds since the previous record
+     *   uint8    kind (see capture::kind)
+     *   varint   data bytes
+     *   bytes    raw frames, as read from or written to the transport
+     *
+     * Outbound records may hold several frames back-to-back (i.e., a batch
+     * of stream data), inbound records hold exactly one. CONNECT is recorded
+     * without its payload (the device credentials).
+     */
+    namespace capture {
+
+        inline constexpr char MAGIC[8] = {'I', 'O', 'T', 'M', 'P', 'C', 'A', 'P'};
+        inline constexpr uint8_t VERSION = 1;
+        inline constexpr size_t HEADER_SIZE = 24;
+
+        enum class kind : uint8_t {
+            INBOUND     = 0,    // frame received from the server
+            OUTBOUND    = 1,    // frames sent to the server
+            CONNECTED   = 2     // transport connected, before CONNECT (no data)
+        };
+
+        struct record {
+            std::chrono::microseconds offset{0};   // since the start of the capture
+            kind type = kind::INBOUND;
+            std::string data;
+        };
+
+    }
+
+    /**
+     * Records the frames a client exchanges with the server to a capture file.
+     *
+     * Records are appended to a memory buffer and written out once it holds
+     * FLUSH_BYTES, on flush() or on close(), so recording costs a copy per
+     * frame on the connection thread plus an occasional write into the page
+     * cache. Recording stops once the file reaches its size limit. All
+     * methods are thread-safe.
+     */
+    class capture_writer {
+    public:
+        static constexpr size_t FLUSH_BYTES = 64 * 1024;
+
+        capture_writer() = default;
+
+        ~capture_writer() {
+            close();
+        }
+
+        capture_writer(const capture_writer&) = delete;
+        capture_writer& operator=(const capture_writer&) = delete;
+
+        // Create (or truncate) the capture file, limited to max_bytes
+        bool open(const std::filesystem::path& path, size_t max_bytes) {
+            std::scoped_lock lock(mutex_);
+            close_locked();
+
+            int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+            if(fd < 0) {
+                LOG_ERROR("Cannot open capture {}: {}", path.string(), std::strerror(errno));
+                return false;
+            }
+
+            auto now = std::chrono::system_clock::now().time_since_epoch();
+            uint64_t start = std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+            buffer_.assign(MAGIC_SIZE, '\0');
+            std::memcpy(buffer_.data(), capture::MAGIC, MAGIC_SIZE);
+            buffer_.push_back(static_cast<char>(capture::VERSION));
+            buffer_.append(7, '\0');
+            for(int i = 0; i < 8; ++i) buffer_.push_back(static_cast<char>(start >> (8 * i)));
+
+            fd_ = fd;
+            path_ = path;
+            max_bytes_ = max_bytes;
+            written_ = 0;
+            records_ = 0;
+            full_ = false;
+            last_ = std::chrono::steady_clock::now();
+            LOG_INFO("Capturing wire traffic to {}", path.string());
+            return true;
+        }
+
+        // Append a record (dropped once the capture is full)
+        void record(capture::kind type, const void* data, size_t size) {
+            std::scoped_lock lock(mutex_);
+            if(fd_ < 0 || full_) return;
+            if(written_ + buffer_.size() + size + 2 * MAX_VARINT + 1 > max_bytes_) {
+                full_ = true;
+                LOG_WARNING("Capture {} reached {} bytes, recording stopped", path_.string(), max_bytes_);
+                flush_locked();
+                return;
+            }
+
+            auto now = std::chrono::steady_clock::now();
+            write_varint(std::chrono::duration_cast<std::chrono::microseconds>(now - last_).count());
+            last_ = now;
+            buffer_.push_back(static_cast<char>(type));
+            write_varint(size);
+            buffer_.append(static_cast<const char*>(data), size);
+            if(type != capture::kind::CONNECTED) ++records_;
+            if(buffer_.size() >= FLUSH_BYTES) flush_locked();
+        }
+
+        void flush() {
+            std::scoped_lock lock(mutex_);
+            flush_locked();
+        }
+
+        void close() {
+            std::scoped_lock lock(mutex_);
+            close_locked();
+        }
+
+        // Records (connection marks aside) and bytes captured so far
+        uint64_t records() const {
+            std::scoped_lock lock(mutex_);
+            return records_;
+        }
+
+        uint64_t bytes() const {
+            std::scoped_lock lock(mutex_);
+            return written_ + buffer_.size();
+        }
+
+    private:
+        static constexpr size_t MAGIC_SIZE = sizeof(capture::MAGIC);
+        static constexpr size_t MAX_VARINT = 10;
+
+        void write_varint(uint64_t value) {
+            while(value >= 0x80) {
+                buffer_.push_back(static_cast<char>(value | 0x80));
+                value >>= 7;
+            }
+            buffer_.push_back(static_cast<char>(value));
+        }
+
+        void flush_locked() {
+            if(fd_ < 0 || buffer_.empty()) return;
+            size_t offset = 0;
+            while(offset < buffer_.size()) {
+                ssize_t n = ::write(fd_, buffer_.data() + offset, buffer_.size() - offset);
+                if(n < 0 && errno == EINTR) continue;
+                if(n <= 0) {
+                    LOG_ERROR("Cannot write capture {}: {}", path_.string(), std::strerror(errno));
+                    full_ = true;
+                    break;
+                }
+                offset += static_cast<size_t>(n);
+            }
+            written_ += offset;
+            buffer_.clear();
+        }
+
+        void close_locked() {
+            if(fd_ < 0) return;
+            flush_locked();
+            ::close(fd_);
+            fd_ = -1;
+            LOG_INFO("Capture {} closed: {} records, {} bytes", path_.string(), records_, written_);
+        }
+
+        mutable std::mutex mutex_;
+        int fd_ = -1;
+        std::filesystem::path path_;
+        std::string buffer_;
+        size_t max_bytes_ = 0;
+        size_t written_ = 0;
+        uint64_t records_ = 0;
+        bool full_ = false;
+        std::chrono::steady_clock::time_point last_;
+    };
+
+    /**
+     * Sequential reader of a capture file (see capture_writer).
+     */
+    class capture_reader {
+    public:
+        capture_reader() = default;
+
+        ~capture_reader() {
+            if(fd_ >= 0) ::close(fd_);
+        }
+
+        capture_reader(const capture_reader&) = delete;
+        capture_reader& operator=(const capture_reader&) = delete;
+
+        bool open(const std::filesystem::path& path) {
+            fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if(fd_ < 0) {
+                LOG_ERROR("Cannot open capture {}: {}", path.string(), std::strerror(errno));
+                return false;
+            }
+            if(!fill(capture::HEADER_SIZE) || std::memcmp(buffer_.data(), capture::MAGIC, sizeof(capture::MAGIC)) != 0 ||
+               static_cast<uint8_t>(buffer_[sizeof(capture::MAGIC)]) != capture::VERSION) {
+                LOG_ERROR("{} is not a capture file (or has an unsupported version)", path.string());
+                return false;
+            }
+            start_ = 0;
+            for(int i = 7; i >= 0; --i) start_ = (start_ << 8) | static_cast<uint8_t>(buffer_[16 + i]);
+            position_ = capture::HEADER_SIZE;
+            return true;
+        }
+
+        // Wall clock time the capture started, in microseconds since the epoch
+        uint64_t start_time() const {
+            return start_;
+        }
+
+        /**
+         * Read the next record
+         * @return false at the end of the file (or on a truncated record, as
+         * left by a process that did not close its capture)
+         */
+        bool next(capture::record& out) {
+            uint64_t delta, size;
+            if(!read_varint(delta) || !fill(position_ + 1)) return false;
+            auto type = static_cast<capture::kind>(buffer_[position_++]);
+            if(!read_varint(size) || !fill(position_ + size)) return false;
+            offset_ += std::chrono::microseconds(delta);
+            out.offset = offset_;
+            out.type = type;
+            out.data.assign(buffer_.data() + position_, size);
+            position_ += size;
+            return true;
+        }
+
+    private:
+        static constexpr size_t READ_SIZE = 64 * 1024;
+
+        // Make sure the buffer holds bytes up to position end
+        bool fill(size_t end) {
+            if(end <= buffer_.size()) return true;
+            if(position_ > 0) {
+                buffer_.erase(0, position_);
+                end -= position_;
+                position_ = 0;
+            }
+            char chunk[READ_SIZE];
+            while(buffer_.size() < end) {
+                ssize_t n = ::read(fd_, chunk, sizeof(chunk));
+                if(n < 0 && errno == EINTR) continue;
+                if(n <= 0) return false;
+                buffer_.append(chunk, static_cast<size_t>(n));
+            }
+            return true;
+        }
+
+        bool read_varint(uint64_t& value) {
+            value = 0;
+            for(unsigned shift = 0; shift < 64; shift += 7) {
+                if(!fill(position_ + 1)) return false;
+                auto byte = static_cast<uint8_t>(buffer_[position_++]);
+                value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+                if(!(byte & 0x80)) return true;
+            }
+            return false;
+        }
+
+        int fd_ = -1;
+        std::string buffer_;
+        size_t position_ = 0;
+        uint64_t start_ = 0;
+        std::chrono::microseconds offset_{0};
+    };
+
+}
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef THINGER_IOTMP_DNS_CACHE_HPP
+#define THINGER_IOTMP_DNS_CACHE_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/asio/ip/tcp.hpp>
+
+#include <thinger/util/types.hpp>
+
+#include "iotmp_logger.hpp"
+
+namespace thinger::iotmp {
+
+    /**
+     * Process-wide cache of resolved addresses.
+     *
+     * Results are kept for a fixed TTL (the system resolver does not report
+     * record TTLs). When a lookup fails, the last known addresses are used
+     * even if expired, so a broken resolver does not prevent reconnecting to
+     * a server that is still reachable.
+     */
+    class dns_cache {
+    public:
+        using endpoints = std::vector<boost::asio::ip::tcp::endpoint>;
+        static constexpr auto DEFAULT_TTL = std::chrono::minutes(5);
+
+        static dns_cache& instance() {
+            static dns_cache cache;
+            return cache;
+        }
+
+        void set_ttl(std::chrono::seconds ttl) {
+            std::scoped_lock lock(mutex_);
+            ttl_ = ttl;
+        }
+
+        void clear() {
+            std::scoped_lock lock(mutex_);
+            entries_.clear();
+        }
+
+        /**
+         * Resolve a host, using the cache when the entry is fresh
+         * @return the error, and the addresses ordered for connection racing
+         */
+        thinger::awaitable<std::pair<boost::system::error_code, endpoints>>
+        resolve(boost::asio::io_context& io, const std::string& host, const std::string& port) {
+            auto key = host + ":" + port;
+            endpoints stale;
+            {
+                std::scoped_lock lock(mutex_);
+                auto it = entries_.find(key);
+                if(it != entries_.end()) {
+                    if(std::chrono::steady_clock::now() < it->second.expires) {
+                        co_return std::make_pair(boost::system::error_code{}, it->second.addresses);
+                    }
+                    stale = it->second.addresses;
+                }
+            }
+
+            boost::asio::ip::tcp::resolver resolver(io);
+            auto [ec, results] = co_await resolver.async_resolve(host, port, thinger::use_nothrow_awaitable);
+            if(ec || results.empty()) {
+                if(!stale.empty()) {
+                    LOG_WARNING("Cannot resolve {}: {}. Using cached addresses", host, ec.message());
+                    co_return std::make_pair(boost::system::error_code{}, stale);
+                }
+                co_return std::make_pair(ec ? ec : boost::asio::error::host_not_found, endpoints{});
+            }
+
+            endpoints addresses;
+            for(auto& entry : results) addresses.push_back(entry.endpoint());
+            addresses = interleave(std::move(addresses));
+
+            std::scoped_lock lock(mutex_);
+            entries_[key] = entry{addresses, std::chrono::steady_clock::now() + ttl_};
+            co_return std::make_pair(boost::system::error_code{}, std::move(addresses));
+        }
+
+        // Alternate address families, starting with the first one returned
+        // by the resolver (RFC 8305 section 4)
+        static endpoints interleave(endpoints addresses) {
+            if(addresses.empty()) return addresses;
+            bool first_v6 = addresses.front().address().is_v6();
+            endpoints first, second, result;
+            for(auto& address : addresses) {
+                (address.address().is_v6() == first_v6 ? first : second).push_back(address);
+            }
+            for(size_t i = 0; i < std::max(first.size(), second.size()); ++i) {
+                if(i < first.size()) result.push_back(first[i]);
+                if(i < second.size()) result.push_back(second[i]);
+            }
+            return result;
+        }
+
+    private:
+        struct entry {
+            endpoints addresses;
+            std::chrono::steady_clock::time_point expires;
+        };
+
+        std::mutex mutex_;
+        std::map<std::string, entry> entries_;
+        std::chrono::seconds ttl_ = DEFAULT_TTL;
+    };
+
+}
+
+#endif
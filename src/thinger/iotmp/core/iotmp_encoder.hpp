@@ -64,6 +64,23 @@ namespace thinger::iotmp {
             }
         }
 
+        // STREAM_DATA body with a binary payload, without building a message
+        void encode_stream_data(uint16_t stream_id, const void* data, size_t size) {
+            encode_field(message::wire_type::varint, message::field::STREAM_ID);
+            pb_write_varint(stream_id);
+            encode_field(message::wire_type::pson_v2, message::field::PAYLOAD);
+            pson_encoder<Writer> encoder(writer_);
+            encoder.pb_encode_bytes(data, size);
+        }
+
+        // STREAM_DATA body with a JSON payload
+        void encode_stream_data(uint16_t stream_id, const nlohmann::json& payload) {
+            encode_field(message::wire_type::varint, message::field::STREAM_ID);
+            pb_write_varint(stream_id);
+            encode_field(message::wire_type::pson_v2, message::field::PAYLOAD);
+            encode_pson_value(payload);
+        }
+
     private:
         Writer writer_;
 
@@ -78,26 +95,50 @@ namespace thinger::iotmp {
         }
     };
 
-    // Helper function to encode a complete message (header + body) to a string
-    inline std::string encode_message(iotmp_message& message) {
+    // Encode a frame (header + body) into a buffer, replacing its contents
+    // (its capacity is reused). encode_body writes the body to an encoder,
+    // once to size it and once for real.
+    template<class Body>
+    inline void encode_frame(std::string& output, message::type type, Body&& encode_body) {
         // First pass: calculate body size using null_writer
         iotmp_encoder<null_writer> sizer;
-        sizer.encode(message);
+        encode_body(sizer);
         size_t body_size = sizer.bytes_written();
 
         // Pre-allocate output (header max ~10 bytes for two varints + body)
-        std::string output;
+        output.clear();
         output.reserve(10 + body_size);
 
         // Encode header + body directly to output
         iotmp_encoder<string_writer> encoder(output);
-        encoder.pb_write_varint(static_cast<uint8_t>(message.get_message_type()));
+        encoder.pb_write_varint(static_cast<uint8_t>(type));
         encoder.pb_write_varint(body_size);
-        encoder.encode(message);
+        encode_body(encoder);
+    }
 
+    inline void encode_message(iotmp_message& message, std::string& output) {
+        encode_frame(output, message.get_message_type(), [&message](auto& encoder) { encoder.encode(message); });
+    }
+
+    // Helper function to encode a complete message (header + body) to a string
+    inline std::string encode_message(iotmp_message& message) {
+        std::string output;
+        encode_message(message, output);
         return output;
     }
 
+    // STREAM_DATA frames straight from the stream id and payload, for the
+    // stream data paths that should not build a message per chunk
+    inline void encode_stream_data(std::string& output, uint16_t stream_id, const void* data, size_t size) {
+        encode_frame(output, message::type::STREAM_DATA,
+            [=](auto& encoder) { encoder.encode_stream_data(stream_id, data, size); });
+    }
+
+    inline void encode_stream_data(std::string& output, uint16_t stream_id, const nlohmann::json& payload) {
+        encode_frame(output, message::type::STREAM_DATA,
+            [&payload, stream_id](auto& encoder) { encoder.encode_stream_data(stream_id, payload); });
+    }
+
     // Helper function to encode just a message type (for messages without body like KEEP_ALIVE)
     inline std::string encode_message(message::type type) {
         std::string output;
@@ -0,0 +1,116 @@
+#ifndef THINGER_IOTMP_FRAME_POOL_HPP
+#define THINGER_IOTMP_FRAME_POOL_HPP
+
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "iotmp_memory.hpp"
+
+namespace thinger::iotmp {
+
+    /**
+     * Recycled buffers for outbound frames.
+     *
+     * Frames are encoded into a buffer taken from the pool and the buffer
+     * goes back once the frame was written, so steady streaming reuses the
+     * same buffers instead of allocating a string per message. The pool
+     * keeps up to max_bytes of buffers, each charged at least MIN_CHARGE
+     * bytes so small frames do not make it keep an unbounded number of
+     * them. The client sizes it from the write queue high watermark: every
+     * frame a stream can have in flight while it is writable fits, so a
+     * producer that fills the queue up to its watermark before yielding
+     * still gets a recycled buffer for each frame. Buffers larger than the
+     * capacity limit (i.e., file download chunks) are freed instead, and so
+     * are the ones returned while the pool is full. The capacity held is
+     * accounted as FRAME_POOL. Thread-safe: frames are encoded on the
+     * producing thread and written on the connection one.
+     */
+    class frame_pool {
+    public:
+        static constexpr size_t DEFAULT_MAX_BYTES = 1024 * 1024;
+        static constexpr size_t DEFAULT_MAX_CAPACITY = 64 * 1024;
+        static constexpr size_t MIN_CHARGE = 256;
+        static constexpr size_t INITIAL_BUFFERS = 64;
+
+        explicit frame_pool(memory_accounting& memory, size_t max_bytes = DEFAULT_MAX_BYTES,
+                            size_t max_capacity = DEFAULT_MAX_CAPACITY) :
+            memory_(memory), max_bytes_(max_bytes), max_capacity_(max_capacity)
+        {
+            free_.reserve(INITIAL_BUFFERS);
+        }
+
+        ~frame_pool() {
+            set_max_bytes(0);
+        }
+
+        frame_pool(const frame_pool&) = delete;
+        frame_pool& operator=(const frame_pool&) = delete;
+
+        // Bytes of buffers the pool may keep. Lowering it frees the excess.
+        void set_max_bytes(size_t max_bytes) {
+            std::scoped_lock lock(mutex_);
+            max_bytes_ = max_bytes;
+            while(held_ > max_bytes_ && !free_.empty()) take();
+        }
+
+        // Free buffers until the pool keeps at most max_bytes, without
+        // lowering its limit: it refills as frames are written again
+        void trim(size_t max_bytes) {
+            std::scoped_lock lock(mutex_);
+            while(held_ > max_bytes && !free_.empty()) take();
+        }
+
+        // An empty buffer, with the capacity it had when it was released
+        std::string acquire() {
+            std::scoped_lock lock(mutex_);
+            if(free_.empty()) return {};
+            return take();
+        }
+
+        // Give a buffer back (it is cleared)
+        void release(std::string&& buffer) {
+            // short strings live inline: nothing to recycle
+            if(buffer.capacity() <= SMALL_CAPACITY || buffer.capacity() > max_capacity_) return;
+            buffer.clear();
+            std::scoped_lock lock(mutex_);
+            if(held_ + charge(buffer) > max_bytes_) return;
+            held_ += charge(buffer);
+            memory_.add(memory_accounting::subsystem::FRAME_POOL, buffer.capacity());
+            // grows with the working set while warming up, then stays
+            free_.emplace_back().swap(buffer);
+        }
+
+        size_t size() const {
+            std::scoped_lock lock(mutex_);
+            return free_.size();
+        }
+
+    private:
+        static inline const size_t SMALL_CAPACITY = std::string().capacity();
+
+        static size_t charge(const std::string& buffer) {
+            return buffer.capacity() > MIN_CHARGE ? buffer.capacity() : MIN_CHARGE;
+        }
+
+        // Remove the last free buffer (mutex held)
+        std::string take() {
+            std::string buffer = std::move(free_.back());
+            free_.pop_back();
+            held_ -= charge(buffer);
+            memory_.release(memory_accounting::subsystem::FRAME_POOL, buffer.capacity());
+            return buffer;
+        }
+
+        memory_accounting& memory_;
+        size_t max_bytes_;
+        size_t max_capacity_;
+        mutable std::mutex mutex_;
+        std::vector<std::string> free_;
+        size_t held_ = 0;                   // charged bytes of the free buffers
+    };
+
+}
+
+#endif
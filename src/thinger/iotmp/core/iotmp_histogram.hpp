@@ -0,0 +1,109 @@
+#ifndef THINGER_IOTMP_HISTOGRAM_HPP
+#define THINGER_IOTMP_HISTOGRAM_HPP
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+namespace thinger::iotmp {
+
+    /**
+     * Log-linear histogram of unsigned values (i.e., microseconds).
+     *
+     * Every power of two is split in SUB_BUCKETS linear buckets, so any
+     * recorded value is reported with a relative error below 1/SUB_BUCKETS
+     * (12.5%) and values below SUB_BUCKETS are exact. Recording is a few
+     * relaxed atomic increments, so any thread can record while another
+     * reads percentiles.
+     */
+    class histogram {
+    public:
+        static constexpr size_t SUB_BUCKET_BITS = 3;
+        static constexpr size_t SUB_BUCKETS = size_t{1} << SUB_BUCKET_BITS;
+        static constexpr size_t BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+        void record(uint64_t value) {
+            buckets_[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+            count_.fetch_add(1, std::memory_order_relaxed);
+            sum_.fetch_add(value, std::memory_order_relaxed);
+            uint64_t max = max_.load(std::memory_order_relaxed);
+            while(value > max && !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {}
+        }
+
+        uint64_t count() const {
+            return count_.load(std::memory_order_relaxed);
+        }
+
+        uint64_t sum() const {
+            return sum_.load(std::memory_order_relaxed);
+        }
+
+        uint64_t max() const {
+            return max_.load(std::memory_order_relaxed);
+        }
+
+        double mean() const {
+            uint64_t n = count();
+            return n ? static_cast<double>(sum()) / n : 0.0;
+        }
+
+        /**
+         * Value at a given percentile
+         * @param percentile in [0, 100]
+         * @return upper bound of the bucket holding the percentile (0 if empty)
+         */
+        uint64_t percentile(double percentile) const {
+            uint64_t n = count();
+            if(n == 0) return 0;
+            auto rank = static_cast<uint64_t>(percentile / 100.0 * static_cast<double>(n) + 0.5);
+            if(rank == 0) rank = 1;
+            uint64_t seen = 0;
+            for(size_t i = 0; i < BUCKETS; ++i) {
+                seen += buckets_[i].load(std::memory_order_relaxed);
+                if(seen >= rank) {
+                    uint64_t upper = bucket_upper_bound(i);
+                    return upper < max() ? upper : max();
+                }
+            }
+            return max();
+        }
+
+        // Number of values recorded in a bucket, see bucket_upper_bound()
+        uint64_t bucket_count(size_t index) const {
+            return buckets_[index].load(std::memory_order_relaxed);
+        }
+
+        // Largest value that falls in a bucket
+        static uint64_t bucket_upper_bound(size_t index) {
+            if(index < SUB_BUCKETS) return index;
+            size_t shift = index / SUB_BUCKETS - 1;
+            uint64_t base = (SUB_BUCKETS + index % SUB_BUCKETS) << shift;
+            return base + ((uint64_t{1} << shift) - 1);
+        }
+
+        static size_t bucket_index(uint64_t value) {
+            if(value < SUB_BUCKETS) return value;
+            // position of the highest bit above the sub-bucket bits
+            size_t shift = std::bit_width(value) - SUB_BUCKET_BITS - 1;
+            return (shift + 1) * SUB_BUCKETS + ((value >> shift) & (SUB_BUCKETS - 1));
+        }
+
+        void reset() {
+            for(auto& bucket : buckets_) bucket.store(0, std::memory_order_relaxed);
+            count_.store(0, std::memory_order_relaxed);
+            sum_.store(0, std::memory_order_relaxed);
+            max_.store(0, std::memory_order_relaxed);
+        }
+
+    private:
+        std::array<std::atomic<uint64_t>, BUCKETS> buckets_{};
+        std::atomic<uint64_t> count_{0};
+        std::atomic<uint64_t> sum_{0};
+        std::atomic<uint64_t> max_{0};
+    };
+
+}
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef THINGER_IOTMP_INPUT_BUFFER_HPP
+#define THINGER_IOTMP_INPUT_BUFFER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <vector>
+
+namespace thinger::iotmp {
+
+    // Header of an encoded frame: type (1 byte) + body size (varint)
+    struct frame_header {
+        uint8_t type = 0;
+        uint32_t size = 0;      // body bytes
+        size_t length = 0;      // header bytes
+    };
+
+    enum class frame_parse { COMPLETE, INCOMPLETE, INVALID };
+
+    inline frame_parse parse_frame_header(const uint8_t* data, size_t size, frame_header& header) {
+        if(size == 0) return frame_parse::INCOMPLETE;
+        uint32_t value = 0;
+        uint8_t bit_pos = 0;
+        for(size_t i = 1; i < size; ++i) {
+            value |= static_cast<uint32_t>(data[i] & 0x7F) << bit_pos;
+            if(!(data[i] & 0x80)) {
+                header.type = data[0];
+                header.size = value;
+                header.length = i + 1;
+                return frame_parse::COMPLETE;
+            }
+            bit_pos += 7;
+            if(bit_pos >= 32) return frame_parse::INVALID;
+        }
+        return frame_parse::INCOMPLETE;
+    }
+
+    /**
+     * Receive buffer of a connection.
+     *
+     * The socket is read in chunks as large as the free space, and frames
+     * are decoded in place, so a read that returns several frames (i.e., a
+     * WebSocket message packing many IOTMP frames) is parsed without going
+     * back to the socket. The buffer grows to hold the largest frame
+     * received.
+     */
+    class input_buffer {
+    public:
+        static constexpr size_t DEFAULT_CAPACITY = 16 * 1024;
+
+        explicit input_buffer(size_t capacity = DEFAULT_CAPACITY) : buffer_(capacity) {}
+
+        // Received bytes not consumed yet
+        const uint8_t* data() const {
+            return buffer_.data() + begin_;
+        }
+
+        size_t size() const {
+            return end_ - begin_;
+        }
+
+        size_t capacity() const {
+            return buffer_.size();
+        }
+
+        void consume(size_t bytes) {
+            begin_ += bytes;
+            if(begin_ == end_) begin_ = end_ = 0;
+        }
+
+        // Free space for at least min_bytes more, compacting pending bytes to
+        // the front before growing
+        std::span<uint8_t> prepare(size_t min_bytes) {
+            if(buffer_.size() - end_ < min_bytes) {
+                if(begin_ > 0) {
+                    std::memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+                    end_ -= begin_;
+                    begin_ = 0;
+                }
+                if(buffer_.size() - end_ < min_bytes) buffer_.resize(end_ + min_bytes);
+            }
+            return {buffer_.data() + end_, buffer_.size() - end_};
+        }
+
+        // Bytes written in the space returned by prepare()
+        void commit(size_t bytes) {
+            end_ += bytes;
+        }
+
+        void clear() {
+            begin_ = end_ = 0;
+        }
+
+        /**
+         * Give memory back after a burst of large frames: reallocate the
+         * buffer with the given capacity, keeping the pending bytes
+         * @return false if it is not larger, or the pending bytes do not fit
+         */
+        bool shrink(size_t capacity) {
+            size_t pending = size();
+            if(buffer_.size() <= capacity || pending > capacity) return false;
+            std::vector<uint8_t> smaller(capacity);
+            if(pending > 0) std::memcpy(smaller.data(), data(), pending);
+            buffer_.swap(smaller);
+            begin_ = 0;
+            end_ = pending;
+            return true;
+        }
+
+    private:
+        std::vector<uint8_t> buffer_;
+        size_t begin_ = 0;
+        size_t end_ = 0;
+    };
+
+}
+
+#endif
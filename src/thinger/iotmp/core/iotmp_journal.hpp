@@ -0,0 +1,342 @@
+#ifndef THINGER_IOTMP_JOURNAL_HPP
+#define THINGER_IOTMP_JOURNAL_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "iotmp_logger.hpp"
+
+namespace thinger::iotmp {
+
+    /**
+     * Durable store-and-forward journal for outbound frames.
+     *
+     * A single memory-mapped segment file of bounded size. Frames are
+     * appended at the tail as records (length, CRC-32, bytes) and consumed
+     * from the head once delivered; when the journal empties, both go back to
+     * the start of the segment.
+     *
+     * Appends only copy into the mapping. They are made durable in groups:
+     * commit() flushes the records and then the header with the new tail,
+     * and runs by itself once COMMIT_BYTES are pending or COMMIT_INTERVAL
+     * went by since the last one. As that is only checked on the next
+     * append or consume, the owner also arms a deadline for every group
+     * (see needs_deadline()), so records are committed within
+     * COMMIT_INTERVAL even if nothing follows them. A crash (or power loss)
+     * can therefore lose the records of the last group, but never exposes a
+     * torn record, and records are delivered at least once.
+     *
+     * A record that does not fit compacts the live records to the start
+     * first (when they take less than the space already consumed), and is
+     * dropped if it still does not fit. All methods are thread-safe.
+     */
+    class journal {
+    public:
+        static constexpr size_t COMMIT_BYTES = 64 * 1024;
+        static constexpr auto COMMIT_INTERVAL = std::chrono::seconds(5);
+
+        journal() = default;
+
+        ~journal() {
+            close();
+        }
+
+        journal(const journal&) = delete;
+        journal& operator=(const journal&) = delete;
+
+        /**
+         * Open (or create) the journal file, recovering the records committed
+         * by a previous run. An existing journal larger than max_bytes keeps
+         * its size.
+         */
+        bool open(const std::filesystem::path& path, size_t max_bytes) {
+            std::scoped_lock lock(mutex_);
+            close_locked();
+
+            size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+            int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+            if(fd < 0) {
+                LOG_ERROR("Cannot open journal {}: {}", path.string(), std::strerror(errno));
+                return false;
+            }
+
+            struct stat st{};
+            ::fstat(fd, &st);
+            size_t size = std::max(round_up(HEADER_SIZE + max_bytes, page), static_cast<size_t>(st.st_size));
+            if(static_cast<size_t>(st.st_size) < size && ::ftruncate(fd, static_cast<off_t>(size)) != 0) {
+                LOG_ERROR("Cannot size journal {}: {}", path.string(), std::strerror(errno));
+                ::close(fd);
+                return false;
+            }
+
+            void* map = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if(map == MAP_FAILED) {
+                LOG_ERROR("Cannot map journal {}: {}", path.string(), std::strerror(errno));
+                ::close(fd);
+                return false;
+            }
+
+            fd_ = fd;
+            base_ = static_cast<uint8_t*>(map);
+            size_ = size;
+            page_ = page;
+            recover();
+            last_commit_ = std::chrono::steady_clock::now();
+            LOG_INFO("Journal {} opened: {} records ({} bytes) pending", path.string(), records_.load(), bytes_locked());
+            return true;
+        }
+
+        void close() {
+            std::scoped_lock lock(mutex_);
+            close_locked();
+        }
+
+        bool is_open() const {
+            return base_ != nullptr;
+        }
+
+        // Append a frame. Returns false if it was dropped (journal full).
+        bool append(std::string_view frame) {
+            std::scoped_lock lock(mutex_);
+            if(!base_) return false;
+            size_t record = RECORD_HEADER + frame.size();
+            if(tail_ + record > size_) {
+                compact();
+                if(tail_ + record > size_) {
+                    dropped_.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+            }
+
+            uint32_t length = static_cast<uint32_t>(frame.size());
+            uint32_t checksum = crc32(frame);
+            std::memcpy(base_ + tail_, &length, 4);
+            std::memcpy(base_ + tail_ + 4, &checksum, 4);
+            std::memcpy(base_ + tail_ + RECORD_HEADER, frame.data(), frame.size());
+            tail_ += record;
+            records_.fetch_add(1, std::memory_order_relaxed);
+            pending_bytes_ += record;
+            maybe_commit();
+            return true;
+        }
+
+        /**
+         * Copy the oldest records, up to max_bytes (at least one record).
+         * They stay in the journal until consume() is called with the bytes
+         * returned.
+         * @return journal bytes spanned by the records copied
+         */
+        size_t peek(size_t max_bytes, std::vector<std::string>& frames) const {
+            std::scoped_lock lock(mutex_);
+            size_t offset = head_;
+            while(offset < tail_) {
+                uint32_t length;
+                std::memcpy(&length, base_ + offset, 4);
+                size_t record = RECORD_HEADER + length;
+                if(offset > head_ && offset + record - head_ > max_bytes) break;
+                frames.emplace_back(reinterpret_cast<const char*>(base_ + offset + RECORD_HEADER), length);
+                offset += record;
+            }
+            return offset - head_;
+        }
+
+        // Drop delivered records, as returned by peek()
+        void consume(size_t bytes, size_t records) {
+            std::scoped_lock lock(mutex_);
+            if(!base_) return;
+            head_ = std::min(head_ + bytes, tail_);
+            records_.fetch_sub(std::min(records, records_.load(std::memory_order_relaxed)), std::memory_order_relaxed);
+            if(head_ == tail_) head_ = tail_ = HEADER_SIZE;
+            pending_bytes_ += bytes;
+            maybe_commit();
+        }
+
+        // Flush pending records and the header to disk
+        void commit() {
+            std::scoped_lock lock(mutex_);
+            commit_locked();
+        }
+
+        /**
+         * Whether the caller must arm a commit deadline: true once for every
+         * group of pending changes. The caller then calls commit_pending()
+         * within COMMIT_INTERVAL (i.e., from a timer).
+         */
+        bool needs_deadline() {
+            std::scoped_lock lock(mutex_);
+            if(pending_bytes_ == 0 || deadline_armed_) return false;
+            deadline_armed_ = true;
+            return true;
+        }
+
+        // Commit the pending changes, if any (the deadline of a group)
+        void commit_pending() {
+            std::scoped_lock lock(mutex_);
+            deadline_armed_ = false;
+            if(pending_bytes_ > 0) commit_locked();
+        }
+
+        bool empty() const {
+            return records_.load(std::memory_order_relaxed) == 0;
+        }
+
+        // Records waiting for delivery
+        size_t size() const {
+            return records_.load(std::memory_order_relaxed);
+        }
+
+        size_t bytes() const {
+            std::scoped_lock lock(mutex_);
+            return bytes_locked();
+        }
+
+        size_t capacity() const {
+            return size_ > HEADER_SIZE ? size_ - HEADER_SIZE : 0;
+        }
+
+        // Frames rejected because the journal was full
+        uint64_t dropped() const {
+            return dropped_.load(std::memory_order_relaxed);
+        }
+
+    private:
+        static constexpr uint32_t MAGIC = 0x4a544f49;   // "IOTJ"
+        static constexpr uint32_t VERSION = 1;
+        static constexpr size_t RECORD_HEADER = 8;      // length + CRC-32
+
+        // First page: magic, version, head and tail offsets
+        struct header {
+            uint32_t magic;
+            uint32_t version;
+            uint64_t head;
+            uint64_t tail;
+        };
+        static constexpr size_t HEADER_SIZE = 4096;
+
+        static size_t round_up(size_t value, size_t page) {
+            return (value + page - 1) / page * page;
+        }
+
+        size_t bytes_locked() const {
+            return tail_ - head_;
+        }
+
+        // Load the committed state, keeping the records that pass their
+        // checksum
+        void recover() {
+            header h{};
+            std::memcpy(&h, base_, sizeof(h));
+            head_ = tail_ = HEADER_SIZE;
+            records_ = 0;
+            if(h.magic != MAGIC || h.version != VERSION || h.head < HEADER_SIZE || h.tail > size_ || h.head > h.tail) {
+                write_header();
+                ::msync(base_, page_, MS_SYNC);
+                return;
+            }
+
+            head_ = h.head;
+            size_t offset = head_;
+            while(offset + RECORD_HEADER <= h.tail) {
+                uint32_t length, checksum;
+                std::memcpy(&length, base_ + offset, 4);
+                std::memcpy(&checksum, base_ + offset + 4, 4);
+                if(offset + RECORD_HEADER + length > h.tail) break;
+                if(crc32({reinterpret_cast<const char*>(base_ + offset + RECORD_HEADER), length}) != checksum) break;
+                offset += RECORD_HEADER + length;
+                records_.fetch_add(1, std::memory_order_relaxed);
+            }
+            if(offset != h.tail) LOG_WARNING("Journal truncated after {} valid records", records_.load());
+            tail_ = offset;
+            if(head_ == tail_) head_ = tail_ = HEADER_SIZE;
+        }
+
+        // Move the live records to the start of the segment. Only done when
+        // the copy does not overlap them, so the committed header keeps
+        // pointing at intact records until the new one is written.
+        void compact() {
+            if(head_ - HEADER_SIZE < tail_ - head_) return;
+            std::memcpy(base_ + HEADER_SIZE, base_ + head_, tail_ - head_);
+            tail_ -= head_ - HEADER_SIZE;
+            head_ = HEADER_SIZE;
+            commit_locked();
+        }
+
+        void maybe_commit() {
+            if(pending_bytes_ >= COMMIT_BYTES || std::chrono::steady_clock::now() - last_commit_ >= COMMIT_INTERVAL) {
+                commit_locked();
+            }
+        }
+
+        void commit_locked() {
+            if(!base_) return;
+            // records first, then the header that makes them visible
+            size_t begin = head_ / page_ * page_;
+            if(tail_ > begin) ::msync(base_ + begin, round_up(tail_, page_) - begin, MS_SYNC);
+            write_header();
+            ::msync(base_, page_, MS_SYNC);
+            pending_bytes_ = 0;
+            last_commit_ = std::chrono::steady_clock::now();
+        }
+
+        void write_header() {
+            header h{MAGIC, VERSION, head_, tail_};
+            std::memcpy(base_, &h, sizeof(h));
+        }
+
+        void close_locked() {
+            if(!base_) return;
+            commit_locked();
+            ::munmap(base_, size_);
+            ::close(fd_);
+            base_ = nullptr;
+            fd_ = -1;
+            size_ = 0;
+            head_ = tail_ = HEADER_SIZE;
+            records_ = 0;
+        }
+
+        static uint32_t crc32(std::string_view data) {
+            static const auto table = [] {
+                std::array<uint32_t, 256> t{};
+                for(uint32_t i = 0; i < 256; ++i) {
+                    uint32_t c = i;
+                    for(int k = 0; k < 8; ++k) c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+                    t[i] = c;
+                }
+                return t;
+            }();
+            uint32_t crc = 0xFFFFFFFF;
+            for(unsigned char byte : data) crc = table[(crc ^ byte) & 0xFF] ^ (crc >> 8);
+            return crc ^ 0xFFFFFFFF;
+        }
+
+        mutable std::mutex mutex_;
+        int fd_ = -1;
+        uint8_t* base_ = nullptr;
+        size_t size_ = 0;
+        size_t page_ = 4096;
+        size_t head_ = HEADER_SIZE;
+        size_t tail_ = HEADER_SIZE;
+        size_t pending_bytes_ = 0;
+        bool deadline_armed_ = false;
+        std::chrono::steady_clock::time_point last_commit_;
+        std::atomic<size_t> records_{0};
+        std::atomic<uint64_t> dropped_{0};
+    };
+
+}
+
+#endif
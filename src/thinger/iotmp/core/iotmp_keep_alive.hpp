@@ -0,0 +1,105 @@
+#ifndef THINGER_IOTMP_KEEP_ALIVE_HPP
+#define THINGER_IOTMP_KEEP_ALIVE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace thinger::iotmp {
+
+    /**
+     * Liveness policy of a connection.
+     *
+     * A KEEP_ALIVE probe is sent once either direction has been idle for
+     * interval. A probe that gets no echo within the probe timeout (the
+     * retransmission timeout estimated from the RTT, clamped between the
+     * min and max probe timeouts) after it was written is missed, unless
+     * the uplink is still busy with earlier data, and the peer is declared
+     * dead after max_missed consecutive misses. The kernel TCP keepalive and
+     * TCP_USER_TIMEOUT are derived from the same values.
+     */
+    struct keep_alive_policy {
+        std::chrono::seconds interval{60};
+        std::chrono::milliseconds min_probe_timeout{1000};
+        std::chrono::milliseconds max_probe_timeout{10000};
+        unsigned max_missed = 3;
+
+        // Longest time the peer may stay silent once probing started
+        std::chrono::milliseconds dead_peer_timeout() const {
+            return max_probe_timeout * std::max(max_missed, 1u);
+        }
+    };
+
+    /**
+     * Smoothed round-trip time estimator (Jacobson/Karels, as in RFC 6298).
+     *
+     * Samples come from the connection thread; the estimates can be read
+     * from any thread.
+     */
+    class rtt_estimator {
+    public:
+        using duration = std::chrono::microseconds;
+
+        // Timeout used until the first sample (RFC 6298 suggests 1s, but
+        // cellular uplinks often need more)
+        static constexpr duration INITIAL_TIMEOUT = std::chrono::seconds(3);
+
+        void sample(duration rtt) {
+            int64_t r = std::max<int64_t>(rtt.count(), 1);
+            if(samples_.load(std::memory_order_relaxed) == 0) {
+                srtt_.store(r, std::memory_order_relaxed);
+                rttvar_.store(r / 2, std::memory_order_relaxed);
+            } else {
+                int64_t srtt = srtt_.load(std::memory_order_relaxed);
+                int64_t rttvar = rttvar_.load(std::memory_order_relaxed);
+                int64_t error = srtt > r ? srtt - r : r - srtt;
+                rttvar_.store(rttvar - rttvar / 4 + error / 4, std::memory_order_relaxed);
+                srtt_.store(srtt - srtt / 8 + r / 8, std::memory_order_relaxed);
+            }
+            last_.store(r, std::memory_order_relaxed);
+            samples_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void reset() {
+            srtt_.store(0, std::memory_order_relaxed);
+            rttvar_.store(0, std::memory_order_relaxed);
+            last_.store(0, std::memory_order_relaxed);
+            samples_.store(0, std::memory_order_relaxed);
+        }
+
+        // Smoothed RTT (zero until the first sample)
+        duration srtt() const {
+            return duration(srtt_.load(std::memory_order_relaxed));
+        }
+
+        // RTT mean deviation
+        duration rttvar() const {
+            return duration(rttvar_.load(std::memory_order_relaxed));
+        }
+
+        // Most recent sample
+        duration last() const {
+            return duration(last_.load(std::memory_order_relaxed));
+        }
+
+        uint64_t samples() const {
+            return samples_.load(std::memory_order_relaxed);
+        }
+
+        // Retransmission timeout: SRTT + 4 * RTTVAR
+        duration timeout() const {
+            if(samples() == 0) return INITIAL_TIMEOUT;
+            return srtt() + 4 * rttvar();
+        }
+
+    private:
+        std::atomic<int64_t> srtt_{0};
+        std::atomic<int64_t> rttvar_{0};
+        std::atomic<int64_t> last_{0};
+        std::atomic<uint64_t> samples_{0};
+    };
+
+}
+
+#endif
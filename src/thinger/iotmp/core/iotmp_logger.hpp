@@ -25,16 +25,29 @@
 #define THINGER_IOTMP_LOGGER_HPP
 
 #include "iotmp_message.hpp"
+#include "iotmp_mpsc_queue.hpp"
 #include <thinger/util/logger.hpp>
+#include <spdlog/spdlog.h>
 #include <sstream>
 #include <iomanip>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 namespace thinger::iotmp {
 
+    class async_message_log;
+
     /**
      * Helper class for formatting and logging IOTMP messages
      * Provides methods to dump message contents in a readable format with colors and symbols
+     *
+     * Messages are only formatted when the info level is enabled. With an
+     * async_message_log installed (set_async), the caller just snapshots the
+     * message into a ring buffer and the formatting happens on its thread.
      */
     class message_logger {
     public:
@@ -67,6 +80,84 @@ namespace thinger::iotmp {
          * @return Formatted string representation of the message
          */
         static std::string dump(iotmp_message& msg, bool include_binary = false, bool use_colors = true, bool is_incoming = true) {
+            return format(msg, include_binary, use_colors, is_incoming, 0);
+        }
+
+        /**
+         * Whether log_incoming/log_outgoing would emit anything at the current log level
+         */
+        static bool enabled() {
+            return spdlog::should_log(spdlog::level::info);
+        }
+
+        /**
+         * Defer message formatting to an async_message_log (nullptr logs synchronously again).
+         * The log must stay alive until it is replaced or removed; its stop()
+         * removes it and waits for the pushes already in progress.
+         */
+        static void set_async(async_message_log* log) {
+            async_.store(log, std::memory_order_release);
+        }
+
+        static async_message_log* get_async() {
+            return async_.load(std::memory_order_acquire);
+        }
+
+        /**
+         * Dump a message with compact format (no binary payloads)
+         * @param msg The message to dump
+         * @param is_incoming Whether this is an incoming message
+         * @return Compact string representation
+         */
+        static std::string dump_compact(iotmp_message& msg, bool is_incoming = true) {
+            return dump(msg, false, true, is_incoming);
+        }
+
+        /**
+         * Dump a message with full details including binary info
+         * @param msg The message to dump
+         * @param is_incoming Whether this is an incoming message
+         * @return Full string representation
+         */
+        static std::string dump_full(iotmp_message& msg, bool is_incoming = true) {
+            return dump(msg, true, true, is_incoming);
+        }
+
+        /**
+         * Log an incoming message
+         * @param msg The message to log
+         * @param include_binary Whether to include binary payload info (default: false)
+         */
+        static void log_incoming(iotmp_message& msg, bool include_binary = false) {
+            log(msg, include_binary, true);
+        }
+
+        /**
+         * Log an outgoing message
+         * @param msg The message to log
+         * @param include_binary Whether to include binary payload info (default: false)
+         */
+        static void log_outgoing(iotmp_message& msg, bool include_binary = false) {
+            log(msg, include_binary, false);
+        }
+
+        /**
+         * Log a message in the given direction, synchronously or through the async log
+         */
+        static void log(iotmp_message& msg, bool include_binary, bool is_incoming);
+
+    private:
+        friend class async_message_log;
+
+        static inline std::atomic<async_message_log*> async_{nullptr};
+        // log() calls that may be using async_, see async_message_log::stop()
+        static inline std::atomic<uint32_t> pushing_{0};
+
+        /**
+         * Dump a message, optionally reporting a binary payload of binary_size
+         * bytes that is no longer attached to it
+         */
+        static std::string format(iotmp_message& msg, bool include_binary, bool use_colors, bool is_incoming, size_t binary_size) {
             std::ostringstream ss;
 
             // Direction arrow with color
@@ -130,50 +221,17 @@ namespace thinger::iotmp {
                     ss << format_json_value(payload, 150);
                     if (use_colors) ss << RESET;
                 }
+            } else if (binary_size && include_binary) {
+                // binary payload left out of a deferred snapshot
+                if (use_colors) ss << " " << DIM << DOT << RESET << " " << BINARY_COLOR;
+                else ss << " " << DOT << " ";
+                ss << "⟨" << format_size(binary_size) << "⟩";
+                if (use_colors) ss << RESET;
             }
 
             return ss.str();
         }
 
-        /**
-         * Dump a message with compact format (no binary payloads)
-         * @param msg The message to dump
-         * @param is_incoming Whether this is an incoming message
-         * @return Compact string representation
-         */
-        static std::string dump_compact(iotmp_message& msg, bool is_incoming = true) {
-            return dump(msg, false, true, is_incoming);
-        }
-
-        /**
-         * Dump a message with full details including binary info
-         * @param msg The message to dump
-         * @param is_incoming Whether this is an incoming message
-         * @return Full string representation
-         */
-        static std::string dump_full(iotmp_message& msg, bool is_incoming = true) {
-            return dump(msg, true, true, is_incoming);
-        }
-
-        /**
-         * Log an incoming message
-         * @param msg The message to log
-         * @param include_binary Whether to include binary payload info (default: false)
-         */
-        static void log_incoming(iotmp_message& msg, bool include_binary = false) {
-            THINGER_LOG_TAG("iotmp", "{}", dump(msg, include_binary, true, true));
-        }
-
-        /**
-         * Log an outgoing message
-         * @param msg The message to log
-         * @param include_binary Whether to include binary payload info (default: false)
-         */
-        static void log_outgoing(iotmp_message& msg, bool include_binary = false) {
-            THINGER_LOG_TAG("iotmp", "{}", dump(msg, include_binary, true, false));
-        }
-
-    private:
         /**
          * Format a JSON value for logging (truncate if too long)
          * @param value The JSON value to format
@@ -214,6 +272,149 @@ namespace thinger::iotmp {
         }
     };
 
+    /**
+     * Asynchronous sink for message_logger.
+     *
+     * Logging threads push a snapshot of each message into a bounded
+     * lock-free ring (mpsc_queue) and return; a background thread formats
+     * and writes them. Snapshots copy the message fields but leave binary
+     * payloads out (only their size is kept), so a large STREAM_DATA or
+     * bucket write does not get copied just to be logged. When the ring is
+     * full the newest messages are dropped and counted, and the drop count
+     * is logged once the ring drains, so a burst never blocks the caller.
+     * The background thread sleeps while the ring is empty and a push wakes
+     * it up.
+     */
+    class async_message_log {
+    public:
+        static constexpr size_t DEFAULT_CAPACITY = 4096;
+
+        explicit async_message_log(size_t capacity = DEFAULT_CAPACITY) :
+            queue_(capacity),
+            thread_([this]() { run(); })
+        {
+        }
+
+        ~async_message_log() {
+            stop();
+        }
+
+        async_message_log(const async_message_log&) = delete;
+        async_message_log& operator=(const async_message_log&) = delete;
+
+        /**
+         * Snapshot a message for deferred logging
+         * @return false if the ring is full and the message was dropped
+         */
+        bool push(iotmp_message& msg, bool include_binary, bool is_incoming) {
+            record entry{iotmp_message(msg.get_message_type()), 0, include_binary, is_incoming};
+            for(auto& [field, value] : msg.get_fields()) {
+                if(field == message::field::PAYLOAD && value.is_binary()) {
+                    entry.binary_size = value.get_binary().size();
+                } else {
+                    entry.message[field] = value;
+                }
+            }
+            if(!queue_.try_push(entry)) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            // pairs with the fence in run(): either it sees the entry or we see it sleeping
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(sleeping_.load(std::memory_order_relaxed)) wake();
+            return true;
+        }
+
+        /**
+         * Write pending messages and stop the logging thread. Uninstalls the
+         * log from message_logger if it is still the active one, and waits
+         * for the message_logger calls that may still be pushing to it, so
+         * the log can be destroyed right after.
+         */
+        void stop() {
+            async_message_log* self = this;
+            message_logger::async_.compare_exchange_strong(self, nullptr, std::memory_order_seq_cst);
+            while(message_logger::pushing_.load(std::memory_order_seq_cst) != 0) std::this_thread::yield();
+            if(!running_.exchange(false)) return;
+            wake();
+            if(thread_.joinable()) thread_.join();
+        }
+
+        // Messages dropped because the ring was full
+        uint64_t get_dropped() const {
+            return dropped_.load(std::memory_order_relaxed);
+        }
+
+        size_t pending() const {
+            return queue_.size_approx();
+        }
+
+    private:
+        struct record {
+            iotmp_message message{message::type::RESERVED};
+            size_t binary_size = 0;
+            bool include_binary = false;
+            bool is_incoming = false;
+        };
+
+        void wake() {
+            std::scoped_lock lock(mutex_);
+            wakeup_.notify_one();
+        }
+
+        // Sleep until a push or stop() (only returns once the ring has entries or stopping)
+        void sleep() {
+            std::unique_lock lock(mutex_);
+            sleeping_.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            wakeup_.wait(lock, [this]() {
+                return queue_.size_approx() != 0 || !running_.load(std::memory_order_acquire);
+            });
+            sleeping_.store(false, std::memory_order_relaxed);
+        }
+
+        void run() {
+            uint64_t reported = 0;
+            for(;;) {
+                // read the flag before draining, so nothing pushed before stop() is lost
+                bool running = running_.load(std::memory_order_acquire);
+                while(auto entry = queue_.try_pop()) {
+                    THINGER_LOG_TAG("iotmp", "{}", message_logger::format(entry->message,
+                        entry->include_binary, true, entry->is_incoming, entry->binary_size));
+                }
+                uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+                if(dropped != reported) {
+                    LOG_WARNING("Message log overrun, {} messages dropped", dropped - reported);
+                    reported = dropped;
+                }
+                if(!running) break;
+                sleep();
+            }
+        }
+
+        mpsc_queue<record> queue_;
+        std::atomic<uint64_t> dropped_{0};
+        std::atomic<bool> running_{true};
+        std::atomic<bool> sleeping_{false};
+        std::mutex mutex_;
+        std::condition_variable wakeup_;
+        std::thread thread_;
+    };
+
+    inline void message_logger::log(iotmp_message& msg, bool include_binary, bool is_incoming) {
+        // skip formatting altogether when the level is disabled
+        if(!enabled()) return;
+        // counted before reading async_, so stop() sees this call or we see it uninstalled
+        pushing_.fetch_add(1, std::memory_order_seq_cst);
+        if(auto* async = async_.load(std::memory_order_seq_cst)) {
+            async->push(msg, include_binary, is_incoming);
+            pushing_.fetch_sub(1, std::memory_order_release);
+            return;
+        }
+        pushing_.fetch_sub(1, std::memory_order_release);
+        THINGER_LOG_TAG("iotmp", "{}", format(msg, include_binary, true, is_incoming, 0));
+    }
+
 } // namespace thinger::iotmp
 
 #endif // THINGER_IOTMP_MESSAGE_LOGGER_HPP
\ No newline at end of file
@@ -0,0 +1,389 @@
+#ifndef THINGER_IOTMP_LOOP_WATCHDOG_HPP
+#define THINGER_IOTMP_LOOP_WATCHDOG_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <execinfo.h>
+#include <pthread.h>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/post.hpp>
+#include <thinger/asio/workers.hpp>
+
+#include "iotmp_histogram.hpp"
+#include "iotmp_logger.hpp"
+#include "iotmp_metrics.hpp"
+
+namespace thinger::iotmp {
+
+    namespace detail {
+
+        // Copy of what a watched event loop thread is running
+        struct activity {
+            static constexpr size_t DETAIL_SIZE = 128;   // longer details are truncated
+
+            const char* what = nullptr;         // static string
+            char detail[DETAIL_SIZE] = {};
+            int64_t since = 0;                  // steady clock, nanoseconds
+        };
+
+        /**
+         * What a watched event loop thread is running, as told by
+         * loop_activity. Written by that thread only, and read by the
+         * watchdog under a seqlock: the sequence is odd while a write is in
+         * progress, and a read is retried if it changed meanwhile. The detail
+         * is copied in, so it may be gone by the time a stall is reported.
+         */
+        class activity_slot {
+        public:
+            // Owner thread
+            void store(const activity& value) {
+                uint64_t words[WORDS];
+                std::memcpy(words, value.detail, sizeof(words));
+                auto sequence = sequence_.load(std::memory_order_relaxed);
+                sequence_.store(sequence + 1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+                what_.store(value.what, std::memory_order_relaxed);
+                for(size_t i = 0; i < WORDS; ++i) detail_[i].store(words[i], std::memory_order_relaxed);
+                since_.store(value.since, std::memory_order_relaxed);
+                sequence_.store(sequence + 2, std::memory_order_release);
+            }
+
+            // Any thread. False if the owner kept writing (i.e., it is not stalled).
+            bool load(activity& value) const {
+                for(int attempt = 0; attempt < MAX_READ_ATTEMPTS; ++attempt) {
+                    auto sequence = sequence_.load(std::memory_order_acquire);
+                    if(sequence & 1) continue;
+                    uint64_t words[WORDS];
+                    value.what = what_.load(std::memory_order_relaxed);
+                    for(size_t i = 0; i < WORDS; ++i) words[i] = detail_[i].load(std::memory_order_relaxed);
+                    value.since = since_.load(std::memory_order_relaxed);
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if(sequence_.load(std::memory_order_relaxed) != sequence) continue;
+                    std::memcpy(value.detail, words, sizeof(words));
+                    value.detail[activity::DETAIL_SIZE - 1] = '\0';
+                    return true;
+                }
+                return false;
+            }
+
+        private:
+            static constexpr size_t WORDS = activity::DETAIL_SIZE / sizeof(uint64_t);
+            static constexpr int MAX_READ_ATTEMPTS = 100;
+
+            std::atomic<uint32_t> sequence_{0};
+            std::atomic<const char*> what_{nullptr};
+            std::array<std::atomic<uint64_t>, WORDS> detail_{};
+            std::atomic<int64_t> since_{0};
+        };
+
+        // Slot of the watched loop running on this thread, if any
+        inline thread_local activity_slot* current_activity = nullptr;
+
+        inline int64_t steady_ns() {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        // Stack captured by the stalled thread itself, from a signal handler
+        struct stack_sample {
+            static constexpr int MAX_FRAMES = 64;
+            void* frames[MAX_FRAMES];
+            std::atomic<int> size{-1};
+        };
+
+        inline stack_sample& pending_stack_sample() {
+            static stack_sample sample;
+            return sample;
+        }
+
+        inline void capture_stack_sample(int) {
+            auto& sample = pending_stack_sample();
+            int size = ::backtrace(sample.frames, stack_sample::MAX_FRAMES);
+            sample.size.store(size, std::memory_order_release);
+        }
+
+    }
+
+    /**
+     * Marks what the current thread runs for the loop_watchdog, i.e.,
+     * a resource handler or a session step executed inline on an event
+     * loop. Scopes nest, and cost a couple of stores on watched threads
+     * (nothing elsewhere). They must not span a co_await, as the thread
+     * moves on to other handlers while the coroutine is suspended. The
+     * label must be a static string (i.e., a literal); the subject is copied,
+     * truncated to activity::DETAIL_SIZE.
+     */
+    class loop_activity {
+    public:
+        explicit loop_activity(const char* what, const char* subject = nullptr) :
+            slot_(detail::current_activity)
+        {
+            if(!slot_) return;
+            slot_->load(previous_);
+            detail::activity current;
+            current.what = what;
+            if(subject) std::strncpy(current.detail, subject, detail::activity::DETAIL_SIZE - 1);
+            current.since = detail::steady_ns();
+            slot_->store(current);
+        }
+
+        ~loop_activity() {
+            if(slot_) slot_->store(previous_);
+        }
+
+        loop_activity(const loop_activity&) = delete;
+        loop_activity& operator=(const loop_activity&) = delete;
+
+    private:
+        detail::activity_slot* slot_;
+        detail::activity previous_;
+    };
+
+    /**
+     * Event loop stall watchdog.
+     *
+     * A background thread posts a heartbeat probe to every watched
+     * io_context each interval, and the probe records how long it waited to
+     * run (the scheduling lag) in a histogram per loop. A probe still
+     * pending after the stall threshold means a handler is blocking the
+     * loop: the watchdog logs the loop, for how long it is stalled and the
+     * innermost loop_activity running there, and can also log a stack
+     * sample of the stalled thread. Stack samples interrupt the thread with
+     * STACK_SIGNAL, whose handler captures the stack with backtrace().
+     *
+     * The io_contexts, and the registry passed to register_metrics(), must
+     * outlive the watchdog.
+     */
+    class loop_watchdog {
+    public:
+        static constexpr auto DEFAULT_INTERVAL = std::chrono::milliseconds(50);
+        static constexpr auto DEFAULT_THRESHOLD = std::chrono::milliseconds(250);
+        static constexpr auto STACK_SAMPLE_TIMEOUT = std::chrono::milliseconds(100);
+        static inline const int STACK_SIGNAL = SIGRTMIN + 4;
+
+        struct policy {
+            std::chrono::milliseconds interval = DEFAULT_INTERVAL;      // between probes
+            std::chrono::milliseconds threshold = DEFAULT_THRESHOLD;    // lag reported as a stall
+            bool stack_samples = false;
+        };
+
+        loop_watchdog() : loop_watchdog(policy{}) {}
+
+        explicit loop_watchdog(policy config) : policy_(config) {}
+
+        ~loop_watchdog() {
+            stop();
+            if(registry_) registry_->remove(this);
+        }
+
+        loop_watchdog(const loop_watchdog&) = delete;
+        loop_watchdog& operator=(const loop_watchdog&) = delete;
+
+        // Watch an event loop (any time)
+        void watch(boost::asio::io_context& io, std::string name) {
+            auto state = std::make_shared<loop_state>(io, std::move(name));
+            std::scoped_lock lock(mutex_);
+            if(registry_) register_loop(*state);
+            loops_.push_back(std::move(state));
+        }
+
+        // Watch every thinger-http worker io_context. Found by walking the
+        // round-robin of get_next_io_context() until it wraps around.
+        void watch_workers(size_t max_workers = 256) {
+            auto& workers = thinger::asio::get_workers();
+            std::vector<boost::asio::io_context*> found;
+            for(size_t i = 0; i < max_workers; ++i) {
+                auto* io = &workers.get_next_io_context();
+                if(std::find(found.begin(), found.end(), io) != found.end()) break;
+                found.push_back(io);
+            }
+            for(size_t i = 0; i < found.size(); ++i) watch(*found[i], "worker-" + std::to_string(i));
+        }
+
+        // Lag histograms and stall counters of every loop
+        void register_metrics(metrics& registry) {
+            std::scoped_lock lock(mutex_);
+            registry_ = &registry;
+            for(auto& state : loops_) register_loop(*state);
+        }
+
+        bool start() {
+            std::scoped_lock lock(mutex_);
+            if(thread_.joinable()) return false;
+            if(policy_.stack_samples) install_stack_handler();
+            running_ = true;
+            thread_ = std::thread([this]() { run(); });
+            return true;
+        }
+
+        void stop() {
+            {
+                std::scoped_lock lock(mutex_);
+                running_ = false;
+            }
+            wakeup_.notify_all();
+            if(thread_.joinable()) thread_.join();
+        }
+
+        // Scheduling lag of a loop in microseconds (nullptr if not watched)
+        const histogram* get_lag(const std::string& name) const {
+            std::scoped_lock lock(mutex_);
+            for(auto& state : loops_) {
+                if(state->name == name) return &state->lag;
+            }
+            return nullptr;
+        }
+
+        // Stalls reported, over all loops
+        uint64_t get_stalls() const {
+            std::scoped_lock lock(mutex_);
+            uint64_t stalls = 0;
+            for(auto& state : loops_) stalls += state->stalls.load(std::memory_order_relaxed);
+            return stalls;
+        }
+
+    private:
+        struct loop_state {
+            loop_state(boost::asio::io_context& io, std::string name) : io(io), name(std::move(name)) {}
+
+            boost::asio::io_context& io;
+            const std::string name;
+            detail::activity_slot activity;
+            histogram lag;                              // microseconds
+            std::atomic<uint64_t> stalls{0};
+            std::atomic<int64_t> posted{0};             // pending probe, 0 if none
+            std::atomic<bool> stalled{false};           // pending probe reported
+            std::atomic<bool> has_thread{false};
+            std::atomic<pthread_t> thread{};
+        };
+
+        void register_loop(loop_state& state) {
+            metrics::label_set labels{{"loop", state.name}};
+            registry_->add_histogram("iotmp_event_loop_lag_seconds", "Time heartbeat probes waited to run on an event loop",
+                labels, state.lag, this);
+            registry_->add_counter("iotmp_event_loop_stalls_total", "Event loop stalls over the watchdog threshold", labels,
+                [&state]() { return static_cast<double>(state.stalls.load(std::memory_order_relaxed)); }, this);
+        }
+
+        void run() {
+            std::unique_lock lock(mutex_);
+            while(running_) {
+                auto now = detail::steady_ns();
+                for(auto& state : loops_) check(state, now);
+                wakeup_.wait_for(lock, policy_.interval, [this]() { return !running_; });
+            }
+        }
+
+        void check(const std::shared_ptr<loop_state>& state, int64_t now) {
+            int64_t posted = state->posted.load(std::memory_order_acquire);
+            if(posted == 0) {
+                post_probe(state, now);
+                return;
+            }
+            auto pending = std::chrono::nanoseconds(now - posted);
+            if(pending < policy_.threshold || state->stalled.exchange(true)) return;
+            state->stalls.fetch_add(1, std::memory_order_relaxed);
+            report_stall(*state, pending);
+        }
+
+        void post_probe(const std::shared_ptr<loop_state>& state, int64_t now) {
+            state->posted.store(now, std::memory_order_release);
+            boost::asio::post(state->io, [state]() {
+                detail::current_activity = &state->activity;
+                state->thread.store(pthread_self(), std::memory_order_relaxed);
+                state->has_thread.store(true, std::memory_order_release);
+
+                int64_t posted = state->posted.load(std::memory_order_acquire);
+                auto lag = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::nanoseconds(detail::steady_ns() - posted));
+                state->lag.record(static_cast<uint64_t>(std::max<int64_t>(lag.count(), 0)));
+                if(state->stalled.exchange(false)) {
+                    LOG_WARNING("Event loop {} recovered after {} ms", state->name, lag.count() / 1000);
+                }
+                state->posted.store(0, std::memory_order_release);
+            });
+        }
+
+        void report_stall(loop_state& state, std::chrono::nanoseconds pending) {
+            detail::activity running;
+            bool known = state.activity.load(running);
+            auto stalled_ms = std::chrono::duration_cast<std::chrono::milliseconds>(pending).count();
+
+            if(known && running.what) {
+                auto running_ms = (detail::steady_ns() - running.since) / 1000000;
+                LOG_WARNING("Event loop {} stalled for {} ms, running {}{}{} for {} ms", state.name, stalled_ms,
+                    running.what, running.detail[0] ? " " : "", running.detail, running_ms);
+            } else {
+                LOG_WARNING("Event loop {} stalled for {} ms, running an unmarked handler", state.name, stalled_ms);
+            }
+            if(policy_.stack_samples && state.has_thread.load(std::memory_order_acquire)) {
+                log_stack_sample(state);
+            }
+        }
+
+        // Interrupt the stalled thread so it captures its own stack
+        void log_stack_sample(loop_state& state) {
+            auto& sample = detail::pending_stack_sample();
+            sample.size.store(-1, std::memory_order_relaxed);
+            if(pthread_kill(state.thread.load(std::memory_order_relaxed), STACK_SIGNAL) != 0) return;
+
+            auto deadline = std::chrono::steady_clock::now() + STACK_SAMPLE_TIMEOUT;
+            int size;
+            while((size = sample.size.load(std::memory_order_acquire)) < 0) {
+                if(std::chrono::steady_clock::now() > deadline) {
+                    LOG_WARNING("No stack sample from event loop {}", state.name);
+                    return;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+
+            char** symbols = ::backtrace_symbols(sample.frames, size);
+            if(!symbols) return;
+            std::string stack;
+            // skip the signal handler and the signal trampoline
+            for(int i = 2; i < size; ++i) stack.append("\n    ").append(symbols[i]);
+            std::free(symbols);
+            LOG_WARNING("Stack of event loop {}:{}", state.name, stack);
+        }
+
+        static void install_stack_handler() {
+            static std::once_flag installed;
+            std::call_once(installed, []() {
+                // the first backtrace() call loads the unwinder, which must
+                // not happen inside the signal handler
+                void* frame;
+                ::backtrace(&frame, 1);
+                struct sigaction action{};
+                action.sa_handler = detail::capture_stack_sample;
+                action.sa_flags = SA_RESTART;
+                sigemptyset(&action.sa_mask);
+                sigaction(STACK_SIGNAL, &action, nullptr);
+            });
+        }
+
+        const policy policy_;
+        mutable std::mutex mutex_;
+        std::condition_variable wakeup_;
+        std::vector<std::shared_ptr<loop_state>> loops_;
+        std::thread thread_;
+        bool running_ = false;
+        metrics* registry_ = nullptr;
+    };
+
+}
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef THINGER_IOTMP_MEMORY_HPP
+#define THINGER_IOTMP_MEMORY_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace thinger::iotmp {
+
+    /**
+     * Bytes held by the buffers of a client and its sessions, and live
+     * sessions, per subsystem.
+     *
+     * Counts are relaxed atomics updated by the thread that owns each buffer
+     * and read by the metrics scraper, so they are exact once the owner is
+     * quiet and close enough meanwhile. They track payload bytes (or buffer
+     * capacity where the buffer is kept around), not allocator overhead.
+     */
+    class memory_accounting {
+    public:
+        enum class subsystem : uint8_t {
+            INPUT_BUFFER,       // connection receive buffer (capacity)
+            WRITE_BATCH,        // coalesced write buffer (capacity)
+            FRAME_POOL,         // recycled outbound frame buffers (capacity)
+            TERMINAL,           // input queued for the terminal PTYs
+            PROXY,              // data queued for the proxied sockets
+            CMD,                // stdin queued for streamed commands
+            FILE_TRANSFER       // file download chunk buffers
+        };
+
+        static constexpr size_t SUBSYSTEMS = 7;
+
+        static const char* to_string(subsystem value) {
+            switch(value) {
+                case subsystem::INPUT_BUFFER: return "input_buffer";
+                case subsystem::WRITE_BATCH: return "write_batch";
+                case subsystem::FRAME_POOL: return "frame_pool";
+                case subsystem::TERMINAL: return "terminal";
+                case subsystem::PROXY: return "proxy";
+                case subsystem::CMD: return "cmd";
+                case subsystem::FILE_TRANSFER: return "file_transfer";
+            }
+            return "unknown";
+        }
+
+        void add(subsystem owner, size_t bytes) {
+            entry(owner).bytes.fetch_add(static_cast<int64_t>(bytes), std::memory_order_relaxed);
+        }
+
+        void release(subsystem owner, size_t bytes) {
+            entry(owner).bytes.fetch_sub(static_cast<int64_t>(bytes), std::memory_order_relaxed);
+        }
+
+        // For buffers owned by a single object, i.e., the input buffer capacity
+        void set(subsystem owner, size_t bytes) {
+            entry(owner).bytes.store(static_cast<int64_t>(bytes), std::memory_order_relaxed);
+        }
+
+        int64_t bytes(subsystem owner) const {
+            return entry(owner).bytes.load(std::memory_order_relaxed);
+        }
+
+        int64_t sessions(subsystem owner) const {
+            return entry(owner).sessions.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Accounts a session of a subsystem and the bytes it holds, for its
+         * lifetime: whatever it did not release is released on destruction.
+         */
+        class tracker {
+        public:
+            tracker(memory_accounting& accounting, subsystem owner) :
+                accounting_(accounting), owner_(owner)
+            {
+                accounting_.entry(owner_).sessions.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            ~tracker() {
+                accounting_.release(owner_, held_);
+                accounting_.entry(owner_).sessions.fetch_sub(1, std::memory_order_relaxed);
+            }
+
+            tracker(const tracker&) = delete;
+            tracker& operator=(const tracker&) = delete;
+
+            void add(size_t bytes) {
+                held_ += bytes;
+                accounting_.add(owner_, bytes);
+            }
+
+            void release(size_t bytes) {
+                held_ -= bytes;
+                accounting_.release(owner_, bytes);
+            }
+
+            size_t held() const {
+                return held_;
+            }
+
+        private:
+            memory_accounting& accounting_;
+            subsystem owner_;
+            size_t held_ = 0;
+        };
+
+    private:
+        struct counts {
+            std::atomic<int64_t> bytes{0};
+            std::atomic<int64_t> sessions{0};
+        };
+
+        counts& entry(subsystem owner) {
+            return entries_[static_cast<size_t>(owner)];
+        }
+
+        const counts& entry(subsystem owner) const {
+            return entries_[static_cast<size_t>(owner)];
+        }
+
+        std::array<counts, SUBSYSTEMS> entries_;
+    };
+
+}
+
+#endif
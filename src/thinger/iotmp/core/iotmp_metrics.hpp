@@ -0,0 +1,397 @@
+#ifndef THINGER_IOTMP_METRICS_HPP
+#define THINGER_IOTMP_METRICS_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <spdlog/fmt/fmt.h>
+
+#include "iotmp_histogram.hpp"
+#include "iotmp_types.hpp"
+
+namespace thinger::iotmp {
+
+    namespace detail {
+
+        /**
+         * Process-wide counter slots, one set per thread.
+         *
+         * Every counter owns a slot id, and every thread that increments it
+         * writes only its own slot, with a relaxed load and store instead of
+         * an atomic read-modify-write, so increments never contend. Reading
+         * a counter sums its slot across the live threads plus what exited
+         * threads left behind.
+         */
+        class counter_slots {
+        public:
+            static constexpr size_t BLOCK_SLOTS = 512;
+            static constexpr size_t MAX_BLOCKS = 1024;
+
+            static counter_slots& instance() {
+                static counter_slots slots;
+                return slots;
+            }
+
+            uint32_t allocate() {
+                std::scoped_lock lock(mutex_);
+                if(!free_.empty()) {
+                    uint32_t id = free_.back();
+                    free_.pop_back();
+                    return id;
+                }
+                if(next_ >= BLOCK_SLOTS * MAX_BLOCKS) throw std::length_error("too many metric counters");
+                return next_++;
+            }
+
+            // Slots are not cleared when released: counters keep the value
+            // their slot had when allocated as their zero
+            void release(uint32_t id) {
+                std::scoped_lock lock(mutex_);
+                free_.push_back(id);
+            }
+
+            void add(uint32_t id, uint64_t value) {
+                auto& slot = local().slot(id);
+                slot.store(slot.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+            }
+
+            uint64_t sum(uint32_t id) const {
+                std::scoped_lock lock(mutex_);
+                auto it = retired_.find(id);
+                uint64_t total = it != retired_.end() ? it->second : 0;
+                for(auto* shard : shards_) total += shard->value(id);
+                return total;
+            }
+
+        private:
+            struct block {
+                std::array<std::atomic<uint64_t>, BLOCK_SLOTS> slots{};
+            };
+
+            // Slots of one thread, allocated a block at a time by that thread
+            struct shard {
+                std::array<std::atomic<block*>, MAX_BLOCKS> blocks{};
+
+                ~shard() {
+                    for(auto& entry : blocks) delete entry.load(std::memory_order_relaxed);
+                }
+
+                std::atomic<uint64_t>& slot(uint32_t id) {
+                    auto& entry = blocks[id / BLOCK_SLOTS];
+                    auto* slots = entry.load(std::memory_order_relaxed);
+                    if(!slots) {
+                        slots = new block();
+                        entry.store(slots, std::memory_order_release);
+                    }
+                    return slots->slots[id % BLOCK_SLOTS];
+                }
+
+                uint64_t value(uint32_t id) const {
+                    auto* slots = blocks[id / BLOCK_SLOTS].load(std::memory_order_acquire);
+                    return slots ? slots->slots[id % BLOCK_SLOTS].load(std::memory_order_relaxed) : 0;
+                }
+            };
+
+            // Lists the shard of a thread while it runs, and keeps its
+            // values once it exits
+            struct thread_shard {
+                explicit thread_shard(counter_slots& owner) : owner(owner) {
+                    std::scoped_lock lock(owner.mutex_);
+                    owner.shards_.push_back(&slots);
+                }
+
+                ~thread_shard() {
+                    std::scoped_lock lock(owner.mutex_);
+                    for(size_t i = 0; i < MAX_BLOCKS; ++i) {
+                        auto* values = slots.blocks[i].load(std::memory_order_relaxed);
+                        if(!values) continue;
+                        for(size_t j = 0; j < BLOCK_SLOTS; ++j) {
+                            uint64_t value = values->slots[j].load(std::memory_order_relaxed);
+                            if(value) owner.retired_[static_cast<uint32_t>(i * BLOCK_SLOTS + j)] += value;
+                        }
+                    }
+                    std::erase(owner.shards_, &slots);
+                }
+
+                counter_slots& owner;
+                shard slots;
+            };
+
+            shard& local() {
+                thread_local thread_shard current(*this);
+                return current.slots;
+            }
+
+            mutable std::mutex mutex_;
+            std::vector<shard*> shards_;
+            std::unordered_map<uint32_t, uint64_t> retired_;
+            std::vector<uint32_t> free_;
+            uint32_t next_ = 0;
+        };
+
+    }
+
+    /**
+     * Monotonic counter with per-thread slots (see detail::counter_slots).
+     * add() is a couple of plain memory operations on the calling thread;
+     * value() is meant for scrapes, not hot paths.
+     */
+    class counter {
+    public:
+        counter() :
+            id_(detail::counter_slots::instance().allocate()),
+            base_(detail::counter_slots::instance().sum(id_))
+        {}
+
+        ~counter() {
+            detail::counter_slots::instance().release(id_);
+        }
+
+        counter(const counter&) = delete;
+        counter& operator=(const counter&) = delete;
+
+        void add(uint64_t value = 1) {
+            detail::counter_slots::instance().add(id_, value);
+        }
+
+        uint64_t value() const {
+            return detail::counter_slots::instance().sum(id_) - base_;
+        }
+
+    private:
+        const uint32_t id_;
+        const uint64_t base_;
+    };
+
+    /**
+     * Registry of named metrics: counters, gauges (evaluated when read) and
+     * latency histograms in microseconds.
+     *
+     * Metrics are grouped in families by name, and told apart by their
+     * labels. Every metric can be tagged with an owner, so a client sharing
+     * the registry (i.e., in a gateway) can list and remove only its own.
+     * Registering and reading take a lock; updating a counter or histogram
+     * does not. Gauge functions run on the reading thread, under the
+     * registry lock.
+     */
+    class metrics {
+    public:
+        using label_set = std::vector<std::pair<std::string, std::string>>;
+        using value_function = std::function<double()>;
+
+        enum class metric_type { COUNTER, GAUGE, HISTOGRAM };
+
+        // Histogram buckets for the Prometheus text, in microseconds
+        static constexpr std::array<uint64_t, 18> LATENCY_BUCKETS = {
+            50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000,
+            250000, 500000, 1000000, 2500000, 5000000, 10000000, 30000000
+        };
+
+        counter& add_counter(std::string_view name, std::string_view help, label_set labels = {}, const void* owner = nullptr) {
+            auto& entry = add(name, help, metric_type::COUNTER, std::move(labels), owner);
+            entry.owned_counter = std::make_unique<counter>();
+            return *entry.owned_counter;
+        }
+
+        // Counter kept elsewhere (i.e., an existing atomic total)
+        void add_counter(std::string_view name, std::string_view help, label_set labels, value_function value, const void* owner = nullptr) {
+            add(name, help, metric_type::COUNTER, std::move(labels), owner).value = std::move(value);
+        }
+
+        void add_gauge(std::string_view name, std::string_view help, label_set labels, value_function value, const void* owner = nullptr) {
+            add(name, help, metric_type::GAUGE, std::move(labels), owner).value = std::move(value);
+        }
+
+        histogram& add_histogram(std::string_view name, std::string_view help, label_set labels = {}, const void* owner = nullptr) {
+            auto& entry = add(name, help, metric_type::HISTOGRAM, std::move(labels), owner);
+            entry.owned_histogram = std::make_unique<histogram>();
+            entry.source = entry.owned_histogram.get();
+            return *entry.owned_histogram;
+        }
+
+        // Histogram kept elsewhere, which must outlive its registration
+        void add_histogram(std::string_view name, std::string_view help, label_set labels, const histogram& source, const void* owner = nullptr) {
+            add(name, help, metric_type::HISTOGRAM, std::move(labels), owner).source = &source;
+        }
+
+        // Whether an owner registered any metric
+        bool contains(const void* owner) const {
+            std::scoped_lock lock(mutex_);
+            for(auto& [name, family] : families_) {
+                for(auto& entry : family.entries) {
+                    if(entry.owner == owner) return true;
+                }
+            }
+            return false;
+        }
+
+        // Unregister every metric of an owner
+        void remove(const void* owner) {
+            std::scoped_lock lock(mutex_);
+            for(auto it = families_.begin(); it != families_.end();) {
+                it->second.entries.remove_if([owner](const entry& e) { return e.owner == owner; });
+                it = it->second.entries.empty() ? families_.erase(it) : std::next(it);
+            }
+        }
+
+        /**
+         * Current values, by family: {name: {"type", "help", "metrics": [...]}}
+         * where every metric holds its "labels" and either its "value" or,
+         * for histograms, "count", "sum", "p50", "p90", "p99" and "max" in
+         * microseconds.
+         * @param owners only the metrics of these owners (all if empty)
+         */
+        json_t to_json(const std::vector<const void*>& owners = {}) const {
+            json_t result = json_t::object();
+            std::scoped_lock lock(mutex_);
+            for(auto& [name, family] : families_) {
+                json_t values = json_t::array();
+                for(auto& e : family.entries) {
+                    if(!owners.empty() && std::find(owners.begin(), owners.end(), e.owner) == owners.end()) continue;
+                    json_t metric;
+                    metric["labels"] = json_t::object();
+                    for(auto& [key, value] : e.labels) metric["labels"][key] = value;
+                    if(family.type == metric_type::HISTOGRAM) {
+                        metric["count"] = e.source->count();
+                        metric["sum"] = e.source->sum();
+                        metric["p50"] = e.source->percentile(50);
+                        metric["p90"] = e.source->percentile(90);
+                        metric["p99"] = e.source->percentile(99);
+                        metric["max"] = e.source->max();
+                    } else if(e.owned_counter) {
+                        metric["value"] = e.owned_counter->value();
+                    } else {
+                        metric["value"] = e.read();
+                    }
+                    values.push_back(std::move(metric));
+                }
+                if(values.empty()) continue;
+                auto& out = result[name];
+                out["type"] = to_string(family.type);
+                out["help"] = family.help;
+                out["metrics"] = std::move(values);
+            }
+            return result;
+        }
+
+        // Prometheus text exposition format (version 0.0.4). Histograms are
+        // reported in seconds.
+        std::string to_prometheus() const {
+            std::string out;
+            std::scoped_lock lock(mutex_);
+            for(auto& [name, family] : families_) {
+                fmt::format_to(std::back_inserter(out), "# HELP {} {}\n# TYPE {} {}\n", name, family.help, name, to_string(family.type));
+                for(auto& e : family.entries) {
+                    if(family.type != metric_type::HISTOGRAM) {
+                        if(e.owned_counter) {
+                            fmt::format_to(std::back_inserter(out), "{}{} {}\n", name, format_labels(e.labels), e.owned_counter->value());
+                        } else {
+                            fmt::format_to(std::back_inserter(out), "{}{} {}\n", name, format_labels(e.labels), e.read());
+                        }
+                        continue;
+                    }
+                    // cumulative counts of the log-linear buckets below each bound
+                    uint64_t cumulative = 0;
+                    size_t index = 0;
+                    for(auto bound : LATENCY_BUCKETS) {
+                        while(index < histogram::BUCKETS && histogram::bucket_upper_bound(index) <= bound) {
+                            cumulative += e.source->bucket_count(index++);
+                        }
+                        fmt::format_to(std::back_inserter(out), "{}_bucket{} {}\n", name,
+                            format_labels(e.labels, fmt::format("{}", bound / 1e6)), cumulative);
+                    }
+                    for(; index < histogram::BUCKETS; ++index) cumulative += e.source->bucket_count(index);
+                    fmt::format_to(std::back_inserter(out), "{}_bucket{} {}\n", name, format_labels(e.labels, "+Inf"), cumulative);
+                    fmt::format_to(std::back_inserter(out), "{}_sum{} {}\n", name, format_labels(e.labels), e.source->sum() / 1e6);
+                    fmt::format_to(std::back_inserter(out), "{}_count{} {}\n", name, format_labels(e.labels), cumulative);
+                }
+            }
+            return out;
+        }
+
+        static const char* to_string(metric_type type) {
+            switch(type) {
+                case metric_type::COUNTER: return "counter";
+                case metric_type::GAUGE: return "gauge";
+                case metric_type::HISTOGRAM: return "histogram";
+            }
+            return "untyped";
+        }
+
+    private:
+        struct entry {
+            label_set labels;
+            const void* owner = nullptr;
+            std::unique_ptr<counter> owned_counter;
+            std::unique_ptr<histogram> owned_histogram;
+            const histogram* source = nullptr;
+            value_function value;
+
+            double read() const {
+                return value ? value() : 0.0;
+            }
+        };
+
+        struct family {
+            std::string help;
+            metric_type type;
+            std::list<entry> entries;       // stable addresses for the metrics handed out
+        };
+
+        entry& add(std::string_view name, std::string_view help, metric_type type, label_set labels, const void* owner) {
+            std::scoped_lock lock(mutex_);
+            auto [it, inserted] = families_.try_emplace(std::string(name));
+            auto& f = it->second;
+            if(inserted) {
+                f.help = std::string(help);
+                f.type = type;
+            } else if(f.type != type) {
+                throw std::invalid_argument(fmt::format("metric {} registered with another type", name));
+            }
+            auto& e = f.entries.emplace_back();
+            e.labels = std::move(labels);
+            e.owner = owner;
+            return e;
+        }
+
+        static std::string format_labels(const label_set& labels, std::string_view le = {}) {
+            if(labels.empty() && le.empty()) return {};
+            std::string out = "{";
+            for(auto& [key, value] : labels) {
+                if(out.size() > 1) out.push_back(',');
+                out.append(key).append("=\"");
+                for(char c : value) {
+                    if(c == '\\' || c == '"') out.push_back('\\');
+                    if(c == '\n') out.append("\\n");
+                    else out.push_back(c);
+                }
+                out.push_back('"');
+            }
+            if(!le.empty()) {
+                if(out.size() > 1) out.push_back(',');
+                out.append("le=\"").append(le).append("\"");
+            }
+            out.push_back('}');
+            return out;
+        }
+
+        mutable std::mutex mutex_;
+        std::map<std::string, family, std::less<>> families_;
+    };
+
+}
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef THINGER_IOTMP_MPSC_QUEUE_HPP
+#define THINGER_IOTMP_MPSC_QUEUE_HPP
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <optional>
+
+namespace thinger::iotmp {
+
+    /**
+     * Bounded lock-free multi-producer single-consumer queue.
+     *
+     * Array based queue where every slot carries a sequence number telling
+     * whether it is free for the producer of a given round or holds a value
+     * for the consumer (D. Vyukov's bounded queue). Producers claim slots
+     * with a CAS on the tail and never block: try_push() fails when the
+     * queue is full. Only one thread may call try_pop() at a time.
+     */
+    template<typename T>
+    class mpsc_queue {
+    public:
+        /**
+         * @param capacity maximum number of queued elements, rounded up to a power of two
+         */
+        explicit mpsc_queue(size_t capacity) :
+            capacity_(std::bit_ceil(capacity < 2 ? size_t{2} : capacity)),
+            mask_(capacity_ - 1),
+            slots_(std::make_unique<slot[]>(capacity_))
+        {
+            for(size_t i = 0; i < capacity_; ++i) {
+                slots_[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        mpsc_queue(const mpsc_queue&) = delete;
+        mpsc_queue& operator=(const mpsc_queue&) = delete;
+
+        /**
+         * Push a value from any thread
+         * @return false if the queue is full (the value is left untouched)
+         */
+        bool try_push(T& value) {
+            size_t pos = tail_.load(std::memory_order_relaxed);
+            for(;;) {
+                slot& s = slots_[pos & mask_];
+                size_t seq = s.sequence.load(std::memory_order_acquire);
+                auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+                if(diff == 0) {
+                    if(tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        s.value = std::move(value);
+                        s.sequence.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                } else if(diff < 0) {
+                    return false;
+                } else {
+                    pos = tail_.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        bool try_push(T&& value) {
+            return try_push(value);
+        }
+
+        /**
+         * Pop the oldest value (single consumer)
+         * @return the value, or std::nullopt if the queue is empty
+         */
+        std::optional<T> try_pop() {
+            size_t pos = head_.load(std::memory_order_relaxed);
+            slot& s = slots_[pos & mask_];
+            size_t seq = s.sequence.load(std::memory_order_acquire);
+            if(static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos + 1) < 0) {
+                return std::nullopt;
+            }
+            std::optional<T> value(std::move(s.value));
+            s.value = T{};
+            s.sequence.store(pos + capacity_, std::memory_order_release);
+            head_.store(pos + 1, std::memory_order_relaxed);
+            return value;
+        }
+
+        // Approximate number of queued elements
+        size_t size_approx() const {
+            size_t tail = tail_.load(std::memory_order_relaxed);
+            size_t head = head_.load(std::memory_order_relaxed);
+            return tail > head ? tail - head : 0;
+        }
+
+        size_t capacity() const {
+            return capacity_;
+        }
+
+    private:
+        static constexpr size_t CACHE_LINE = 64;
+
+        struct slot {
+            std::atomic<size_t> sequence;
+            T value;
+        };
+
+        const size_t capacity_;
+        const size_t mask_;
+        std::unique_ptr<slot[]> slots_;
+
+        // producers and consumer live on different cache lines
+        alignas(CACHE_LINE) std::atomic<size_t> tail_{0};
+        alignas(CACHE_LINE) std::atomic<size_t> head_{0};
+    };
+
+}
+
+#endif
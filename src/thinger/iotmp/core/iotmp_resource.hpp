@@ -378,6 +378,7 @@ namespace thinger::iotmp{
         callback    callback_;
         uint16_t    stream_id_          = 0;
         bool        stream_echo_        = true;
+        bool        fixed_output_       = false;
 
 #ifdef THINGER_USE_LOCAL_HTTPLIB
         httplib::Server* server_        = nullptr;
@@ -424,6 +425,22 @@ namespace thinger::iotmp{
             stream_echo_ = enabled;
         }
 
+        bool fixed_output(){
+            return fixed_output_;
+        }
+
+        /**
+         * Declare that the output handler writes the same keys on every call
+         * (i.e., a sensor reading). Interval streams of the resource then
+         * keep its payload between rounds and only update the values, instead
+         * of building a new one: keys the handler stops writing keep their
+         * last value.
+         */
+        iotmp_resource& set_fixed_output(bool enabled = true){
+            fixed_output_ = enabled;
+            return *this;
+        }
+
         io_type get_io_type(){
             return io_type_;
         }
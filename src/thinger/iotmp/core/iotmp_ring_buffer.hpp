@@ -0,0 +1,95 @@
+#ifndef THINGER_IOTMP_RING_BUFFER_HPP
+#define THINGER_IOTMP_RING_BUFFER_HPP
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace thinger::iotmp {
+
+    /**
+     * FIFO over a circular array that only grows (by doubling).
+     *
+     * Unlike std::deque, which allocates and frees a block every few
+     * elements as it moves along, a queue that keeps filling and draining
+     * allocates nothing once it reached its peak size. Popped slots are
+     * reset to a default value, so they release whatever they held. Not
+     * thread-safe.
+     */
+    template<typename T>
+    class ring_buffer {
+    public:
+        static constexpr size_t MIN_CAPACITY = 8;
+
+        bool empty() const {
+            return size_ == 0;
+        }
+
+        size_t size() const {
+            return size_;
+        }
+
+        size_t capacity() const {
+            return slots_.size();
+        }
+
+        T& front() {
+            return slots_[head_];
+        }
+
+        const T& front() const {
+            return slots_[head_];
+        }
+
+        void push_back(T value) {
+            if(size_ == slots_.size()) grow();
+            at(size_) = std::move(value);
+            ++size_;
+        }
+
+        void pop_front() {
+            slots_[head_] = T{};
+            head_ = (head_ + 1) & (slots_.size() - 1);
+            --size_;
+        }
+
+        // Remove the elements matching a predicate, keeping the order of the rest
+        template<typename Predicate>
+        void erase_if(Predicate predicate) {
+            size_t kept = 0;
+            for(size_t i = 0; i < size_; ++i) {
+                T& item = at(i);
+                if(predicate(item)) continue;
+                if(kept != i) at(kept) = std::move(item);
+                ++kept;
+            }
+            for(size_t i = kept; i < size_; ++i) at(i) = T{};
+            size_ = kept;
+        }
+
+        // Drop every element (the capacity is kept)
+        void clear() {
+            while(size_ > 0) pop_front();
+            head_ = 0;
+        }
+
+    private:
+        T& at(size_t index) {
+            return slots_[(head_ + index) & (slots_.size() - 1)];
+        }
+
+        void grow() {
+            std::vector<T> slots(slots_.empty() ? MIN_CAPACITY : slots_.size() * 2);
+            for(size_t i = 0; i < size_; ++i) slots[i] = std::move(at(i));
+            slots_.swap(slots);
+            head_ = 0;
+        }
+
+        std::vector<T> slots_;      // power of two size
+        size_t head_ = 0;
+        size_t size_ = 0;
+    };
+
+}
+
+#endif
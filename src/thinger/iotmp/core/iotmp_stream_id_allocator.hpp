@@ -0,0 +1,106 @@
+#ifndef THINGER_IOTMP_STREAM_ID_ALLOCATOR_HPP
+#define THINGER_IOTMP_STREAM_ID_ALLOCATOR_HPP
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+
+namespace thinger::iotmp {
+
+    /**
+     * Bitmap allocator for 16-bit stream ids.
+     *
+     * Id 0 means "no stream" across the protocol and is never handed out. The
+     * search starts right after the last allocated id, so a released id is not
+     * reused until the whole space has been walked, and a late response for an
+     * expired request cannot be mistaken for the answer to a newer one. The
+     * cursor starts at a random id on every reset(), so the ids of a new
+     * connection do not repeat the ones of the previous one.
+     */
+    class stream_id_allocator {
+    public:
+        static constexpr size_t MAX_IDS = 65536;
+
+        stream_id_allocator() {
+            reset();
+        }
+
+        /**
+         * Allocate a free stream id
+         * @return the allocated id, or 0 if every id is in use
+         */
+        uint16_t allocate() {
+            if(used_ == MAX_IDS) return 0;
+
+            size_t first_word = next_ / WORD_BITS;
+            // bits below the cursor in the first word are checked last (i == WORDS)
+            uint64_t skip_mask = (uint64_t{1} << (next_ % WORD_BITS)) - 1;
+
+            for(size_t i = 0; i <= WORDS; ++i) {
+                size_t word = (first_word + i) % WORDS;
+                uint64_t bits = bitmap_[word];
+                if(i == 0) bits |= skip_mask;
+                if(bits == ~uint64_t{0}) continue;
+
+                auto id = static_cast<uint16_t>(word * WORD_BITS + std::countr_one(bits));
+                bitmap_[word] |= uint64_t{1} << (id % WORD_BITS);
+                ++used_;
+                next_ = (static_cast<size_t>(id) + 1) % MAX_IDS;
+                return id;
+            }
+            return 0;
+        }
+
+        /**
+         * Mark an id chosen elsewhere (i.e., by the server) as in use
+         * @return true if the id was free
+         */
+        bool mark(uint16_t id) {
+            if(id == 0 || is_used(id)) return false;
+            bitmap_[id / WORD_BITS] |= uint64_t{1} << (id % WORD_BITS);
+            ++used_;
+            return true;
+        }
+
+        /**
+         * Return an id to the pool
+         * @return true if the id was in use
+         */
+        bool release(uint16_t id) {
+            if(id == 0 || !is_used(id)) return false;
+            bitmap_[id / WORD_BITS] &= ~(uint64_t{1} << (id % WORD_BITS));
+            --used_;
+            return true;
+        }
+
+        bool is_used(uint16_t id) const {
+            return (bitmap_[id / WORD_BITS] >> (id % WORD_BITS)) & 1;
+        }
+
+        // Number of ids currently in use (id 0 included)
+        size_t size() const {
+            return used_;
+        }
+
+        void reset() {
+            bitmap_.fill(0);
+            bitmap_[0] = 1;  // id 0 is reserved
+            used_ = 1;
+            next_ = std::uniform_int_distribution<size_t>(1, MAX_IDS - 1)(random_);
+        }
+
+    private:
+        static constexpr size_t WORD_BITS = 64;
+        static constexpr size_t WORDS = MAX_IDS / WORD_BITS;
+
+        std::array<uint64_t, WORDS> bitmap_{};
+        size_t used_ = 0;
+        size_t next_ = 1;
+        std::minstd_rand random_{std::random_device{}()};
+    };
+
+}
+
+#endif
@@ -3,6 +3,10 @@
 
 namespace thinger::iotmp {
 
+boost::asio::io_context& session_io_context(client& client) {
+    return client.get_session_io_context();
+}
+
 stream_manager::stream_manager(client& client, const char* resource)
     : client_(client),
       resource_(client[resource])
@@ -12,7 +16,16 @@ stream_manager::stream_manager(client& client, const char* resource)
         auto stream_id = in.get_stream_id();
         auto session = get_session(stream_id);
         if(session) {
-            session->handle_input(in);
+            auto& io = session->get_io_context();
+            if(io.get_executor().running_in_this_thread()) {
+                session->handle_input(in);
+            } else {
+                // the request is gone once this returns, so the payload moves along
+                boost::asio::post(io, [session, stream_id, data = std::move(in.payload())]() mutable {
+                    input session_in(stream_id, data);
+                    session->handle_input(session_in);
+                });
+            }
         } else {
             THINGER_LOG_ERROR("stream id does not correspond with a session: {}", stream_id);
             stop(stream_id, [](const exec_result&) {});
@@ -52,24 +65,31 @@ void stream_manager::start(uint16_t stream_id, json_t& path_parameters,
         return handler(false);
     }
 
-    // Launch coroutine to start the session
-    co_spawn(client_.get_io_context(),
-        [this, stream_id, session, handler = std::move(handler)]() mutable -> awaitable<void> {
+    // Launch coroutine to start the session on its own io_context. The
+    // session table is only touched from the connection io_context.
+    auto& connection_io = client_.get_io_context();
+    co_spawn(session->get_io_context(),
+        [this, stream_id, session, &connection_io, handler = std::move(handler)]() mutable -> awaitable<void> {
             // Start session using coroutine
             auto result = co_await session->start();
 
-            if(result) {
-                // Store session (as weak ptr)
-                sessions_.emplace(stream_id, session);
-
-                // Set session listener to clean-up once done
-                session->set_on_end_listener([this, stream_id]() {
-                    stop(stream_id, [](exec_result&&) {});
+            boost::asio::dispatch(connection_io,
+                [this, stream_id, session, &connection_io, handler = std::move(handler), result = std::move(result)]() mutable {
+                    if(result) {
+                        // Store session (as weak ptr)
+                        sessions_.emplace(stream_id, session);
+
+                        // Set session listener to clean-up once done
+                        session->set_on_end_listener([this, stream_id, &connection_io]() {
+                            boost::asio::dispatch(connection_io, [this, stream_id]() {
+                                stop(stream_id, [](exec_result&&) {});
+                            });
+                        });
+                    }
+
+                    // Call the handler with the result
+                    handler(std::move(result));
                 });
-            }
-
-            // Call the handler with the result
-            handler(std::move(result));
         },
         detached);
 }
@@ -84,7 +104,9 @@ void stream_manager::stop(uint16_t stream_id, result_handler handler) {
     sessions_.erase(it);
 
     if(session) {
-        session->stop();
+        boost::asio::dispatch(session->get_io_context(), [session]() {
+            session->stop();
+        });
     } else {
         client_.stop_stream(stream_id);
     }
@@ -13,11 +13,13 @@ namespace thinger::iotmp {
 
 #include "iotmp_logger.hpp"
 #include "iotmp_resource.hpp"
+#include "iotmp_trace.hpp"
 
 // Include coroutine support from thinger-http
 #include <thinger/util/types.hpp>
 #include <boost/asio/co_spawn.hpp>
 #include <boost/asio/detached.hpp>
+#include <boost/asio/io_context.hpp>
 
 namespace thinger::iotmp {
 
@@ -28,6 +30,9 @@ using boost::asio::use_awaitable;
 using boost::asio::co_spawn;
 using boost::asio::detached;
 
+// io_context a new session runs on, see client::get_session_io_context()
+boost::asio::io_context& session_io_context(client& client);
+
 // Stop reasons for stream sessions
 enum class StopReason {
     SERVER_STOP,     // STOP_STREAM received from server
@@ -40,14 +45,18 @@ class stream_session : public std::enable_shared_from_this<stream_session> {
 public:
     stream_session(client& client, uint16_t stream_id, std::string session = "")
         : client_(client),
+          io_context_(session_io_context(client)),
           stream_id_(stream_id),
           session_(std::move(session)),
           last_(std::chrono::system_clock::now())
     {
+        IOTMP_TRACE(session_start, stream_id_, session_.c_str());
     }
 
     virtual ~stream_session() {
         THINGER_LOG("stream session {} ended. {} sent, {} received", stream_id_, sent_, received_);
+        IOTMP_TRACE(session_stop, stream_id_, sent_, received_,
+            std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started_).count());
         if(on_end_) on_end_();
     }
 
@@ -60,6 +69,13 @@ public:
     virtual awaitable<exec_result> start() = 0;
     virtual bool stop(StopReason reason = StopReason::SERVER_STOP) = 0;
 
+    // io_context running this session. With session sharding it may not be
+    // the connection one: input and stop are delivered here by the stream
+    // manager, and data goes back through the thread-safe client API.
+    boost::asio::io_context& get_io_context() const {
+        return io_context_;
+    }
+
     uint16_t get_stream_id() const {
         return stream_id_;
     }
@@ -83,20 +99,24 @@ public:
 
 protected:
     void increase_sent(size_t bytes) {
+        IOTMP_TRACE(session_chunk, stream_id_, bytes, 0);
         sent_ += bytes;
         last_ = std::chrono::system_clock::now();
     }
 
     void increase_received(size_t bytes) {
+        IOTMP_TRACE(session_chunk, stream_id_, bytes, 1);
         received_ += bytes;
         last_ = std::chrono::system_clock::now();
     }
 
 protected:
     client& client_;
+    boost::asio::io_context& io_context_;
     uint16_t stream_id_;
     std::string session_;
     std::chrono::time_point<std::chrono::system_clock> last_;
+    const std::chrono::steady_clock::time_point started_ = std::chrono::steady_clock::now();
     size_t sent_ = 0;
     size_t received_ = 0;
     std::function<void()> on_end_;
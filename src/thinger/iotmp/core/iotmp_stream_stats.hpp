@@ -0,0 +1,95 @@
+#ifndef THINGER_IOTMP_STREAM_STATS_HPP
+#define THINGER_IOTMP_STREAM_STATS_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace thinger::iotmp {
+
+    /**
+     * Traffic of an open stream, in each direction.
+     *
+     * Updated by the client on the connection thread for every stream data
+     * frame it reads or writes, where it already looks the stream up, so
+     * keeping it costs a few additions and a time comparison per frame.
+     * Rates are measured over RATE_WINDOW: the one of the last complete
+     * window, or of the current one once it is overdue, so the rate of a
+     * stream that went quiet falls to zero. Not thread-safe.
+     */
+    class stream_stats {
+    public:
+        using clock = std::chrono::steady_clock;
+        static constexpr auto RATE_WINDOW = std::chrono::seconds(1);
+
+        class direction {
+        public:
+            void record(size_t bytes, size_t frames, clock::time_point now) {
+                if(now - window_start_ >= RATE_WINDOW) {
+                    rate_ = per_second(window_bytes_, now - window_start_);
+                    window_start_ = now;
+                    window_bytes_ = 0;
+                }
+                bytes_ += bytes;
+                frames_ += frames;
+                window_bytes_ += bytes;
+                last_ = now;
+            }
+
+            uint64_t bytes() const { return bytes_; }
+            uint64_t frames() const { return frames_; }
+            clock::time_point last() const { return last_; }
+
+            // Bytes per second
+            double rate(clock::time_point now) const {
+                auto elapsed = now - window_start_;
+                return elapsed >= RATE_WINDOW ? per_second(window_bytes_, elapsed) : rate_;
+            }
+
+        private:
+            friend class stream_stats;
+
+            static double per_second(uint64_t bytes, clock::duration elapsed) {
+                return bytes / std::chrono::duration<double>(elapsed).count();
+            }
+
+            uint64_t bytes_ = 0;
+            uint64_t frames_ = 0;
+            clock::time_point last_{};
+            clock::time_point window_start_{};
+            uint64_t window_bytes_ = 0;
+            double rate_ = 0;
+        };
+
+        explicit stream_stats(clock::time_point started = clock::now()) : started_(started) {
+            sent_.window_start_ = received_.window_start_ = started;
+        }
+
+        void record_sent(size_t bytes, size_t frames, clock::time_point now) {
+            sent_.record(bytes, frames, now);
+        }
+
+        void record_received(size_t bytes, clock::time_point now) {
+            received_.record(bytes, 1, now);
+        }
+
+        const direction& sent() const { return sent_; }
+        const direction& received() const { return received_; }
+
+        clock::time_point started() const { return started_; }
+
+        // Last frame in either direction (the start time if there was none)
+        clock::time_point last_activity() const {
+            auto last = sent_.last() > received_.last() ? sent_.last() : received_.last();
+            return last > started_ ? last : started_;
+        }
+
+    private:
+        clock::time_point started_;
+        direction sent_;
+        direction received_;
+    };
+
+}
+
+#endif
@@ -0,0 +1,390 @@
+#ifndef THINGER_IOTMP_TLS_CONTEXT_HPP
+#define THINGER_IOTMP_TLS_CONTEXT_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+#include <boost/asio/ssl.hpp>
+#include <openssl/ssl.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "iotmp_histogram.hpp"
+#include "iotmp_logger.hpp"
+
+namespace thinger::iotmp {
+
+    /**
+     * Client TLS context with session resumption.
+     *
+     * Wraps a boost::asio::ssl::context shared by every connection created
+     * from it, and caches the sessions the server hands out (TLS 1.3 tickets
+     * or TLS 1.2 session ids) by server name. When a new connection starts
+     * its handshake, the cached session for its server name is offered, so
+     * reconnects skip the full handshake whenever the server accepts it.
+     * Sessions can optionally be persisted to a file so they also survive
+     * process restarts. The file is written by a thread of its own, at most
+     * once per SAVE_DELAY, never from the handshake callbacks.
+     *
+     * All hooks are installed on the SSL_CTX, so they work with any socket
+     * built on top of the context. They may run on any io thread.
+     */
+    class tls_context {
+    public:
+        // Sessions issued within this delay are saved in one write (a TLS 1.3
+        // server usually sends two tickets, and clients reconnect together)
+        static constexpr auto SAVE_DELAY = std::chrono::seconds(1);
+
+        // Addresses with a server name, see set_server_name()
+        static constexpr size_t MAX_SERVER_NAMES = 64;
+
+        tls_context() :
+            context_(std::make_shared<boost::asio::ssl::context>(boost::asio::ssl::context::tlsv12_client))
+        {
+            context_->set_verify_mode(boost::asio::ssl::verify_none);
+
+            SSL_CTX* ctx = context_->native_handle();
+            SSL_CTX_set_app_data(ctx, this);
+            // sessions are kept here, keyed by server name, not in OpenSSL's cache
+            SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+            SSL_CTX_sess_set_new_cb(ctx, &tls_context::on_new_session);
+            SSL_CTX_set_info_callback(ctx, &tls_context::on_info);
+        }
+
+        ~tls_context() {
+            // sockets may still hold the SSL_CTX
+            SSL_CTX_set_app_data(context_->native_handle(), nullptr);
+            // write what is still pending before the sessions go away
+            if(saver_.joinable()) {
+                saver_.request_stop();
+                saver_.join();
+            }
+            std::scoped_lock lock(mutex_);
+            for(auto& [name, session] : sessions_) SSL_SESSION_free(session);
+        }
+
+        tls_context(const tls_context&) = delete;
+        tls_context& operator=(const tls_context&) = delete;
+
+        // Process-wide context, shared by all clients unless they set their own
+        static std::shared_ptr<tls_context> shared() {
+            static auto context = std::make_shared<tls_context>();
+            return context;
+        }
+
+        const std::shared_ptr<boost::asio::ssl::context>& get() const {
+            return context_;
+        }
+
+        /**
+         * Persist cached sessions in a file, loading any sessions already there.
+         * Sessions grant access to the connection keys: keep the file private.
+         */
+        void set_session_file(std::filesystem::path path) {
+            std::scoped_lock lock(mutex_);
+            session_file_ = std::move(path);
+            load_sessions();
+            if(!saver_.joinable()) saver_ = std::jthread([this](std::stop_token stop) { save_loop(stop); });
+        }
+
+        /**
+         * Server name (SNI) to use for connections to an address. Needed when
+         * connecting to a resolved address instead of the host name. Only the
+         * MAX_SERVER_NAMES most recently set addresses are kept (DNS answers
+         * rotate), so it must be set before every connection attempt.
+         */
+        void set_server_name(const std::string& address, const std::string& name) {
+            std::scoped_lock lock(mutex_);
+            auto [it, inserted] = server_names_.insert_or_assign(address, name);
+            if(!inserted) std::erase(server_name_order_, address);
+            server_name_order_.push_back(address);
+            if(server_name_order_.size() > MAX_SERVER_NAMES) {
+                server_names_.erase(server_name_order_.front());
+                server_name_order_.pop_front();
+            }
+        }
+
+        void clear_sessions() {
+            std::scoped_lock lock(mutex_);
+            for(auto& [name, session] : sessions_) SSL_SESSION_free(session);
+            sessions_.clear();
+            request_save();
+        }
+
+        // Completed handshakes
+        uint64_t get_handshakes() const {
+            return handshakes_.load(std::memory_order_relaxed);
+        }
+
+        // Handshakes that resumed a cached session
+        uint64_t get_resumed_handshakes() const {
+            return resumed_.load(std::memory_order_relaxed);
+        }
+
+        double get_resumption_rate() const {
+            uint64_t handshakes = get_handshakes();
+            return handshakes ? static_cast<double>(get_resumed_handshakes()) / handshakes : 0.0;
+        }
+
+        // Handshake duration in microseconds, full and resumed
+        const histogram& get_handshake_time(bool resumed) const {
+            return resumed ? resumed_handshake_time_ : full_handshake_time_;
+        }
+
+    private:
+        using clock = std::chrono::steady_clock;
+
+        static tls_context* from(const SSL* ssl) {
+            return static_cast<tls_context*>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+        }
+
+        static std::string server_name(const SSL* ssl) {
+            const char* name = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+            return name ? name : "";
+        }
+
+        // Index of the handshake start time stored on each SSL
+        static int start_time_index() {
+            static int index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr,
+                [](void*, void* ptr, CRYPTO_EX_DATA*, int, long, void*) {
+                    delete static_cast<clock::time_point*>(ptr);
+                });
+            return index;
+        }
+
+        // The server issued a session: keep a copy for the next connection.
+        // OpenSSL invalidates the session of a connection that ends without
+        // close_notify, which is how most of our connections end (link loss),
+        // so the cached copy must not be the live object.
+        static int on_new_session(SSL* ssl, SSL_SESSION* session) {
+            auto* self = from(ssl);
+            if(!self) return 0;
+            if(SSL_SESSION* copy = SSL_SESSION_dup(session)) {
+                self->store_session(server_name(ssl), copy);
+            }
+            return 0;   // OpenSSL keeps ownership of the original
+        }
+
+        static void on_info(const SSL* ssl, int where, int) {
+            auto* self = from(ssl);
+            if(!self) return;
+
+            auto* handle = const_cast<SSL*>(ssl);
+            if((where & SSL_CB_HANDSHAKE_START) && SSL_in_before(ssl)) {
+                // first handshake of the connection, before the ClientHello
+                SSL_set_ex_data(handle, start_time_index(), new clock::time_point(clock::now()));
+                self->apply_server_name(handle);
+                self->offer_session(handle);
+            } else if(where & SSL_CB_HANDSHAKE_DONE) {
+                // TLS 1.3 post-handshake messages report more handshakes: count the first
+                auto* started = static_cast<clock::time_point*>(SSL_get_ex_data(ssl, start_time_index()));
+                if(!started) return;
+                auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - *started);
+                delete started;
+                SSL_set_ex_data(handle, start_time_index(), nullptr);
+                self->on_handshake_done(SSL_session_reused(ssl) == 1, elapsed);
+            }
+        }
+
+        // Replace an address used as server name (or no server name at all)
+        // by the host name registered for the peer address
+        void apply_server_name(SSL* ssl) {
+            std::string address = server_name(ssl);
+            if(address.empty()) address = peer_address(ssl);
+            if(address.empty()) return;
+
+            std::scoped_lock lock(mutex_);
+            auto it = server_names_.find(address);
+            if(it != server_names_.end()) SSL_set_tlsext_host_name(ssl, it->second.c_str());
+        }
+
+        static std::string peer_address(const SSL* ssl) {
+            int fd = SSL_get_fd(ssl);
+            if(fd < 0) return "";
+            sockaddr_storage storage{};
+            socklen_t length = sizeof(storage);
+            if(getpeername(fd, reinterpret_cast<sockaddr*>(&storage), &length) != 0) return "";
+            char buffer[INET6_ADDRSTRLEN] = {};
+            if(storage.ss_family == AF_INET) {
+                inet_ntop(AF_INET, &reinterpret_cast<sockaddr_in*>(&storage)->sin_addr, buffer, sizeof(buffer));
+            } else if(storage.ss_family == AF_INET6) {
+                inet_ntop(AF_INET6, &reinterpret_cast<sockaddr_in6*>(&storage)->sin6_addr, buffer, sizeof(buffer));
+            }
+            return buffer;
+        }
+
+        void offer_session(SSL* ssl) {
+            std::scoped_lock lock(mutex_);
+            auto it = sessions_.find(server_name(ssl));
+            if(it == sessions_.end()) return;
+            if(!is_valid(it->second)) {
+                SSL_SESSION_free(it->second);
+                sessions_.erase(it);
+                return;
+            }
+            // offer a copy too: the connection may invalidate the one it uses
+            if(SSL_SESSION* copy = SSL_SESSION_dup(it->second)) {
+                SSL_set_session(ssl, copy);
+                SSL_SESSION_free(copy);
+            }
+        }
+
+        void on_handshake_done(bool resumed, std::chrono::microseconds elapsed) {
+            handshakes_.fetch_add(1, std::memory_order_relaxed);
+            if(resumed) resumed_.fetch_add(1, std::memory_order_relaxed);
+            (resumed ? resumed_handshake_time_ : full_handshake_time_).record(static_cast<uint64_t>(elapsed.count()));
+            LOG_DEBUG("TLS handshake {} in {} ms", resumed ? "resumed" : "completed",
+                      static_cast<double>(elapsed.count()) / 1000.0);
+        }
+
+        void store_session(const std::string& name, SSL_SESSION* session) {
+            std::scoped_lock lock(mutex_);
+            auto& entry = sessions_[name];
+            if(entry) SSL_SESSION_free(entry);
+            entry = session;
+            request_save();
+        }
+
+        static bool is_valid(SSL_SESSION* session) {
+            if(!SSL_SESSION_is_resumable(session)) return false;
+            auto expires = static_cast<std::time_t>(SSL_SESSION_get_time(session)) + SSL_SESSION_get_timeout(session);
+            return std::time(nullptr) < expires;
+        }
+
+        // Called with the mutex held
+        void request_save() {
+            if(session_file_.empty()) return;
+            save_pending_ = true;
+            save_requested_.notify_one();
+        }
+
+        // Save thread: wait for a change, let SAVE_DELAY gather the ones that
+        // follow it, and write them all at once, outside the mutex. Pending
+        // changes are written when stopping.
+        void save_loop(std::stop_token stop) {
+            std::unique_lock lock(mutex_);
+            while(true) {
+                save_requested_.wait(lock, stop, [this] { return save_pending_; });
+                if(!stop.stop_requested()) save_requested_.wait_for(lock, stop, SAVE_DELAY, [] { return false; });
+                if(save_pending_) {
+                    save_pending_ = false;
+                    std::string data = serialize_sessions();
+                    auto path = session_file_;
+                    lock.unlock();
+                    write_session_file(path, data);
+                    lock.lock();
+                }
+                if(stop.stop_requested()) return;
+            }
+        }
+
+        // File format, per session: name length (u16), name, DER length (u32), DER
+        std::string serialize_sessions() const {
+            std::string data;
+            for(auto& [name, session] : sessions_) {
+                int size = i2d_SSL_SESSION(session, nullptr);
+                if(size <= 0 || !is_valid(session)) continue;
+                std::vector<unsigned char> der(static_cast<size_t>(size));
+                unsigned char* out = der.data();
+                i2d_SSL_SESSION(session, &out);
+                append_int(data, static_cast<uint16_t>(name.size()), 2);
+                data.append(name);
+                append_int(data, static_cast<uint32_t>(size), 4);
+                data.append(reinterpret_cast<const char*>(der.data()), der.size());
+            }
+            return data;
+        }
+
+        static void write_session_file(const std::filesystem::path& path, const std::string& data) {
+            auto tmp = path;
+            tmp += ".tmp";
+            {
+                std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+                if(!file) {
+                    LOG_WARNING("Cannot write TLS session file {}", tmp.string());
+                    return;
+                }
+                file.write(data.data(), static_cast<std::streamsize>(data.size()));
+            }
+            std::error_code ec;
+            std::filesystem::permissions(tmp, std::filesystem::perms::owner_read | std::filesystem::perms::owner_write,
+                                         std::filesystem::perm_options::replace, ec);
+            std::filesystem::rename(tmp, path, ec);
+            if(ec) LOG_WARNING("Cannot write TLS session file {}: {}", path.string(), ec.message());
+        }
+
+        void load_sessions() {
+            std::ifstream file(session_file_, std::ios::binary);
+            if(!file) return;
+            std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+            size_t pos = 0;
+            size_t loaded = 0;
+            while(pos + 2 <= data.size()) {
+                size_t name_size = read_int(data, pos, 2);
+                if(pos + name_size + 4 > data.size()) break;
+                std::string name = data.substr(pos, name_size);
+                pos += name_size;
+                size_t der_size = read_int(data, pos, 4);
+                if(pos + der_size > data.size()) break;
+
+                auto* in = reinterpret_cast<const unsigned char*>(data.data() + pos);
+                pos += der_size;
+                SSL_SESSION* session = d2i_SSL_SESSION(nullptr, &in, static_cast<long>(der_size));
+                if(!session) continue;
+                if(!is_valid(session)) {
+                    SSL_SESSION_free(session);
+                    continue;
+                }
+                auto& entry = sessions_[name];
+                if(entry) SSL_SESSION_free(entry);
+                entry = session;
+                ++loaded;
+            }
+            LOG_DEBUG("Loaded {} TLS sessions from {}", loaded, session_file_.string());
+        }
+
+        static void append_int(std::string& out, uint32_t value, size_t bytes) {
+            for(size_t i = 0; i < bytes; ++i) out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+        }
+
+        static size_t read_int(const std::string& in, size_t& pos, size_t bytes) {
+            size_t value = 0;
+            for(size_t i = 0; i < bytes; ++i) value |= static_cast<size_t>(static_cast<uint8_t>(in[pos + i])) << (8 * i);
+            pos += bytes;
+            return value;
+        }
+
+        std::shared_ptr<boost::asio::ssl::context> context_;
+
+        std::mutex mutex_;
+        std::map<std::string, SSL_SESSION*> sessions_;
+        std::map<std::string, std::string> server_names_;
+        std::deque<std::string> server_name_order_;     // least recently set first
+        std::filesystem::path session_file_;
+        std::condition_variable_any save_requested_;
+        bool save_pending_ = false;
+        std::jthread saver_;
+
+        std::atomic<uint64_t> handshakes_{0};
+        std::atomic<uint64_t> resumed_{0};
+        histogram full_handshake_time_;
+        histogram resumed_handshake_time_;
+    };
+
+}
+
+#endif
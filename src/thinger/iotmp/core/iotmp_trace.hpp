@@ -0,0 +1,53 @@
+#ifndef THINGER_IOTMP_TRACE_HPP
+#define THINGER_IOTMP_TRACE_HPP
+
+/**
+ * Statically defined tracepoints (USDT, systemtap SDT) for perf, bpftrace
+ * and other uprobe-based tracers, under the "iotmp" provider.
+ *
+ * Built in when THINGER_IOTMP_USDT is defined (CMake option
+ * THINGER_IOTMP_TRACEPOINTS, on by default when <sys/sdt.h> is found).
+ * Every probe has an SDT semaphore, which tracers increment while they are
+ * attached to it: until then a tracepoint is a test of its semaphore, and
+ * its arguments are not evaluated. Without THINGER_IOTMP_USDT, IOTMP_TRACE
+ * expands to nothing.
+ *
+ *   message_received   type, stream id, frame bytes, time from read to decoded (us)
+ *   message_queued     stream id, control, frame bytes, write queue bytes
+ *   write_done         frames, bytes, queue delay of the first frame (us), write time (us)
+ *                      (also for the unqueued writes of write_message, with no queue delay)
+ *   resource_begin     stream id, resource path, resource pool wait (us)
+ *   resource_end       stream id, resource path, run time (us), success
+ *   session_start      stream id, session name
+ *   session_chunk      stream id, bytes, direction (0 sent, 1 received)
+ *   session_stop       stream id, bytes sent, bytes received, lifetime (ms)
+ *
+ * i.e., `bpftrace -e 'usdt:./thinger_iotmp:iotmp:write_done { @[arg2] = hist(arg3); }'`
+ */
+
+#if defined(THINGER_IOTMP_USDT) && __has_include(<sys/sdt.h>)
+#  define _SDT_HAS_SEMAPHORES 1
+#  include <sys/sdt.h>
+
+// Semaphores are referenced by name from the probe notes, so they live in
+// the global namespace. Every probe needs one.
+#  define IOTMP_TRACE_SEMAPHORE(name) \
+     inline volatile unsigned short iotmp_##name##_semaphore __attribute__((unused, section(".probes"))) = 0
+
+IOTMP_TRACE_SEMAPHORE(message_received);
+IOTMP_TRACE_SEMAPHORE(message_queued);
+IOTMP_TRACE_SEMAPHORE(write_done);
+IOTMP_TRACE_SEMAPHORE(resource_begin);
+IOTMP_TRACE_SEMAPHORE(resource_end);
+IOTMP_TRACE_SEMAPHORE(session_start);
+IOTMP_TRACE_SEMAPHORE(session_chunk);
+IOTMP_TRACE_SEMAPHORE(session_stop);
+
+#  define IOTMP_TRACE(name, ...) do { \
+       if(__builtin_expect(iotmp_##name##_semaphore != 0, 0)) STAP_PROBEV(iotmp, name, __VA_ARGS__); \
+   } while(0)
+#else
+#  define IOTMP_TRACE(name, ...) do {} while(0)
+#endif
+
+#endif
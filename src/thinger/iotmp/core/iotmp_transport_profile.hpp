@@ -0,0 +1,127 @@
+#ifndef THINGER_IOTMP_TRANSPORT_PROFILE_HPP
+#define THINGER_IOTMP_TRANSPORT_PROFILE_HPP
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+namespace thinger::iotmp {
+
+    // Socket tuning of a connection for the kind of traffic it carries
+    enum class transport_profile : uint8_t {
+        AUTO,           // INTERACTIVE or BULK, depending on the active streams
+        INTERACTIVE,    // low latency: terminal, proxy, request/response
+        BULK,           // throughput: file transfers
+        CONSTRAINED     // slow or metered links, small memory footprint
+    };
+
+    inline const char* to_string(transport_profile profile) {
+        switch(profile) {
+            case transport_profile::AUTO: return "auto";
+            case transport_profile::INTERACTIVE: return "interactive";
+            case transport_profile::BULK: return "bulk";
+            case transport_profile::CONSTRAINED: return "constrained";
+        }
+        return "unknown";
+    }
+
+    /**
+     * TCP options of a transport profile.
+     *
+     * TCP_NOTSENT_LOWAT bounds the data the kernel holds that was not sent
+     * yet, so the socket only reports writable (and the write queue only
+     * hands over the next frame) when that backlog is short. Frames wait in
+     * the application priority queue instead, where a keystroke can still
+     * overtake a file chunk, while the bytes in flight are not limited.
+     */
+    struct socket_options {
+        bool no_delay = true;           // TCP_NODELAY: disable Nagle
+        int notsent_lowat = 0;          // TCP_NOTSENT_LOWAT, in bytes
+        int send_buffer = 0;            // SO_SNDBUF, 0 keeps kernel autotuning
+        int receive_buffer = 0;         // SO_RCVBUF, 0 keeps kernel autotuning
+        bool cork = false;              // TCP_CORK while writing back-to-back frames
+    };
+
+    inline socket_options profile_options(transport_profile profile) {
+        switch(profile) {
+            case transport_profile::BULK:
+                // a deeper backlog keeps the pipe full between writes, and
+                // corking packs chunks into full segments
+                return {.no_delay = true, .notsent_lowat = 256 * 1024, .cork = true};
+            case transport_profile::CONSTRAINED:
+                // fewer, fuller packets (Nagle) and little kernel memory. No
+                // corking: a corked partial segment larger than the low
+                // watermark would hold the socket unwritable.
+                return {.no_delay = false, .notsent_lowat = 4 * 1024,
+                        .send_buffer = 32 * 1024, .receive_buffer = 32 * 1024};
+            case transport_profile::AUTO:
+            case transport_profile::INTERACTIVE:
+                break;
+        }
+        return {.no_delay = true, .notsent_lowat = 16 * 1024};
+    }
+
+    // Option that could not be set, with its errno
+    struct socket_option_error {
+        const char* option;
+        int error;
+    };
+
+    inline std::optional<socket_option_error> set_socket_option(int fd, int level, int option, int value, const char* name) {
+        if(::setsockopt(fd, level, option, &value, sizeof(value)) != 0) return socket_option_error{name, errno};
+        return std::nullopt;
+    }
+
+    /**
+     * Apply the options of a profile to a connected TCP socket. Buffer sizes
+     * are only set when given, as setting them disables kernel autotuning
+     * for the rest of the connection.
+     * @return the first option that failed, if any
+     */
+    inline std::optional<socket_option_error> apply_socket_options(int fd, const socket_options& options) {
+        std::optional<socket_option_error> result;
+        auto set = [&](int level, int option, int value, const char* name) {
+            auto error = set_socket_option(fd, level, option, value, name);
+            if(error && !result) result = error;
+        };
+        set(IPPROTO_TCP, TCP_NODELAY, options.no_delay ? 1 : 0, "TCP_NODELAY");
+#ifdef TCP_NOTSENT_LOWAT
+        if(options.notsent_lowat > 0) set(IPPROTO_TCP, TCP_NOTSENT_LOWAT, options.notsent_lowat, "TCP_NOTSENT_LOWAT");
+#endif
+        if(options.send_buffer > 0) set(SOL_SOCKET, SO_SNDBUF, options.send_buffer, "SO_SNDBUF");
+        if(options.receive_buffer > 0) set(SOL_SOCKET, SO_RCVBUF, options.receive_buffer, "SO_RCVBUF");
+#ifdef TCP_CORK
+        if(!options.cork) set(IPPROTO_TCP, TCP_CORK, 0, "TCP_CORK");
+#endif
+        return result;
+    }
+
+    // Hold partial segments while frames are written back-to-back; clearing
+    // it flushes them
+    inline std::optional<socket_option_error> set_cork(int fd, bool enabled) {
+#ifdef TCP_CORK
+        return set_socket_option(fd, IPPROTO_TCP, TCP_CORK, enabled ? 1 : 0, "TCP_CORK");
+#else
+        return std::nullopt;
+#endif
+    }
+
+    // Bytes written to a TCP socket that the peer has not acknowledged yet
+    // (0 where the kernel does not tell, or for an invalid descriptor)
+    inline size_t unsent_bytes(int fd) {
+#ifdef TIOCOUTQ
+        int bytes = 0;
+        if(fd >= 0 && ::ioctl(fd, TIOCOUTQ, &bytes) == 0 && bytes > 0) return static_cast<size_t>(bytes);
+#endif
+        return 0;
+    }
+
+}
+
+#endif
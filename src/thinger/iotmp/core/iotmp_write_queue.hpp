@@ -0,0 +1,409 @@
+#ifndef THINGER_IOTMP_WRITE_QUEUE_HPP
+#define THINGER_IOTMP_WRITE_QUEUE_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "iotmp_histogram.hpp"
+#include "iotmp_ring_buffer.hpp"
+
+namespace thinger::iotmp {
+
+    // Scheduling class of an outbound frame, in strict priority order
+    enum class stream_priority : uint8_t {
+        CONTROL,        // keep-alives, requests and responses
+        INTERACTIVE,    // small latency-sensitive stream data (terminal, proxy)
+        BULK            // transfers that can wait (file downloads)
+    };
+
+    static constexpr size_t STREAM_PRIORITIES = 3;
+
+    inline const char* to_string(stream_priority priority) {
+        switch(priority) {
+            case stream_priority::CONTROL: return "control";
+            case stream_priority::INTERACTIVE: return "interactive";
+            case stream_priority::BULK: return "bulk";
+        }
+        return "unknown";
+    }
+
+    // Encoded frame waiting to be written
+    struct outbound_frame {
+        uint16_t stream_id = 0;
+        bool control = true;        // anything but STREAM_DATA
+        std::string data;
+        std::chrono::steady_clock::time_point enqueued{};
+        bool probe = false;         // KEEP_ALIVE probe, timed from its write
+    };
+
+    /**
+     * Byte-accounted outbound queue with high/low watermarks and a priority
+     * scheduler.
+     *
+     * Stream data is accounted both globally and per stream. A stream becomes
+     * congested when its queued bytes reach the stream high watermark, and the
+     * whole queue when the total reaches the global one; each clears again
+     * once it drains below the matching low watermark. Control frames are
+     * always admitted and only count towards the total.
+     *
+     * Frames are queued per stream and served by class in strict priority
+     * order (control, interactive, bulk), with deficit round-robin between
+     * the streams of a class so a large transfer cannot starve its peers.
+     * Frames of a stream are always written in order: a control frame for a
+     * stream that still has data queued (i.e., STOP_STREAM after its last
+     * chunk) waits behind that data. The time each frame spends queued is
+     * recorded per class.
+     *
+     * The queues and byte counts of a stream are kept while it is idle, so
+     * steady streaming allocates nothing here, and dropped by forget() once
+     * the stream ends (control-only streams are dropped as they drain).
+     *
+     * Frames produced on other threads reach the connection thread through
+     * another queue: reserve() accounts their bytes up front, so the limit
+     * and the congestion flag see them before push_reserved() queues them.
+     *
+     * push(), pop(), clear() and set_priority() must run on the connection
+     * thread, and reserve() and cancel_reservation() on any. The frame and
+     * byte totals, the congestion flags and the delay histograms can be read
+     * from any thread.
+     */
+    class write_queue {
+    public:
+        using clock = std::chrono::steady_clock;
+
+        static constexpr size_t DEFAULT_LOW_WATERMARK = 256 * 1024;
+        static constexpr size_t DEFAULT_HIGH_WATERMARK = 1024 * 1024;
+        static constexpr size_t DEFAULT_STREAM_LOW_WATERMARK = 64 * 1024;
+        static constexpr size_t DEFAULT_STREAM_HIGH_WATERMARK = 256 * 1024;
+        static constexpr size_t DEFAULT_LIMIT = 8 * 1024 * 1024;
+        static constexpr size_t DEFAULT_QUANTUM = 16 * 1024;
+
+        void set_watermarks(size_t low, size_t high) {
+            low_watermark_ = low;
+            high_watermark_ = high;
+        }
+
+        void set_stream_watermarks(size_t low, size_t high) {
+            stream_low_watermark_ = low;
+            stream_high_watermark_ = high;
+        }
+
+        size_t high_watermark() const {
+            return high_watermark_;
+        }
+
+        size_t stream_high_watermark() const {
+            return stream_high_watermark_;
+        }
+
+        // Hard limit for stream data, see full()
+        void set_limit(size_t limit) {
+            limit_ = limit;
+        }
+
+        // Bytes a stream may send per round-robin turn
+        void set_quantum(size_t quantum) {
+            quantum_ = quantum ? quantum : 1;
+        }
+
+        /**
+         * Set the class of the stream data of a stream. Frames already queued
+         * move along with the stream, so its order is kept.
+         */
+        void set_priority(uint16_t stream_id, stream_priority priority) {
+            auto previous = stream_priority_of(stream_id);
+            if(priority == default_priority_) stream_priorities_.erase(stream_id);
+            else stream_priorities_[stream_id] = priority;
+            if(previous == priority) return;
+
+            auto& from = classes_[index(previous)];
+            auto it = from.queues.find(stream_id);
+            if(it == from.queues.end()) return;
+            auto& source = it->second.frames;
+            if(!source.empty()) {
+                auto& to = classes_[index(priority)];
+                auto& target = to.queues[stream_id];
+                if(target.frames.empty()) to.active.push_back(stream_id);
+                while(!source.empty()) {
+                    target.frames.push_back(std::move(source.front()));
+                    source.pop_front();
+                }
+                from.active.erase_if([stream_id](uint16_t id) { return id == stream_id; });
+            }
+            from.queues.erase(it);
+        }
+
+        stream_priority stream_priority_of(uint16_t stream_id) const {
+            auto it = stream_priorities_.find(stream_id);
+            return it != stream_priorities_.end() ? it->second : default_priority_;
+        }
+
+        void reset_priority(uint16_t stream_id) {
+            set_priority(stream_id, default_priority_);
+        }
+
+        // Drop the state kept for an idle stream, once it ended. Frames still
+        // queued for it are sent, and its state kept until they are.
+        void forget(uint16_t stream_id) {
+            for(auto& cls : classes_) {
+                auto it = cls.queues.find(stream_id);
+                if(it != cls.queues.end() && it->second.frames.empty()) cls.queues.erase(it);
+            }
+            auto it = stream_bytes_.find(stream_id);
+            if(it != stream_bytes_.end() && it->second == 0) stream_bytes_.erase(it);
+        }
+
+        /**
+         * Account the bytes of a frame that will be pushed later, from any
+         * thread. Stream data is refused (false) once the limit is reached,
+         * control frames are always admitted. The reservation ends with
+         * push_reserved(), or cancel_reservation() if the frame is dropped.
+         */
+        bool reserve(size_t size, bool control) {
+            size_t total = reserved_.fetch_add(size, std::memory_order_relaxed) + size +
+                           bytes_.load(std::memory_order_relaxed);
+            if(!control && total - size >= limit_) {
+                reserved_.fetch_sub(size, std::memory_order_relaxed);
+                return false;
+            }
+            if(total >= high_watermark_) congested_.store(true, std::memory_order_relaxed);
+            return true;
+        }
+
+        void cancel_reservation(size_t size) {
+            reserved_.fetch_sub(size, std::memory_order_relaxed);
+        }
+
+        // Queue a frame whose bytes were reserved()
+        void push_reserved(outbound_frame frame, clock::time_point now = clock::now()) {
+            reserved_.fetch_sub(frame.data.size(), std::memory_order_relaxed);
+            push(std::move(frame), now);
+        }
+
+        void push(outbound_frame frame, clock::time_point now = clock::now()) {
+            size_t size = frame.data.size();
+            size_t total = bytes_.fetch_add(size, std::memory_order_relaxed) + size +
+                           reserved_.load(std::memory_order_relaxed);
+            if(total >= high_watermark_) congested_.store(true, std::memory_order_relaxed);
+
+            if(!frame.control) {
+                size_t& stream_bytes = stream_bytes_[frame.stream_id];
+                stream_bytes += size;
+                if(stream_bytes >= stream_high_watermark_) set_congested(frame.stream_id, true);
+            }
+
+            frame.enqueued = now;
+            auto priority = frame.control ? stream_priority::CONTROL : stream_priority_of(frame.stream_id);
+            // keep the stream order: a control frame waits behind queued data of its stream
+            if(frame.control && frame.stream_id != 0 && bytes(frame.stream_id) > 0) {
+                priority = stream_priority_of(frame.stream_id);
+            }
+
+            last_push_[index(priority)] = now;
+            auto& cls = classes_[index(priority)];
+            auto& queue = cls.queues[frame.stream_id];
+            if(queue.frames.empty()) cls.active.push_back(frame.stream_id);
+            queue.frames.push_back(std::move(frame));
+            frames_.store(frames_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+
+        // Next frame in schedule order, if it is not larger than max_size
+        // (otherwise it stays first, i.e., for the next write)
+        std::optional<outbound_frame> pop(clock::time_point now = clock::now(),
+                                          size_t max_size = std::numeric_limits<size_t>::max()) {
+            for(size_t i = 0; i < STREAM_PRIORITIES; ++i) {
+                auto& cls = classes_[i];
+                if(cls.active.empty()) continue;
+
+                auto popped = pop(cls, max_size);
+                if(!popped) return std::nullopt;
+                auto& frame = *popped;
+                frames_.store(frames_.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+                account_pop(frame);
+                auto delay = std::chrono::duration_cast<std::chrono::microseconds>(now - frame.enqueued);
+                queue_delay_[i].record(delay.count() > 0 ? static_cast<uint64_t>(delay.count()) : 0);
+                return popped;
+            }
+            return std::nullopt;
+        }
+
+        // Drop the queued frames. Reservations stay, their frames are still
+        // on their way (and cancel them when dropped).
+        void clear() {
+            for(auto& [stream_id, bytes] : stream_bytes_) set_congested(stream_id, false);
+            for(auto& cls : classes_) {
+                cls.queues.clear();
+                cls.active.clear();
+            }
+            frames_.store(0, std::memory_order_relaxed);
+            stream_bytes_.clear();
+            stream_priorities_.clear();
+            bytes_.store(0, std::memory_order_relaxed);
+            congested_.store(false, std::memory_order_relaxed);
+            relieved_ = false;
+        }
+
+        bool empty() const {
+            return frames_.load(std::memory_order_relaxed) == 0;
+        }
+
+        // Number of queued frames (any thread)
+        size_t size() const {
+            return frames_.load(std::memory_order_relaxed);
+        }
+
+        // Queued and reserved bytes (any thread)
+        size_t bytes() const {
+            return bytes_.load(std::memory_order_relaxed) + reserved_.load(std::memory_order_relaxed);
+        }
+
+        // Queued stream data bytes for a stream (connection thread)
+        size_t bytes(uint16_t stream_id) const {
+            auto it = stream_bytes_.find(stream_id);
+            return it != stream_bytes_.end() ? it->second : 0;
+        }
+
+        // Whether new stream data should be rejected (any thread)
+        bool full() const {
+            return bytes() >= limit_;
+        }
+
+        bool is_congested() const {
+            return congested_.load(std::memory_order_relaxed);
+        }
+
+        bool is_congested(uint16_t stream_id) const {
+            return (congested_streams_[stream_id / 64].load(std::memory_order_relaxed) >> (stream_id % 64)) & 1;
+        }
+
+        // Whether a stream may produce more data (any thread)
+        bool writable(uint16_t stream_id) const {
+            return !is_congested() && !is_congested(stream_id);
+        }
+
+        // Whether a pop() cleared the queue or a stream congestion since the
+        // last call (connection thread): the only time writers waiting for
+        // writable() may go on
+        bool take_relieved() {
+            return std::exchange(relieved_, false);
+        }
+
+        // Last time a frame of a class was queued (connection thread)
+        clock::time_point last_push(stream_priority priority) const {
+            return last_push_[index(priority)];
+        }
+
+        // Time frames of a class spent queued, in microseconds (any thread)
+        const histogram& queue_delay(stream_priority priority) const {
+            return queue_delay_[index(priority)];
+        }
+
+    private:
+        struct stream_queue {
+            ring_buffer<outbound_frame> frames;
+            size_t deficit = 0;
+        };
+
+        struct priority_class {
+            std::unordered_map<uint16_t, stream_queue> queues;
+            ring_buffer<uint16_t> active;   // round-robin order of streams with frames
+        };
+
+        static size_t index(stream_priority priority) {
+            return static_cast<size_t>(priority);
+        }
+
+        // Deficit round-robin: the stream at the head of the round is served
+        // while its deficit covers its next frame, otherwise it earns a
+        // quantum and goes to the back. The frame to serve is left in place
+        // if it is larger than max_size.
+        std::optional<outbound_frame> pop(priority_class& cls, size_t max_size) {
+            for(;;) {
+                uint16_t stream_id = cls.active.front();
+                auto& queue = cls.queues[stream_id];
+                size_t size = queue.frames.front().data.size();
+
+                if(queue.deficit >= size) {
+                    if(size > max_size) return std::nullopt;
+                    queue.deficit -= size;
+                    outbound_frame frame = std::move(queue.frames.front());
+                    queue.frames.pop_front();
+                    if(queue.frames.empty()) {
+                        cls.active.pop_front();
+                        queue.deficit = 0;
+                        // request and response ids come and go: only streams are kept
+                        if(&cls == &classes_[index(stream_priority::CONTROL)]) cls.queues.erase(stream_id);
+                    }
+                    return frame;
+                }
+
+                // only stream in the class: no one to be fair with
+                if(cls.active.size() == 1) {
+                    queue.deficit = size;
+                    continue;
+                }
+
+                queue.deficit += quantum_;
+                cls.active.pop_front();
+                cls.active.push_back(stream_id);
+            }
+        }
+
+        void account_pop(const outbound_frame& frame) {
+            size_t size = frame.data.size();
+            size_t total = bytes_.fetch_sub(size, std::memory_order_relaxed) - size +
+                           reserved_.load(std::memory_order_relaxed);
+            if(total <= low_watermark_ && congested_.exchange(false, std::memory_order_relaxed)) relieved_ = true;
+
+            if(!frame.control) {
+                auto it = stream_bytes_.find(frame.stream_id);
+                if(it != stream_bytes_.end()) {
+                    it->second -= size;
+                    if(it->second <= stream_low_watermark_ && is_congested(frame.stream_id)) {
+                        set_congested(frame.stream_id, false);
+                        relieved_ = true;
+                    }
+                }
+            }
+        }
+
+        void set_congested(uint16_t stream_id, bool congested) {
+            uint64_t bit = uint64_t{1} << (stream_id % 64);
+            auto& word = congested_streams_[stream_id / 64];
+            if(congested) word.fetch_or(bit, std::memory_order_relaxed);
+            else word.fetch_and(~bit, std::memory_order_relaxed);
+        }
+
+        std::array<priority_class, STREAM_PRIORITIES> classes_;
+        std::atomic<size_t> frames_{0};     // only written on the connection thread
+        std::unordered_map<uint16_t, size_t> stream_bytes_;
+        std::unordered_map<uint16_t, stream_priority> stream_priorities_;
+        stream_priority default_priority_ = stream_priority::INTERACTIVE;
+
+        size_t low_watermark_ = DEFAULT_LOW_WATERMARK;
+        size_t high_watermark_ = DEFAULT_HIGH_WATERMARK;
+        size_t stream_low_watermark_ = DEFAULT_STREAM_LOW_WATERMARK;
+        size_t stream_high_watermark_ = DEFAULT_STREAM_HIGH_WATERMARK;
+        size_t limit_ = DEFAULT_LIMIT;
+        size_t quantum_ = DEFAULT_QUANTUM;
+
+        std::atomic<size_t> bytes_{0};
+        std::atomic<size_t> reserved_{0};   // see reserve()
+        std::atomic<bool> congested_{false};
+        bool relieved_ = false;
+        std::array<std::atomic<uint64_t>, 1024> congested_streams_{};
+        std::array<histogram, STREAM_PRIORITIES> queue_delay_;
+        std::array<clock::time_point, STREAM_PRIORITIES> last_push_{};
+    };
+
+}
+
+#endif
@@ -155,6 +155,13 @@ namespace thinger::iotmp {
 
                 case pson_wire_type::bytes_t: {
                     if(type_payload > UINT32_MAX) return false;
+                    // decoding into a value kept from a previous message reuses its storage
+                    if(value.is_binary()) {
+                        auto& binary = value.get_binary();
+                        binary.clear_subtype();
+                        binary.resize(type_payload);
+                        return read(binary.data(), type_payload);
+                    }
                     std::vector<uint8_t> vec(type_payload);
                     if(!read(vec.data(), type_payload)) return false;
                     value = nlohmann::json::binary(std::move(vec));
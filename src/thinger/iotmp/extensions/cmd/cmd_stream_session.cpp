@@ -16,10 +16,11 @@ namespace thinger::iotmp {
     cmd_stream_session::cmd_stream_session(client& client, uint16_t stream_id, std::string session,
                                            json_t& parameters)
         : stream_session(client, stream_id, std::move(session)),
-          stdin_pipe_(client.get_io_context()),
-          stdout_pipe_(client.get_io_context()),
-          stderr_pipe_(client.get_io_context()),
-          timeout_timer_(client.get_io_context())
+          stdin_pipe_(get_io_context()),
+          stdout_pipe_(get_io_context()),
+          stderr_pipe_(get_io_context()),
+          timeout_timer_(get_io_context()),
+          memory_(client.get_memory(), memory_accounting::subsystem::CMD)
     {
         ensure_home_env();
         command_ = get_value(parameters, "cmd", empty::string);
@@ -47,7 +48,7 @@ namespace thinger::iotmp {
         boost::system::error_code ec;
         std::vector<std::string> args = {"-c", command_};
         process_.emplace(
-            client_.get_io_context().get_executor(),
+            get_io_context().get_executor(),
             preferred_shell(),
             args,
             bp2::process_stdio{stdin_pipe_, stdout_pipe_, stderr_pipe_},
@@ -64,10 +65,10 @@ namespace thinger::iotmp {
 
         // Spawn the coordinator coroutine; it keeps the session alive via
         // shared_from_this() until stdout, stderr, and the process all complete.
-        co_spawn(client_.get_io_context(), run(), detached);
+        co_spawn(get_io_context(), run(), detached);
 
         if (timeout_seconds_ > 0) {
-            co_spawn(client_.get_io_context(), watch_timeout(), detached);
+            co_spawn(get_io_context(), watch_timeout(), detached);
         }
 
         co_return true;
@@ -109,11 +110,12 @@ namespace thinger::iotmp {
         if (data.empty()) return;
 
         increase_received(data.size());
+        memory_.add(data.size());
         stdin_queue_.emplace(std::move(data));
 
         if (!stdin_writing_) {
             stdin_writing_ = true;
-            co_spawn(client_.get_io_context(), stdin_write_loop(), detached);
+            co_spawn(get_io_context(), stdin_write_loop(), detached);
         }
     }
 
@@ -126,6 +128,7 @@ namespace thinger::iotmp {
                 stdin_pipe_,
                 boost::asio::buffer(data),
                 use_nothrow_awaitable);
+            memory_.release(data.size());
             if (ec) {
                 if (ec != boost::asio::error::operation_aborted) {
                     LOG_WARNING("cmd stream {} stdin write failed: {}",
@@ -152,7 +155,9 @@ namespace thinger::iotmp {
         json_t frame;
         frame["exit"] = exit_code_;
         if (timed_out_) frame["timeout"] = true;
-        client_.stream_resource(stream_id_, std::move(frame));
+        if (!client_.stream_resource(stream_id_, std::move(frame))) {
+            THINGER_LOG_ERROR("[{}] cannot send command exit code", stream_id_);
+        }
 
         if (process_) {
             process_->detach();
@@ -166,6 +171,8 @@ namespace thinger::iotmp {
     awaitable<void> cmd_stream_session::read_stdout() {
         auto self = shared_from_this();
         while (true) {
+            // stop reading the pipe while the uplink is congested
+            if (!co_await client_.wait_writable(stream_id_)) break;
             auto [ec, bytes] = co_await stdout_pipe_.async_read_some(
                 boost::asio::buffer(stdout_buffer_, CMD_STREAM_BUFFER_SIZE),
                 use_nothrow_awaitable);
@@ -174,7 +181,11 @@ namespace thinger::iotmp {
                 increase_sent(bytes);
                 json_t frame;
                 frame["out"] = json_t::binary({stdout_buffer_, stdout_buffer_ + bytes});
-                client_.stream_resource(stream_id_, std::move(frame));
+                if (!client_.stream_resource(stream_id_, std::move(frame))) {
+                    THINGER_LOG_ERROR("[{}] cannot send command stdout", stream_id_);
+                    stop(StopReason::CLIENT_STOP);
+                    break;
+                }
             }
         }
     }
@@ -182,6 +193,8 @@ namespace thinger::iotmp {
     awaitable<void> cmd_stream_session::read_stderr() {
         auto self = shared_from_this();
         while (true) {
+            // stop reading the pipe while the uplink is congested
+            if (!co_await client_.wait_writable(stream_id_)) break;
             auto [ec, bytes] = co_await stderr_pipe_.async_read_some(
                 boost::asio::buffer(stderr_buffer_, CMD_STREAM_BUFFER_SIZE),
                 use_nothrow_awaitable);
@@ -190,7 +203,11 @@ namespace thinger::iotmp {
                 increase_sent(bytes);
                 json_t frame;
                 frame["err"] = json_t::binary({stderr_buffer_, stderr_buffer_ + bytes});
-                client_.stream_resource(stream_id_, std::move(frame));
+                if (!client_.stream_resource(stream_id_, std::move(frame))) {
+                    THINGER_LOG_ERROR("[{}] cannot send command stderr", stream_id_);
+                    stop(StopReason::CLIENT_STOP);
+                    break;
+                }
             }
         }
     }
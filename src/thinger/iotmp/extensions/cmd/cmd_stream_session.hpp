@@ -55,6 +55,9 @@ namespace thinger::iotmp {
 
         std::queue<std::string> stdin_queue_;
         bool stdin_writing_ = false;
+
+        // Session count and queued bytes (see client::get_memory)
+        memory_accounting::tracker memory_;
     };
 
 }
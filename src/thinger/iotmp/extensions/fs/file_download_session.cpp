@@ -15,8 +15,10 @@ namespace thinger::iotmp{
         , chunk_size_(config.chunk_size)
         , window_size_(config.window_size)
         , max_bandwidth_mbps_(config.max_bandwidth_mbps)
+        , memory_(client.get_memory(), memory_accounting::subsystem::FILE_TRANSFER)
     {
         buffer_.resize(chunk_size_);
+        memory_.add(buffer_.capacity());
     }
 
     awaitable<exec_result> file_download_session::start() {
@@ -69,8 +71,10 @@ namespace thinger::iotmp{
         THINGER_LOG("download: sending start response - chunk_size={}",
                    chunk_size_);
 
-        // Start sending data (post to avoid blocking)
-        boost::asio::post(client_.get_io_context(), [this]() {
+        // Start sending data (post to avoid blocking). File chunks are bulk
+        // data, so terminal and control traffic can overtake them.
+        boost::asio::post(get_io_context(), [this]() {
+            client_.set_stream_priority(stream_id_, stream_priority::BULK);
             send_next_chunk();
         });
 
@@ -189,7 +193,7 @@ namespace thinger::iotmp{
 
                     // STEP 4: Set a safety timeout in case server doesn't respond
                     // This prevents the session from hanging indefinitely
-                    completion_timer_ = std::make_shared<boost::asio::steady_timer>(client_.get_io_context());
+                    completion_timer_ = std::make_shared<boost::asio::steady_timer>(get_io_context());
                     completion_timer_->expires_after(std::chrono::seconds(30)); // 30 seconds timeout
                     completion_timer_->async_wait([this](const boost::system::error_code& ec) {
                         if(!ec && self_reference_) {
@@ -225,18 +229,37 @@ namespace thinger::iotmp{
             return;
         }
         
+        // STEP 8b: Backpressure - the window is set by the server, so also stop
+        // reading while this stream (or the whole write queue) is over its
+        // watermark, and resume once it drains
+        if(!client_.is_writable(stream_id_)) {
+            co_spawn(get_io_context(), resume_when_writable(), detached);
+            return;
+        }
+
         // STEP 9: Read directly to json binary buffer (true zero-copy)
         json_t payload = json_t::binary(std::vector<uint8_t>(chunk_size_));
         auto& binary = payload.get_binary();
-        file_stream_.read(reinterpret_cast<char*>(binary.data()), chunk_size_);
+        {
+            loop_activity activity("file_download", file_path_.c_str());
+            file_stream_.read(reinterpret_cast<char*>(binary.data()), chunk_size_);
+        }
         size_t bytes_read = file_stream_.gcount();
 
         if(bytes_read > 0) {
             // Resize buffer to actual bytes read
             binary.resize(bytes_read);
 
-            // STEP 10: Send the chunk
-            client_.stream_resource(stream_id_, std::move(payload));
+            // STEP 10: Send the chunk. It is only refused past the write queue
+            // hard limit (or disconnected): fail the transfer instead of
+            // leaving a hole in the file
+            if(!client_.stream_resource(stream_id_, std::move(payload))) {
+                THINGER_LOG_ERROR("download: cannot queue chunk at {} bytes, aborting transfer", bytes_transferred_);
+                state_ = SessionState::FAILED;
+                error_message_ = "Send queue full";
+                stop(StopReason::CLIENT_STOP);
+                return;
+            }
             bytes_transferred_ += bytes_read;
             increase_sent(bytes_read);
             bytes_in_flight_ += bytes_read;
@@ -264,7 +287,7 @@ namespace thinger::iotmp{
                         if(delay_ms < MIN_CHUNK_DELAY_MS) delay_ms = MIN_CHUNK_DELAY_MS;
 
                         if(!rate_limit_timer_) {
-                            rate_limit_timer_ = std::make_shared<boost::asio::steady_timer>(client_.get_io_context());
+                            rate_limit_timer_ = std::make_shared<boost::asio::steady_timer>(get_io_context());
                         }
 
                         rate_limit_timer_->expires_after(std::chrono::milliseconds(delay_ms));
@@ -281,7 +304,7 @@ namespace thinger::iotmp{
                 
                 // STEP 13: No bandwidth limit - continue sending immediately
                 // Post to io_context to avoid stack overflow from recursion
-                boost::asio::post(client_.get_io_context(), [this](){
+                boost::asio::post(get_io_context(), [this](){
                     send_next_chunk();
                 });
             } else {
@@ -300,7 +323,7 @@ namespace thinger::iotmp{
                     // Set a timeout to force close if server doesn't respond
                     // (same logic as in STEP 4 above)
                     if(!completion_timer_) {
-                        completion_timer_ = std::make_shared<boost::asio::steady_timer>(client_.get_io_context());
+                        completion_timer_ = std::make_shared<boost::asio::steady_timer>(get_io_context());
                         completion_timer_->expires_after(std::chrono::seconds(30));
                         completion_timer_->async_wait([this](const boost::system::error_code& ec) {
                             if(!ec && self_reference_) {
@@ -320,6 +343,12 @@ namespace thinger::iotmp{
         }
     }
 
+    awaitable<void> file_download_session::resume_when_writable() {
+        auto self = shared_from_this();
+        // false once disconnected, which stops the session
+        if(co_await client_.wait_writable(stream_id_) && !stopping_) send_next_chunk();
+    }
+
     void file_download_session::on_chunk_acknowledged(size_t ack_bytes) {
         // ACK contains the number of bytes confirmed by the server
         if(bytes_in_flight_ >= ack_bytes) {
@@ -343,7 +372,7 @@ namespace thinger::iotmp{
                 if(!file_stream_.eof() && state_ == SessionState::IN_PROGRESS) {
                     // More data to send - continue the transfer
                     // Use post to avoid deep recursion
-                    boost::asio::post(client_.get_io_context(), [this](){
+                    boost::asio::post(get_io_context(), [this](){
                         send_next_chunk();
                     });
                 } else {
@@ -360,7 +389,7 @@ namespace thinger::iotmp{
                             // The self-reference keeps the session alive
                             // Set up one-time completion timer as safety net
                             if(!completion_timer_) {
-                                completion_timer_ = std::make_shared<boost::asio::steady_timer>(client_.get_io_context());
+                                completion_timer_ = std::make_shared<boost::asio::steady_timer>(get_io_context());
                                 completion_timer_->expires_after(std::chrono::seconds(30));
                                 completion_timer_->async_wait([this](const boost::system::error_code& ec) {
                                     if(!ec && self_reference_) {
@@ -388,7 +417,7 @@ namespace thinger::iotmp{
         if(ack_timer_) {
             ack_timer_->cancel();
         } else {
-            ack_timer_ = std::make_shared<boost::asio::steady_timer>(client_.get_io_context());
+            ack_timer_ = std::make_shared<boost::asio::steady_timer>(get_io_context());
         }
 
         // Set new timeout
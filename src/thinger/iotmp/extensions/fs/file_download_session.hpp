@@ -23,6 +23,7 @@ namespace thinger::iotmp{
 
     private:
         void send_next_chunk();
+        awaitable<void> resume_when_writable();
         void on_chunk_acknowledged(size_t ack_bytes);
         void start_ack_timeout();
         void log_progress(bool force = false);
@@ -60,6 +61,9 @@ namespace thinger::iotmp{
         // Keep session alive after completion
         std::shared_ptr<file_download_session> self_reference_;
         std::shared_ptr<boost::asio::steady_timer> completion_timer_;
+
+        // Session count and chunk buffer (see client::get_memory)
+        memory_accounting::tracker memory_;
     };
 
 }
@@ -1,4 +1,6 @@
 #include "file_upload_session.hpp"
+#include "../../core/iotmp_adapters.hpp"
+#include "../../core/pson_encoder.hpp"
 #include <thinger/util/logger.hpp>
 #include <boost/asio/post.hpp>
 
@@ -17,6 +19,7 @@ namespace thinger::iotmp{
         , expected_size_(config.expected_size)
         , chunk_size_(config.chunk_size)
         , max_bandwidth_mbps_(config.max_bandwidth_mbps)
+        , memory_(client.get_memory(), memory_accounting::subsystem::FILE_TRANSFER)
     {
     }
 
@@ -203,7 +206,10 @@ namespace thinger::iotmp{
         last_data_time_ = now;
 
         // Write to file
-        file_stream_.write(reinterpret_cast<const char*>(data), size);
+        {
+            loop_activity activity("file_upload", file_path_.c_str());
+            file_stream_.write(reinterpret_cast<const char*>(data), size);
+        }
         if(!file_stream_.good()) {
             state_ = SessionState::FAILED;
             error_message_ = "Failed to write to file";
@@ -216,12 +222,9 @@ namespace thinger::iotmp{
         bytes_since_last_ack_ += size;
         increase_received(size);
 
-        // Log progress every second
+        // Log progress every second (the receive timeout counts from last_data_time_)
         log_progress();
 
-        // Reset receive timeout since we got data
-        start_receive_timeout();
-
         // Send ACK when threshold is reached or on last chunk
         bool is_last_chunk = (expected_size_ > 0 && bytes_received_ >= expected_size_);
         if(bytes_since_last_ack_ >= ack_threshold_ || is_last_chunk) {
@@ -258,19 +261,14 @@ namespace thinger::iotmp{
                 if(delay_ms < MIN_CHUNK_DELAY_MS) delay_ms = MIN_CHUNK_DELAY_MS;
 
                 if(!rate_limit_timer_) {
-                    rate_limit_timer_ = std::make_shared<boost::asio::steady_timer>(client_.get_io_context());
+                    rate_limit_timer_ = std::make_shared<boost::asio::steady_timer>(get_io_context());
                 }
 
                 rate_limit_timer_->expires_after(std::chrono::milliseconds(delay_ms));
                 rate_limit_timer_->async_wait([this, bytes_to_ack = bytes_since_last_ack_](const boost::system::error_code& ec) {
                     if(!ec) {
                         // Actually send the ACK after the delay
-                        json_t ack_data = {
-                            {"ack", ++ack_number_},
-                            {"bytes", bytes_to_ack}
-                        };
-                        client_.stream_resource(stream_id_, std::move(ack_data));
-                        increase_sent(ack_data.dump().size());
+                        stream_ack(bytes_to_ack);
 
                         bytes_since_last_ack_ = 0;
                         last_ack_time_ = std::chrono::steady_clock::now();
@@ -282,31 +280,41 @@ namespace thinger::iotmp{
         }
 
         // No bandwidth limit or enough time has passed - send ACK immediately
-        json_t ack_data = {
-            {"ack", ++ack_number_},
-            {"bytes", bytes_since_last_ack_}
-        };
-        client_.stream_resource(stream_id_, std::move(ack_data));
-        increase_sent(ack_data.dump().size());
+        stream_ack(bytes_since_last_ack_);
 
         bytes_since_last_ack_ = 0;
         last_ack_time_ = now;
         last_ack_sent_time_ = now;
     }
 
+    void file_upload_session::stream_ack(size_t bytes) {
+        // The payload is kept between ACKs, so only its values change
+        ack_["ack"] = ++ack_number_;
+        ack_["bytes"] = bytes;
+        client_.stream_resource(stream_id_, ack_);
+
+        null_writer sizer;
+        pson_encoder<null_writer>(sizer).encode(ack_);
+        increase_sent(sizer.bytes_written());
+    }
+
     void file_upload_session::start_receive_timeout() {
-        // Cancel any existing timer first
-        if(receive_timeout_timer_) {
-            receive_timeout_timer_->cancel();
-        } else {
-            receive_timeout_timer_ = std::make_shared<boost::asio::steady_timer>(client_.get_io_context());
+        if(!receive_timeout_timer_) {
+            receive_timeout_timer_ = std::make_shared<boost::asio::steady_timer>(get_io_context());
         }
 
-        // Set new timeout - wait for data to arrive (use calculated timeout)
-        receive_timeout_timer_->expires_after(receive_timeout_);
+        // Wait for data to arrive (use calculated timeout). Chunks only move
+        // last_data_time_, so the timer is not re-armed for every chunk.
+        receive_timeout_timer_->expires_at(last_data_time_ + receive_timeout_);
 
         receive_timeout_timer_->async_wait([this](const boost::system::error_code& ec) {
             if(!ec && receive_timeout_timer_) {
+                // Data arrived meanwhile: wait for the timeout since the last chunk
+                if(std::chrono::steady_clock::now() < last_data_time_ + receive_timeout_) {
+                    start_receive_timeout();
+                    return;
+                }
+
                 // Timeout occurred while waiting for data
                 auto elapsed = std::chrono::steady_clock::now() - last_data_time_;
                 auto elapsed_seconds = std::chrono::duration_cast<std::chrono::seconds>(elapsed).count();
@@ -318,7 +326,7 @@ namespace thinger::iotmp{
                 receive_timeout_timer_.reset();
                 stop(StopReason::CLIENT_STOP);
             }
-            // If ec (cancelled), do nothing - this is normal when we receive data
+            // If ec (cancelled), do nothing - the session stopped
         });
     }
 
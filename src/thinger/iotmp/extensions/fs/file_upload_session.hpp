@@ -23,6 +23,7 @@ namespace thinger::iotmp{
     private:
         void handle_upload_chunk(uint8_t* data, size_t size);
         void send_ack(bool is_final = false);
+        void stream_ack(size_t bytes);
         void start_receive_timeout();
         void log_progress(bool force = false);
 
@@ -45,6 +46,7 @@ namespace thinger::iotmp{
         size_t bytes_since_last_ack_ = 0;
         uint32_t ack_number_ = 0;
         size_t ack_threshold_ = 0;  // Dynamic threshold calculated from file size
+        json_t ack_;                // ACK payload, reused
 
         // Bandwidth limiting
         size_t max_bandwidth_mbps_ = 0;  // 0 = unlimited
@@ -63,6 +65,9 @@ namespace thinger::iotmp{
         // Keep session alive after completion
         std::shared_ptr<file_upload_session> self_reference_;
         std::shared_ptr<boost::asio::steady_timer> completion_timer_;
+
+        // Session count (chunks go straight to the file, see client::get_memory)
+        memory_accounting::tracker memory_;
     };
 
 }
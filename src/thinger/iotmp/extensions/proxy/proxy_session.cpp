@@ -9,9 +9,10 @@ proxy_session::proxy_session(client& client, uint16_t stream_id, std::string ses
                              std::string host, uint16_t port, bool secure)
     : stream_session(client, stream_id, std::move(session)),
       host_(std::move(host)),
-      port_(port)
+      port_(port),
+      memory_(client.get_memory(), memory_accounting::subsystem::PROXY)
 {
-    auto& io = client.get_io_context();
+    auto& io = get_io_context();
     if(secure) {
         auto ssl_context = std::make_shared<boost::asio::ssl::context>(
             boost::asio::ssl::context::tlsv12_client);
@@ -64,7 +65,8 @@ void proxy_session::handle_input(input& in) {
     if(binary.empty()) return;
 
     // Queue data for writing
-    write_queue_.emplace(reinterpret_cast<const char*>(binary.data()), binary.size());
+    pending_.append(reinterpret_cast<const char*>(binary.data()), binary.size());
+    memory_.add(binary.size());
 
     // Start write loop if not already running
     if(!write_in_progress_) {
@@ -77,6 +79,13 @@ awaitable<void> proxy_session::read_loop() {
     auto self = shared_from_this();
 
     while(running_ && socket_->is_open()) {
+        // stop reading the socket while the uplink is congested (checked inline
+        // first, so the common case does not start a coroutine per read)
+        if(!client_.is_writable(stream_id_) && !co_await client_.wait_writable(stream_id_)) {
+            stop();
+            break;
+        }
+
         auto [read_ec, bytes] = co_await socket_->read_some(read_buffer_, PROXY_BUFFER_SIZE);
 
         if(read_ec) {
@@ -100,16 +109,21 @@ awaitable<void> proxy_session::read_loop() {
 awaitable<void> proxy_session::write_loop() {
     auto self = shared_from_this();
 
-    while(running_ && !write_queue_.empty()) {
+    while(running_ && !pending_.empty()) {
         if(!socket_ || !socket_->is_open()) {
             stop();
             break;
         }
 
-        auto data = std::move(write_queue_.front());
-        write_queue_.pop();
+        // write everything queued so far; new input queues meanwhile
+        writing_.swap(pending_);
 
-        auto [write_ec, bytes] = co_await socket_->write(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+        auto [write_ec, bytes] = co_await socket_->write(reinterpret_cast<const uint8_t*>(writing_.data()), writing_.size());
+        size_t written = writing_.size();
+        memory_.release(written);
+        writing_.clear();
+        // do not keep the capacity of a burst
+        if(writing_.capacity() > PROXY_WRITE_BUFFER_KEEP) std::string().swap(writing_);
         if(write_ec) {
             if(write_ec != boost::asio::error::operation_aborted) {
                 THINGER_LOG_ERROR("[{}] proxy write error: {}", stream_id_, write_ec.message());
@@ -117,7 +131,7 @@ awaitable<void> proxy_session::write_loop() {
             stop();
             break;
         }
-        increase_sent(data.size());
+        increase_sent(written);
     }
 
     write_in_progress_ = false;
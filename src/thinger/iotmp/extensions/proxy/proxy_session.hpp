@@ -4,11 +4,11 @@
 #include "../../client.hpp"
 #include "../../core/iotmp_stream_session.hpp"
 #include <string>
-#include <queue>
 
 namespace thinger::iotmp {
 
 constexpr size_t PROXY_BUFFER_SIZE = 4096;
+constexpr size_t PROXY_WRITE_BUFFER_KEEP = 64 * 1024;
 
 class proxy_session : public stream_session {
 
@@ -29,13 +29,19 @@ private:
     std::string host_;
     uint16_t port_;
 
-    // Write queue with synchronization
-    std::queue<std::string> write_queue_;
+    // Input queued while a write is in progress, and the input being
+    // written. Swapped on every write, so both keep their capacity, up to
+    // PROXY_WRITE_BUFFER_KEEP after a burst.
+    std::string pending_;
+    std::string writing_;
     bool write_in_progress_ = false;
     bool running_ = false;
 
     // Read buffer
     uint8_t read_buffer_[PROXY_BUFFER_SIZE];
+
+    // Session count and queued bytes (see client::get_memory)
+    memory_accounting::tracker memory_;
 };
 
 }
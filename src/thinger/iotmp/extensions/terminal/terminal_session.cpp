@@ -16,7 +16,8 @@ namespace thinger::iotmp {
 terminal_session::terminal_session(client& client, uint16_t stream_id, std::string session,
                                    json_t& parameters)
     : stream_session(client, stream_id, std::move(session)),
-      descriptor_(client.get_io_context())
+      descriptor_(get_io_context()),
+      memory_(client.get_memory(), memory_accounting::subsystem::TERMINAL)
 {
     terminal_ = preferred_shell_name();
 
@@ -105,7 +106,8 @@ void terminal_session::handle_input(input& in) {
     increase_received(binary.size());
 
     // Queue data for writing
-    write_queue_.emplace(reinterpret_cast<const char*>(binary.data()), binary.size());
+    pending_.append(reinterpret_cast<const char*>(binary.data()), binary.size());
+    memory_.add(binary.size());
 
     // Start write loop if not already running
     if(!write_in_progress_) {
@@ -118,6 +120,13 @@ awaitable<void> terminal_session::read_loop() {
     auto self = shared_from_this();
 
     while(running_ && descriptor_.is_open()) {
+        // stop reading the PTY while the uplink is congested (checked inline
+        // first, so the common case does not start a coroutine per read)
+        if(!client_.is_writable(stream_id_) && !co_await client_.wait_writable(stream_id_)) {
+            stop();
+            break;
+        }
+
         auto [ec, bytes] = co_await descriptor_.async_read_some(
             boost::asio::buffer(read_buffer_, TERMINAL_BUFFER_SIZE),
             use_nothrow_awaitable);
@@ -146,14 +155,18 @@ awaitable<void> terminal_session::read_loop() {
 awaitable<void> terminal_session::write_loop() {
     auto self = shared_from_this();
 
-    while(running_ && !write_queue_.empty() && descriptor_.is_open()) {
-        auto data = std::move(write_queue_.front());
-        write_queue_.pop();
+    while(running_ && !pending_.empty() && descriptor_.is_open()) {
+        // write everything queued so far; new input queues meanwhile
+        writing_.swap(pending_);
 
         auto [ec, bytes] = co_await boost::asio::async_write(
             descriptor_,
-            boost::asio::buffer(data),
+            boost::asio::buffer(writing_),
             use_nothrow_awaitable);
+        memory_.release(writing_.size());
+        writing_.clear();
+        // do not keep the capacity of a burst (i.e., a paste)
+        if(writing_.capacity() > TERMINAL_WRITE_BUFFER_KEEP) std::string().swap(writing_);
 
         if(ec) {
             if(ec != boost::asio::error::operation_aborted) {
@@ -4,11 +4,12 @@
 #include "../../client.hpp"
 #include "../../core/iotmp_stream_session.hpp"
 #include <boost/asio/posix/stream_descriptor.hpp>
-#include <queue>
+#include <string>
 
 namespace thinger::iotmp {
 
 constexpr size_t TERMINAL_BUFFER_SIZE = 1024;
+constexpr size_t TERMINAL_WRITE_BUFFER_KEEP = 16 * 1024;
 
 class terminal_session : public stream_session {
 
@@ -40,9 +41,15 @@ private:
     // Read buffer
     uint8_t read_buffer_[TERMINAL_BUFFER_SIZE];
 
-    // Write queue with synchronization
-    std::queue<std::string> write_queue_;
+    // Input queued while a write is in progress, and the input being
+    // written. Swapped on every write, so both keep their capacity, up to
+    // TERMINAL_WRITE_BUFFER_KEEP after a burst.
+    std::string pending_;
+    std::string writing_;
     bool write_in_progress_ = false;
+
+    // Session count and queued bytes (see client::get_memory)
+    memory_accounting::tracker memory_;
 };
 
 }
@@ -0,0 +1,193 @@
+#ifndef THINGER_IOTMP_GATEWAY_HPP
+#define THINGER_IOTMP_GATEWAY_HPP
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "client.hpp"
+
+namespace thinger::iotmp {
+
+    /**
+     * Hosts many device connections in one process.
+     *
+     * Every device is a regular client with its own IOTMP identity. All of
+     * them run on the thinger-http worker io_contexts (assigned round-robin
+     * on start) and share a single thread pool for blocking resource
+     * executions, so the per-device cost is the client state itself.
+     */
+    class gateway {
+    public:
+        // Frames queued from other threads per device. Sub-devices are
+        // usually fed from the io threads, so a small queue is enough.
+        static constexpr size_t DEVICE_SEND_QUEUE_CAPACITY = 64;
+
+        // Write queue watermarks per device. They also size its frame pool,
+        // which would otherwise keep up to 1MB per device.
+        static constexpr size_t DEVICE_WRITE_LOW_WATERMARK = 16 * 1024;
+        static constexpr size_t DEVICE_WRITE_HIGH_WATERMARK = 64 * 1024;
+
+        explicit gateway(unsigned int resource_threads = std::min(std::thread::hardware_concurrency(), 4u)) :
+            resource_pool_(std::make_shared<asio::thread_pool>(resource_threads ? resource_threads : 1))
+        {}
+
+        ~gateway() {
+            stop();
+            resource_pool_->join();
+        }
+
+        gateway(const gateway&) = delete;
+        gateway& operator=(const gateway&) = delete;
+
+        // Defaults applied to devices added afterwards
+        void set_host(std::string host) {
+            host_ = std::move(host);
+        }
+
+        void set_transport(transport_type transport) {
+            transport_ = transport;
+        }
+
+        // 0 keeps the default port of the transport
+        void set_port(uint16_t port) {
+            port_ = port;
+        }
+
+        // See client::set_session_sharding()
+        void set_session_sharding(bool enabled) {
+            session_sharding_ = enabled;
+        }
+
+        // See client::set_buffer_shrink(). 0 disables it (the default).
+        void set_buffer_shrink(size_t max_bytes = client::BUFFER_SHRINK_BYTES,
+                               std::chrono::milliseconds delay = client::BUFFER_SHRINK_DELAY) {
+            shrink_bytes_ = max_bytes;
+            shrink_delay_ = delay;
+        }
+
+        // Called with the device id on every state change of any device, from
+        // the device io threads. Can be replaced at any time.
+        void set_state_callback(std::function<void(const std::string&, client_state, const std::string&)> callback) {
+            std::scoped_lock lock(callback_mutex_);
+            state_callback_ = std::move(callback);
+        }
+
+        /**
+         * Add a device connection. Resources can be defined on the returned
+         * client, which stays valid until the device is removed.
+         * @return the device client, or nullptr if the device already exists
+         */
+        client* add_device(const std::string& user, const std::string& device, const std::string& password) {
+            std::scoped_lock lock(mutex_);
+            reap_retired();
+            if(devices_.contains(device)) return nullptr;
+
+            auto device_client = std::make_unique<client>();
+            device_client->set_credentials(user, device, password);
+            device_client->set_host(host_);
+            device_client->set_transport(transport_);
+            if(port_) device_client->set_port(port_);
+            device_client->set_resource_pool(resource_pool_);
+            device_client->set_send_queue_capacity(DEVICE_SEND_QUEUE_CAPACITY);
+            device_client->set_write_watermarks(DEVICE_WRITE_LOW_WATERMARK, DEVICE_WRITE_HIGH_WATERMARK);
+            device_client->set_stream_write_watermarks(DEVICE_WRITE_LOW_WATERMARK, DEVICE_WRITE_HIGH_WATERMARK);
+            device_client->set_metrics(metrics_);
+            device_client->set_session_sharding(session_sharding_);
+            if(shrink_bytes_) device_client->set_buffer_shrink(shrink_bytes_, shrink_delay_);
+            device_client->set_state_callback([this, device](client_state state, const std::string& reason) {
+                // called without the lock, so the callback may use the gateway
+                std::function<void(const std::string&, client_state, const std::string&)> callback;
+                {
+                    std::scoped_lock lock(callback_mutex_);
+                    callback = state_callback_;
+                }
+                if(callback) callback(device, state, reason);
+            });
+            if(running_) device_client->start();
+
+            auto* result = device_client.get();
+            devices_.emplace(device, std::move(device_client));
+            return result;
+        }
+
+        // Disconnect and remove a device. The client is destroyed once its
+        // connection coroutine has exited, on a later add or remove (or with
+        // the gateway).
+        bool remove_device(const std::string& device) {
+            std::scoped_lock lock(mutex_);
+            reap_retired();
+            auto it = devices_.find(device);
+            if(it == devices_.end()) return false;
+            it->second->stop();
+            metrics_->remove(it->second.get());
+            retired_.emplace_back(std::move(it->second));
+            devices_.erase(it);
+            return true;
+        }
+
+        client* get_device(const std::string& device) {
+            std::scoped_lock lock(mutex_);
+            auto it = devices_.find(device);
+            return it != devices_.end() ? it->second.get() : nullptr;
+        }
+
+        size_t size() const {
+            std::scoped_lock lock(mutex_);
+            return devices_.size();
+        }
+
+        // Metrics of every device, labelled with its device id
+        metrics& get_metrics() {
+            return *metrics_;
+        }
+
+        // Start every device connection
+        void start() {
+            std::scoped_lock lock(mutex_);
+            if(running_) return;
+            running_ = true;
+            for(auto& [id, device_client] : devices_) device_client->start();
+            LOG_INFO("Gateway started with {} devices", devices_.size());
+        }
+
+        // Stop every device connection
+        void stop() {
+            std::scoped_lock lock(mutex_);
+            if(!running_) return;
+            running_ = false;
+            for(auto& [id, device_client] : devices_) device_client->stop();
+        }
+
+    private:
+        // Destroy the removed clients whose connection coroutine has exited
+        // (mutex held)
+        void reap_retired() {
+            std::erase_if(retired_, [](const std::unique_ptr<client>& retired) {
+                return retired->is_stopped();
+            });
+        }
+
+        std::shared_ptr<asio::thread_pool> resource_pool_;
+        std::shared_ptr<metrics> metrics_ = std::make_shared<metrics>();
+        std::map<std::string, std::unique_ptr<client>> devices_;
+        std::vector<std::unique_ptr<client>> retired_;
+        mutable std::mutex mutex_;
+        bool running_ = false;
+
+        std::string host_ = "iot.thinger.io";
+        transport_type transport_ = transport_type::SSL;
+        uint16_t port_ = 0;
+        bool session_sharding_ = false;
+        size_t shrink_bytes_ = 0;
+        std::chrono::milliseconds shrink_delay_ = client::BUFFER_SHRINK_DELAY;
+        std::function<void(const std::string&, client_state, const std::string&)> state_callback_;
+        std::mutex callback_mutex_;
+    };
+
+}
+
+#endif
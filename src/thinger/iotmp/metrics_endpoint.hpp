@@ -0,0 +1,128 @@
+#ifndef THINGER_IOTMP_METRICS_ENDPOINT_HPP
+#define THINGER_IOTMP_METRICS_ENDPOINT_HPP
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "client.hpp"
+
+namespace thinger::iotmp {
+
+    /**
+     * Local HTTP endpoint serving a metrics registry in the Prometheus text
+     * format, at GET /metrics.
+     *
+     * Meant for a scraper on the same host: it listens on the loopback
+     * interface by default, has no authentication, and answers a single
+     * request per connection. It runs on a thinger-http worker io_context,
+     * and the registry must outlive it.
+     */
+    class metrics_endpoint {
+    public:
+        static constexpr size_t MAX_REQUEST = 8 * 1024;
+        static constexpr auto REQUEST_TIMEOUT = std::chrono::seconds(5);
+
+        explicit metrics_endpoint(metrics& registry) : registry_(registry) {}
+
+        ~metrics_endpoint() {
+            stop();
+        }
+
+        metrics_endpoint(const metrics_endpoint&) = delete;
+        metrics_endpoint& operator=(const metrics_endpoint&) = delete;
+
+        // Listen on address:port (port 0 picks a free one, see get_port())
+        bool start(uint16_t port, const std::string& address = "127.0.0.1") {
+            boost::system::error_code ec;
+            auto ip = asio::ip::make_address(address, ec);
+            if(ec) {
+                LOG_ERROR("Invalid metrics address {}: {}", address, ec.message());
+                return false;
+            }
+
+            auto& io = thinger::asio::get_workers().get_next_io_context();
+            auto acceptor = std::make_shared<asio::ip::tcp::acceptor>(io);
+            asio::ip::tcp::endpoint endpoint(ip, port);
+            acceptor->open(endpoint.protocol(), ec);
+            if(!ec) acceptor->set_option(asio::socket_base::reuse_address(true), ec);
+            if(!ec) acceptor->bind(endpoint, ec);
+            if(!ec) acceptor->listen(asio::socket_base::max_listen_connections, ec);
+            if(ec) {
+                LOG_ERROR("Cannot listen for metrics on {}:{}: {}", address, port, ec.message());
+                return false;
+            }
+
+            acceptor_ = acceptor;
+            co_spawn(io, accept_loop(acceptor, registry_), detached);
+            LOG_INFO("Metrics endpoint listening on http://{}:{}/metrics", address, get_port());
+            return true;
+        }
+
+        void stop() {
+            if(!acceptor_) return;
+            asio::post(acceptor_->get_executor(), [acceptor = acceptor_]() {
+                boost::system::error_code ec;
+                acceptor->close(ec);
+            });
+            acceptor_.reset();
+        }
+
+        uint16_t get_port() const {
+            boost::system::error_code ec;
+            return acceptor_ ? acceptor_->local_endpoint(ec).port() : 0;
+        }
+
+    private:
+        static awaitable<void> accept_loop(std::shared_ptr<asio::ip::tcp::acceptor> acceptor, metrics& registry) {
+            while(acceptor->is_open()) {
+                boost::system::error_code ec;
+                auto socket = co_await acceptor->async_accept(asio::redirect_error(use_awaitable, ec));
+                if(ec == asio::error::operation_aborted) break;
+                if(ec) continue;
+                co_spawn(acceptor->get_executor(), serve(std::move(socket), registry), detached);
+            }
+        }
+
+        static awaitable<void> serve(asio::ip::tcp::socket socket, metrics& registry) {
+            // a client that never completes its request gets disconnected
+            asio::steady_timer deadline(socket.get_executor(), REQUEST_TIMEOUT);
+            deadline.async_wait([&socket](const boost::system::error_code& ec) {
+                if(!ec) socket.close();
+            });
+
+            std::string request;
+            auto [ec, n] = co_await asio::async_read_until(socket, asio::dynamic_buffer(request, MAX_REQUEST),
+                "\r\n\r\n", use_nothrow_awaitable);
+            if(!ec) {
+                std::string_view line(request.data(), request.find("\r\n"));
+                std::string response;
+                if(line.starts_with("GET /metrics ") || line.starts_with("GET /metrics?")) {
+                    response = reply("200 OK", registry.to_prometheus());
+                } else {
+                    response = reply("404 Not Found", "Not Found\n");
+                }
+                co_await asio::async_write(socket, asio::buffer(response), use_nothrow_awaitable);
+                socket.shutdown(asio::ip::tcp::socket::shutdown_both, ec);
+            }
+            deadline.cancel();
+        }
+
+        static std::string reply(std::string_view status, const std::string& body) {
+            std::string response;
+            response.append("HTTP/1.1 ").append(status).append("\r\n")
+                    .append("Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n")
+                    .append("Content-Length: ").append(std::to_string(body.size())).append("\r\n")
+                    .append("Connection: close\r\n\r\n")
+                    .append(body);
+            return response;
+        }
+
+        metrics& registry_;
+        std::shared_ptr<asio::ip::tcp::acceptor> acceptor_;
+    };
+
+}
+
+#endif